@@ -0,0 +1,193 @@
+#include "AddressSpace.h"
+
+#ifdef VM_CONCURRENT
+// every thread switches between the address spaces on its own, like a CPU does:
+#define CURRENT_ADDRESS_SPACE_STORAGE thread_local
+#else
+#define CURRENT_ADDRESS_SPACE_STORAGE
+#endif
+
+// the context of every address space, read without locks by the accesses of a VM_CONCURRENT build:
+int addressSpaceContexts[MAX_ADDRESS_SPACES];
+// the address space that was created last, or MAX_ADDRESS_SPACES - 1 if none was:
+int lastCreatedAddressSpace = MAX_ADDRESS_SPACES - 1;
+CURRENT_ADDRESS_SPACE_STORAGE int currentAddressSpace = 0;
+
+/*
+ * A range of pages inside a context, from firstPageIdx up to (not including) endPageIdx, with an advised pattern.
+ */
+typedef struct {
+    uint64_t firstPageIdx;
+    uint64_t endPageIdx;
+    PageAdvice advice;
+} AdvisedRange;
+
+// the advised ranges of every address space, which are looked up by the page faults, so they are few and unsorted:
+AdvisedRange advisedRanges[MAX_ADDRESS_SPACES][MAX_ADVISED_RANGES];
+int numAdvisedRanges[MAX_ADDRESS_SPACES];
+
+// the root of every context, read without locks by the lock-free walks of a VM_CONCURRENT build:
+word_t contextRoots[MAX_CONTEXTS];
+int contextSnapshots[MAX_CONTEXTS];
+// the number of contexts whose snapshot each context is, read without locks by the accesses that write:
+int contextSharers[MAX_CONTEXTS];
+// whether each context wrote a page to the swap file since it was created:
+bool contextSwapped[MAX_CONTEXTS];
+int numContexts = 1;
+int lastCreatedContext = MAX_CONTEXTS - 1;
+
+/**
+ * @return the first id after lastCreated (going round from maxIds - 1 to 1) that isFree accepts, or -1 if none does.
+ */
+template<typename IsFree>
+int FindFreeId(int lastCreated, int maxIds, IsFree isFree) {
+    // the ids go round like process ids, so an id is not reused soon after it is freed:
+    for (int step = 1; step < maxIds; step++) {
+        int id = 1 + ((lastCreated - 1 + step) % (maxIds - 1));
+        if (isFree(id)) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+void AddressSpacesInitialize() {
+    for (int addressSpace = 0; addressSpace < MAX_ADDRESS_SPACES; addressSpace++) {
+        __atomic_store_n(&addressSpaceContexts[addressSpace], (addressSpace == 0) ? 0 : -1, __ATOMIC_RELEASE);
+        numAdvisedRanges[addressSpace] = 0;
+    }
+    lastCreatedAddressSpace = MAX_ADDRESS_SPACES - 1;
+    currentAddressSpace = 0;
+    for (int context = 0; context < MAX_CONTEXTS; context++) {
+        __atomic_store_n(&contextRoots[context], (context == 0) ? 0 : NO_ROOT, __ATOMIC_RELEASE);
+        contextSnapshots[context] = -1;
+        __atomic_store_n(&contextSharers[context], 0, __ATOMIC_RELEASE);
+        contextSwapped[context] = false;
+    }
+    numContexts = 1;
+    lastCreatedContext = MAX_CONTEXTS - 1;
+}
+
+int FindFreeAddressSpace() {
+    return FindFreeId(lastCreatedAddressSpace, MAX_ADDRESS_SPACES, [](int addressSpace) {
+        return GetAddressSpaceContext(addressSpace) < 0;
+    });
+}
+
+void SetAddressSpaceContext(int addressSpace, int context) {
+    if ((GetAddressSpaceContext(addressSpace) < 0) && (context >= 0)) {
+        lastCreatedAddressSpace = addressSpace;
+    }
+    if (context < 0) {
+        numAdvisedRanges[addressSpace] = 0;
+    }
+    __atomic_store_n(&addressSpaceContexts[addressSpace], context, __ATOMIC_RELEASE);
+}
+
+bool SetAddressSpaceAdvice(int addressSpace, uint64_t firstPageIdx, uint64_t count, PageAdvice advice) {
+    uint64_t endPageIdx = firstPageIdx + count;
+    // every range that is overlapped may leave a part on each side of the new range:
+    AdvisedRange ranges[(2 * MAX_ADVISED_RANGES) + 1];
+    int numRanges = 0;
+    for (int i = 0; i < numAdvisedRanges[addressSpace]; i++) {
+        const AdvisedRange &range = advisedRanges[addressSpace][i];
+        if ((range.endPageIdx <= firstPageIdx) || (range.firstPageIdx >= endPageIdx)) {
+            ranges[numRanges++] = range;
+            continue;
+        }
+        if (range.firstPageIdx < firstPageIdx) {
+            ranges[numRanges++] = {range.firstPageIdx, firstPageIdx, range.advice};
+        }
+        if (range.endPageIdx > endPageIdx) {
+            ranges[numRanges++] = {endPageIdx, range.endPageIdx, range.advice};
+        }
+    }
+    if ((advice != ADVISE_NORMAL) && (count > 0)) {
+        ranges[numRanges++] = {firstPageIdx, endPageIdx, advice};
+    }
+    if (numRanges > MAX_ADVISED_RANGES) {
+        return false;
+    }
+    for (int i = 0; i < numRanges; i++) {
+        advisedRanges[addressSpace][i] = ranges[i];
+    }
+    numAdvisedRanges[addressSpace] = numRanges;
+    return true;
+}
+
+PageAdvice GetAddressSpaceAdvice(int addressSpace, uint64_t pageIdx) {
+    for (int i = 0; i < numAdvisedRanges[addressSpace]; i++) {
+        const AdvisedRange &range = advisedRanges[addressSpace][i];
+        if ((pageIdx >= range.firstPageIdx) && (pageIdx < range.endPageIdx)) {
+            return range.advice;
+        }
+    }
+    return ADVISE_NORMAL;
+}
+
+int GetAddressSpaceContext(int addressSpace) {
+    return __atomic_load_n(&addressSpaceContexts[addressSpace], __ATOMIC_ACQUIRE);
+}
+
+int FindFreeContext() {
+    return FindFreeId(lastCreatedContext, MAX_CONTEXTS, [](int context) {
+        return GetContextRoot(context) == NO_ROOT;
+    });
+}
+
+int GetNumContexts() {
+    return numContexts;
+}
+
+void SetContextRoot(int context, word_t rootFrameIdx) {
+    word_t oldRootFrameIdx = GetContextRoot(context);
+    numContexts += ((oldRootFrameIdx == NO_ROOT) ? 1 : 0) - ((rootFrameIdx == NO_ROOT) ? 1 : 0);
+    if ((oldRootFrameIdx == NO_ROOT) && (rootFrameIdx != NO_ROOT)) {
+        lastCreatedContext = context;
+        contextSwapped[context] = false;
+    }
+    __atomic_store_n(&contextRoots[context], rootFrameIdx, __ATOMIC_RELEASE);
+}
+
+word_t GetContextRoot(int context) {
+    return __atomic_load_n(&contextRoots[context], __ATOMIC_ACQUIRE);
+}
+
+void SetContextSnapshot(int context, int snapshot) {
+    int oldSnapshot = contextSnapshots[context];
+    if (oldSnapshot >= 0) {
+        __atomic_store_n(&contextSharers[oldSnapshot], contextSharers[oldSnapshot] - 1, __ATOMIC_RELEASE);
+    }
+    if (snapshot >= 0) {
+        __atomic_store_n(&contextSharers[snapshot], contextSharers[snapshot] + 1, __ATOMIC_RELEASE);
+    }
+    contextSnapshots[context] = snapshot;
+}
+
+int GetContextSnapshot(int context) {
+    return contextSnapshots[context];
+}
+
+bool IsContextFrozen(int context) {
+    return __atomic_load_n(&contextSharers[context], __ATOMIC_ACQUIRE) > 0;
+}
+
+int GetNumContextSharers(int context) {
+    return contextSharers[context];
+}
+
+void SetContextSwapped(int context) {
+    contextSwapped[context] = true;
+}
+
+bool IsContextSwapped(int context) {
+    return contextSwapped[context];
+}
+
+int GetCurrentAddressSpace() {
+    return currentAddressSpace;
+}
+
+void SetCurrentAddressSpace(int addressSpace) {
+    currentAddressSpace = addressSpace;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "MemoryConstants.h"
+//#include "YaaraConstants.h"
+#include "VirtualMemory.h"
+
+/*
+ * The address spaces that share the RAM and the swap store. Every address space is translated in a context: a page
+ * table of its own, rooted in a frame of its own. Context 0 is rooted in frame 0, and is the first context of address
+ * space 0, which always exists. The others are rooted in a frame that was taken like any other.
+ * Inside the library a virtual address is tagged with its context, which is put above its VIRTUAL_ADDRESS_WIDTH bits.
+ * The page index and the cumulative page indices of a tagged address thus tell the contexts apart in the TLB, the
+ * paging-structure cache, the frame bookkeeping and the swap store, while the indices into the tables (GetPi) are those
+ * of the untagged address.
+ *
+ * Forking an address space freezes its context as a snapshot, which the address space and its child then share: each
+ * of them is given a new context whose snapshot it is. A context only holds the pages that were written (or first
+ * read) in it since, and the other pages are read from its snapshot, or from the snapshot of its snapshot, and so on.
+ * A snapshot is never written again. Once a single context shares it, that context is merged into it, so every snapshot
+ * is shared by two contexts at least, and there are fewer snapshots than address spaces.
+ */
+
+// number of address spaces that can exist at once, including address space 0
+#ifndef MAX_ADDRESS_SPACES
+#define MAX_ADDRESS_SPACES 16
+#endif
+
+// number of contexts that can exist at once, including the snapshots. every fork takes two new contexts.
+#ifndef MAX_CONTEXTS
+#define MAX_CONTEXTS (2 * MAX_ADDRESS_SPACES)
+#endif
+
+// number of ranges of pages with an advised pattern (see VMadvise) that an address space can have at once
+#ifndef MAX_ADVISED_RANGES
+#define MAX_ADVISED_RANGES 16
+#endif
+
+// number of bits of a page index inside its context, below the context of a tagged page index:
+#define CONTEXT_PAGE_WIDTH (VIRTUAL_ADDRESS_WIDTH - OFFSET_WIDTH)
+
+// the root of a context that does not exist:
+#define NO_ROOT ((word_t) -1)
+
+static_assert((MAX_ADDRESS_SPACES >= 1) && (MAX_CONTEXTS >= MAX_ADDRESS_SPACES),
+              "every address space must have a context");
+static_assert((uint64_t) MAX_CONTEXTS <= (1ULL << (62 - VIRTUAL_ADDRESS_WIDTH)), "a tagged address must fit 62 bits");
+
+/*
+ * Forgets every address space but 0 and every context but 0, translates address space 0 in context 0, and makes 0 the
+ * current address space of the calling thread.
+ */
+void AddressSpacesInitialize();
+
+/*
+ * returns the first address space after the one that was created last (going round from MAX_ADDRESS_SPACES - 1 to 1)
+ * that does not exist, or -1 if MAX_ADDRESS_SPACES exist.
+ */
+int FindFreeAddressSpace();
+
+/*
+ * Sets the context that an address space is translated in, which creates the address space, or -1, which destroys it.
+ */
+void SetAddressSpaceContext(int addressSpace, int context);
+
+/*
+ * Sets the pattern (ADVISE_NORMAL, ADVISE_RANDOM or ADVISE_SEQUENTIAL) of the 'count' pages of an address space from
+ * firstPageIdx onwards, which are page indices inside a context. The range replaces the parts of the ranges that it
+ * overlaps, and ADVISE_NORMAL only removes them. An address space that is destroyed forgets its ranges.
+ * returns false, and changes nothing, if the address space would be left with more than MAX_ADVISED_RANGES ranges.
+ */
+bool SetAddressSpaceAdvice(int addressSpace, uint64_t firstPageIdx, uint64_t count, PageAdvice advice);
+
+/*
+ * returns the pattern of the given page (inside a context) of an address space, which is ADVISE_NORMAL unless the page
+ * is in one of its ranges.
+ */
+PageAdvice GetAddressSpaceAdvice(int addressSpace, uint64_t pageIdx);
+
+/*
+ * returns the context that the given address space is translated in, or -1 if the address space does not exist.
+ * May be called without holding any lock in a VM_CONCURRENT build.
+ */
+int GetAddressSpaceContext(int addressSpace);
+
+/*
+ * returns the first context after the one that was created last (going round like FindFreeAddressSpace) that does not
+ * exist, or -1 if MAX_CONTEXTS exist.
+ */
+int FindFreeContext();
+
+/*
+ * returns the number of contexts that exist, including 0 and the snapshots, which is the number of root tables.
+ */
+int GetNumContexts();
+
+/*
+ * Sets the frame of the root table of a context, which creates it, or NO_ROOT, which destroys it.
+ */
+void SetContextRoot(int context, word_t rootFrameIdx);
+
+/*
+ * returns the frame of the root table of the given context, or NO_ROOT if it does not exist.
+ * May be called without holding any lock in a VM_CONCURRENT build.
+ */
+word_t GetContextRoot(int context);
+
+/*
+ * Sets the snapshot that a context reads the pages it does not hold from, or -1 for none, and updates the number of
+ * contexts that share the old snapshot and the new one.
+ */
+void SetContextSnapshot(int context, int snapshot);
+
+/*
+ * returns the snapshot of the given context, or -1 if it has none.
+ */
+int GetContextSnapshot(int context);
+
+/*
+ * returns true if the given context is a snapshot, so its pages must not be written.
+ * May be called without holding any lock in a VM_CONCURRENT build.
+ */
+bool IsContextFrozen(int context);
+
+/*
+ * returns the number of contexts whose snapshot the given context is.
+ */
+int GetNumContextSharers(int context);
+
+/*
+ * Records that a page of the given context was written to the swap file, which a context that is created starts
+ * without. The copies of a context in the swap file are only looked for if it has any.
+ */
+void SetContextSwapped(int context);
+
+bool IsContextSwapped(int context);
+
+/*
+ * The address space that the accesses of the calling thread are translated in.
+ * In a VM_CONCURRENT build every thread has its own current address space.
+ */
+int GetCurrentAddressSpace();
+
+void SetCurrentAddressSpace(int addressSpace);
+
+inline uint64_t TagAddress(int context, uint64_t virtualAddress) {
+    return ((uint64_t) context << VIRTUAL_ADDRESS_WIDTH) | virtualAddress;
+}
+
+inline int GetContextOfPage(uint64_t pageIdx) {
+    return (int) (pageIdx >> CONTEXT_PAGE_WIDTH);
+}
+
+/*
+ * returns the given tagged address, tagged with another context instead.
+ */
+inline uint64_t RetagAddress(int context, uint64_t virtualAddress) {
+    return TagAddress(context, virtualAddress & (VIRTUAL_MEMORY_SIZE - 1));
+}
@@ -0,0 +1,295 @@
+#include "Checkpoint.h"
+#include "PhysicalMemory.h"
+#include "SwapStore.h"
+#include "Stats.h"
+
+#include <string>
+#include <vector>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PAGE_BYTES (PAGE_SIZE * sizeof(word_t))
+// the data pages start right after the header and the contexts, rounded up to the alignment:
+#define DATA_OFFSET ((((uint64_t) (sizeof(CheckpointHeader) + sizeof(CheckpointContexts)) + CHECKPOINT_ALIGNMENT - 1) / \
+                      CHECKPOINT_ALIGNMENT) * CHECKPOINT_ALIGNMENT)
+
+typedef struct {
+    int fd;
+    std::string path;
+    std::string temporaryPath;
+    CheckpointHeader header;
+    CheckpointContexts contexts;
+    std::vector<CheckpointPage> pages;
+    std::vector<uint64_t> dataChecksums;
+    bool failed;
+} CheckpointWriter;
+
+CheckpointWriter* writer = nullptr;
+
+// the checkpoint that the pages of the swap store are loaded from, if any:
+CheckpointFile checkpointInUse = {nullptr, 0, nullptr, nullptr, nullptr, nullptr};
+
+inline uint64_t RotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/**
+ * A 64-bit hash of the given bytes, which goes on from the hash of the bytes before them, so several buffers can be
+ * hashed as one. Each 8 bytes are mixed in by a multiply and a rotate, like xxHash does.
+ * @param seed The hash of the bytes before, or 0.
+ */
+uint64_t Checksum(const void* data, uint64_t bytes, uint64_t seed) {
+    const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    const unsigned char* input = (const unsigned char*) data;
+    uint64_t hash = seed ^ (bytes * prime1);
+    for (uint64_t offset = 0; offset < bytes; offset += sizeof(uint64_t)) {
+        uint64_t chunk = 0;
+        memcpy(&chunk, input + offset, (bytes - offset < sizeof(uint64_t)) ? (bytes - offset) : sizeof(uint64_t));
+        hash = RotateLeft(hash ^ (chunk * prime2), 31) * prime1;
+    }
+    // the final mix of MurmurHash3, so every bit of the input affects every bit of the hash:
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+uint64_t CheckpointChecksumMetadata(const CheckpointHeader &header, const CheckpointContexts &contexts,
+                                    const CheckpointPage* pages, const uint64_t* dataChecksums) {
+    uint64_t hash = Checksum(&header, offsetof(CheckpointHeader, checksum), 0);
+    hash = Checksum(&contexts, sizeof(CheckpointContexts), hash);
+    hash = Checksum(pages, header.numPages * sizeof(CheckpointPage), hash);
+    return Checksum(dataChecksums, header.numDataPages * sizeof(uint64_t), hash);
+}
+
+/**
+ * Writes the given bytes at the given offset of the file, retrying partial writes.
+ * @return false if a write failed.
+ */
+bool WriteAt(int fd, const void* data, uint64_t bytes, uint64_t offset) {
+    const char* input = (const char*) data;
+    uint64_t done = 0;
+    while (done < bytes) {
+        ssize_t result = pwrite(fd, input + done, bytes - done, (off_t) (offset + done));
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        done += (uint64_t) result;
+    }
+    return true;
+}
+
+bool CheckpointBeginWrite(const char* path, uint64_t policy, bool hugePages, const CheckpointContexts &contexts,
+                          uint64_t numPages) {
+    if (writer != nullptr) {
+        return false;
+    }
+    std::string temporaryPath = std::string(path) + ".tmp";
+    int fd = open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    writer = new CheckpointWriter();
+    writer->fd = fd;
+    writer->path = path;
+    writer->temporaryPath = temporaryPath;
+    memset(&writer->header, 0, sizeof(CheckpointHeader));
+    writer->header.magic = CHECKPOINT_MAGIC;
+    writer->header.version = CHECKPOINT_VERSION;
+    writer->header.wordBytes = sizeof(word_t);
+    writer->header.offsetWidth = OFFSET_WIDTH;
+    writer->header.physicalAddressWidth = PHYSICAL_ADDRESS_WIDTH;
+    writer->header.virtualAddressWidth = VIRTUAL_ADDRESS_WIDTH;
+    writer->header.maxContexts = MAX_CONTEXTS;
+    writer->header.maxAddressSpaces = MAX_ADDRESS_SPACES;
+    writer->header.policy = policy;
+    writer->header.hugePages = hugePages ? 1 : 0;
+    writer->header.numPages = numPages;
+    writer->header.dataOffset = DATA_OFFSET;
+    writer->contexts = contexts;
+    writer->pages.reserve(numPages);
+    writer->failed = false;
+    return true;
+}
+
+void CheckpointWritePage(uint64_t pageIdx, const word_t* page) {
+    CheckpointPage entry = {pageIdx, CHECKPOINT_ZERO_PAGE};
+    if (!AreWordsZero(page, PAGE_SIZE)) {
+        entry.dataPage = writer->dataChecksums.size();
+        writer->failed = writer->failed ||
+                         !WriteAt(writer->fd, page, PAGE_BYTES, writer->header.dataOffset + (entry.dataPage * PAGE_BYTES));
+        writer->dataChecksums.push_back(Checksum(page, PAGE_BYTES, 0));
+    }
+    writer->pages.push_back(entry);
+}
+
+bool CheckpointFinishWrite() {
+    CheckpointHeader &header = writer->header;
+    bool failed = writer->failed || (writer->pages.size() != header.numPages);
+    header.numDataPages = writer->dataChecksums.size();
+    header.indexOffset = header.dataOffset + (header.numDataPages * PAGE_BYTES);
+    header.fileBytes = header.indexOffset + (header.numPages * sizeof(CheckpointPage)) +
+                       (header.numDataPages * sizeof(uint64_t));
+    header.checksum = CheckpointChecksumMetadata(header, writer->contexts, writer->pages.data(),
+                                                 writer->dataChecksums.data());
+
+    // the header is written last, so a checkpoint that was cut short has no magic:
+    failed = failed ||
+             !WriteAt(writer->fd, writer->pages.data(), header.numPages * sizeof(CheckpointPage), header.indexOffset) ||
+             !WriteAt(writer->fd, writer->dataChecksums.data(), header.numDataPages * sizeof(uint64_t),
+                      header.indexOffset + (header.numPages * sizeof(CheckpointPage))) ||
+             !WriteAt(writer->fd, &writer->contexts, sizeof(CheckpointContexts), sizeof(CheckpointHeader)) ||
+             (ftruncate(writer->fd, (off_t) header.fileBytes) != 0) || (fsync(writer->fd) != 0) ||
+             !WriteAt(writer->fd, &header, sizeof(CheckpointHeader), 0) || (fsync(writer->fd) != 0);
+    failed = (close(writer->fd) != 0) || failed;
+    failed = failed || (rename(writer->temporaryPath.c_str(), writer->path.c_str()) != 0);
+    if (failed) {
+        unlink(writer->temporaryPath.c_str());
+    }
+    delete writer;
+    writer = nullptr;
+    return !failed;
+}
+
+/**
+ * @return true if the given context exists in the checkpoint.
+ */
+bool IsCheckpointContext(const CheckpointContexts &contexts, int64_t context) {
+    return (context >= 0) && (context < MAX_CONTEXTS) && (contexts.contextSnapshots[context] != CHECKPOINT_NO_CONTEXT);
+}
+
+/**
+ * @return true if context 0 and address space 0 exist, if every snapshot and every context of an address space exists,
+ *         and if no context is its own snapshot through the snapshots of its snapshot.
+ */
+bool AreContextsValid(const CheckpointContexts &contexts) {
+    if (!IsCheckpointContext(contexts, 0) || !IsCheckpointContext(contexts, contexts.addressSpaceContexts[0])) {
+        return false;
+    }
+    for (int context = 0; context < MAX_CONTEXTS; context++) {
+        if (!IsCheckpointContext(contexts, context)) {
+            continue;
+        }
+        int64_t snapshot = contexts.contextSnapshots[context];
+        for (int depth = 0; snapshot != -1; depth++) {
+            if ((depth == MAX_CONTEXTS) || !IsCheckpointContext(contexts, snapshot)) {
+                return false;
+            }
+            snapshot = contexts.contextSnapshots[snapshot];
+        }
+    }
+    for (int addressSpace = 0; addressSpace < MAX_ADDRESS_SPACES; addressSpace++) {
+        int64_t context = contexts.addressSpaceContexts[addressSpace];
+        if ((context != -1) && !IsCheckpointContext(contexts, context)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @return true if the pages are in increasing page order, in contexts that exist, and their data pages are in the file.
+ */
+bool ArePagesValid(const CheckpointFile &file) {
+    for (uint64_t entry = 0; entry < file.header->numPages; entry++) {
+        const CheckpointPage &page = file.pages[entry];
+        if (((entry > 0) && (page.pageIdx <= file.pages[entry - 1].pageIdx)) ||
+            ((page.pageIdx >> CONTEXT_PAGE_WIDTH) >= (uint64_t) MAX_CONTEXTS) ||
+            !IsCheckpointContext(*file.contexts, GetContextOfPage(page.pageIdx)) ||
+            ((page.dataPage != CHECKPOINT_ZERO_PAGE) && (page.dataPage >= file.header->numDataPages))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @return true if the header matches this build, and the sections that it tells of fit the file exactly.
+ */
+bool IsHeaderValid(const CheckpointHeader &header, uint64_t fileBytes) {
+    if ((header.magic != CHECKPOINT_MAGIC) || (header.version != CHECKPOINT_VERSION) ||
+        (header.wordBytes != sizeof(word_t)) || (header.offsetWidth != OFFSET_WIDTH) ||
+        (header.physicalAddressWidth != PHYSICAL_ADDRESS_WIDTH) ||
+        (header.virtualAddressWidth != VIRTUAL_ADDRESS_WIDTH) || (header.maxContexts != MAX_CONTEXTS) ||
+        (header.maxAddressSpaces != MAX_ADDRESS_SPACES) || (header.policy > ARC_POLICY) || (header.hugePages > 1)) {
+        return false;
+    }
+    // the counts are bounded by the size of the file before they are multiplied, so nothing overflows:
+    if ((header.fileBytes != fileBytes) || (header.dataOffset != DATA_OFFSET) ||
+        (header.numDataPages > SWAP_MAX_CHECKPOINT_PAGES) || (header.numDataPages > fileBytes / PAGE_BYTES) ||
+        (header.numPages > fileBytes / sizeof(CheckpointPage))) {
+        return false;
+    }
+    return (header.indexOffset == header.dataOffset + (header.numDataPages * PAGE_BYTES)) &&
+           (header.fileBytes == header.indexOffset + (header.numPages * sizeof(CheckpointPage)) +
+                                (header.numDataPages * sizeof(uint64_t)));
+}
+
+bool CheckpointOpen(const char* path, CheckpointFile* file) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if ((fstat(fd, &status) != 0) || ((uint64_t) status.st_size < DATA_OFFSET)) {
+        close(fd);
+        return false;
+    }
+    uint64_t bytes = (uint64_t) status.st_size;
+    // the pages are only read from the page cache when they are loaded, and the mapping outlives the descriptor:
+    void* mapping = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    CheckpointFile opened;
+    opened.mapping = (const char*) mapping;
+    opened.bytes = bytes;
+    opened.header = (const CheckpointHeader*) opened.mapping;
+    opened.contexts = (const CheckpointContexts*) (opened.mapping + sizeof(CheckpointHeader));
+    bool valid = IsHeaderValid(*opened.header, bytes);
+    if (valid) {
+        opened.pages = (const CheckpointPage*) (opened.mapping + opened.header->indexOffset);
+        opened.dataChecksums = (const uint64_t*) (opened.pages + opened.header->numPages);
+        valid = (CheckpointChecksumMetadata(*opened.header, *opened.contexts, opened.pages, opened.dataChecksums) ==
+                 opened.header->checksum) && AreContextsValid(*opened.contexts) && ArePagesValid(opened);
+    }
+    if (!valid) {
+        munmap(mapping, bytes);
+        return false;
+    }
+    *file = opened;
+    return true;
+}
+
+void CheckpointUse(const CheckpointFile &file) {
+    if (checkpointInUse.mapping != nullptr) {
+        munmap((void*) checkpointInUse.mapping, checkpointInUse.bytes);
+    }
+    checkpointInUse = file;
+}
+
+void CheckpointLoadPage(uint64_t dataPage, word_t* page) {
+    assert(dataPage < checkpointInUse.header->numDataPages);
+    memcpy(page, checkpointInUse.mapping + checkpointInUse.header->dataOffset + (dataPage * PAGE_BYTES), PAGE_BYTES);
+    if (Checksum(page, PAGE_BYTES, 0) != checkpointInUse.dataChecksums[dataPage]) {
+        fprintf(stderr, "page %llu of the checkpoint does not match its checksum\n", (unsigned long long) dataPage);
+        exit(1);
+    }
+    STATS_ADD(checkpointRestores, 1);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "MemoryConstants.h"
+//#include "YaaraConstants.h"
+#include "AddressSpace.h"
+
+/*
+ * The checkpoint files of VMcheckpoint and VMrestoreCheckpoint, which keep every page that the contexts hold, whether
+ * in the RAM or in the swap store, with the contexts and the address spaces that they make up.
+ *
+ * The file starts with a CheckpointHeader and a CheckpointContexts. The data pages follow from a multiple of
+ * CHECKPOINT_ALIGNMENT bytes, so each of them can be read in place from a mapping of the file, and the file ends with
+ * the page index (a CheckpointPage per page, in page order) and the checksum of each data page. A page of zeroes takes
+ * no data page. The page tables are not kept: a restored page is mapped by its first access, like a page that was
+ * swapped out.
+ * The header, the contexts and the end of the file are covered by one checksum, which is checked when the file is
+ * opened, and each data page by a checksum of its own, which is checked when the page is loaded, so opening a checkpoint
+ * reads none of its data pages.
+ */
+
+#define CHECKPOINT_MAGIC 0x54504b434d56ULL
+#define CHECKPOINT_VERSION 1
+// the data pages start at a multiple of this many bytes, which is a page of the host:
+#define CHECKPOINT_ALIGNMENT 4096
+// the snapshot of a context that does not exist:
+#define CHECKPOINT_NO_CONTEXT (-2)
+// the data page of a page of zeroes:
+#define CHECKPOINT_ZERO_PAGE ((uint64_t) -1)
+
+typedef struct {
+    uint64_t magic;
+    uint64_t version;
+    // the geometry of the build that wrote the checkpoint, which a restore must match:
+    uint64_t wordBytes;
+    uint64_t offsetWidth;
+    uint64_t physicalAddressWidth;
+    uint64_t virtualAddressWidth;
+    uint64_t maxContexts;
+    uint64_t maxAddressSpaces;
+    // the replacement policy, and whether huge pages were enabled:
+    uint64_t policy;
+    uint64_t hugePages;
+    // the entries of the page index, and the data pages, which only the pages that are not zeroes take:
+    uint64_t numPages;
+    uint64_t numDataPages;
+    // the offsets of the first data page and of the page index, and the size of the file, in bytes:
+    uint64_t dataOffset;
+    uint64_t indexOffset;
+    uint64_t fileBytes;
+    // of the fields above, the contexts, the page index and the checksums of the data pages:
+    uint64_t checksum;
+} CheckpointHeader;
+
+/*
+ * The contexts and the address spaces, see AddressSpace.h.
+ */
+typedef struct {
+    // the snapshot of each context, -1 for none, or CHECKPOINT_NO_CONTEXT if the context does not exist:
+    int64_t contextSnapshots[MAX_CONTEXTS];
+    // the context of each address space, or -1 if it does not exist:
+    int64_t addressSpaceContexts[MAX_ADDRESS_SPACES];
+} CheckpointContexts;
+
+typedef struct {
+    // tagged with its context:
+    uint64_t pageIdx;
+    // the index of its data page, or CHECKPOINT_ZERO_PAGE:
+    uint64_t dataPage;
+} CheckpointPage;
+
+/*
+ * returns the checksum of the header (without its checksum), the contexts, the page index and the checksums of the data
+ * pages, which is the checksum in the header.
+ */
+uint64_t CheckpointChecksumMetadata(const CheckpointHeader &header, const CheckpointContexts &contexts,
+                                    const CheckpointPage* pages, const uint64_t* dataChecksums);
+
+/*
+ * Creates the checkpoint file at the given path, for 'numPages' pages that are written by CheckpointWritePage, in page
+ * order. The file is written under a temporary name, and only takes the given path on CheckpointFinishWrite, so an
+ * older checkpoint at the path is kept until the new one is complete.
+ * returns false if the file cannot be created, or if a checkpoint is already being written.
+ */
+bool CheckpointBeginWrite(const char* path, uint64_t policy, bool hugePages, const CheckpointContexts &contexts,
+                          uint64_t numPages);
+
+/*
+ * Writes the next page of the checkpoint.
+ */
+void CheckpointWritePage(uint64_t pageIdx, const word_t* page);
+
+/*
+ * Writes the page index and the header, and moves the file to its path.
+ * returns false, and removes the file, if any write failed.
+ */
+bool CheckpointFinishWrite();
+
+/*
+ * A checkpoint file, mapped to the memory.
+ */
+typedef struct {
+    const char* mapping;
+    uint64_t bytes;
+    const CheckpointHeader* header;
+    const CheckpointContexts* contexts;
+    const CheckpointPage* pages;
+    const uint64_t* dataChecksums;
+} CheckpointFile;
+
+/*
+ * Maps the checkpoint at the given path, and checks that it is complete, that it matches the geometry of this build and
+ * its checksum, and that its contexts and page index are consistent.
+ * returns false, and maps nothing, if it does not.
+ */
+bool CheckpointOpen(const char* path, CheckpointFile* file);
+
+/*
+ * Makes the given checkpoint the one that CheckpointLoadPage loads from, and unmaps the one that was used before, whose
+ * pages must not be in the swap store anymore.
+ */
+void CheckpointUse(const CheckpointFile &file);
+
+/*
+ * Copies the given data page of the checkpoint in use into 'page'. A data page that does not match its checksum is
+ * fatal, since the page would be lost.
+ */
+void CheckpointLoadPage(uint64_t dataPage, word_t* page);
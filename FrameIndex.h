@@ -0,0 +1,414 @@
+#pragma once
+
+#include "Geometry.h"
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+/*
+ * Bookkeeping of the frames that are linked into the hierarchical page table, kept up to date on every change of the
+ * table so that a page fault can find its frame without traversing the whole table in the RAM.
+ */
+typedef struct {
+    bool used;
+    // 0 for the root table of a context, TablesDepth for a frame that holds a page:
+    int depth;
+    word_t parentFrameIdx;
+    uint64_t offsetInParent;
+    // the page index accumulated along the path to this frame, of the tagged address (see AddressSpace.h). for a page,
+    // this is its page index, and for a root table its context:
+    uint64_t cumulativePageIdx;
+    // number of non-zero entries, for a frame that holds a table:
+    uint64_t numChildren;
+    // for a frame that holds a page, whether it differs from the copy of the page in the swap file (or has no copy):
+    bool dirty;
+    // for a frame that holds a page, whether the page is a part of a huge page. all of the pages of a huge page are
+    // linked to the parent of the huge page, at its offset:
+    bool huge;
+} FrameInfo;
+
+/*
+ * The bookkeeping of the frames of a RAM in the given geometry. The global virtual memory keeps one for
+ * CompiledGeometry behind the functions of FrameTable.h, and every VirtualMemoryInstance keeps its own. The
+ * geometries in Geometry.h are instantiated once, in FrameTable.cpp.
+ */
+template<typename Geometry>
+class FrameIndex {
+public:
+    explicit FrameIndex(const Geometry &geometry = Geometry());
+
+    /*
+     * Resets the bookkeeping to a page table that holds only frame 0, which is empty.
+     */
+    void Initialize();
+
+    /*
+     * Records that frameIdx was linked at offsetInParent of parentFrameIdx, in the given depth of the page table.
+     */
+    void LinkFrame(word_t frameIdx, word_t parentFrameIdx, uint64_t offsetInParent, int depth,
+                   uint64_t cumulativePageIdx);
+
+    /*
+     * Records that frameIdx holds the root table of the given context, which is never taken for another node.
+     * The frame is released with ReleaseFrame once its context is destroyed.
+     */
+    void LinkRootFrame(word_t frameIdx, int context);
+
+    /*
+     * Records that frameIdx was removed from its parent. The frame is still considered as used by the caller.
+     */
+    void UnlinkFrame(word_t frameIdx);
+
+    /*
+     * Records that the linked frameIdx was moved to offsetInParent of parentFrameIdx, in the same depth of the page
+     * table.
+     */
+    void MoveFrame(word_t frameIdx, word_t parentFrameIdx, uint64_t offsetInParent);
+
+    /*
+     * Finds the first empty table in DFS order, other than ignoreFrameIdx.
+     * returns true and puts its index in 'frameIdx' if there is one.
+     */
+    bool FindEmptyTable(word_t ignoreFrameIdx, word_t *frameIdx) const;
+
+    /*
+     * Takes a frame that was never used, if the RAM is not full yet. The frame is marked as used once it is linked.
+     * returns true and puts its index in 'frameIdx' on success.
+     */
+    bool AllocateUnusedFrame(word_t *frameIdx);
+
+    /*
+     * Takes count consecutive frames that are free or were never used, the lowest such run. The frames are marked as
+     * used once they are linked.
+     * returns true and puts the index of the first frame in 'firstFrameIdx' if there is such a run.
+     */
+    bool AllocateFrameRun(uint64_t count, word_t *firstFrameIdx);
+
+    /*
+     * Takes count consecutive frames, each free, never used, or released. The frames are marked as used once they are
+     * linked.
+     */
+    void TakeFrameRun(word_t firstFrameIdx, uint64_t count);
+
+    /*
+     * returns true if frameIdx is in the pool of free frames, or was never used.
+     */
+    bool IsFrameFree(word_t frameIdx) const {
+        return availableFrames[frameIdx];
+    }
+
+    /*
+     * Marks a frame that was unlinked from its parent as not used, so it is not mistaken for its old node.
+     */
+    void ReleaseFrame(word_t frameIdx);
+
+    /*
+     * Adds a released frame, which must be zeroed, to the pool of free frames.
+     */
+    void PushFreeFrame(word_t frameIdx);
+
+    /*
+     * Takes a frame from the pool of free frames. The frame is marked as used once it is linked.
+     * returns true and puts its index in 'frameIdx' if the pool is not empty.
+     */
+    bool PopFreeFrame(word_t *frameIdx);
+
+    uint64_t GetNumFreeFrames() const {
+        return freeFrames.size();
+    }
+
+    /*
+     * returns true if some frame was never used yet, so AllocateUnusedFrame would succeed.
+     */
+    bool HasUnusedFrame() const {
+        return ((uint64_t) maxUsedFrameIdx + 1) < geometry.NumFrames();
+    }
+
+    uint64_t GetNumResidentPages() const {
+        return residentPages.size();
+    }
+
+    /*
+     * Finds the frame of the resident page, in any context, with the largest cyclic distance from pageIdx inside their
+     * contexts (the smallest page index wins a tie), in O(number of contexts * log(number of resident pages)).
+     */
+    word_t FindVictimFrame(uint64_t pageIdx) const;
+
+    /*
+     * Sets whether the page in frameIdx differs from its copy in the swap file. Linking a frame clears the flag.
+     */
+    void SetFrameDirty(word_t frameIdx, bool dirty) {
+        frames[frameIdx].dirty = dirty;
+    }
+
+    /*
+     * Sets whether the page in frameIdx is a part of a huge page. Linking a frame clears the flag.
+     */
+    void SetFrameHuge(word_t frameIdx, bool huge) {
+        frames[frameIdx].huge = huge;
+    }
+
+    const FrameInfo &GetFrameInfo(word_t frameIdx) const {
+        return frames[frameIdx];
+    }
+
+private:
+    std::pair<uint64_t, word_t> EmptyTableKey(word_t frameIdx) const;
+
+    uint64_t CyclicDistance(uint64_t pageIdx1, uint64_t pageIdx2) const;
+
+    Geometry geometry;
+    std::vector<FrameInfo> frames;
+    // empty tables, ordered by the first page index under them, which is their DFS order:
+    std::set<std::pair<uint64_t, word_t> > emptyTables;
+    // the frames of the resident pages, ordered by page index:
+    std::map<uint64_t, word_t> residentPages;
+    word_t maxUsedFrameIdx;
+    // released frames that hold zeroes, ready to be linked without an eviction:
+    std::vector<word_t> freeFrames;
+    // whether each frame is in freeFrames or after maxUsedFrameIdx, so a frame or a run of frames is checked without
+    // searching freeFrames:
+    std::vector<bool> availableFrames;
+};
+
+template<typename Geometry>
+FrameIndex<Geometry>::FrameIndex(const Geometry &geometry) : geometry(geometry) {
+    Initialize();
+}
+
+template<typename Geometry>
+void FrameIndex<Geometry>::Initialize() {
+    FrameInfo unused = {false, 0, 0, 0, 0, 0, false, false};
+    frames.assign(geometry.NumFrames(), unused);
+    frames[0].used = true;
+    emptyTables.clear();
+    residentPages.clear();
+    maxUsedFrameIdx = 0;
+    freeFrames.clear();
+    availableFrames.assign(geometry.NumFrames(), true);
+    availableFrames[0] = false;
+}
+
+/**
+ * @return the key of the given table frame in emptyTables.
+ */
+template<typename Geometry>
+std::pair<uint64_t, word_t> FrameIndex<Geometry>::EmptyTableKey(word_t frameIdx) const {
+    const FrameInfo &info = frames[frameIdx];
+    return std::make_pair(info.cumulativePageIdx << (geometry.OffsetWidth() * (geometry.TablesDepth() - info.depth)),
+                          frameIdx);
+}
+
+template<typename Geometry>
+uint64_t FrameIndex<Geometry>::CyclicDistance(uint64_t pageIdx1, uint64_t pageIdx2) const {
+    uint64_t dist1 = (pageIdx1 > pageIdx2) ? (pageIdx1 - pageIdx2) : (pageIdx2 - pageIdx1);
+    uint64_t dist2 = geometry.NumPages() - dist1;
+    return (dist1 > dist2) ? dist2 : dist1;
+}
+
+template<typename Geometry>
+void FrameIndex<Geometry>::LinkFrame(word_t frameIdx, word_t parentFrameIdx, uint64_t offsetInParent, int depth,
+                                     uint64_t cumulativePageIdx) {
+    FrameInfo &info = frames[frameIdx];
+    info.used = true;
+    info.depth = depth;
+    info.parentFrameIdx = parentFrameIdx;
+    info.offsetInParent = offsetInParent;
+    info.cumulativePageIdx = cumulativePageIdx;
+    info.numChildren = 0;
+    info.dirty = false;
+    info.huge = false;
+    if (depth < geometry.TablesDepth()) {
+        emptyTables.insert(EmptyTableKey(frameIdx));
+    } else {
+        residentPages[cumulativePageIdx] = frameIdx;
+    }
+
+    FrameInfo &parentInfo = frames[parentFrameIdx];
+    if ((parentInfo.numChildren++ == 0) && (parentInfo.depth != 0)) {
+        emptyTables.erase(EmptyTableKey(parentFrameIdx));
+    }
+}
+
+template<typename Geometry>
+void FrameIndex<Geometry>::LinkRootFrame(word_t frameIdx, int context) {
+    FrameInfo &info = frames[frameIdx];
+    info.used = true;
+    info.depth = 0;
+    info.parentFrameIdx = frameIdx;
+    info.offsetInParent = 0;
+    info.cumulativePageIdx = (uint64_t) context;
+    info.numChildren = 0;
+    info.dirty = false;
+    info.huge = false;
+}
+
+template<typename Geometry>
+void FrameIndex<Geometry>::UnlinkFrame(word_t frameIdx) {
+    FrameInfo &info = frames[frameIdx];
+    if (info.depth < geometry.TablesDepth()) {
+        emptyTables.erase(EmptyTableKey(frameIdx));
+    } else {
+        residentPages.erase(info.cumulativePageIdx);
+    }
+
+    word_t parentFrameIdx = info.parentFrameIdx;
+    FrameInfo &parentInfo = frames[parentFrameIdx];
+    assert(parentInfo.numChildren > 0);
+    if ((--parentInfo.numChildren == 0) && (parentInfo.depth != 0)) {
+        emptyTables.insert(EmptyTableKey(parentFrameIdx));
+    }
+}
+
+template<typename Geometry>
+void FrameIndex<Geometry>::MoveFrame(word_t frameIdx, word_t parentFrameIdx, uint64_t offsetInParent) {
+    FrameInfo &info = frames[frameIdx];
+    word_t oldParentFrameIdx = info.parentFrameIdx;
+    FrameInfo &oldParentInfo = frames[oldParentFrameIdx];
+    assert(oldParentInfo.numChildren > 0);
+    if ((--oldParentInfo.numChildren == 0) && (oldParentInfo.depth != 0)) {
+        emptyTables.insert(EmptyTableKey(oldParentFrameIdx));
+    }
+
+    info.parentFrameIdx = parentFrameIdx;
+    info.offsetInParent = offsetInParent;
+    FrameInfo &parentInfo = frames[parentFrameIdx];
+    if ((parentInfo.numChildren++ == 0) && (parentInfo.depth != 0)) {
+        emptyTables.erase(EmptyTableKey(parentFrameIdx));
+    }
+}
+
+template<typename Geometry>
+bool FrameIndex<Geometry>::FindEmptyTable(word_t ignoreFrameIdx, word_t *frameIdx) const {
+    for (auto it = emptyTables.begin(); it != emptyTables.end(); ++it) {
+        if (it->second != ignoreFrameIdx) {
+            *frameIdx = it->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename Geometry>
+bool FrameIndex<Geometry>::AllocateUnusedFrame(word_t *frameIdx) {
+    if (!HasUnusedFrame()) {
+        return false;
+    }
+    *frameIdx = ++maxUsedFrameIdx;
+    availableFrames[*frameIdx] = false;
+    return true;
+}
+
+template<typename Geometry>
+bool FrameIndex<Geometry>::AllocateFrameRun(uint64_t count, word_t *firstFrameIdx) {
+    // the frames after maxUsedFrameIdx are all available, so the lowest run ends by maxUsedFrameIdx + count if any:
+    uint64_t endFrameIdx = std::min(geometry.NumFrames(), (uint64_t) maxUsedFrameIdx + count + 1);
+    uint64_t runLength = 0;
+    for (word_t frameIdx = 1; (uint64_t) frameIdx < endFrameIdx; frameIdx++) {
+        runLength = availableFrames[frameIdx] ? (runLength + 1) : 0;
+        if (runLength < count) {
+            continue;
+        }
+        *firstFrameIdx = frameIdx - (word_t) count + 1;
+        TakeFrameRun(*firstFrameIdx, count);
+        return true;
+    }
+    return false;
+}
+
+template<typename Geometry>
+void FrameIndex<Geometry>::TakeFrameRun(word_t firstFrameIdx, uint64_t count) {
+    word_t lastFrameIdx = firstFrameIdx + (word_t) count - 1;
+    bool hasFreeFrame = false;
+    for (word_t frameIdx = firstFrameIdx; frameIdx <= lastFrameIdx; frameIdx++) {
+        hasFreeFrame = hasFreeFrame || ((frameIdx <= maxUsedFrameIdx) && availableFrames[frameIdx]);
+        availableFrames[frameIdx] = false;
+    }
+    if (hasFreeFrame) {
+        auto inRun = [firstFrameIdx, lastFrameIdx](word_t frameIdx) {
+            return (frameIdx >= firstFrameIdx) && (frameIdx <= lastFrameIdx);
+        };
+        freeFrames.erase(std::remove_if(freeFrames.begin(), freeFrames.end(), inRun), freeFrames.end());
+    }
+    // a run that reaches past maxUsedFrameIdx must start at or before maxUsedFrameIdx + 1, or it would be free:
+    maxUsedFrameIdx = std::max(maxUsedFrameIdx, lastFrameIdx);
+}
+
+template<typename Geometry>
+void FrameIndex<Geometry>::ReleaseFrame(word_t frameIdx) {
+    frames[frameIdx].used = false;
+}
+
+template<typename Geometry>
+void FrameIndex<Geometry>::PushFreeFrame(word_t frameIdx) {
+    assert(!frames[frameIdx].used);
+    freeFrames.push_back(frameIdx);
+    availableFrames[frameIdx] = true;
+}
+
+template<typename Geometry>
+bool FrameIndex<Geometry>::PopFreeFrame(word_t *frameIdx) {
+    if (freeFrames.empty()) {
+        return false;
+    }
+    *frameIdx = freeFrames.back();
+    freeFrames.pop_back();
+    availableFrames[*frameIdx] = false;
+    return true;
+}
+
+/**
+ * The pages of a context are on a ring of NumPages (an even number), so the cyclic distance of a page from pageIdx
+ * is NumPages/2 minus its cyclic distance from the antipode of pageIdx. Thus the victim in each context is the
+ * resident page closest to the antipode, which is either the first resident page of the context from the antipode
+ * onwards, or the last one before it. The pages of the other contexts are measured by their page index inside their
+ * context, as if they were on the ring of pageIdx.
+ */
+template<typename Geometry>
+word_t FrameIndex<Geometry>::FindVictimFrame(uint64_t pageIdx) const {
+    assert(!residentPages.empty());
+    uint64_t numPages = geometry.NumPages();
+    // the context of a page is in the bits above its page index inside its context (see AddressSpace.h):
+    int contextPageWidth = geometry.VirtualAddressWidth() - geometry.OffsetWidth();
+    uint64_t antipodeInSpace = ((pageIdx % numPages) + (numPages / 2)) % numPages;
+
+    uint64_t victimDist = 0;
+    auto victim = residentPages.end();
+    // visits every context that has a resident page, in order:
+    for (auto first = residentPages.begin(); first != residentPages.end();) {
+        uint64_t firstPageIdx = (first->first >> contextPageWidth) << contextPageWidth;
+        auto end = residentPages.lower_bound(firstPageIdx + numPages);
+        uint64_t antipode = firstPageIdx + antipodeInSpace;
+
+        auto after = residentPages.lower_bound(antipode);
+        if (after == end) {
+            after = first;
+        }
+        auto before = residentPages.lower_bound(antipode);
+        if (before == first) {
+            before = end;
+        }
+        --before;
+
+        // the smallest page index wins a tie, and the candidates are visited in page order:
+        for (auto candidate : {before, after}) {
+            uint64_t dist = CyclicDistance(candidate->first - firstPageIdx, antipodeInSpace);
+            if ((victim == residentPages.end()) || (dist < victimDist) ||
+                ((dist == victimDist) && (candidate->first < victim->first))) {
+                victim = candidate;
+                victimDist = dist;
+            }
+        }
+        first = end;
+    }
+    return victim->second;
+}
+
+// the frame indices of the geometries in Geometry.h are compiled once, in FrameTable.cpp:
+extern template class FrameIndex<RuntimeGeometry>;
+extern template class FrameIndex<CompiledGeometry>;
+extern template class FrameIndex<LargeGeometry>;
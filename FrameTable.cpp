@@ -0,0 +1,90 @@
+#include "FrameTable.h"
+
+template class FrameIndex<RuntimeGeometry>;
+template class FrameIndex<CompiledGeometry>;
+template class FrameIndex<LargeGeometry>;
+
+static_assert(CompiledGeometry::TablesDepth() == TABLES_DEPTH, "CompiledGeometry must match MemoryConstants.h");
+
+FrameIndex<CompiledGeometry> frameTable;
+
+void FrameTableInitialize() {
+    frameTable.Initialize();
+}
+
+void LinkFrame(word_t frameIdx, word_t parentFrameIdx, uint64_t offsetInParent, int depth,
+               uint64_t cumulativePageIdx) {
+    frameTable.LinkFrame(frameIdx, parentFrameIdx, offsetInParent, depth, cumulativePageIdx);
+}
+
+void LinkRootFrame(word_t frameIdx, int context) {
+    frameTable.LinkRootFrame(frameIdx, context);
+}
+
+void UnlinkFrame(word_t frameIdx) {
+    frameTable.UnlinkFrame(frameIdx);
+}
+
+void MoveFrame(word_t frameIdx, word_t parentFrameIdx, uint64_t offsetInParent) {
+    frameTable.MoveFrame(frameIdx, parentFrameIdx, offsetInParent);
+}
+
+bool FindEmptyTable(word_t ignoreFrameIdx, word_t *frameIdx) {
+    return frameTable.FindEmptyTable(ignoreFrameIdx, frameIdx);
+}
+
+bool AllocateUnusedFrame(word_t *frameIdx) {
+    return frameTable.AllocateUnusedFrame(frameIdx);
+}
+
+bool AllocateFrameRun(uint64_t count, word_t *firstFrameIdx) {
+    return frameTable.AllocateFrameRun(count, firstFrameIdx);
+}
+
+void TakeFrameRun(word_t firstFrameIdx, uint64_t count) {
+    frameTable.TakeFrameRun(firstFrameIdx, count);
+}
+
+bool IsFrameFree(word_t frameIdx) {
+    return frameTable.IsFrameFree(frameIdx);
+}
+
+void ReleaseFrame(word_t frameIdx) {
+    frameTable.ReleaseFrame(frameIdx);
+}
+
+void PushFreeFrame(word_t frameIdx) {
+    frameTable.PushFreeFrame(frameIdx);
+}
+
+bool PopFreeFrame(word_t *frameIdx) {
+    return frameTable.PopFreeFrame(frameIdx);
+}
+
+uint64_t GetNumFreeFrames() {
+    return frameTable.GetNumFreeFrames();
+}
+
+bool HasUnusedFrame() {
+    return frameTable.HasUnusedFrame();
+}
+
+uint64_t GetNumResidentPages() {
+    return frameTable.GetNumResidentPages();
+}
+
+word_t FindVictimFrame(uint64_t pageIdx) {
+    return frameTable.FindVictimFrame(pageIdx);
+}
+
+void SetFrameDirty(word_t frameIdx, bool dirty) {
+    frameTable.SetFrameDirty(frameIdx, dirty);
+}
+
+void SetFrameHuge(word_t frameIdx, bool huge) {
+    frameTable.SetFrameHuge(frameIdx, huge);
+}
+
+const FrameInfo &GetFrameInfo(word_t frameIdx) {
+    return frameTable.GetFrameInfo(frameIdx);
+}
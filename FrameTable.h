@@ -0,0 +1,109 @@
+#pragma once
+
+#include "MemoryConstants.h"
+//#include "YaaraConstants.h"
+#include "FrameIndex.h"
+
+/*
+ * The bookkeeping of the frames of the global virtual memory (see FrameIndex), in CompiledGeometry.
+ */
+
+/*
+ * Resets the bookkeeping to a page table that holds only frame 0, which is empty.
+ */
+void FrameTableInitialize();
+
+/*
+ * Records that frameIdx was linked at offsetInParent of parentFrameIdx, in the given depth of the page table.
+ */
+void LinkFrame(word_t frameIdx, word_t parentFrameIdx, uint64_t offsetInParent, int depth,
+               uint64_t cumulativePageIdx);
+
+/*
+ * Records that frameIdx holds the root table of the given context, which is never taken for another node.
+ * The frame is released with ReleaseFrame once its context is destroyed.
+ */
+void LinkRootFrame(word_t frameIdx, int context);
+
+/*
+ * Records that frameIdx was removed from its parent. The frame is still considered as used by the caller.
+ */
+void UnlinkFrame(word_t frameIdx);
+
+/*
+ * Records that the linked frameIdx was moved to offsetInParent of parentFrameIdx, in the same depth of the page table.
+ */
+void MoveFrame(word_t frameIdx, word_t parentFrameIdx, uint64_t offsetInParent);
+
+/*
+ * Finds the first empty table in DFS order, other than ignoreFrameIdx.
+ * returns true and puts its index in 'frameIdx' if there is one.
+ */
+bool FindEmptyTable(word_t ignoreFrameIdx, word_t *frameIdx);
+
+/*
+ * Takes a frame that was never used, if the RAM is not full yet. The frame is marked as used once it is linked.
+ * returns true and puts its index in 'frameIdx' on success.
+ */
+bool AllocateUnusedFrame(word_t *frameIdx);
+
+/*
+ * Takes count consecutive frames that are free or were never used, the lowest such run. The frames are marked as used
+ * once they are linked.
+ * returns true and puts the index of the first frame in 'firstFrameIdx' if there is such a run.
+ */
+bool AllocateFrameRun(uint64_t count, word_t *firstFrameIdx);
+
+/*
+ * Takes count consecutive frames, each free, never used, or released. The frames are marked as used once they are
+ * linked.
+ */
+void TakeFrameRun(word_t firstFrameIdx, uint64_t count);
+
+/*
+ * returns true if frameIdx is in the pool of free frames, or was never used.
+ */
+bool IsFrameFree(word_t frameIdx);
+
+/*
+ * Marks a frame that was unlinked from its parent as not used, so it is not mistaken for its old node.
+ */
+void ReleaseFrame(word_t frameIdx);
+
+/*
+ * Adds a released frame, which must be zeroed, to the pool of free frames.
+ */
+void PushFreeFrame(word_t frameIdx);
+
+/*
+ * Takes a frame from the pool of free frames. The frame is marked as used once it is linked.
+ * returns true and puts its index in 'frameIdx' if the pool is not empty.
+ */
+bool PopFreeFrame(word_t *frameIdx);
+
+uint64_t GetNumFreeFrames();
+
+/*
+ * returns true if some frame was never used yet, so AllocateUnusedFrame would succeed.
+ */
+bool HasUnusedFrame();
+
+uint64_t GetNumResidentPages();
+
+/*
+ * Finds the frame of the resident page, in any context, with the largest cyclic distance from pageIdx inside their
+ * contexts (the smallest page index wins a tie), in O(number of contexts * log(number of resident pages)).
+ */
+word_t FindVictimFrame(uint64_t pageIdx);
+
+/*
+ * Sets whether the page in frameIdx differs from its copy in the swap file. Linking a frame clears the flag.
+ */
+void SetFrameDirty(word_t frameIdx, bool dirty);
+
+/*
+ * Sets whether the page in frameIdx is a part of a huge page. Linking a frame clears the flag.
+ */
+void SetFrameHuge(word_t frameIdx, bool huge);
+
+const FrameInfo &GetFrameInfo(word_t frameIdx);
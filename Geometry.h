@@ -0,0 +1,182 @@
+#pragma once
+
+#include "MemoryConstants.h"
+//#include "YaaraConstants.h"
+
+/*
+ * The geometry of a VirtualMemoryInstance: the widths that MemoryConstants.h fixes for the global virtual memory, and
+ * everything that is derived from them. A geometry is either a RuntimeGeometry, which is read from a VMgeometry at
+ * runtime, or a StaticGeometry, whose widths are template arguments, so every shift and mask that is derived from them
+ * is a compile time constant.
+ * Both have the same interface, which VirtualMemoryInstance is templated on.
+ */
+
+typedef struct {
+    // number of bits in the offset, so a page (and a table) has 2^offsetWidth words
+    int offsetWidth;
+    // number of bits in a physical address
+    int physicalAddressWidth;
+    // number of bits in a virtual address
+    int virtualAddressWidth;
+} VMgeometry;
+
+/*
+ * The depth of the page table, like TABLES_DEPTH, but rounded up with integers so it is a constant expression.
+ */
+constexpr int GeometryTablesDepth(int offsetWidth, int virtualAddressWidth) {
+    return (virtualAddressWidth - offsetWidth + offsetWidth - 1) / offsetWidth;
+}
+
+/*
+ * The number of bits of the virtual address that index frame 0, which may be fewer than offsetWidth.
+ */
+constexpr int GeometryFrame0AddressWidth(int offsetWidth, int virtualAddressWidth) {
+    return virtualAddressWidth - offsetWidth -
+           (offsetWidth * (GeometryTablesDepth(offsetWidth, virtualAddressWidth) - 1));
+}
+
+/*
+ * returns true if a VirtualMemoryInstance can be created with the given widths: pages of at least 2 words, frame
+ * indices that fit a word, virtual addresses that fit 62 bits, and enough frames for a whole walk of the page table.
+ */
+constexpr bool GeometryIsValid(int offsetWidth, int physicalAddressWidth, int virtualAddressWidth) {
+    return (offsetWidth >= 1) && (physicalAddressWidth > offsetWidth) &&
+           ((physicalAddressWidth - offsetWidth) < (int) (WORD_WIDTH - 1)) &&
+           (virtualAddressWidth > offsetWidth) && (virtualAddressWidth <= 62) &&
+           ((1LL << (physicalAddressWidth - offsetWidth)) > GeometryTablesDepth(offsetWidth, virtualAddressWidth));
+}
+
+inline bool VMisValidGeometry(const VMgeometry &geometry) {
+    return GeometryIsValid(geometry.offsetWidth, geometry.physicalAddressWidth, geometry.virtualAddressWidth);
+}
+
+/*
+ * A geometry that is chosen at runtime. Must be created from a valid VMgeometry.
+ */
+class RuntimeGeometry {
+public:
+    explicit RuntimeGeometry(const VMgeometry &geometry)
+            : offsetWidth(geometry.offsetWidth), physicalAddressWidth(geometry.physicalAddressWidth),
+              virtualAddressWidth(geometry.virtualAddressWidth),
+              tablesDepth(GeometryTablesDepth(geometry.offsetWidth, geometry.virtualAddressWidth)),
+              frame0AddressWidth(GeometryFrame0AddressWidth(geometry.offsetWidth, geometry.virtualAddressWidth)) {}
+
+    int OffsetWidth() const {
+        return offsetWidth;
+    }
+
+    int PhysicalAddressWidth() const {
+        return physicalAddressWidth;
+    }
+
+    int VirtualAddressWidth() const {
+        return virtualAddressWidth;
+    }
+
+    int TablesDepth() const {
+        return tablesDepth;
+    }
+
+    int Frame0AddressWidth() const {
+        return frame0AddressWidth;
+    }
+
+    uint64_t PageSize() const {
+        return 1ULL << offsetWidth;
+    }
+
+    uint64_t NumFrames() const {
+        return 1ULL << (physicalAddressWidth - offsetWidth);
+    }
+
+    uint64_t NumPages() const {
+        return 1ULL << (virtualAddressWidth - offsetWidth);
+    }
+
+    uint64_t VirtualMemorySize() const {
+        return 1ULL << virtualAddressWidth;
+    }
+
+private:
+    int offsetWidth;
+    int physicalAddressWidth;
+    int virtualAddressWidth;
+    int tablesDepth;
+    int frame0AddressWidth;
+};
+
+/*
+ * A geometry that is fixed at compile time.
+ */
+template<int OFFSET, int PHYSICAL, int VIRTUAL>
+class StaticGeometry {
+public:
+    static_assert(GeometryIsValid(OFFSET, PHYSICAL, VIRTUAL), "invalid geometry");
+
+    static constexpr int OffsetWidth() {
+        return OFFSET;
+    }
+
+    static constexpr int PhysicalAddressWidth() {
+        return PHYSICAL;
+    }
+
+    static constexpr int VirtualAddressWidth() {
+        return VIRTUAL;
+    }
+
+    static constexpr int TablesDepth() {
+        return GeometryTablesDepth(OFFSET, VIRTUAL);
+    }
+
+    static constexpr int Frame0AddressWidth() {
+        return GeometryFrame0AddressWidth(OFFSET, VIRTUAL);
+    }
+
+    static constexpr uint64_t PageSize() {
+        return 1ULL << OFFSET;
+    }
+
+    static constexpr uint64_t NumFrames() {
+        return 1ULL << (PHYSICAL - OFFSET);
+    }
+
+    static constexpr uint64_t NumPages() {
+        return 1ULL << (VIRTUAL - OFFSET);
+    }
+
+    static constexpr uint64_t VirtualMemorySize() {
+        return 1ULL << VIRTUAL;
+    }
+};
+
+/*
+ * returns the page index accumulated along the path to the table entry of the given level of virtualAddress (1 for
+ * the entry in frame 0), which is the cumulative page index of the frame that this entry points to. The bits of the
+ * address above VirtualAddressWidth (the context of a tagged address, see AddressSpace.h) are kept.
+ */
+template<typename Geometry>
+inline uint64_t GeometryCumulativePageIdx(const Geometry &geometry, uint64_t virtualAddress, int level) {
+    return virtualAddress >> (geometry.VirtualAddressWidth() - geometry.Frame0AddressWidth() -
+                              (geometry.OffsetWidth() * (level - 1)));
+}
+
+/*
+ * returns the offset of the table entry of the given level of virtualAddress, in its table.
+ */
+template<typename Geometry>
+inline uint64_t GeometryPi(const Geometry &geometry, uint64_t virtualAddress, int level) {
+    // frame 0 is indexed by the Frame0AddressWidth left most bits, and every other table by OffsetWidth bits:
+    uint64_t mask = (level == 1) ? ((1ULL << geometry.Frame0AddressWidth()) - 1) : (geometry.PageSize() - 1);
+    return GeometryCumulativePageIdx(geometry, virtualAddress, level) & mask;
+}
+
+/*
+ * The geometry of MemoryConstants.h, which the global virtual memory uses.
+ */
+typedef StaticGeometry<OFFSET_WIDTH, PHYSICAL_ADDRESS_WIDTH, VIRTUAL_ADDRESS_WIDTH> CompiledGeometry;
+
+/*
+ * Pages of 256 words, a RAM of 4096 frames and a 32 bit virtual address space, walked in 3 levels.
+ */
+typedef StaticGeometry<8, 20, 32> LargeGeometry;
@@ -0,0 +1,75 @@
+#include "PagingStructureCache.h"
+
+#ifdef VM_CONCURRENT
+// every thread has its own cache. a stale entry is caught by validating the table against the frame bookkeeping, or by
+// validating the page that the walk reaches under its frame lock:
+#define PSC_STORAGE thread_local
+#else
+#define PSC_STORAGE
+#endif
+
+#if PSC_ENTRIES_PER_DEPTH > 0
+typedef struct {
+    bool valid;
+    uint64_t prefix;
+    word_t frameIdx;
+} PscEntry;
+
+// the caches of depths 1 to TABLES_DEPTH - 1. the last one is never used, but keeps the array non-empty when the page
+// table has a single level:
+PSC_STORAGE PscEntry psc[TABLES_DEPTH][PSC_ENTRIES_PER_DEPTH];
+
+PscEntry &GetPscEntry(int depth, uint64_t prefix) {
+    return psc[depth - 1][prefix % PSC_ENTRIES_PER_DEPTH];
+}
+#endif
+
+void PscInitialize() {
+#if PSC_ENTRIES_PER_DEPTH > 0
+    for (int depth = 1; depth < TABLES_DEPTH; depth++) {
+        for (int entry = 0; entry < PSC_ENTRIES_PER_DEPTH; entry++) {
+            psc[depth - 1][entry].valid = false;
+        }
+    }
+#endif
+}
+
+bool PscLookup(int depth, uint64_t prefix, word_t *frameIdx) {
+#if PSC_ENTRIES_PER_DEPTH > 0
+    const PscEntry &entry = GetPscEntry(depth, prefix);
+    if (entry.valid && (entry.prefix == prefix)) {
+        *frameIdx = entry.frameIdx;
+        return true;
+    }
+#else
+    (void) depth;
+    (void) prefix;
+    (void) frameIdx;
+#endif
+    return false;
+}
+
+void PscInsert(int depth, uint64_t prefix, word_t frameIdx) {
+#if PSC_ENTRIES_PER_DEPTH > 0
+    PscEntry &entry = GetPscEntry(depth, prefix);
+    entry.valid = true;
+    entry.prefix = prefix;
+    entry.frameIdx = frameIdx;
+#else
+    (void) depth;
+    (void) prefix;
+    (void) frameIdx;
+#endif
+}
+
+void PscInvalidate(int depth, uint64_t prefix) {
+#if PSC_ENTRIES_PER_DEPTH > 0
+    PscEntry &entry = GetPscEntry(depth, prefix);
+    if (entry.valid && (entry.prefix == prefix)) {
+        entry.valid = false;
+    }
+#else
+    (void) depth;
+    (void) prefix;
+#endif
+}
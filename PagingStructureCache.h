@@ -0,0 +1,39 @@
+#pragma once
+
+#include "MemoryConstants.h"
+//#include "YaaraConstants.h"
+
+/*
+ * A cache of the tables in the intermediate levels of the page table, like the paging-structure caches of x86. It maps
+ * the prefix of a virtual address that leads to a table (its cumulative page index) to the frame of the table, so a
+ * walk that misses the TLB can start at the deepest table it finds instead of at frame 0.
+ * Every depth between 1 and TABLES_DEPTH - 1 has its own direct mapped cache.
+ */
+
+// number of entries in the cache of each depth (0 disables the cache)
+#ifndef PSC_ENTRIES_PER_DEPTH
+#define PSC_ENTRIES_PER_DEPTH 16
+#endif
+
+/*
+ * Clears all of the entries.
+ * In a VM_CONCURRENT build every thread has its own cache, and only the cache of the calling thread is cleared.
+ */
+void PscInitialize();
+
+/*
+ * Looks for the frame of the table in the given depth, whose cumulative page index is prefix.
+ * returns true and puts the frame index in 'frameIdx' on a hit, false on a miss.
+ */
+bool PscLookup(int depth, uint64_t prefix, word_t *frameIdx);
+
+/*
+ * Caches the frame of the table in the given depth, whose cumulative page index is prefix.
+ */
+void PscInsert(int depth, uint64_t prefix, word_t frameIdx);
+
+/*
+ * Drops the entry of the table in the given depth, whose cumulative page index is prefix, if it is cached.
+ * Must be called whenever the table is removed from the page table.
+ */
+void PscInvalidate(int depth, uint64_t prefix);
@@ -1,68 +1,481 @@
 #include "PhysicalMemory.h"
-#include <vector>
-#include <unordered_map>
+#include "SwapStore.h"
+#include "SwapDevice.h"
+#include "AddressSpace.h"
+#include "TraceRecorder.h"
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 
-typedef std::vector<word_t> page_t;
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
-std::vector<page_t> RAM;
-std::unordered_map<uint64_t, page_t> swapFile;
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(PM_NO_SIMD)
+#define PM_X86_SIMD
+#include <immintrin.h>
+#endif
 
-void initialize() {
-    RAM.resize(NUM_FRAMES, page_t(PAGE_SIZE));
+// the RAM is backed by huge pages when it spans at least one of them (define PM_NO_HUGE_PAGES to disable):
+#define HUGE_PAGE_SIZE (2LL << 20)
+// alignment of the RAM when it is not backed by huge pages, so frames never share a cache line needlessly:
+#define RAM_ALIGNMENT 64
+
+word_t* RAM = nullptr;
+
+// the bytes that the swap store may keep ahead of the swap file, once it is open:
+uint64_t swapStoreLimit = 0;
+
+#ifdef PM_COUNT_ACCESSES
+uint64_t pmReadCount = 0;
+uint64_t pmWriteCount = 0;
+#endif
+
+// a set of word kernels, see SetWordKernels:
+typedef struct {
+    const char* name;
+    uint64_t (*findNonZero)(const word_t* words, uint64_t count);
+    bool (*areZero)(const word_t* words, uint64_t count);
+    void (*zero)(word_t* words, uint64_t count);
+} WordKernels;
+
+uint64_t FindNonZeroScalar(const word_t* words, uint64_t count) {
+    uint64_t offset = 0;
+    while ((offset < count) && (words[offset] == 0)) {
+        offset++;
+    }
+    return offset;
+}
+
+bool AreZeroScalar(const word_t* words, uint64_t count) {
+    return FindNonZeroScalar(words, count) == count;
+}
+
+void ZeroScalar(word_t* words, uint64_t count) {
+    for (uint64_t offset = 0; offset < count; offset++) {
+        words[offset] = 0;
+    }
+}
+
+#ifdef PM_X86_SIMD
+static_assert(sizeof(word_t) == sizeof(int32_t), "the SIMD kernels compare 32-bit words");
+
+// the kernels are compiled for their instruction set, and only called on a CPU that supports it:
+__attribute__((target("sse2")))
+uint64_t FindNonZeroSse2(const word_t* words, uint64_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t offset = 0;
+    for (; offset + 4 <= count; offset += 4) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (words + offset));
+        // a bit per word, set if the word is 0:
+        int zeroMask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, zero)));
+        if (zeroMask != 0xF) {
+            return offset + __builtin_ctz(~zeroMask & 0xF);
+        }
+    }
+    return offset + FindNonZeroScalar(words + offset, count - offset);
+}
+
+__attribute__((target("sse2")))
+bool AreZeroSse2(const word_t* words, uint64_t count) {
+    __m128i bits = _mm_setzero_si128();
+    uint64_t offset = 0;
+    for (; offset + 4 <= count; offset += 4) {
+        bits = _mm_or_si128(bits, _mm_loadu_si128((const __m128i*) (words + offset)));
+    }
+    return (_mm_movemask_epi8(_mm_cmpeq_epi8(bits, _mm_setzero_si128())) == 0xFFFF) &&
+           AreZeroScalar(words + offset, count - offset);
+}
+
+__attribute__((target("sse2")))
+void ZeroSse2(word_t* words, uint64_t count) {
+    uint64_t offset = 0;
+    for (; offset + 4 <= count; offset += 4) {
+        _mm_storeu_si128((__m128i*) (words + offset), _mm_setzero_si128());
+    }
+    ZeroScalar(words + offset, count - offset);
+}
+
+__attribute__((target("avx2")))
+uint64_t FindNonZeroAvx2(const word_t* words, uint64_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t offset = 0;
+    for (; offset + 8 <= count; offset += 8) {
+        __m256i block = _mm256_loadu_si256((const __m256i*) (words + offset));
+        int zeroMask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(block, zero)));
+        if (zeroMask != 0xFF) {
+            return offset + __builtin_ctz(~zeroMask & 0xFF);
+        }
+    }
+    return offset + FindNonZeroScalar(words + offset, count - offset);
+}
+
+__attribute__((target("avx2")))
+bool AreZeroAvx2(const word_t* words, uint64_t count) {
+    __m256i bits = _mm256_setzero_si256();
+    uint64_t offset = 0;
+    for (; offset + 8 <= count; offset += 8) {
+        bits = _mm256_or_si256(bits, _mm256_loadu_si256((const __m256i*) (words + offset)));
+    }
+    return _mm256_testz_si256(bits, bits) && AreZeroScalar(words + offset, count - offset);
+}
+
+__attribute__((target("avx2")))
+void ZeroAvx2(word_t* words, uint64_t count) {
+    uint64_t offset = 0;
+    for (; offset + 8 <= count; offset += 8) {
+        _mm256_storeu_si256((__m256i*) (words + offset), _mm256_setzero_si256());
+    }
+    ZeroScalar(words + offset, count - offset);
+}
+#endif
+
+const WordKernels scalarKernels = {"scalar", FindNonZeroScalar, AreZeroScalar, ZeroScalar};
+#ifdef PM_X86_SIMD
+const WordKernels sse2Kernels = {"sse2", FindNonZeroSse2, AreZeroSse2, ZeroSse2};
+const WordKernels avx2Kernels = {"avx2", FindNonZeroAvx2, AreZeroAvx2, ZeroAvx2};
+#endif
+
+/**
+ * @return true if the CPU supports the given kernels.
+ */
+bool AreKernelsSupported(const WordKernels &kernels) {
+#ifdef PM_X86_SIMD
+    __builtin_cpu_init();
+    if (&kernels == &avx2Kernels) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (&kernels == &sse2Kernels) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return &kernels == &scalarKernels;
+}
+
+// every set of kernels that this build has, from the fastest:
+const WordKernels* const allKernels[] = {
+#ifdef PM_X86_SIMD
+        &avx2Kernels, &sse2Kernels,
+#endif
+        &scalarKernels};
+
+const WordKernels* SelectWordKernels() {
+    for (const WordKernels* kernels : allKernels) {
+        if (AreKernelsSupported(*kernels)) {
+            return kernels;
+        }
+    }
+    return &scalarKernels;
+}
+
+const WordKernels* wordKernels = SelectWordKernels();
+
+uint64_t FindNonZeroWord(const word_t* words, uint64_t count) {
+    return wordKernels->findNonZero(words, count);
+}
+
+bool AreWordsZero(const word_t* words, uint64_t count) {
+    return wordKernels->areZero(words, count);
+}
+
+void ZeroWords(word_t* words, uint64_t count) {
+    wordKernels->zero(words, count);
+}
+
+const char* GetWordKernels() {
+    return wordKernels->name;
+}
+
+bool SetWordKernels(const char* name) {
+    for (const WordKernels* kernels : allKernels) {
+        if ((strcmp(kernels->name, name) == 0) && AreKernelsSupported(*kernels)) {
+            wordKernels = kernels;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @return a zeroed buffer of RAM_SIZE words, backed by huge pages if possible.
+ */
+word_t* AllocateRam() {
+    size_t ramBytes = RAM_SIZE * sizeof(word_t);
+#if defined(__linux__) && !defined(PM_NO_HUGE_PAGES)
+    if (ramBytes >= (size_t) HUGE_PAGE_SIZE) {
+        size_t mapBytes = ((ramBytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+        void* ram = mmap(nullptr, mapBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ram == MAP_FAILED) {
+            // no reserved huge pages, so asks for transparent huge pages instead:
+            ram = mmap(nullptr, mapBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ram != MAP_FAILED) {
+                madvise(ram, mapBytes, MADV_HUGEPAGE);
+            }
+        }
+        if (ram != MAP_FAILED) {
+            // anonymous mappings are already zeroed:
+            return (word_t*) ram;
+        }
+    }
+#endif
+
+    void* ram = nullptr;
+    if (posix_memalign(&ram, RAM_ALIGNMENT, ramBytes) != 0) {
+        fprintf(stderr, "failed to allocate the RAM\n");
+        exit(1);
+    }
+    memset(ram, 0, ramBytes);
+    return (word_t*) ram;
+}
+
+void PMinitialize() {
+    if (RAM == nullptr) {
+        RAM = AllocateRam();
+        SwapStoreInitialize();
+    }
+}
+
+void PMgetAccessCounts(uint64_t* reads, uint64_t* writes) {
+#ifdef PM_COUNT_ACCESSES
+    *reads = __atomic_load_n(&pmReadCount, __ATOMIC_RELAXED);
+    *writes = __atomic_load_n(&pmWriteCount, __ATOMIC_RELAXED);
+#else
+    *reads = 0;
+    *writes = 0;
+#endif
+}
+
+int PMuseSwapFile(const char* path) {
+    return SwapDeviceOpen(path) ? 1 : 0;
+}
+
+void PMsetSwapStoreLimit(uint64_t maxBytes) {
+    swapStoreLimit = maxBytes;
+}
+
+void PMgetSwapStoreUsage(uint64_t* pages, uint64_t* bytes) {
+    SwapStoreGetUsage(pages, bytes);
 }
 
-void PMread(uint64_t physicalAddress, word_t* value) {
-    if (RAM.empty()) {
-        initialize();
+void PMreadRange(uint64_t physicalAddress, word_t* values, uint64_t count) {
+    assert(RAM != nullptr);
+    assert(physicalAddress < RAM_SIZE);
+    assert((physicalAddress % PAGE_SIZE) + count <= PAGE_SIZE);
+
+    PM_COUNT(pmReadCount, count);
+#ifdef VM_CONCURRENT
+    // the range may be a table, whose entries are written without locks by concurrent page faults:
+    for (uint64_t i = 0; i < count; i++) {
+        values[i] = __atomic_load_n(RAM + physicalAddress + i, __ATOMIC_RELAXED);
     }
+#else
+    memcpy(values, RAM + physicalAddress, count * sizeof(word_t));
+#endif
+}
 
+void PMwriteRange(uint64_t physicalAddress, const word_t* values, uint64_t count) {
+    assert(RAM != nullptr);
     assert(physicalAddress < RAM_SIZE);
+    assert((physicalAddress % PAGE_SIZE) + count <= PAGE_SIZE);
 
-    uint64_t frameIndex = physicalAddress / PAGE_SIZE;
-    uint64_t frameOffset = physicalAddress % PAGE_SIZE;
-    *value = RAM[frameIndex][frameOffset];
- }
+    PM_COUNT(pmWriteCount, count);
+#ifdef VM_CONCURRENT
+    // a stale lock-free walk may still read the frame as a table, like it does for PMwrite:
+    for (uint64_t i = 0; i < count; i++) {
+        __atomic_store_n(RAM + physicalAddress + i, values[i], __ATOMIC_RELAXED);
+    }
+#else
+    memcpy(RAM + physicalAddress, values, count * sizeof(word_t));
+#endif
+}
 
-void PMwrite(uint64_t physicalAddress, word_t value) {
-    if (RAM.empty()) {
-        initialize();
+void PMfill(uint64_t physicalAddress, word_t value, uint64_t count) {
+    assert(RAM != nullptr);
+    assert(physicalAddress < RAM_SIZE);
+    assert((physicalAddress % PAGE_SIZE) + count <= PAGE_SIZE);
+
+    PM_COUNT(pmWriteCount, count);
+#ifdef VM_CONCURRENT
+    for (uint64_t i = 0; i < count; i++) {
+        __atomic_store_n(RAM + physicalAddress + i, value, __ATOMIC_RELAXED);
     }
+#else
+    std::fill_n(RAM + physicalAddress, count, value);
+#endif
+}
 
+uint64_t PMfindNonZero(uint64_t physicalAddress, uint64_t count) {
+    assert(RAM != nullptr);
     assert(physicalAddress < RAM_SIZE);
+    assert((physicalAddress % PAGE_SIZE) + count <= PAGE_SIZE);
 
-    uint64_t frameIndex = physicalAddress / PAGE_SIZE;
-    uint64_t frameOffset = physicalAddress % PAGE_SIZE;
-    RAM[frameIndex][frameOffset] = value;
+    uint64_t offset = FindNonZeroWord(RAM + physicalAddress, count);
+    PM_COUNT(pmReadCount, (offset < count) ? offset + 1 : count);
+    return offset;
+}
+
+int PMisZero(uint64_t physicalAddress, uint64_t count) {
+    assert(RAM != nullptr);
+    assert(physicalAddress < RAM_SIZE);
+    assert((physicalAddress % PAGE_SIZE) + count <= PAGE_SIZE);
+
+    PM_COUNT(pmReadCount, count);
+    return AreWordsZero(RAM + physicalAddress, count) ? 1 : 0;
+}
+
+void PMzeroFrame(uint64_t frameIndex) {
+    assert(frameIndex < NUM_FRAMES);
+#ifdef VM_CONCURRENT
+    PMfill(frameIndex * PAGE_SIZE, 0, PAGE_SIZE);
+#else
+    assert(RAM != nullptr);
+    PM_COUNT(pmWriteCount, PAGE_SIZE);
+    ZeroWords(RAM + (frameIndex * PAGE_SIZE), PAGE_SIZE);
+#endif
 }
 
 void PMevict(uint64_t frameIndex, uint64_t evictedPageIndex) {
-    if (RAM.empty()) {
-        initialize();
+    assert(RAM != nullptr);
+    assert(frameIndex < NUM_FRAMES);
+    // the page index is tagged with its context:
+    assert(GetContextOfPage(evictedPageIndex) < MAX_CONTEXTS);
+
+    if (TraceIsRecordingPhysical()) {
+        TraceRecordPmPage(TRACE_PM_EVICT, frameIndex, evictedPageIndex);
+    }
+    // without a swap file there is nowhere to spill to:
+    uint64_t maxBytes = SwapDeviceIsOpen() ? swapStoreLimit : SWAP_STORE_UNLIMITED;
+    if (!SwapStoreSave(evictedPageIndex, RAM + (frameIndex * PAGE_SIZE), maxBytes)) {
+        SwapDeviceSave(evictedPageIndex, RAM + (frameIndex * PAGE_SIZE));
+    } else if (SwapDeviceIsOpen()) {
+        // a page that was spilled before, and restored with its copy kept, has a stale copy in the swap file:
+        SwapDeviceDiscard(evictedPageIndex, 1);
+    }
+}
+
+void PMevictZeroPage(uint64_t pageIndex) {
+    assert(GetContextOfPage(pageIndex) < MAX_CONTEXTS);
+    static const word_t zeroPage[PAGE_SIZE] = {0};
+    // a page of zeroes is kept as a flag, so it fits any limit:
+    SwapStoreSave(pageIndex, zeroPage, SWAP_STORE_UNLIMITED);
+}
+
+/**
+ * Copies the given page from the swap file into 'page'.
+ * @return true if the page was in the swap file.
+ */
+bool LoadPage(uint64_t pageIndex, word_t* page, bool keepSwap) {
+    // the swap store knows whether a page was spilled to the swap file:
+    SwapLoadResult result = SwapStoreLoad(pageIndex, page, keepSwap);
+    if ((result == SWAP_PAGE_SPILLED) && !SwapDeviceLoad(pageIndex, page, keepSwap)) {
+        result = SWAP_PAGE_MISSING;
     }
+    return result != SWAP_PAGE_MISSING;
+}
 
+/**
+ * Copies the given page from the swap file into the given frame.
+ * @return true if the page was in the swap file.
+ */
+bool RestorePage(uint64_t frameIndex, uint64_t restoredPageIndex, bool keepSwap) {
+    assert(RAM != nullptr);
     assert(frameIndex < NUM_FRAMES);
-    assert(evictedPageIndex < NUM_PAGES);
-    assert(swapFile.find(evictedPageIndex) == swapFile.end());
 
-    swapFile[evictedPageIndex] = RAM[frameIndex];
+    if (TraceIsRecordingPhysical()) {
+        TraceRecordPmPage(TRACE_PM_RESTORE, frameIndex, restoredPageIndex);
+    }
+#ifdef VM_CONCURRENT
+    // a stale lock-free walk may still read the frame as a table, so the page is only copied in by PMwriteRange:
+    word_t buffer[PAGE_SIZE];
+    bool restored = LoadPage(restoredPageIndex, buffer, keepSwap);
+    if (restored) {
+        PMwriteRange(frameIndex * PAGE_SIZE, buffer, PAGE_SIZE);
+    }
+    return restored;
+#else
+    return LoadPage(restoredPageIndex, RAM + (frameIndex * PAGE_SIZE), keepSwap);
+#endif
 }
 
 void PMrestore(uint64_t frameIndex, uint64_t restoredPageIndex) {
-    if (RAM.empty()) {
-        initialize();
+    // if the page is not in swap file, this is essentially
+    // the first reference to this page. we can just leave the frame
+    // as it is, as it doesn't matter if the page contains garbage
+    RestorePage(frameIndex, restoredPageIndex, false);
+}
+
+int PMrestoreKeepSwap(uint64_t frameIndex, uint64_t restoredPageIndex) {
+    return RestorePage(frameIndex, restoredPageIndex, true) ? 1 : 0;
+}
+
+int PMcontains(uint64_t pageIndex) {
+    return SwapStoreContains(pageIndex) ? 1 : 0;
+}
+
+void PMdiscard(uint64_t firstPageIndex, uint64_t count) {
+    SwapStoreDiscard(firstPageIndex, count);
+    if (SwapDeviceIsOpen()) {
+        SwapDeviceDiscard(firstPageIndex, count);
+    }
+}
+
+void PMmove(uint64_t firstPageIndex, uint64_t count, uint64_t firstTargetPageIndex) {
+    // a spilled page moves in the swap store too, where it is looked up first:
+    SwapStoreMove(firstPageIndex, count, firstTargetPageIndex);
+    if (SwapDeviceIsOpen()) {
+        SwapDeviceMove(firstPageIndex, count, firstTargetPageIndex);
     }
+}
+
+int PMreadSwapped(uint64_t pageIndex, word_t* page) {
+    return LoadPage(pageIndex, page, true) ? 1 : 0;
+}
 
+std::vector<uint64_t> PMfindSwapped(uint64_t firstPageIndex, uint64_t count) {
+    // a spilled page is in the swap store too:
+    return SwapStoreFindPages(firstPageIndex, count);
+}
+
+void PMmapCheckpointPage(uint64_t pageIndex, uint64_t dataPage) {
+    assert(GetContextOfPage(pageIndex) < MAX_CONTEXTS);
+    SwapStoreMapCheckpointPage(pageIndex, dataPage);
+}
+
+void PMsetDedup(int enable) {
+    SwapStoreSetDedup(enable != 0);
+}
+
+uint64_t PMhashFrame(uint64_t frameIndex) {
     assert(frameIndex < NUM_FRAMES);
+    word_t page[PAGE_SIZE];
+    PMreadRange(frameIndex * PAGE_SIZE, page, PAGE_SIZE);
+    return SwapStoreHashPage(page);
+}
 
-    // page is not in swap file, so this is essentially
-    // the first reference to this page. we can just return
-    // as it doesn't matter if the page contains garbage
-    if (swapFile.find(restoredPageIndex) == swapFile.end()) {
-        return;
+void PMshareFrame(uint64_t pageIndex, uint64_t frameIndex) {
+    assert(GetContextOfPage(pageIndex) < MAX_CONTEXTS);
+    assert(frameIndex < NUM_FRAMES);
+    SwapStoreShareFrame(pageIndex, frameIndex);
+}
+
+int PMisFrameShared(uint64_t frameIndex) {
+    return SwapStoreIsFrameShared(frameIndex) ? 1 : 0;
+}
+
+void PMunshareFrame(uint64_t frameIndex) {
+    // each eviction replaces the copy of one page, which stops sharing the frame:
+    for (uint64_t pageIndex : SwapStoreFindFrameSharers(frameIndex)) {
+        PMevict(frameIndex, pageIndex);
     }
+}
+
+uint64_t PMfindSharedFrame(uint64_t pageIndex) {
+    uint64_t frameIndex;
+    return SwapStoreFindSharedFrame(pageIndex, &frameIndex) ? frameIndex : 0;
+}
 
-    RAM[frameIndex] = std::move(swapFile[restoredPageIndex]);
-    swapFile.erase(restoredPageIndex);
+void PMgetDedupUsage(uint64_t* framePages, uint64_t* slotPages, uint64_t* slotBytes) {
+    SwapStoreGetDedupUsage(framePages, slotPages, slotBytes);
 }
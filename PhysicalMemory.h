@@ -3,24 +3,272 @@
 #include "MemoryConstants.h"
 //#include "YaaraConstants.h"
 
+#include <cassert>
+#include <vector>
+
+#ifdef PM_TRACE_ACCESSES
+#include "TraceRecorder.h"
+#endif
+
+/*
+ * The RAM, as one contiguous buffer of RAM_SIZE words. Frame i starts at RAM + (i * PAGE_SIZE).
+ * Allocated by PMinitialize.
+ */
+extern word_t* RAM;
+
+/*
+ * Allocates the RAM (zeroed), if it was not allocated yet.
+ * Must be called before any other PM function. VMinitialize calls it.
+ */
+void PMinitialize();
+
+/*
+ * Keeps the pages that are evicted from now on in a swap file at the given path, instead of in memory, but for the
+ * pages of zeroes and the pages that fit the limit of PMsetSwapStoreLimit, which stay compressed in memory.
+ * The pages are written to the file in the background, so PMevict does not wait for the disk.
+ * Pages that are already swapped out stay in memory.
+ *
+ * returns 1 on success.
+ * returns 0 on failure (if the file cannot be opened, or a swap file is already in use)
+ */
+int PMuseSwapFile(const char* path);
+
+/*
+ * Sets the bytes that the compressed pages in memory may take once a swap file is in use, so the pages that are
+ * evicted when the limit is reached are spilled to the swap file. The limit is 0 by default, and without a swap file
+ * there is none.
+ */
+void PMsetSwapStoreLimit(uint64_t maxBytes);
+
+/*
+ * Puts the number of swapped-out pages that are kept in memory in 'pages', and the bytes that they take compressed in
+ * 'bytes'.
+ */
+void PMgetSwapStoreUsage(uint64_t* pages, uint64_t* bytes);
+
+#ifdef PM_COUNT_ACCESSES
+/*
+ * The number of words that were read and written through the PM functions. Only kept in a build with
+ * PM_COUNT_ACCESSES, since counting costs every access.
+ */
+extern uint64_t pmReadCount;
+extern uint64_t pmWriteCount;
+#ifdef VM_CONCURRENT
+#define PM_COUNT(counter, count) __atomic_fetch_add(&(counter), (count), __ATOMIC_RELAXED)
+#else
+#define PM_COUNT(counter, count) ((counter) += (count))
+#endif
+#else
+#define PM_COUNT(counter, count)
+#endif
+
+/*
+ * Puts the number of words that were read through the PM functions in 'reads', and of the words that were written in
+ * 'writes'. Both are 0 in a build without PM_COUNT_ACCESSES.
+ */
+void PMgetAccessCounts(uint64_t* reads, uint64_t* writes);
+
 /*
  * Reads an integer from the given physical address and puts it in 'value'.
  */
-void PMread(uint64_t physicalAddress, word_t* value);
+inline void PMread(uint64_t physicalAddress, word_t* value) {
+    assert(RAM != nullptr);
+    assert(physicalAddress < RAM_SIZE);
+    PM_COUNT(pmReadCount, 1);
+#ifdef PM_TRACE_ACCESSES
+    if (TraceIsRecordingPhysical()) {
+        TraceRecordPmAccess(TRACE_PM_READ, physicalAddress, 0);
+    }
+#endif
+
+#ifdef VM_CONCURRENT
+    // page table entries are read without locks by concurrent translations:
+    *value = __atomic_load_n(RAM + physicalAddress, __ATOMIC_RELAXED);
+#else
+    *value = RAM[physicalAddress];
+#endif
+}
 
 /*
  * Writes 'value' to the given physical address.
  */
-void PMwrite(uint64_t physicalAddress, word_t value);
+inline void PMwrite(uint64_t physicalAddress, word_t value) {
+    assert(RAM != nullptr);
+    assert(physicalAddress < RAM_SIZE);
+    PM_COUNT(pmWriteCount, 1);
+#ifdef PM_TRACE_ACCESSES
+    if (TraceIsRecordingPhysical()) {
+        TraceRecordPmAccess(TRACE_PM_WRITE, physicalAddress, value);
+    }
+#endif
+
+#ifdef VM_CONCURRENT
+    __atomic_store_n(RAM + physicalAddress, value, __ATOMIC_RELAXED);
+#else
+    RAM[physicalAddress] = value;
+#endif
+}
+
+/*
+ * Reads 'count' consecutive words, starting at the given physical address, into 'values'.
+ * All of the words must be in the same frame.
+ */
+void PMreadRange(uint64_t physicalAddress, word_t* values, uint64_t count);
+
+/*
+ * Writes 'count' consecutive words from 'values', starting at the given physical address.
+ * All of the words must be in the same frame.
+ */
+void PMwriteRange(uint64_t physicalAddress, const word_t* values, uint64_t count);
+
+/*
+ * Writes 'value' to 'count' consecutive words, starting at the given physical address.
+ * All of the words must be in the same frame.
+ */
+void PMfill(uint64_t physicalAddress, word_t value, uint64_t count);
+
+/*
+ * returns the offset of the first word that is not 0 among the 'count' consecutive words from the given physical
+ * address, or 'count' if all of them are 0.
+ * All of the words must be in the same frame.
+ */
+uint64_t PMfindNonZero(uint64_t physicalAddress, uint64_t count);
+
+/*
+ * returns 1 if the 'count' consecutive words from the given physical address are all 0, and 0 otherwise.
+ * All of the words must be in the same frame.
+ */
+int PMisZero(uint64_t physicalAddress, uint64_t count);
+
+/*
+ * Writes 0 to every word of the given frame. In a VM_CONCURRENT build the words are written one by one, like PMwrite
+ * does, since a stale lock-free walk may read the frame meanwhile.
+ */
+void PMzeroFrame(uint64_t frameIndex);
+
+/*
+ * The word kernels behind PMfindNonZero, PMisZero and PMzeroFrame, which work on any buffer of words.
+ * They are selected once, at startup: AVX2 or SSE2 on an x86 CPU that has it, and plain loops on any other CPU, or in a
+ * build with PM_NO_SIMD.
+ */
+uint64_t FindNonZeroWord(const word_t* words, uint64_t count);
+
+bool AreWordsZero(const word_t* words, uint64_t count);
+
+void ZeroWords(word_t* words, uint64_t count);
+
+/*
+ * returns the name of the word kernels in use: "avx2", "sse2" or "scalar".
+ */
+const char* GetWordKernels();
+
+/*
+ * Switches to the word kernels of the given name, e.g. to compare them.
+ * returns false, and keeps the kernels in use, if the name is unknown or the CPU does not support them.
+ */
+bool SetWordKernels(const char* name);
 
 
 /*
  * Evicts a page from the RAM to the hard drive.
+ * If the page is already on the hard drive (see PMrestoreKeepSwap), its copy there is replaced.
  */
 void PMevict(uint64_t frameIndex, uint64_t evictedPageIndex);
 
+/*
+ * Puts a page of zeroes on the hard drive as the copy of the given page, as if a frame of zeroes was evicted, but
+ * without a frame. The page takes no room in the swap store, and is never spilled.
+ */
+void PMevictZeroPage(uint64_t pageIndex);
+
 
 /*
  * Restores a page from the hard drive to the RAM.
  */
 void PMrestore(uint64_t frameIndex, uint64_t restoredPageIndex);
+
+/*
+ * Restores a page from the hard drive to the RAM, keeping its copy on the hard drive, so while the page is not
+ * modified it can leave the RAM without being evicted again.
+ *
+ * returns 1 if the page was on the hard drive.
+ * returns 0 if it was not, in which case the frame is left as it is.
+ */
+int PMrestoreKeepSwap(uint64_t frameIndex, uint64_t restoredPageIndex);
+
+/*
+ * returns 1 if the given page is on the hard drive, so PMrestore would find it.
+ * returns 0 if it is not.
+ */
+int PMcontains(uint64_t pageIndex);
+
+/*
+ * Drops the copies on the hard drive of the 'count' pages from firstPageIndex onwards, so PMrestore does not find them.
+ */
+void PMdiscard(uint64_t firstPageIndex, uint64_t count);
+
+/*
+ * Moves the copies on the hard drive of the 'count' pages from firstPageIndex onwards to the pages from
+ * firstTargetPageIndex onwards, replacing the copies of those pages. The ranges must not overlap.
+ */
+void PMmove(uint64_t firstPageIndex, uint64_t count, uint64_t firstTargetPageIndex);
+
+/*
+ * Copies the copy on the hard drive of the given page into 'page', keeping it there.
+ *
+ * returns 1 if the page was on the hard drive.
+ * returns 0 if it was not, in which case 'page' is left as it is.
+ */
+int PMreadSwapped(uint64_t pageIndex, word_t* page);
+
+/*
+ * returns the pages from firstPageIndex onwards, up to 'count' of them, that are on the hard drive, in no particular
+ * order.
+ */
+std::vector<uint64_t> PMfindSwapped(uint64_t firstPageIndex, uint64_t count);
+
+/*
+ * Puts the given data page of the checkpoint in use (see Checkpoint.h) on the hard drive as the copy of the given page,
+ * without reading it. The page is read from the checkpoint when it is restored.
+ */
+void PMmapCheckpointPage(uint64_t pageIndex, uint64_t dataPage);
+
+/*
+ * Turns the dedup of the evicted pages on or off: with dedup on, a page that is identical to a page on the hard drive
+ * shares its copy there.
+ */
+void PMsetDedup(int enable);
+
+/*
+ * returns the hash of the page in the given frame, which is equal for identical pages.
+ */
+uint64_t PMhashFrame(uint64_t frameIndex);
+
+/*
+ * Puts the given frame on the hard drive as the copy of the given page, whose page is identical to the page in the
+ * frame, without copying it. The page is read from the frame when it is restored, so the frame must not change until
+ * PMunshareFrame.
+ */
+void PMshareFrame(uint64_t pageIndex, uint64_t frameIndex);
+
+/*
+ * returns 1 if the given frame is the copy of some page on the hard drive (see PMshareFrame).
+ * returns 0 if it is not.
+ */
+int PMisFrameShared(uint64_t frameIndex);
+
+/*
+ * Evicts the given frame as the copy of every page that shares it, so the frame can change.
+ */
+void PMunshareFrame(uint64_t frameIndex);
+
+/*
+ * returns the frame that is the copy of the given page on the hard drive (see PMshareFrame), or 0 if there is none.
+ */
+uint64_t PMfindSharedFrame(uint64_t pageIndex);
+
+/*
+ * Puts the number of pages that share a frame in 'framePages', and the number of pages that share the copy of another
+ * page on the hard drive in 'slotPages', with the bytes that their copies would have taken in 'slotBytes'.
+ */
+void PMgetDedupUsage(uint64_t* framePages, uint64_t* slotPages, uint64_t* slotBytes);
@@ -0,0 +1,130 @@
+#include "Readahead.h"
+
+#include <vector>
+
+#ifdef VM_CONCURRENT
+#include <atomic>
+// pages read ahead are accessed outside of the page faults, by threads that only hold the lock of their frame:
+typedef std::atomic<uint64_t> ReadaheadCounter;
+#else
+typedef uint64_t ReadaheadCounter;
+#endif
+
+uint64_t maxReadaheadWindow = 0;
+uint64_t readaheadWindow = READAHEAD_INITIAL_WINDOW;
+
+bool readaheadHasLastFault = false;
+uint64_t readaheadLastFaultPageIdx = 0;
+int64_t readaheadLastFaultStride = 0;
+
+// the pages of the current window that were read ahead, and how many of them were accessed:
+uint64_t windowPrefetched = 0;
+ReadaheadCounter windowHits(0);
+
+// whether the page in each frame was read ahead and not accessed yet:
+std::vector<uint8_t> prefetchedFrames;
+
+uint64_t prefetchedCount = 0;
+ReadaheadCounter readaheadHitCount(0);
+uint64_t readaheadWasteCount = 0;
+
+void ReadaheadInitialize(uint64_t maxWindow) {
+    maxReadaheadWindow = maxWindow;
+    readaheadWindow = (maxWindow < READAHEAD_INITIAL_WINDOW) ? maxWindow : READAHEAD_INITIAL_WINDOW;
+    readaheadHasLastFault = false;
+    windowPrefetched = 0;
+    windowHits = 0;
+    prefetchedFrames.assign(NUM_FRAMES, 0);
+    prefetchedCount = 0;
+    readaheadHitCount = 0;
+    readaheadWasteCount = 0;
+}
+
+/**
+ * Grows the window if the whole previous window was used, and shrinks it if less than half of it was.
+ */
+void AdaptWindow() {
+    if (windowPrefetched == 0) {
+        return;
+    }
+    if (windowHits == windowPrefetched) {
+        readaheadWindow = ((2 * readaheadWindow) < maxReadaheadWindow) ? (2 * readaheadWindow) : maxReadaheadWindow;
+    } else if ((2 * windowHits) < windowPrefetched) {
+        readaheadWindow = (readaheadWindow > 1) ? (readaheadWindow / 2) : 1;
+    }
+    windowPrefetched = 0;
+    windowHits = 0;
+}
+
+uint64_t ReadaheadOnFault(uint64_t pageIdx, PageAdvice advice, int64_t *stride) {
+    if (advice == ADVISE_RANDOM) {
+        return 0;
+    }
+    if (advice == ADVISE_SEQUENTIAL) {
+        *stride = 1;
+        return (maxReadaheadWindow > 0) ? maxReadaheadWindow : READAHEAD_SEQUENTIAL_WINDOW;
+    }
+    if (maxReadaheadWindow == 0) {
+        return 0;
+    }
+    int64_t faultStride = (int64_t) pageIdx - (int64_t) readaheadLastFaultPageIdx;
+    bool inStream = readaheadHasLastFault && (faultStride != 0) && (faultStride == readaheadLastFaultStride);
+    readaheadHasLastFault = true;
+    readaheadLastFaultPageIdx = pageIdx;
+    readaheadLastFaultStride = faultStride;
+    if (!inStream) {
+        return 0;
+    }
+
+    AdaptWindow();
+    *stride = faultStride;
+    return readaheadWindow;
+}
+
+void ReadaheadOnWindowDone(uint64_t lastPageIdx) {
+    readaheadLastFaultPageIdx = lastPageIdx;
+}
+
+/**
+ * Clears the flag of the given frame in prefetchedFrames.
+ * @return whether the page in the frame was read ahead and not accessed yet.
+ */
+bool TakePrefetchedFlag(word_t frameIdx) {
+#ifdef VM_CONCURRENT
+    // a page fault and a lock-free access of the same page may clear the flag together:
+    return __atomic_exchange_n(&prefetchedFrames[frameIdx], 0, __ATOMIC_RELAXED) != 0;
+#else
+    bool isPrefetched = prefetchedFrames[frameIdx] != 0;
+    prefetchedFrames[frameIdx] = 0;
+    return isPrefetched;
+#endif
+}
+
+void ReadaheadOnPrefetched(word_t frameIdx) {
+#ifdef VM_CONCURRENT
+    __atomic_store_n(&prefetchedFrames[frameIdx], 1, __ATOMIC_RELAXED);
+#else
+    prefetchedFrames[frameIdx] = 1;
+#endif
+    windowPrefetched++;
+    prefetchedCount++;
+}
+
+void ReadaheadOnAccess(word_t frameIdx) {
+    if (TakePrefetchedFlag(frameIdx)) {
+        windowHits++;
+        readaheadHitCount++;
+    }
+}
+
+void ReadaheadOnEvicted(word_t frameIdx) {
+    if (TakePrefetchedFlag(frameIdx)) {
+        readaheadWasteCount++;
+    }
+}
+
+void ReadaheadGetStats(uint64_t *prefetched, uint64_t *hits, uint64_t *wasted) {
+    *prefetched = prefetchedCount;
+    *hits = readaheadHitCount;
+    *wasted = readaheadWasteCount;
+}
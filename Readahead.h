@@ -0,0 +1,56 @@
+#pragma once
+
+#include "MemoryConstants.h"
+//#include "YaaraConstants.h"
+#include "VirtualMemory.h"
+
+/*
+ * Detects sequential and constant-stride streams of page faults, and sizes the window of pages that are restored ahead
+ * of the stream. The window grows while the pages read ahead are used, and shrinks when they are evicted unused.
+ */
+
+// the window that a new stream starts with
+#define READAHEAD_INITIAL_WINDOW 2
+// the window of the faults in a range that was advised as sequential while readahead is disabled
+#ifndef READAHEAD_SEQUENTIAL_WINDOW
+#define READAHEAD_SEQUENTIAL_WINDOW 8
+#endif
+
+/*
+ * Resets the detector, and sets the largest window (0 disables readahead).
+ */
+void ReadaheadInitialize(uint64_t maxWindow);
+
+/*
+ * Records a page fault on pageIdx that was not caused by readahead, in a range with the given pattern (see VMadvise).
+ * A fault in a random range reads nothing ahead, and a fault in a sequential range reads ahead the largest window of
+ * the pages after it. Neither is recorded by the detector.
+ * returns the number of pages to read ahead (0 for none), and puts the stride between them in 'stride'.
+ */
+uint64_t ReadaheadOnFault(uint64_t pageIdx, PageAdvice advice, int64_t *stride);
+
+/*
+ * Records that the readahead after the last fault stopped at lastPageIdx, so the stream is expected to fault next
+ * one stride after it.
+ */
+void ReadaheadOnWindowDone(uint64_t lastPageIdx);
+
+/*
+ * Records that a page was read ahead into frameIdx.
+ */
+void ReadaheadOnPrefetched(word_t frameIdx);
+
+/*
+ * Records an access to the page in frameIdx. The first access to a page that was read ahead is a readahead hit.
+ */
+void ReadaheadOnAccess(word_t frameIdx);
+
+/*
+ * Records that the page in frameIdx was evicted. A page that was read ahead and never accessed is wasted.
+ */
+void ReadaheadOnEvicted(word_t frameIdx);
+
+/*
+ * Puts the number of pages read ahead, of readahead hits and of wasted pages since ReadaheadInitialize.
+ */
+void ReadaheadGetStats(uint64_t *prefetched, uint64_t *hits, uint64_t *wasted);
@@ -0,0 +1,552 @@
+#include "ReplacementPolicy.h"
+#include "FrameTable.h"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <cassert>
+
+#ifdef VM_CONCURRENT
+// the lists of a policy are guarded by a lock of its own. accesses are reported concurrently without it, see AccessBits:
+typedef std::mutex PolicyMutex;
+#else
+struct PolicyMutex {
+    void lock() {}
+    void unlock() {}
+};
+#endif
+
+#define NO_FRAME ((word_t) -1)
+#define NO_LIST (-1)
+
+/**
+ * Doubly linked lists of frames, threaded through arrays that are indexed by frame, so moving a frame between the lists
+ * costs no allocation. A frame is in at most one of the lists. The front of a list is its most recently used frame.
+ */
+class FrameLists {
+public:
+    explicit FrameLists(int numLists) : heads(numLists, NO_FRAME), tails(numLists, NO_FRAME), sizes(numLists, 0),
+                                        prev(NUM_FRAMES, NO_FRAME), next(NUM_FRAMES, NO_FRAME),
+                                        owner(NUM_FRAMES, NO_LIST) {}
+
+    int ListOf(word_t frameIdx) const {
+        return owner[frameIdx];
+    }
+
+    uint64_t Size(int list) const {
+        return sizes[list];
+    }
+
+    word_t Back(int list) const {
+        return tails[list];
+    }
+
+    word_t Prev(word_t frameIdx) const {
+        return prev[frameIdx];
+    }
+
+    void PushBack(int list, word_t frameIdx) {
+        assert(owner[frameIdx] == NO_LIST);
+        owner[frameIdx] = list;
+        next[frameIdx] = NO_FRAME;
+        prev[frameIdx] = tails[list];
+        if (tails[list] != NO_FRAME) {
+            next[tails[list]] = frameIdx;
+        } else {
+            heads[list] = frameIdx;
+        }
+        tails[list] = frameIdx;
+        sizes[list]++;
+    }
+
+    void PushFront(int list, word_t frameIdx) {
+        assert(owner[frameIdx] == NO_LIST);
+        owner[frameIdx] = list;
+        prev[frameIdx] = NO_FRAME;
+        next[frameIdx] = heads[list];
+        if (heads[list] != NO_FRAME) {
+            prev[heads[list]] = frameIdx;
+        } else {
+            tails[list] = frameIdx;
+        }
+        heads[list] = frameIdx;
+        sizes[list]++;
+    }
+
+    void Remove(word_t frameIdx) {
+        int list = owner[frameIdx];
+        assert(list != NO_LIST);
+        if (prev[frameIdx] != NO_FRAME) {
+            next[prev[frameIdx]] = next[frameIdx];
+        } else {
+            heads[list] = next[frameIdx];
+        }
+        if (next[frameIdx] != NO_FRAME) {
+            prev[next[frameIdx]] = prev[frameIdx];
+        } else {
+            tails[list] = prev[frameIdx];
+        }
+        owner[frameIdx] = NO_LIST;
+        sizes[list]--;
+    }
+
+private:
+    std::vector<word_t> heads;
+    std::vector<word_t> tails;
+    std::vector<uint64_t> sizes;
+    std::vector<word_t> prev;
+    std::vector<word_t> next;
+    std::vector<int> owner;
+};
+
+#ifdef VM_CONCURRENT
+/**
+ * The accesses that were reported since a policy last looked at its frames: a bit per frame, which OnPageAccessed sets
+ * without taking the lock of the policy, so the lock-free translations of the threads never wait for each other.
+ * A policy applies the bits to its lists under its lock, when a frame with its bit set reaches the back of a list in
+ * ChooseVictim, like the referenced bits of ClockPolicy. A bit that is already set is not written again, so the cache
+ * line of a hot page is not bounced between the threads that access it.
+ */
+class AccessBits {
+public:
+    AccessBits() : bits(NUM_FRAMES, 0) {}
+
+    void Set(word_t frameIdx) {
+        if (!__atomic_load_n(&bits[frameIdx], __ATOMIC_RELAXED)) {
+            __atomic_store_n(&bits[frameIdx], 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    void Clear(word_t frameIdx) {
+        __atomic_store_n(&bits[frameIdx], 0, __ATOMIC_RELAXED);
+    }
+
+    bool Test(word_t frameIdx) const {
+        return __atomic_load_n(&bits[frameIdx], __ATOMIC_RELAXED) != 0;
+    }
+
+    /**
+     * @return whether the bit of frameIdx was set, and clears it. An access that races with it may be lost, which only
+     *         makes the page look a bit older.
+     */
+    bool TestAndClear(word_t frameIdx) {
+        if (!Test(frameIdx)) {
+            return false;
+        }
+        Clear(frameIdx);
+        return true;
+    }
+
+private:
+    std::vector<uint8_t> bits;
+};
+#endif
+
+/**
+ * Evicts the resident page with the largest cyclic distance from the faulting page, which is the policy in the pdf.
+ * Accesses do not matter, and the resident pages are already indexed by the frame bookkeeping. The pages that are
+ * unneeded are evicted first though, in the order in which they became unneeded, which is all that is listed, until
+ * they are accessed again.
+ */
+class CyclicDistancePolicy : public ReplacementPolicy {
+public:
+    CyclicDistancePolicy() : unneeded(1), isUnneeded(NUM_FRAMES, 0) {}
+
+    void OnPageMapped(word_t, uint64_t) override {}
+
+    void OnPageEvicted(word_t frameIdx, uint64_t) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        RemoveUnneeded(frameIdx);
+    }
+
+    void OnPageAccessed(word_t frameIdx) override {
+        // almost no page is unneeded, so the lock is only taken for the ones that are:
+        if (!__atomic_load_n(&isUnneeded[frameIdx], __ATOMIC_RELAXED)) {
+            return;
+        }
+        std::lock_guard<PolicyMutex> lock(mutex);
+        RemoveUnneeded(frameIdx);
+    }
+
+    void OnPageUnneeded(word_t frameIdx) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        if (unneeded.ListOf(frameIdx) == NO_LIST) {
+            unneeded.PushFront(0, frameIdx);
+            __atomic_store_n(&isUnneeded[frameIdx], 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    word_t ChooseVictim(uint64_t faultingPageIdx) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        return (unneeded.Size(0) > 0) ? unneeded.Back(0) : FindVictimFrame(faultingPageIdx);
+    }
+
+    word_t PeekVictim(uint64_t faultingPageIdx) override {
+        return ChooseVictim(faultingPageIdx);
+    }
+
+private:
+    void RemoveUnneeded(word_t frameIdx) {
+        if (unneeded.ListOf(frameIdx) != NO_LIST) {
+            unneeded.Remove(frameIdx);
+            __atomic_store_n(&isUnneeded[frameIdx], 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    PolicyMutex mutex;
+    FrameLists unneeded;
+    // whether each frame is in 'unneeded', which OnPageAccessed reads without the lock:
+    std::vector<uint8_t> isUnneeded;
+};
+
+/**
+ * Evicts the least recently used page. In a VM_CONCURRENT build the accesses are only recorded in AccessBits, and a
+ * page that was accessed is moved to the front when it reaches the back, so the victim is the least recently used page
+ * among those that were not accessed since they were last moved.
+ */
+class LruPolicy : public ReplacementPolicy {
+public:
+    LruPolicy() : lists(1) {}
+
+    void OnPageMapped(word_t frameIdx, uint64_t) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        ClearAccessed(frameIdx);
+        lists.PushFront(0, frameIdx);
+    }
+
+    void OnPageEvicted(word_t frameIdx, uint64_t) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        lists.Remove(frameIdx);
+    }
+
+    void OnPageAccessed(word_t frameIdx) override {
+#ifdef VM_CONCURRENT
+        accessed.Set(frameIdx);
+#else
+        lists.Remove(frameIdx);
+        lists.PushFront(0, frameIdx);
+#endif
+    }
+
+    void OnPageUnneeded(word_t frameIdx) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        ClearAccessed(frameIdx);
+        lists.Remove(frameIdx);
+        lists.PushBack(0, frameIdx);
+    }
+
+    word_t ChooseVictim(uint64_t) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        assert(lists.Size(0) > 0);
+#ifdef VM_CONCURRENT
+        for (uint64_t step = 0; (step < lists.Size(0)) && accessed.TestAndClear(lists.Back(0)); step++) {
+            word_t frameIdx = lists.Back(0);
+            lists.Remove(frameIdx);
+            lists.PushFront(0, frameIdx);
+        }
+#endif
+        return lists.Back(0);
+    }
+
+    word_t PeekVictim(uint64_t) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        assert(lists.Size(0) > 0);
+#ifdef VM_CONCURRENT
+        // ChooseVictim moves the accessed frames at the back to the front, and ends at the original back if all are:
+        for (word_t frameIdx = lists.Back(0); frameIdx != NO_FRAME; frameIdx = lists.Prev(frameIdx)) {
+            if (!accessed.Test(frameIdx)) {
+                return frameIdx;
+            }
+        }
+#endif
+        return lists.Back(0);
+    }
+
+private:
+    void ClearAccessed(word_t frameIdx) {
+#ifdef VM_CONCURRENT
+        accessed.Clear(frameIdx);
+#else
+        (void) frameIdx;
+#endif
+    }
+
+    PolicyMutex mutex;
+    FrameLists lists;
+#ifdef VM_CONCURRENT
+    AccessBits accessed;
+#endif
+};
+
+/**
+ * Second chance: a hand sweeps over the frames, clearing the referenced bits of the pages it passes, and evicts the
+ * first page whose bit is already clear. Accesses only set a bit, so they take no lock, and an unneeded page loses its
+ * second chance. The rest of the state is guarded by the lock of the policy, like in the other policies, so it does not
+ * depend on the callers holding the lock of the page fault handler.
+ */
+class ClockPolicy : public ReplacementPolicy {
+public:
+    ClockPolicy() : resident(NUM_FRAMES, 0), referenced(NUM_FRAMES, 0), hand(0) {}
+
+    void OnPageMapped(word_t frameIdx, uint64_t) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        resident[frameIdx] = 1;
+        SetReferenced(frameIdx, 1);
+    }
+
+    void OnPageEvicted(word_t frameIdx, uint64_t) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        resident[frameIdx] = 0;
+    }
+
+    void OnPageAccessed(word_t frameIdx) override {
+        SetReferenced(frameIdx, 1);
+    }
+
+    void OnPageUnneeded(word_t frameIdx) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        SetReferenced(frameIdx, 0);
+    }
+
+    word_t ChooseVictim(uint64_t) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        // two sweeps are enough, since the first one clears every referenced bit:
+        for (uint64_t step = 0; step < 2 * NUM_FRAMES; step++) {
+            word_t frameIdx = hand;
+            hand = (hand + 1) % NUM_FRAMES;
+            if (!resident[frameIdx]) {
+                continue;
+            }
+            if (!GetReferenced(frameIdx)) {
+                return frameIdx;
+            }
+            SetReferenced(frameIdx, 0);
+        }
+        assert(false);
+        return 0;
+    }
+
+    word_t PeekVictim(uint64_t) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        // the first resident page from the hand that is not referenced, or the first resident page if all of them are:
+        word_t firstResidentIdx = NUM_FRAMES;
+        for (uint64_t step = 0; step < NUM_FRAMES; step++) {
+            word_t frameIdx = (hand + step) % NUM_FRAMES;
+            if (!resident[frameIdx]) {
+                continue;
+            }
+            if (!GetReferenced(frameIdx)) {
+                return frameIdx;
+            }
+            if (firstResidentIdx == NUM_FRAMES) {
+                firstResidentIdx = frameIdx;
+            }
+        }
+        assert(firstResidentIdx != NUM_FRAMES);
+        return firstResidentIdx;
+    }
+
+private:
+    uint8_t GetReferenced(word_t frameIdx) {
+        return __atomic_load_n(&referenced[frameIdx], __ATOMIC_RELAXED);
+    }
+
+    void SetReferenced(word_t frameIdx, uint8_t value) {
+        __atomic_store_n(&referenced[frameIdx], value, __ATOMIC_RELAXED);
+    }
+
+    // guards resident and hand. the referenced bits are written without it, by OnPageAccessed:
+    PolicyMutex mutex;
+    std::vector<uint8_t> resident;
+    std::vector<uint8_t> referenced;
+    word_t hand;
+};
+
+/**
+ * Adaptive Replacement Cache (Megiddo and Modha). Resident pages that were accessed once since they were mapped are in
+ * T1, and pages that were accessed again are in T2. B1 and B2 remember the pages that were recently evicted from T1 and
+ * T2, and a fault on a page in one of them moves the target size of T1 (p) towards the list it was evicted from.
+ * The cache size is NUM_FRAMES, and the ghost lists are trimmed so |T1| + |B1| <= c and |T1| + |T2| + |B1| + |B2| <= 2c.
+ * In a VM_CONCURRENT build the accesses are only recorded in AccessBits, like in LruPolicy, and a page that was accessed
+ * is moved to the front of T2 when it reaches the back of the list that a victim is taken from.
+ */
+class ArcPolicy : public ReplacementPolicy {
+public:
+    ArcPolicy() : lists(2), targetT1Size(0) {}
+
+    void OnPageMapped(word_t frameIdx, uint64_t pageIdx) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        ClearAccessed(frameIdx);
+        if (IsGhost(B1, pageIdx)) {
+            uint64_t delta = Ratio(ghostLists[B2].size(), ghostLists[B1].size());
+            targetT1Size = ((targetT1Size + delta) < NUM_FRAMES) ? (targetT1Size + delta) : NUM_FRAMES;
+            RemoveGhost(B1, pageIdx);
+            lists.PushFront(T2, frameIdx);
+        } else if (IsGhost(B2, pageIdx)) {
+            uint64_t delta = Ratio(ghostLists[B1].size(), ghostLists[B2].size());
+            targetT1Size = (targetT1Size > delta) ? (targetT1Size - delta) : 0;
+            RemoveGhost(B2, pageIdx);
+            lists.PushFront(T2, frameIdx);
+        } else {
+            lists.PushFront(T1, frameIdx);
+        }
+        TrimGhosts();
+    }
+
+    void OnPageEvicted(word_t frameIdx, uint64_t pageIdx) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        int list = lists.ListOf(frameIdx);
+        lists.Remove(frameIdx);
+        AddGhost((list == T1) ? B1 : B2, pageIdx);
+        TrimGhosts();
+    }
+
+    void OnPageAccessed(word_t frameIdx) override {
+#ifdef VM_CONCURRENT
+        accessed.Set(frameIdx);
+#else
+        lists.Remove(frameIdx);
+        lists.PushFront(T2, frameIdx);
+#endif
+    }
+
+    void OnPageUnneeded(word_t frameIdx) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        ClearAccessed(frameIdx);
+        lists.Remove(frameIdx);
+        lists.PushBack(T1, frameIdx);
+    }
+
+    word_t ChooseVictim(uint64_t faultingPageIdx) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        assert((lists.Size(T1) + lists.Size(T2)) > 0);
+#ifdef VM_CONCURRENT
+        uint64_t numResident = lists.Size(T1) + lists.Size(T2);
+        for (uint64_t step = 0; step < numResident; step++) {
+            word_t frameIdx = lists.Back(ChooseVictimList(faultingPageIdx, lists.Size(T1), lists.Size(T2)));
+            if (!accessed.TestAndClear(frameIdx)) {
+                return frameIdx;
+            }
+            lists.Remove(frameIdx);
+            lists.PushFront(T2, frameIdx);
+        }
+#endif
+        return lists.Back(ChooseVictimList(faultingPageIdx, lists.Size(T1), lists.Size(T2)));
+    }
+
+    word_t PeekVictim(uint64_t faultingPageIdx) override {
+        std::lock_guard<PolicyMutex> lock(mutex);
+        assert((lists.Size(T1) + lists.Size(T2)) > 0);
+        uint64_t t1Size = lists.Size(T1);
+        uint64_t t2Size = lists.Size(T2);
+#ifdef VM_CONCURRENT
+        // follows ChooseVictim with a cursor per list, counting the accessed frames of T1 as moved to T2. Once the
+        // frames that were in T2 run out, ChooseVictim reaches the first frame it moved, whose bit it cleared:
+        word_t cursors[2] = {lists.Back(T1), lists.Back(T2)};
+        word_t firstMovedIdx = NO_FRAME;
+        for (uint64_t step = 0; step < (t1Size + t2Size); step++) {
+            int list = ChooseVictimList(faultingPageIdx, t1Size, t2Size);
+            word_t frameIdx = cursors[list];
+            if (frameIdx == NO_FRAME) {
+                break;
+            }
+            if (!accessed.Test(frameIdx)) {
+                return frameIdx;
+            }
+            cursors[list] = lists.Prev(frameIdx);
+            if (firstMovedIdx == NO_FRAME) {
+                firstMovedIdx = frameIdx;
+            }
+            if (list == T1) {
+                t1Size--;
+                t2Size++;
+            }
+        }
+        if (firstMovedIdx != NO_FRAME) {
+            return firstMovedIdx;
+        }
+#endif
+        return lists.Back(ChooseVictimList(faultingPageIdx, t1Size, t2Size));
+    }
+
+private:
+    enum {
+        T1 = 0, T2 = 1
+    };
+    enum {
+        B1 = 0, B2 = 1
+    };
+
+    /**
+     * @return the list that the victim of a page fault on faultingPageIdx is taken from, when T1 and T2 have the given
+     *         sizes.
+     */
+    int ChooseVictimList(uint64_t faultingPageIdx, uint64_t t1Size, uint64_t t2Size) const {
+        bool evictFromT1 = (t1Size > 0) &&
+                           ((t1Size > targetT1Size) || (IsGhost(B2, faultingPageIdx) && (t1Size == targetT1Size)) ||
+                            (t2Size == 0));
+        return evictFromT1 ? T1 : T2;
+    }
+
+    void ClearAccessed(word_t frameIdx) {
+#ifdef VM_CONCURRENT
+        accessed.Clear(frameIdx);
+#else
+        (void) frameIdx;
+#endif
+    }
+
+    static uint64_t Ratio(uint64_t numerator, uint64_t denominator) {
+        uint64_t ratio = numerator / denominator;
+        return (ratio > 1) ? ratio : 1;
+    }
+
+    bool IsGhost(int ghostList, uint64_t pageIdx) const {
+        return ghostIndex[ghostList].find(pageIdx) != ghostIndex[ghostList].end();
+    }
+
+    void AddGhost(int ghostList, uint64_t pageIdx) {
+        ghostLists[ghostList].push_front(pageIdx);
+        ghostIndex[ghostList][pageIdx] = ghostLists[ghostList].begin();
+    }
+
+    void RemoveGhost(int ghostList, uint64_t pageIdx) {
+        auto it = ghostIndex[ghostList].find(pageIdx);
+        ghostLists[ghostList].erase(it->second);
+        ghostIndex[ghostList].erase(it);
+    }
+
+    void TrimGhosts() {
+        while (((lists.Size(T1) + ghostLists[B1].size()) > NUM_FRAMES) && !ghostLists[B1].empty()) {
+            RemoveGhost(B1, ghostLists[B1].back());
+        }
+        while (((lists.Size(T1) + lists.Size(T2) + ghostLists[B1].size() + ghostLists[B2].size()) > 2 * NUM_FRAMES) &&
+               !ghostLists[B2].empty()) {
+            RemoveGhost(B2, ghostLists[B2].back());
+        }
+    }
+
+    PolicyMutex mutex;
+    FrameLists lists;
+    std::list<uint64_t> ghostLists[2];
+    std::unordered_map<uint64_t, std::list<uint64_t>::iterator> ghostIndex[2];
+    uint64_t targetT1Size;
+#ifdef VM_CONCURRENT
+    AccessBits accessed;
+#endif
+};
+
+ReplacementPolicy* CreateReplacementPolicy(PageReplacementPolicy type) {
+    switch (type) {
+        case LRU_POLICY:
+            return new LruPolicy();
+        case CLOCK_POLICY:
+            return new ClockPolicy();
+        case ARC_POLICY:
+            return new ArcPolicy();
+        case CYCLIC_DISTANCE_POLICY:
+        default:
+            return new CyclicDistancePolicy();
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "MemoryConstants.h"
+//#include "YaaraConstants.h"
+#include "VirtualMemory.h"
+
+/*
+ * Chooses which resident page is evicted when a page fault finds the RAM full (no empty table and no unused frame).
+ * Only the frames that hold pages are tracked by a policy, never the frames that hold tables.
+ * OnPageMapped, OnPageEvicted, OnPageUnneeded and ChooseVictim are called by the page fault handler. OnPageAccessed is
+ * called on every translation that did not fault on its page, and in a VM_CONCURRENT build it may be called from
+ * several threads at once, outside of the page fault handler, so it should take no lock there.
+ */
+class ReplacementPolicy {
+public:
+    virtual ~ReplacementPolicy() {}
+
+    /*
+     * Called after pageIdx was restored into frameIdx.
+     */
+    virtual void OnPageMapped(word_t frameIdx, uint64_t pageIdx) = 0;
+
+    /*
+     * Called when pageIdx is evicted from frameIdx.
+     */
+    virtual void OnPageEvicted(word_t frameIdx, uint64_t pageIdx) = 0;
+
+    /*
+     * Called when the page in frameIdx is accessed.
+     */
+    virtual void OnPageAccessed(word_t frameIdx) = 0;
+
+    /*
+     * Called when the page in frameIdx is not expected to be accessed again soon (see ADVISE_SEQUENTIAL), so it should
+     * be evicted before the pages that were accessed as usual.
+     */
+    virtual void OnPageUnneeded(word_t frameIdx) = 0;
+
+    /*
+     * returns the frame of the page that should be evicted to handle a page fault on faultingPageIdx.
+     */
+    virtual word_t ChooseVictim(uint64_t faultingPageIdx) = 0;
+
+    /*
+     * returns the frame that ChooseVictim would return now, without changing the state of the policy, so a fault that
+     * may give up rather than evict the page (see ReadaheadPage) leaves no trace in the policy when it does.
+     */
+    virtual word_t PeekVictim(uint64_t faultingPageIdx) = 0;
+};
+
+/*
+ * returns a new policy of the given type, with no resident pages.
+ */
+ReplacementPolicy* CreateReplacementPolicy(PageReplacementPolicy type);
@@ -0,0 +1,107 @@
+#include "Stats.h"
+#include "PhysicalMemory.h"
+#include "SwapStore.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// the counters are summed as an array of words:
+static_assert((sizeof(VMstats) % sizeof(uint64_t)) == 0, "VMstats must hold only uint64_t counters");
+#define STATS_NUM_COUNTERS (sizeof(VMstats) / sizeof(uint64_t))
+
+// guards the registered blocks and the baseline:
+std::mutex statsMutex;
+// the sums of the counters at the last reset:
+VMstats statsBaseline;
+
+#ifndef VM_NO_STATS
+// the blocks of all of the threads that ever counted. a block outlives its thread, so its counts are kept:
+std::vector<StatsBlock *> statsBlocks;
+thread_local StatsBlock *localStatsBlock = nullptr;
+
+StatsBlock *RegisterLocalStatsBlock() {
+    void *block = nullptr;
+    if (posix_memalign(&block, STATS_CACHE_LINE_SIZE, sizeof(StatsBlock)) != 0) {
+        fprintf(stderr, "failed to allocate the statistics of a thread\n");
+        exit(1);
+    }
+    memset(block, 0, sizeof(StatsBlock));
+    localStatsBlock = (StatsBlock *) block;
+    std::lock_guard<std::mutex> lock(statsMutex);
+    statsBlocks.push_back(localStatsBlock);
+    return localStatsBlock;
+}
+#endif
+
+#if !defined(VM_NO_STATS) && defined(VM_STATS_LATENCY)
+thread_local uint64_t handedOverFaultStartNs = 0;
+
+uint64_t StatsNow() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void StatsRecordFaultLatency(uint64_t startNs) {
+    uint64_t latencyNs = StatsNow() - startNs;
+    // the bucket is the index of the highest bit that is set:
+    uint64_t bucket = 63 - __builtin_clzll(latencyNs | 1);
+    if (bucket >= VM_STATS_LATENCY_BUCKETS) {
+        bucket = VM_STATS_LATENCY_BUCKETS - 1;
+    }
+    STATS_ADD(faultLatencyHistogram[bucket], 1);
+}
+#endif
+
+/**
+ * Sums the counters of all of the threads, without subtracting the baseline. Must be called while holding statsMutex.
+ */
+void SumStats(VMstats *sum) {
+    memset(sum, 0, sizeof(VMstats));
+#ifndef VM_NO_STATS
+    uint64_t *sumCounters = (uint64_t *) sum;
+    for (StatsBlock *block : statsBlocks) {
+        uint64_t *blockCounters = (uint64_t *) &block->stats;
+        for (uint64_t counter = 0; counter < STATS_NUM_COUNTERS; counter++) {
+            sumCounters[counter] += __atomic_load_n(&blockCounters[counter], __ATOMIC_RELAXED);
+        }
+    }
+    PMgetAccessCounts(&sum->pmReads, &sum->pmWrites);
+    SwapStoreCounters swapCounters;
+    SwapStoreGetCounters(&swapCounters);
+    sum->swapSavedPages = swapCounters.savedPages;
+    sum->swapZeroPages = swapCounters.zeroPages;
+    sum->swapSpilledPages = swapCounters.spilledPages;
+    sum->swapDedupPages = swapCounters.dedupPages;
+    sum->swapUncompressedBytes = swapCounters.uncompressedBytes;
+    sum->swapCompressedBytes = swapCounters.compressedBytes;
+    sum->swapCompressNs = swapCounters.compressNs;
+    sum->swapDecompressNs = swapCounters.decompressNs;
+#endif
+}
+
+void StatsGetTotals(VMstats *totals) {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    SumStats(totals);
+}
+
+void VMgetStats(VMstats *stats) {
+    if (stats == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(statsMutex);
+    SumStats(stats);
+    uint64_t *counters = (uint64_t *) stats;
+    uint64_t *baselineCounters = (uint64_t *) &statsBaseline;
+    for (uint64_t counter = 0; counter < STATS_NUM_COUNTERS; counter++) {
+        counters[counter] -= baselineCounters[counter];
+    }
+}
+
+void VMresetStats() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    SumStats(&statsBaseline);
+}
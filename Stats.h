@@ -0,0 +1,97 @@
+#pragma once
+
+#include "VirtualMemory.h"
+
+/*
+ * The counters behind VMgetStats. Every thread counts in its own cache line aligned block, which only it writes, so
+ * counting takes no lock and no atomic read-modify-write. Define VM_NO_STATS to compile the counting out, and
+ * VM_STATS_LATENCY to also measure the latency of the page faults.
+ */
+
+#ifndef VM_NO_STATS
+#define STATS_CACHE_LINE_SIZE 64
+
+typedef struct alignas(STATS_CACHE_LINE_SIZE) {
+    VMstats stats;
+} StatsBlock;
+
+extern thread_local StatsBlock *localStatsBlock;
+
+/*
+ * Allocates the block of the calling thread, and registers it so VMgetStats sums it.
+ */
+StatsBlock *RegisterLocalStatsBlock();
+
+inline StatsBlock *GetLocalStatsBlock() {
+    return (localStatsBlock != nullptr) ? localStatsBlock : RegisterLocalStatsBlock();
+}
+
+/*
+ * Adds count to a counter of the calling thread. Other threads may read the counter meanwhile, so it is written as a
+ * whole word.
+ */
+inline void StatsAdd(uint64_t *counter, uint64_t count) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + count, __ATOMIC_RELAXED);
+}
+
+#define STATS_ADD(field, count) StatsAdd(&GetLocalStatsBlock()->stats.field, (count))
+#else
+#define STATS_ADD(field, count)
+#endif
+
+/*
+ * Puts the sums of the counters of all of the threads in 'totals', regardless of VMresetStats, so a module can keep a
+ * baseline of its own.
+ */
+void StatsGetTotals(VMstats *totals);
+
+#if !defined(VM_NO_STATS) && defined(VM_STATS_LATENCY)
+/*
+ * returns a timestamp for StatsRecordFaultLatency, in nanoseconds.
+ */
+uint64_t StatsNow();
+
+/*
+ * Counts a page fault that started at the given timestamp in the latency histogram.
+ */
+void StatsRecordFaultLatency(uint64_t startNs);
+
+// the start of a fault that the calling thread handed over to its next fault (see StatsFaultTimer), or 0:
+extern thread_local uint64_t handedOverFaultStartNs;
+
+/*
+ * Measures a page fault from its construction, and counts it in the latency histogram once it is destroyed, so a
+ * fault is counted on every path that it returns on. A fault that gives up to be handled by another one (a huge page
+ * with no run of frames, which falls back to a page) calls HandOver, so the next fault of the thread is measured from
+ * the start of this one, and the two are counted as one.
+ */
+class StatsFaultTimer {
+public:
+    StatsFaultTimer() : startNs((handedOverFaultStartNs != 0) ? handedOverFaultStartNs : StatsNow()),
+                        handedOver(false) {
+        handedOverFaultStartNs = 0;
+    }
+
+    ~StatsFaultTimer() {
+        if (handedOver) {
+            handedOverFaultStartNs = startNs;
+        } else {
+            StatsRecordFaultLatency(startNs);
+        }
+    }
+
+    void HandOver() {
+        handedOver = true;
+    }
+
+private:
+    uint64_t startNs;
+    bool handedOver;
+};
+
+#define STATS_FAULT_START() StatsFaultTimer statsFaultTimer
+#define STATS_FAULT_HAND_OVER() statsFaultTimer.HandOver()
+#else
+#define STATS_FAULT_START()
+#define STATS_FAULT_HAND_OVER()
+#endif
@@ -0,0 +1,234 @@
+#include "SwapDevice.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define PAGE_BYTES (PAGE_SIZE * sizeof(word_t))
+// O_DIRECT transfers must be aligned to (and a multiple of) the logical block size of the disk:
+#define DIRECT_IO_ALIGNMENT 4096
+
+typedef struct {
+    int fd;
+    bool directIo;
+    std::mutex mutex;
+    // signalled whenever a write-back is queued or completed:
+    std::condition_variable cond;
+    // the pages in the device, whether their write-back is pending or completed:
+    std::unordered_set<uint64_t> storedPages;
+    // the write-back buffers of the pages whose write-back is pending:
+    std::unordered_map<uint64_t, word_t*> pendingWrites;
+    std::deque<uint64_t> writeQueue;
+    std::vector<word_t*> freeBuffers;
+    std::vector<std::thread> writers;
+    // set by SwapDeviceClose, once the queue is empty, to stop the writers:
+    bool stopping;
+} SwapDeviceState;
+
+SwapDeviceState* device = nullptr;
+
+word_t* AllocateIoBuffer() {
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, PAGE_BYTES) != 0) {
+        fprintf(stderr, "failed to allocate a swap device buffer\n");
+        exit(1);
+    }
+    return (word_t*) buffer;
+}
+
+/**
+ * Transfers a whole page at the given file offset, retrying partial transfers. Any I/O error is fatal, since the
+ * page would be lost.
+ */
+void TransferPage(bool write, word_t* buffer, uint64_t pageIdx) {
+    char* bytes = (char*) buffer;
+    size_t done = 0;
+    while (done < PAGE_BYTES) {
+        off_t offset = (off_t) ((pageIdx * PAGE_BYTES) + done);
+        ssize_t result = write ? pwrite(device->fd, bytes + done, PAGE_BYTES - done, offset)
+                               : pread(device->fd, bytes + done, PAGE_BYTES - done, offset);
+        if ((result < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (result <= 0) {
+            fprintf(stderr, "swap device %s failed for page %llu: %s\n", write ? "write" : "read",
+                    (unsigned long long) pageIdx, (result < 0) ? strerror(errno) : "end of file");
+            exit(1);
+        }
+        done += result;
+    }
+}
+
+void WriterThread() {
+    std::unique_lock<std::mutex> lock(device->mutex);
+    while (true) {
+        device->cond.wait(lock, []() { return !device->writeQueue.empty() || device->stopping; });
+        if (device->writeQueue.empty()) {
+            return;
+        }
+        uint64_t pageIdx = device->writeQueue.front();
+        device->writeQueue.pop_front();
+        word_t* buffer = device->pendingWrites[pageIdx];
+
+        lock.unlock();
+        TransferPage(true, buffer, pageIdx);
+        lock.lock();
+
+        device->pendingWrites.erase(pageIdx);
+        device->freeBuffers.push_back(buffer);
+        device->cond.notify_all();
+    }
+}
+
+bool SwapDeviceOpen(const char* path) {
+    if (device != nullptr) {
+        return false;
+    }
+    int flags = O_RDWR | O_CREAT | O_TRUNC;
+    bool directIo = false;
+#ifdef O_DIRECT
+    directIo = ((PAGE_BYTES % DIRECT_IO_ALIGNMENT) == 0);
+    int fd = open(path, flags | (directIo ? O_DIRECT : 0), 0600);
+    if ((fd < 0) && directIo) {
+        // the file system may not support O_DIRECT:
+        directIo = false;
+        fd = open(path, flags, 0600);
+    }
+#else
+    int fd = open(path, flags, 0600);
+#endif
+    if (fd < 0) {
+        return false;
+    }
+
+    device = new SwapDeviceState();
+    device->fd = fd;
+    device->directIo = directIo;
+    device->stopping = false;
+    for (int buffer = 0; buffer < SWAP_DEVICE_MAX_PENDING; buffer++) {
+        device->freeBuffers.push_back(AllocateIoBuffer());
+    }
+    // the writers wait for work until the device is closed, at the latest when the process exits:
+    for (int writer = 0; writer < SWAP_DEVICE_WRITERS; writer++) {
+        device->writers.push_back(std::thread(WriterThread));
+    }
+    atexit(SwapDeviceClose);
+    return true;
+}
+
+void SwapDeviceClose() {
+    if (device == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(device->mutex);
+        device->stopping = true;
+        device->cond.notify_all();
+    }
+    // the writers drain the queue before they stop:
+    for (std::thread &writer : device->writers) {
+        writer.join();
+    }
+    close(device->fd);
+    for (word_t* buffer : device->freeBuffers) {
+        free(buffer);
+    }
+    delete device;
+    device = nullptr;
+}
+
+bool SwapDeviceIsOpen() {
+    return device != nullptr;
+}
+
+void SwapDeviceSave(uint64_t pageIdx, const word_t* page) {
+    std::unique_lock<std::mutex> lock(device->mutex);
+    // a page has at most one pending write-back, so the writes of its copies are never reordered:
+    device->cond.wait(lock, [pageIdx]() {
+        return !device->freeBuffers.empty() && (device->pendingWrites.find(pageIdx) == device->pendingWrites.end());
+    });
+
+    word_t* buffer = device->freeBuffers.back();
+    device->freeBuffers.pop_back();
+    memcpy(buffer, page, PAGE_BYTES);
+    device->pendingWrites[pageIdx] = buffer;
+    device->storedPages.insert(pageIdx);
+    device->writeQueue.push_back(pageIdx);
+    device->cond.notify_all();
+}
+
+bool SwapDeviceLoad(uint64_t pageIdx, word_t* page, bool keep) {
+    {
+        std::unique_lock<std::mutex> lock(device->mutex);
+        if (device->storedPages.find(pageIdx) == device->storedPages.end()) {
+            return false;
+        }
+        device->cond.wait(lock, [pageIdx]() {
+            return device->pendingWrites.find(pageIdx) == device->pendingWrites.end();
+        });
+        if (!keep) {
+            device->storedPages.erase(pageIdx);
+        }
+    }
+
+    if (device->directIo) {
+        // every call reads into a buffer of its own, so loads of several threads may run at once:
+        alignas(DIRECT_IO_ALIGNMENT) word_t buffer[PAGE_SIZE];
+        TransferPage(false, buffer, pageIdx);
+        memcpy(page, buffer, PAGE_BYTES);
+    } else {
+        TransferPage(false, page, pageIdx);
+    }
+    return true;
+}
+
+bool SwapDeviceContains(uint64_t pageIdx) {
+    std::lock_guard<std::mutex> lock(device->mutex);
+    return device->storedPages.find(pageIdx) != device->storedPages.end();
+}
+
+void SwapDeviceDiscard(uint64_t firstPageIdx, uint64_t count) {
+    std::lock_guard<std::mutex> lock(device->mutex);
+    // a pending write-back still completes, but its page is not found anymore. a short range is erased page by page:
+    if (count <= device->storedPages.size()) {
+        for (uint64_t pageIdx = firstPageIdx; pageIdx < (firstPageIdx + count); pageIdx++) {
+            device->storedPages.erase(pageIdx);
+        }
+        return;
+    }
+    for (auto it = device->storedPages.begin(); it != device->storedPages.end();) {
+        if ((*it - firstPageIdx) < count) {
+            it = device->storedPages.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void SwapDeviceMove(uint64_t firstPageIdx, uint64_t count, uint64_t firstTargetPageIdx) {
+    std::vector<uint64_t> pages;
+    {
+        std::lock_guard<std::mutex> lock(device->mutex);
+        for (uint64_t pageIdx : device->storedPages) {
+            if ((pageIdx - firstPageIdx) < count) {
+                pages.push_back(pageIdx);
+            }
+        }
+    }
+    std::vector<word_t> page(PAGE_SIZE);
+    for (uint64_t pageIdx : pages) {
+        SwapDeviceLoad(pageIdx, page.data(), false);
+        SwapDeviceSave(firstTargetPageIdx + (pageIdx - firstPageIdx), page.data());
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "MemoryConstants.h"
+//#include "YaaraConstants.h"
+
+/*
+ * A swap device that keeps the evicted pages in a file, page i at offset i * PAGE_SIZE * sizeof(word_t), so the
+ * swapped pages are bounded by the disk instead of the host memory.
+ * Saving a page only copies it to a write-back buffer, and a pool of writer threads writes it to the file in the
+ * background. Loading a page waits for its pending write-back, if there is one.
+ * The file is opened with O_DIRECT when a page is a multiple of the disk block size.
+ */
+
+// number of threads that write the evicted pages back to the file
+#ifndef SWAP_DEVICE_WRITERS
+#define SWAP_DEVICE_WRITERS 2
+#endif
+
+// number of evicted pages that may wait for their write-back at once. saving blocks while all of them are taken.
+#ifndef SWAP_DEVICE_MAX_PENDING
+#define SWAP_DEVICE_MAX_PENDING 64
+#endif
+
+/*
+ * Creates (or truncates) the swap file at the given path and starts the writer threads.
+ * returns false if the file cannot be opened, or if a swap file is already open.
+ */
+bool SwapDeviceOpen(const char* path);
+
+/*
+ * Waits for the pending write-backs, joins the writer threads and closes the swap file, whose pages are lost. Called
+ * when the process exits, so it never exits in the middle of a write-back. Must not be called concurrently with the
+ * other functions.
+ */
+void SwapDeviceClose();
+
+/*
+ * returns true if a swap file was opened.
+ */
+bool SwapDeviceIsOpen();
+
+/*
+ * Copies the PAGE_SIZE words of 'page' to a write-back buffer, and queues the buffer for writing.
+ * If the page is already in the swap device, its copy is replaced.
+ */
+void SwapDeviceSave(uint64_t pageIdx, const word_t* page);
+
+/*
+ * Reads the given page into 'page', after its pending write-back completes. Unless 'keep' is true, the page is removed
+ * from the swap device.
+ * returns false, without touching 'page', if the page is not in the swap device.
+ */
+bool SwapDeviceLoad(uint64_t pageIdx, word_t* page, bool keep);
+
+/*
+ * returns true if the given page is in the swap device, even if its write-back is still pending.
+ */
+bool SwapDeviceContains(uint64_t pageIdx);
+
+/*
+ * Removes the 'count' pages from firstPageIdx onwards from the swap device.
+ */
+void SwapDeviceDiscard(uint64_t firstPageIdx, uint64_t count);
+
+/*
+ * Moves the 'count' pages from firstPageIdx onwards to the pages from firstTargetPageIdx onwards, replacing the target
+ * pages that are in the swap device. Each page is read and written again at the offset of its target. The ranges must
+ * not overlap, and the function must not be called concurrently with SwapDeviceLoad.
+ */
+void SwapDeviceMove(uint64_t firstPageIdx, uint64_t count, uint64_t firstTargetPageIdx);
@@ -0,0 +1,637 @@
+#include "SwapStore.h"
+#include "PhysicalMemory.h"
+#include "Checkpoint.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include <cassert>
+#include <cstring>
+
+#ifndef VM_NO_STATS
+#include <chrono>
+#endif
+
+// a slot handle: the size class above SLOT_INDEX_WIDTH bits of the index of the slot in its class, or a special value
+typedef uint32_t slot_t;
+
+#define NO_SLOT ((slot_t) -1)
+// a page of zeroes, or a page in the swap device, which take no slot:
+#define ZERO_PAGE_SLOT ((slot_t) -2)
+#define SPILLED_SLOT ((slot_t) -3)
+// a page in the checkpoint in use, which takes no slot either. the data page is in the bits below the flag:
+#define CHECKPOINT_SLOT_FLAG ((slot_t) 1 << 31)
+#define CHECKPOINT_SLOT_INDEX_WIDTH 30
+// a page that is the same as the page in a frame of the RAM, see SwapStoreShareFrame. the frame is in the bits below
+// the flag:
+#define SHARED_FRAME_SLOT_FLAG ((slot_t) 6 << 29)
+#define SHARED_FRAME_SLOT_INDEX_WIDTH 29
+#define SLOT_INDEX_WIDTH 26
+#define USE_DIRECT_TABLE (NUM_PAGES <= SWAP_DIRECT_TABLE_MAX_PAGES)
+
+static_assert((SWAP_SIZE_CLASSES >= 1) && (SWAP_SIZE_CLASSES <= 16), "the size class must fit the top of a slot_t");
+// the special values above have the two top bits set, and a checkpoint slot only the top one:
+static_assert(SWAP_MAX_CHECKPOINT_PAGES == (1ULL << CHECKPOINT_SLOT_INDEX_WIDTH), "a data page must fit a slot");
+// and a shared frame the top two, but not the third one:
+static_assert(NUM_FRAMES <= (1ULL << SHARED_FRAME_SLOT_INDEX_WIDTH), "a frame must fit a slot");
+// a free slot holds the next free slot, and the smallest slot is a word:
+static_assert(sizeof(slot_t) <= sizeof(word_t), "a free slot must fit the smallest slot");
+
+// the codec encodes a page as records, each of them a header of (count << 1) | kind, followed by:
+//  RECORD_LITERALS - the count words as they are
+//  RECORD_RUN      - the first word of the run and the step between its words, so a repeated word has a step of 0
+#define RECORD_LITERALS 0
+#define RECORD_RUN 1
+// a shorter run is kept as literals, since its record takes as many words as a run of 3:
+#define MIN_RUN_LENGTH 4
+
+// the arena of a size class. slot i is the (i % SWAP_SLOTS_PER_SLAB)'th slot of slab (i / SWAP_SLOTS_PER_SLAB):
+typedef struct {
+    std::vector<word_t*> slabs;
+    // the free slots. the first word of a free slot holds the next free slot:
+    slot_t freeSlotsHead;
+    // the number of pages that each slot is the copy of, and the hash of its page, for the slots that are in use:
+    std::vector<uint32_t> slotRefs;
+    std::vector<uint64_t> slotHashes;
+} SizeClass;
+
+SizeClass sizeClasses[SWAP_SIZE_CLASSES];
+
+// whether a saved page shares the slot of an identical page, see SwapStoreSetDedup:
+bool swapDedupEnabled = false;
+// the slot of each page hash, while dedup is enabled. a page whose hash is taken by another page gets a slot of its
+// own:
+std::unordered_map<uint64_t, slot_t> contentIndex;
+
+// the pages whose copies are each frame, see SwapStoreShareFrame. the counts are read without locks by
+// SwapStoreIsFrameShared, so they are written as whole words:
+std::vector<std::vector<uint64_t> > frameSharers;
+uint32_t frameSharerCounts[NUM_FRAMES];
+
+// the direct page-index-to-slot table, which grows by NUM_PAGES for every context that swaps a page:
+std::vector<slot_t> directTable;
+
+// the open-addressing page-index-to-slot table, with linear probing:
+typedef struct {
+    uint64_t pageIdx;
+    slot_t slot;
+} SlotTableEntry;
+std::vector<SlotTableEntry> hashTable;
+uint64_t hashTableSize = 0;
+
+#define INITIAL_HASH_TABLE_CAPACITY 1024
+
+// read by SwapStoreGetUsage and SwapStoreGetCounters while pages are saved, so written as whole words:
+uint64_t storedPages = 0;
+uint64_t storedBytes = 0;
+// the pages that share a slot with another page, and the bytes that the slots would take if they did not, and the
+// pages whose copies are frames:
+uint64_t sharedSlotPages = 0;
+uint64_t sharedSlotBytes = 0;
+uint64_t sharedFramePages = 0;
+SwapStoreCounters swapStoreCounters;
+
+void CounterAdd(uint64_t* counter, int64_t count) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + count, __ATOMIC_RELAXED);
+}
+
+#ifndef VM_NO_STATS
+uint64_t CodecNow() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#define CODEC_TIMER_START() uint64_t codecStartNs = CodecNow()
+#define CODEC_TIMER_END(counter) CounterAdd(&swapStoreCounters.counter, CodecNow() - codecStartNs)
+#else
+#define CODEC_TIMER_START()
+#define CODEC_TIMER_END(counter)
+#endif
+
+/**
+ * @return the number of words in a slot of the given size class. The largest class fits a whole page.
+ */
+uint64_t GetClassWords(int sizeClass) {
+    uint64_t words = (((uint64_t) sizeClass + 1) * PAGE_SIZE + SWAP_SIZE_CLASSES - 1) / SWAP_SIZE_CLASSES;
+    return (words > 0) ? words : 1;
+}
+
+uint64_t GetClassBytes(int sizeClass) {
+    return GetClassWords(sizeClass) * sizeof(word_t);
+}
+
+/**
+ * @return the smallest size class whose slots fit the given number of words.
+ */
+int FindSizeClass(uint64_t words) {
+    int sizeClass = 0;
+    while (GetClassWords(sizeClass) < words) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+bool IsSlotInArena(slot_t slot) {
+    return (slot >> 31) == 0;
+}
+
+bool IsCheckpointSlot(slot_t slot) {
+    return (slot >> CHECKPOINT_SLOT_INDEX_WIDTH) == (CHECKPOINT_SLOT_FLAG >> CHECKPOINT_SLOT_INDEX_WIDTH);
+}
+
+bool IsSharedFrameSlot(slot_t slot) {
+    return (slot >> SHARED_FRAME_SLOT_INDEX_WIDTH) == (SHARED_FRAME_SLOT_FLAG >> SHARED_FRAME_SLOT_INDEX_WIDTH);
+}
+
+uint64_t GetSharedFrame(slot_t slot) {
+    return slot & ~SHARED_FRAME_SLOT_FLAG;
+}
+
+int GetSlotClass(slot_t slot) {
+    return (int) (slot >> SLOT_INDEX_WIDTH);
+}
+
+slot_t GetSlotIndex(slot_t slot) {
+    return slot & ((1U << SLOT_INDEX_WIDTH) - 1);
+}
+
+word_t* GetSlot(slot_t slot) {
+    SizeClass &sizeClass = sizeClasses[GetSlotClass(slot)];
+    slot_t index = GetSlotIndex(slot);
+    return sizeClass.slabs[index / SWAP_SLOTS_PER_SLAB] +
+           ((uint64_t) (index % SWAP_SLOTS_PER_SLAB) * GetClassWords(GetSlotClass(slot)));
+}
+
+/**
+ * Adds a slab to the arena of the given size class and pushes its slots to its free list.
+ */
+void GrowArena(int sizeClassIdx) {
+    SizeClass &sizeClass = sizeClasses[sizeClassIdx];
+    uint64_t firstIndex = sizeClass.slabs.size() * SWAP_SLOTS_PER_SLAB;
+    assert(firstIndex + SWAP_SLOTS_PER_SLAB <= (1ULL << SLOT_INDEX_WIDTH));
+    sizeClass.slabs.push_back(new word_t[SWAP_SLOTS_PER_SLAB * GetClassWords(sizeClassIdx)]);
+    sizeClass.slotRefs.resize(firstIndex + SWAP_SLOTS_PER_SLAB, 0);
+    sizeClass.slotHashes.resize(firstIndex + SWAP_SLOTS_PER_SLAB, 0);
+
+    slot_t firstSlot = ((slot_t) sizeClassIdx << SLOT_INDEX_WIDTH) | (slot_t) firstIndex;
+    for (slot_t slot = firstSlot + SWAP_SLOTS_PER_SLAB; slot-- > firstSlot;) {
+        memcpy(GetSlot(slot), &sizeClass.freeSlotsHead, sizeof(slot_t));
+        sizeClass.freeSlotsHead = slot;
+    }
+}
+
+slot_t AllocateSlot(int sizeClassIdx) {
+    SizeClass &sizeClass = sizeClasses[sizeClassIdx];
+    if (sizeClass.freeSlotsHead == NO_SLOT) {
+        GrowArena(sizeClassIdx);
+    }
+    slot_t slot = sizeClass.freeSlotsHead;
+    memcpy(&sizeClass.freeSlotsHead, GetSlot(slot), sizeof(slot_t));
+    sizeClass.slotRefs[GetSlotIndex(slot)] = 1;
+    CounterAdd(&storedPages, 1);
+    CounterAdd(&storedBytes, GetClassBytes(sizeClassIdx));
+    return slot;
+}
+
+/**
+ * Removes the given page from the pages whose copy is the given frame.
+ */
+void RemoveFrameSharer(uint64_t frameIdx, uint64_t pageIdx) {
+    std::vector<uint64_t> &sharers = frameSharers[frameIdx];
+    for (uint64_t sharer = 0; sharer < sharers.size(); sharer++) {
+        if (sharers[sharer] == pageIdx) {
+            sharers[sharer] = sharers.back();
+            sharers.pop_back();
+            break;
+        }
+    }
+    __atomic_store_n(&frameSharerCounts[frameIdx], (uint32_t) sharers.size(), __ATOMIC_RELAXED);
+    CounterAdd(&storedPages, -1);
+    CounterAdd(&sharedFramePages, -1);
+}
+
+/**
+ * Frees the slot of the given page, which may be a special value that takes no slot. A slot that other pages share is
+ * only freed by the last of them.
+ */
+void FreeSlot(uint64_t pageIdx, slot_t slot) {
+    if (slot == ZERO_PAGE_SLOT) {
+        CounterAdd(&storedPages, -1);
+    } else if (IsSharedFrameSlot(slot)) {
+        RemoveFrameSharer(GetSharedFrame(slot), pageIdx);
+    }
+    if (!IsSlotInArena(slot)) {
+        return;
+    }
+    SizeClass &sizeClass = sizeClasses[GetSlotClass(slot)];
+    uint32_t &refs = sizeClass.slotRefs[GetSlotIndex(slot)];
+    if (refs > 1) {
+        refs--;
+        CounterAdd(&storedPages, -1);
+        CounterAdd(&sharedSlotPages, -1);
+        CounterAdd(&sharedSlotBytes, -(int64_t) GetClassBytes(GetSlotClass(slot)));
+        return;
+    }
+    refs = 0;
+    // the index may hold another slot of the same hash, or none:
+    std::unordered_map<uint64_t, slot_t>::iterator indexed =
+            contentIndex.find(sizeClass.slotHashes[GetSlotIndex(slot)]);
+    if ((indexed != contentIndex.end()) && (indexed->second == slot)) {
+        contentIndex.erase(indexed);
+    }
+    memcpy(GetSlot(slot), &sizeClass.freeSlotsHead, sizeof(slot_t));
+    sizeClass.freeSlotsHead = slot;
+    CounterAdd(&storedPages, -1);
+    CounterAdd(&storedBytes, -(int64_t) GetClassBytes(GetSlotClass(slot)));
+}
+
+/**
+ * @return the length of the run of words from 'first' onwards that go up by a constant step (in two's complement).
+ */
+uint64_t GetRunLength(const word_t* page, uint64_t first) {
+    if (first + 1 >= PAGE_SIZE) {
+        return PAGE_SIZE - first;
+    }
+    uint32_t step = (uint32_t) page[first + 1] - (uint32_t) page[first];
+    uint64_t end = first + 2;
+    while ((end < PAGE_SIZE) && (((uint32_t) page[end] - (uint32_t) page[end - 1]) == step)) {
+        end++;
+    }
+    return end - first;
+}
+
+/**
+ * Appends the words of the page in [first, end) to 'out' as a literals record, unless there are none.
+ * @return false if the record would make 'out' longer than maxWords.
+ */
+bool EncodeLiterals(const word_t* page, uint64_t first, uint64_t end, word_t* out, uint64_t* length,
+                    uint64_t maxWords) {
+    if (first == end) {
+        return true;
+    }
+    if (*length + 1 + (end - first) > maxWords) {
+        return false;
+    }
+    out[(*length)++] = (word_t) (((end - first) << 1) | RECORD_LITERALS);
+    memcpy(out + *length, page + first, (end - first) * sizeof(word_t));
+    *length += end - first;
+    return true;
+}
+
+/**
+ * Compresses a page into 'out'.
+ * @return the number of words written to 'out', or 0 if the page does not compress to maxWords words.
+ */
+uint64_t EncodePage(const word_t* page, word_t* out, uint64_t maxWords) {
+    uint64_t length = 0;
+    uint64_t literalsStart = 0;
+    uint64_t first = 0;
+    while (first < PAGE_SIZE) {
+        uint64_t runLength = GetRunLength(page, first);
+        if (runLength < MIN_RUN_LENGTH) {
+            first++;
+            continue;
+        }
+        if (!EncodeLiterals(page, literalsStart, first, out, &length, maxWords) || (length + 3 > maxWords)) {
+            return 0;
+        }
+        out[length++] = (word_t) ((runLength << 1) | RECORD_RUN);
+        out[length++] = page[first];
+        out[length++] = (word_t) ((uint32_t) page[first + 1] - (uint32_t) page[first]);
+        first += runLength;
+        literalsStart = first;
+    }
+    return EncodeLiterals(page, literalsStart, PAGE_SIZE, out, &length, maxWords) ? length : 0;
+}
+
+void DecodePage(const word_t* in, word_t* page) {
+    uint64_t offset = 0;
+    while (offset < PAGE_SIZE) {
+        uint32_t header = (uint32_t) *(in++);
+        uint64_t count = header >> 1;
+        if ((header & 1) == RECORD_LITERALS) {
+            memcpy(page + offset, in, count * sizeof(word_t));
+            in += count;
+        } else {
+            uint32_t value = (uint32_t) in[0];
+            uint32_t step = (uint32_t) in[1];
+            in += 2;
+            for (uint64_t word = 0; word < count; word++, value += step) {
+                page[offset + word] = (word_t) value;
+            }
+        }
+        offset += count;
+    }
+}
+
+uint64_t SwapStoreHashPage(const word_t* page) {
+    const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    uint64_t hash = PAGE_SIZE * prime1;
+    for (uint64_t word = 0; word < PAGE_SIZE; word++) {
+        // a multiply and a rotate per word, like the checksums of Checkpoint.cpp:
+        hash ^= (uint64_t) page[word] * prime2;
+        hash = ((hash << 31) | (hash >> 33)) * prime1;
+    }
+    return hash ^ (hash >> 29);
+}
+
+/**
+ * @return the slot of the given size class that holds the given words, found by the hash of their page, or NO_SLOT if
+ *         there is none.
+ */
+slot_t FindIdenticalSlot(uint64_t hash, int sizeClass, const word_t* content, uint64_t contentWords) {
+    std::unordered_map<uint64_t, slot_t>::const_iterator indexed = contentIndex.find(hash);
+    // two pages of the same hash may differ, and so may two pages that are compressed to different classes:
+    if ((indexed == contentIndex.end()) || (GetSlotClass(indexed->second) != sizeClass) ||
+        (memcmp(GetSlot(indexed->second), content, contentWords * sizeof(word_t)) != 0)) {
+        return NO_SLOT;
+    }
+    return indexed->second;
+}
+
+uint64_t HashPageIdx(uint64_t pageIdx) {
+    // fibonacci hashing spreads consecutive page indices over the table:
+    return pageIdx * 0x9E3779B97F4A7C15ULL;
+}
+
+/**
+ * @return the index in hashTable where the given page is, or the empty entry where it should be inserted.
+ */
+uint64_t FindHashTableEntry(uint64_t pageIdx) {
+    uint64_t mask = hashTable.size() - 1;
+    uint64_t entry = HashPageIdx(pageIdx) & mask;
+    while ((hashTable[entry].slot != NO_SLOT) && (hashTable[entry].pageIdx != pageIdx)) {
+        entry = (entry + 1) & mask;
+    }
+    return entry;
+}
+
+void GrowHashTable() {
+    std::vector<SlotTableEntry> oldTable;
+    oldTable.swap(hashTable);
+    SlotTableEntry emptyEntry = {0, NO_SLOT};
+    hashTable.assign(oldTable.size() * 2, emptyEntry);
+    for (uint64_t entry = 0; entry < oldTable.size(); entry++) {
+        if (oldTable[entry].slot != NO_SLOT) {
+            hashTable[FindHashTableEntry(oldTable[entry].pageIdx)] = oldTable[entry];
+        }
+    }
+}
+
+slot_t LookupSlot(uint64_t pageIdx) {
+    if (USE_DIRECT_TABLE) {
+        return (pageIdx < directTable.size()) ? directTable[pageIdx] : NO_SLOT;
+    }
+    return hashTable[FindHashTableEntry(pageIdx)].slot;
+}
+
+/**
+ * Maps the given page to a slot, replacing the slot it was mapped to, if any.
+ */
+void MapSlot(uint64_t pageIdx, slot_t slot) {
+    if (USE_DIRECT_TABLE) {
+        if (pageIdx >= directTable.size()) {
+            directTable.resize(((pageIdx / NUM_PAGES) + 1) * NUM_PAGES, NO_SLOT);
+        }
+        directTable[pageIdx] = slot;
+        return;
+    }
+    // keeps the load factor under 1/2:
+    if ((hashTableSize + 1) * 2 > hashTable.size()) {
+        GrowHashTable();
+    }
+    SlotTableEntry &entry = hashTable[FindHashTableEntry(pageIdx)];
+    if (entry.slot == NO_SLOT) {
+        hashTableSize++;
+    }
+    entry.pageIdx = pageIdx;
+    entry.slot = slot;
+}
+
+void UnmapSlot(uint64_t pageIdx) {
+    if (USE_DIRECT_TABLE) {
+        directTable[pageIdx] = NO_SLOT;
+        return;
+    }
+    // removes the entry by shifting back the entries after it, so no probe sequence is broken:
+    uint64_t mask = hashTable.size() - 1;
+    uint64_t hole = FindHashTableEntry(pageIdx);
+    hashTable[hole].slot = NO_SLOT;
+    hashTableSize--;
+    for (uint64_t entry = (hole + 1) & mask; hashTable[entry].slot != NO_SLOT; entry = (entry + 1) & mask) {
+        uint64_t home = HashPageIdx(hashTable[entry].pageIdx) & mask;
+        // the entry may move to the hole only if the hole is on its probe sequence, between its home and itself:
+        if (((entry - home) & mask) >= ((entry - hole) & mask)) {
+            hashTable[hole] = hashTable[entry];
+            hashTable[entry].slot = NO_SLOT;
+            hole = entry;
+        }
+    }
+}
+
+void SwapStoreInitialize() {
+    if (!directTable.empty() || !hashTable.empty()) {
+        return;
+    }
+    if (USE_DIRECT_TABLE) {
+        directTable.assign(NUM_PAGES, NO_SLOT);
+    } else {
+        SlotTableEntry emptyEntry = {0, NO_SLOT};
+        hashTable.assign(INITIAL_HASH_TABLE_CAPACITY, emptyEntry);
+    }
+    for (SizeClass &sizeClass : sizeClasses) {
+        sizeClass.freeSlotsHead = NO_SLOT;
+    }
+}
+
+bool SwapStoreContains(uint64_t pageIdx) {
+    return LookupSlot(pageIdx) != NO_SLOT;
+}
+
+bool SwapStoreSave(uint64_t pageIdx, const word_t* page, uint64_t maxBytes) {
+    // the old copy is freed first, so its slot counts for the new copy:
+    FreeSlot(pageIdx, LookupSlot(pageIdx));
+    CounterAdd(&swapStoreCounters.savedPages, 1);
+
+    // only the codec is timed, not the dedup lookup or the bookkeeping of the slots.
+    // a page is only compressed if it fits a smaller class than a whole page, and is else kept in the largest class:
+    CODEC_TIMER_START();
+    bool isZero = AreWordsZero(page, PAGE_SIZE);
+    word_t buffer[PAGE_SIZE];
+    uint64_t length = (!isZero && (SWAP_SIZE_CLASSES > 1)) ?
+                      EncodePage(page, buffer, GetClassWords(SWAP_SIZE_CLASSES - 2)) : 0;
+    CODEC_TIMER_END(compressNs);
+    if (isZero) {
+        MapSlot(pageIdx, ZERO_PAGE_SLOT);
+        CounterAdd(&storedPages, 1);
+        CounterAdd(&swapStoreCounters.zeroPages, 1);
+        return true;
+    }
+
+    int sizeClass = (length > 0) ? FindSizeClass(length) : (SWAP_SIZE_CLASSES - 1);
+    const word_t* content = (length > 0) ? buffer : page;
+    uint64_t contentWords = (length > 0) ? length : PAGE_SIZE;
+    // a page that is identical to a page in a slot shares the slot, which takes no bytes, so it is never spilled:
+    uint64_t hash = swapDedupEnabled ? SwapStoreHashPage(page) : 0;
+    slot_t slot = swapDedupEnabled ? FindIdenticalSlot(hash, sizeClass, content, contentWords) : NO_SLOT;
+    if (slot != NO_SLOT) {
+        sizeClasses[sizeClass].slotRefs[GetSlotIndex(slot)]++;
+        MapSlot(pageIdx, slot);
+        CounterAdd(&storedPages, 1);
+        CounterAdd(&sharedSlotPages, 1);
+        CounterAdd(&sharedSlotBytes, GetClassBytes(sizeClass));
+        CounterAdd(&swapStoreCounters.dedupPages, 1);
+        return true;
+    }
+    if ((maxBytes != SWAP_STORE_UNLIMITED) && (storedBytes + GetClassBytes(sizeClass) > maxBytes)) {
+        MapSlot(pageIdx, SPILLED_SLOT);
+        CounterAdd(&swapStoreCounters.spilledPages, 1);
+        return false;
+    }
+    slot = AllocateSlot(sizeClass);
+    memcpy(GetSlot(slot), content, contentWords * sizeof(word_t));
+    MapSlot(pageIdx, slot);
+    if (swapDedupEnabled) {
+        sizeClasses[sizeClass].slotHashes[GetSlotIndex(slot)] = hash;
+        contentIndex.insert(std::make_pair(hash, slot));
+    }
+    CounterAdd(&swapStoreCounters.uncompressedBytes, PAGE_SIZE * sizeof(word_t));
+    CounterAdd(&swapStoreCounters.compressedBytes, GetClassBytes(sizeClass));
+    return true;
+}
+
+SwapLoadResult SwapStoreLoad(uint64_t pageIdx, word_t* page, bool keep) {
+    slot_t slot = LookupSlot(pageIdx);
+    if (slot == NO_SLOT) {
+        return SWAP_PAGE_MISSING;
+    }
+    if (IsCheckpointSlot(slot)) {
+        CheckpointLoadPage(slot & ~CHECKPOINT_SLOT_FLAG, page);
+    } else if (IsSharedFrameSlot(slot)) {
+        PMreadRange(GetSharedFrame(slot) * PAGE_SIZE, page, PAGE_SIZE);
+    } else if (slot != SPILLED_SLOT) {
+        CODEC_TIMER_START();
+        if (slot == ZERO_PAGE_SLOT) {
+            memset(page, 0, PAGE_SIZE * sizeof(word_t));
+        } else if (GetSlotClass(slot) == SWAP_SIZE_CLASSES - 1) {
+            memcpy(page, GetSlot(slot), PAGE_SIZE * sizeof(word_t));
+        } else {
+            DecodePage(GetSlot(slot), page);
+        }
+        CODEC_TIMER_END(decompressNs);
+    }
+    if (!keep) {
+        UnmapSlot(pageIdx);
+        FreeSlot(pageIdx, slot);
+    }
+    return (slot == SPILLED_SLOT) ? SWAP_PAGE_SPILLED : SWAP_PAGE_LOADED;
+}
+
+void SwapStoreMapCheckpointPage(uint64_t pageIdx, uint64_t dataPage) {
+    assert(dataPage < SWAP_MAX_CHECKPOINT_PAGES);
+    FreeSlot(pageIdx, LookupSlot(pageIdx));
+    MapSlot(pageIdx, CHECKPOINT_SLOT_FLAG | (slot_t) dataPage);
+}
+
+void SwapStoreSetDedup(bool enable) {
+    swapDedupEnabled = enable;
+    // the slots that were saved meanwhile are not in the index, so it starts over the next time:
+    if (!enable) {
+        contentIndex.clear();
+    }
+}
+
+void SwapStoreShareFrame(uint64_t pageIdx, uint64_t frameIdx) {
+    assert(frameIdx < NUM_FRAMES);
+    FreeSlot(pageIdx, LookupSlot(pageIdx));
+    if (frameSharers.empty()) {
+        frameSharers.resize(NUM_FRAMES);
+    }
+    frameSharers[frameIdx].push_back(pageIdx);
+    __atomic_store_n(&frameSharerCounts[frameIdx], (uint32_t) frameSharers[frameIdx].size(), __ATOMIC_RELAXED);
+    MapSlot(pageIdx, SHARED_FRAME_SLOT_FLAG | (slot_t) frameIdx);
+    CounterAdd(&storedPages, 1);
+    CounterAdd(&sharedFramePages, 1);
+}
+
+bool SwapStoreIsFrameShared(uint64_t frameIdx) {
+    return __atomic_load_n(&frameSharerCounts[frameIdx], __ATOMIC_RELAXED) != 0;
+}
+
+std::vector<uint64_t> SwapStoreFindFrameSharers(uint64_t frameIdx) {
+    return frameSharers.empty() ? std::vector<uint64_t>() : frameSharers[frameIdx];
+}
+
+bool SwapStoreFindSharedFrame(uint64_t pageIdx, uint64_t* frameIdx) {
+    // most pages share no frame, so the table is only looked up if some page does:
+    if (__atomic_load_n(&sharedFramePages, __ATOMIC_RELAXED) == 0) {
+        return false;
+    }
+    slot_t slot = LookupSlot(pageIdx);
+    if (!IsSharedFrameSlot(slot)) {
+        return false;
+    }
+    *frameIdx = GetSharedFrame(slot);
+    return true;
+}
+
+std::vector<uint64_t> SwapStoreFindPages(uint64_t firstPageIdx, uint64_t count) {
+    std::vector<uint64_t> pages;
+    if (USE_DIRECT_TABLE) {
+        for (uint64_t pageIdx = firstPageIdx; (pageIdx < directTable.size()) && (pageIdx - firstPageIdx < count);
+             pageIdx++) {
+            if (directTable[pageIdx] != NO_SLOT) {
+                pages.push_back(pageIdx);
+            }
+        }
+        return pages;
+    }
+    for (uint64_t entry = 0; entry < hashTable.size(); entry++) {
+        if ((hashTable[entry].slot != NO_SLOT) && (hashTable[entry].pageIdx - firstPageIdx < count)) {
+            pages.push_back(hashTable[entry].pageIdx);
+        }
+    }
+    return pages;
+}
+
+void SwapStoreMove(uint64_t firstPageIdx, uint64_t count, uint64_t firstTargetPageIdx) {
+    // the pages are collected first, since moving an entry of the hash table moves the entries after it:
+    for (uint64_t pageIdx : SwapStoreFindPages(firstPageIdx, count)) {
+        uint64_t targetPageIdx = firstTargetPageIdx + (pageIdx - firstPageIdx);
+        slot_t slot = LookupSlot(pageIdx);
+        UnmapSlot(pageIdx);
+        FreeSlot(targetPageIdx, LookupSlot(targetPageIdx));
+        MapSlot(targetPageIdx, slot);
+        if (IsSharedFrameSlot(slot)) {
+            std::vector<uint64_t> &sharers = frameSharers[GetSharedFrame(slot)];
+            *std::find(sharers.begin(), sharers.end(), pageIdx) = targetPageIdx;
+        }
+    }
+}
+
+void SwapStoreDiscard(uint64_t firstPageIdx, uint64_t count) {
+    // the pages are collected first, since removing an entry of the hash table moves the entries after it:
+    for (uint64_t pageIdx : SwapStoreFindPages(firstPageIdx, count)) {
+        FreeSlot(pageIdx, LookupSlot(pageIdx));
+        UnmapSlot(pageIdx);
+    }
+}
+
+void SwapStoreGetUsage(uint64_t* pages, uint64_t* bytes) {
+    *pages = __atomic_load_n(&storedPages, __ATOMIC_RELAXED);
+    *bytes = __atomic_load_n(&storedBytes, __ATOMIC_RELAXED);
+}
+
+void SwapStoreGetDedupUsage(uint64_t* framePages, uint64_t* slotPages, uint64_t* slotBytes) {
+    *framePages = __atomic_load_n(&sharedFramePages, __ATOMIC_RELAXED);
+    *slotPages = __atomic_load_n(&sharedSlotPages, __ATOMIC_RELAXED);
+    *slotBytes = __atomic_load_n(&sharedSlotBytes, __ATOMIC_RELAXED);
+}
+
+void SwapStoreGetCounters(SwapStoreCounters* counters) {
+    const uint64_t* source = (const uint64_t*) &swapStoreCounters;
+    uint64_t* target = (uint64_t*) counters;
+    for (uint64_t counter = 0; counter < sizeof(SwapStoreCounters) / sizeof(uint64_t); counter++) {
+        target[counter] = __atomic_load_n(&source[counter], __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "MemoryConstants.h"
+//#include "YaaraConstants.h"
+
+#include <vector>
+
+/*
+ * The swap store that keeps the evicted pages for PMevict and PMrestore, compressed.
+ * A page of zeroes is kept as a flag only. Any other page is compressed with a word-level codec, which encodes runs of
+ * words that go up (or down) by a constant step, including runs of a repeated word, and keeps the other words as they
+ * are. The compressed page is kept in a slot of the size class that fits it, and a page that does not compress is kept
+ * as it is in the largest class. Each size class is a slab arena of its own, whose slots are reused through a free
+ * list, and the pages are found through a page-index-to-slot table, so saving and loading a page allocates nothing
+ * once the arena has grown to the number of swapped pages.
+ * When the store is given a limit, a page that does not fit in it anymore is spilled: the store only records that the
+ * page is in the swap device, so the table of the store tells where every swapped page is. In the same way, a page that
+ * was restored by VMrestoreCheckpoint and not accessed since is only recorded as a data page of the checkpoint in use
+ * (see Checkpoint.h), which it is loaded from.
+ * With dedup on (see SwapStoreSetDedup), a saved page that is identical to a page in a slot shares that slot, which
+ * counts its pages, and a page can share the frame of an identical page that is in the RAM (see SwapStoreShareFrame):
+ * its slot only records the frame, which it is loaded from, so the page must leave the store before the frame changes.
+ */
+
+// number of page slots that are allocated together in one slab of the arena of a size class
+#ifndef SWAP_SLOTS_PER_SLAB
+#define SWAP_SLOTS_PER_SLAB 256
+#endif
+
+// number of size classes. class i keeps the pages that compress to (i + 1) / SWAP_SIZE_CLASSES of a page or less.
+#ifndef SWAP_SIZE_CLASSES
+#define SWAP_SIZE_CLASSES 8
+#endif
+
+// up to this many pages, the page-index-to-slot table is a direct array over NUM_PAGES (of each context).
+// above it, the table is an open-addressing hash map that grows with the number of swapped pages.
+#ifndef SWAP_DIRECT_TABLE_MAX_PAGES
+#define SWAP_DIRECT_TABLE_MAX_PAGES (1LL << 22)
+#endif
+
+// no limit on the bytes that the store keeps, see SwapStoreSave
+#define SWAP_STORE_UNLIMITED ((uint64_t) -1)
+
+// the number of data pages of a checkpoint that the slots of the store can tell apart, see SwapStoreMapCheckpointPage
+#define SWAP_MAX_CHECKPOINT_PAGES (1ULL << 30)
+
+/*
+ * Counters of the swap store since the process started.
+ */
+typedef struct {
+    // pages that were saved, pages of zeroes among them, which took no slot, pages that were spilled, and pages that
+    // shared the slot of an identical page, which took no slot of their own
+    uint64_t savedPages;
+    uint64_t zeroPages;
+    uint64_t spilledPages;
+    uint64_t dedupPages;
+    // bytes of the pages that were kept in slots, and of the slots they took, so their ratio is the compression ratio
+    uint64_t uncompressedBytes;
+    uint64_t compressedBytes;
+    // time spent in the codec compressing (including the check for a page of zeroes) and decompressing pages, in
+    // nanoseconds, without the dedup lookup. not measured in a build with VM_NO_STATS.
+    uint64_t compressNs;
+    uint64_t decompressNs;
+} SwapStoreCounters;
+
+/*
+ * The result of SwapStoreLoad.
+ */
+typedef enum {
+    SWAP_PAGE_MISSING,
+    SWAP_PAGE_LOADED,
+    SWAP_PAGE_SPILLED
+} SwapLoadResult;
+
+/*
+ * Prepares the slot table, if it was not prepared yet.
+ */
+void SwapStoreInitialize();
+
+/*
+ * returns true if the given page is in the swap store, even if it was spilled.
+ */
+bool SwapStoreContains(uint64_t pageIdx);
+
+/*
+ * Compresses the PAGE_SIZE words of 'page' into a slot of the given page, replacing its old copy.
+ * If the slot would make the slots of the store take more than maxBytes, the page is spilled instead.
+ * returns false if the page was spilled, so it must be saved in the swap device.
+ */
+bool SwapStoreSave(uint64_t pageIdx, const word_t* page, uint64_t maxBytes);
+
+/*
+ * Decompresses the given page into 'page'. Unless 'keep' is true, the page is removed from the swap store and its slot
+ * is freed.
+ * returns SWAP_PAGE_MISSING if the page is not in the swap store, and SWAP_PAGE_SPILLED if it is in the swap device, in
+ * both cases without touching 'page'.
+ */
+SwapLoadResult SwapStoreLoad(uint64_t pageIdx, word_t* page, bool keep);
+
+/*
+ * Records that the copy of the given page is the given data page of the checkpoint in use, replacing its old copy. The
+ * page takes no slot, and SwapStoreLoad loads it from the checkpoint.
+ */
+void SwapStoreMapCheckpointPage(uint64_t pageIdx, uint64_t dataPage);
+
+/*
+ * Turns the dedup of saved pages on or off. Pages that already share a slot or a frame keep sharing it.
+ */
+void SwapStoreSetDedup(bool enable);
+
+/*
+ * returns the hash of the PAGE_SIZE words of 'page', by which identical pages are found.
+ */
+uint64_t SwapStoreHashPage(const word_t* page);
+
+/*
+ * Records that the copy of the given page is the given frame, whose page is identical to it, replacing its old copy.
+ * The page takes no slot, and SwapStoreLoad loads it from the frame.
+ */
+void SwapStoreShareFrame(uint64_t pageIdx, uint64_t frameIdx);
+
+/*
+ * returns true if some page of the store shares the given frame.
+ */
+bool SwapStoreIsFrameShared(uint64_t frameIdx);
+
+/*
+ * returns the pages of the store that share the given frame.
+ */
+std::vector<uint64_t> SwapStoreFindFrameSharers(uint64_t frameIdx);
+
+/*
+ * returns true if the given page shares a frame, and puts the frame in frameIdx.
+ */
+bool SwapStoreFindSharedFrame(uint64_t pageIdx, uint64_t* frameIdx);
+
+/*
+ * returns the pages from firstPageIdx onwards, up to count of them, that are in the swap store, in no particular order.
+ */
+std::vector<uint64_t> SwapStoreFindPages(uint64_t firstPageIdx, uint64_t count);
+
+/*
+ * Removes the 'count' pages from firstPageIdx onwards from the swap store, and frees their slots.
+ */
+void SwapStoreDiscard(uint64_t firstPageIdx, uint64_t count);
+
+/*
+ * Moves the 'count' pages from firstPageIdx onwards to the pages from firstTargetPageIdx onwards, by moving their slots,
+ * so nothing is copied. A target page that is already in the swap store is replaced, and the ranges must not overlap.
+ */
+void SwapStoreMove(uint64_t firstPageIdx, uint64_t count, uint64_t firstTargetPageIdx);
+
+/*
+ * Puts the number of pages in the swap store (not counting the spilled ones) in 'pages', and the bytes that their
+ * slots take in 'bytes'.
+ */
+void SwapStoreGetUsage(uint64_t* pages, uint64_t* bytes);
+
+/*
+ * Puts the number of pages that share a frame in 'framePages', and the number of pages that share the slot of another
+ * page in 'slotPages', with the bytes that their slots would have taken in 'slotBytes'.
+ */
+void SwapStoreGetDedupUsage(uint64_t* framePages, uint64_t* slotPages, uint64_t* slotBytes);
+
+void SwapStoreGetCounters(SwapStoreCounters* counters);
@@ -0,0 +1,109 @@
+#include "Tlb.h"
+#include "VirtualMemory.h"
+#include "Stats.h"
+
+#ifdef VM_CONCURRENT
+// every thread has its own TLB. stale entries are caught by the validation of the translation under the frame lock:
+#define TLB_STORAGE thread_local
+#else
+#define TLB_STORAGE
+#endif
+
+#if TLB_NUM_ENTRIES > 0
+static_assert(TLB_ASSOCIATIVITY > 0 && TLB_NUM_ENTRIES % TLB_ASSOCIATIVITY == 0,
+              "TLB_NUM_ENTRIES must be a multiple of TLB_ASSOCIATIVITY");
+
+typedef struct {
+    bool valid;
+    uint64_t pageIdx;
+    word_t frameIdx;
+    uint64_t lastUse;
+} TlbEntry;
+
+TLB_STORAGE TlbEntry tlb[TLB_NUM_SETS][TLB_ASSOCIATIVITY];
+TLB_STORAGE uint64_t tlbClock = 0;
+#endif
+
+// the hits and misses are counted per thread in the statistics (see Stats.h), and VMgetTlbStats reports them since
+// the last TlbInitialize:
+uint64_t tlbHitsBaseline = 0;
+uint64_t tlbMissesBaseline = 0;
+
+void TlbInitialize() {
+#if TLB_NUM_ENTRIES > 0
+    for (uint64_t set = 0; set < TLB_NUM_SETS; set++) {
+        for (int way = 0; way < TLB_ASSOCIATIVITY; way++) {
+            tlb[set][way].valid = false;
+        }
+    }
+    tlbClock = 0;
+#endif
+    VMstats totals;
+    StatsGetTotals(&totals);
+    tlbHitsBaseline = totals.tlbHits;
+    tlbMissesBaseline = totals.tlbMisses;
+}
+
+bool TlbLookup(uint64_t pageIdx, word_t *frameIdx) {
+#if TLB_NUM_ENTRIES > 0
+    TlbEntry *set = tlb[pageIdx % TLB_NUM_SETS];
+    for (int way = 0; way < TLB_ASSOCIATIVITY; way++) {
+        if (set[way].valid && set[way].pageIdx == pageIdx) {
+            set[way].lastUse = ++tlbClock;
+            *frameIdx = set[way].frameIdx;
+            STATS_ADD(tlbHits, 1);
+            return true;
+        }
+    }
+#endif
+    STATS_ADD(tlbMisses, 1);
+    return false;
+}
+
+void TlbInsert(uint64_t pageIdx, word_t frameIdx) {
+#if TLB_NUM_ENTRIES > 0
+    TlbEntry *set = tlb[pageIdx % TLB_NUM_SETS];
+    // prefers an invalid way, and otherwise replaces the least recently used one:
+    int victimWay = 0;
+    for (int way = 0; way < TLB_ASSOCIATIVITY; way++) {
+        if (!set[way].valid) {
+            victimWay = way;
+            break;
+        }
+        if (set[way].lastUse < set[victimWay].lastUse) {
+            victimWay = way;
+        }
+    }
+    set[victimWay].valid = true;
+    set[victimWay].pageIdx = pageIdx;
+    set[victimWay].frameIdx = frameIdx;
+    set[victimWay].lastUse = ++tlbClock;
+#else
+    (void) pageIdx;
+    (void) frameIdx;
+#endif
+}
+
+void TlbInvalidatePage(uint64_t pageIdx) {
+#if TLB_NUM_ENTRIES > 0
+    TlbEntry *set = tlb[pageIdx % TLB_NUM_SETS];
+    for (int way = 0; way < TLB_ASSOCIATIVITY; way++) {
+        if (set[way].valid && set[way].pageIdx == pageIdx) {
+            set[way].valid = false;
+        }
+    }
+#else
+    (void) pageIdx;
+#endif
+}
+
+void VMgetTlbStats(uint64_t *hits, uint64_t *misses) {
+    VMstats totals;
+    StatsGetTotals(&totals);
+    if (hits != nullptr) {
+        *hits = totals.tlbHits - tlbHitsBaseline;
+    }
+    if (misses != nullptr) {
+        *misses = totals.tlbMisses - tlbMissesBaseline;
+    }
+}
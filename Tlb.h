@@ -0,0 +1,41 @@
+#pragma once
+
+#include "MemoryConstants.h"
+//#include "YaaraConstants.h"
+
+// number of entries in the TLB (0 disables the TLB)
+#ifndef TLB_NUM_ENTRIES
+#define TLB_NUM_ENTRIES 64
+#endif
+
+// number of entries in each TLB set (TLB_NUM_ENTRIES for a fully associative TLB)
+#ifndef TLB_ASSOCIATIVITY
+#define TLB_ASSOCIATIVITY 4
+#endif
+
+#if TLB_NUM_ENTRIES > 0
+#define TLB_NUM_SETS (TLB_NUM_ENTRIES / TLB_ASSOCIATIVITY)
+#endif
+
+/*
+ * Clears all of the TLB entries and resets the hit and miss counters.
+ * In a VM_CONCURRENT build every thread has its own TLB, and only the TLB of the calling thread is cleared.
+ */
+void TlbInitialize();
+
+/*
+ * Looks for the frame that holds the given page.
+ * returns true and puts the frame index in 'frameIdx' on a hit, false on a miss.
+ */
+bool TlbLookup(uint64_t pageIdx, word_t *frameIdx);
+
+/*
+ * Caches the translation of the given page to the given frame, replacing the least recently used entry of its set.
+ */
+void TlbInsert(uint64_t pageIdx, word_t frameIdx);
+
+/*
+ * Drops the translation of the given page, if it is cached.
+ * Must be called whenever the page stops being mapped to its frame.
+ */
+void TlbInvalidatePage(uint64_t pageIdx);
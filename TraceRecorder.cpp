@@ -0,0 +1,347 @@
+#include "TraceRecorder.h"
+#include "AddressSpace.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// the most bytes that a record takes, apart from the values of TRACE_VM_WRITE_RANGE:
+#define MAX_RECORD_BYTES (1 + (3 * 10))
+#define MAX_VARINT_BYTES 10
+
+#ifdef VM_CONCURRENT
+typedef std::mutex TraceMutex;
+#else
+// without VM_CONCURRENT only a single thread records, so there is nothing to guard:
+typedef struct {
+    void lock() {}
+
+    void unlock() {}
+} TraceMutex;
+#endif
+
+typedef struct {
+    int fd;
+    // guards the buffers, between the recording threads and the writer thread:
+    std::mutex queueMutex;
+    // signalled whenever a buffer is queued, written, or the writer thread should stop:
+    std::condition_variable cond;
+    std::deque<std::pair<uint8_t*, size_t> > fullBuffers;
+    std::vector<uint8_t*> freeBuffers;
+    bool stop;
+    bool failed;
+    std::thread writer;
+    // the buffer that records are encoded into, which only the holder of recordMutex touches:
+    uint8_t* current;
+    size_t currentSize;
+    uint64_t lastVirtualAddress;
+    uint64_t lastPhysicalAddress;
+    // the address space of the previous access, or -1 if a replay may not be in it:
+    int lastAddressSpace;
+} TraceState;
+
+bool traceRecordingVirtual = false;
+bool traceRecordingPhysical = false;
+
+// serialises the records, so each one is encoded whole and the deltas follow the order in the file:
+TraceMutex recordMutex;
+TraceState* trace = nullptr;
+
+/**
+ * Writes a whole buffer to the trace file, retrying partial writes.
+ * @return false on an I/O error.
+ */
+bool WriteTraceBuffer(int fd, const uint8_t* buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t result = write(fd, buffer + done, size - done);
+        if ((result < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (result <= 0) {
+            fprintf(stderr, "trace write failed: %s\n", (result < 0) ? strerror(errno) : "nothing written");
+            return false;
+        }
+        done += result;
+    }
+    return true;
+}
+
+void TraceWriterThread(TraceState* state) {
+    std::unique_lock<std::mutex> lock(state->queueMutex);
+    while (true) {
+        state->cond.wait(lock, [state]() { return state->stop || !state->fullBuffers.empty(); });
+        if (state->fullBuffers.empty()) {
+            return;
+        }
+        std::pair<uint8_t*, size_t> buffer = state->fullBuffers.front();
+        state->fullBuffers.pop_front();
+
+        lock.unlock();
+        // after a failure the trace is incomplete anyway, so the rest is dropped:
+        bool written = !state->failed && WriteTraceBuffer(state->fd, buffer.first, buffer.second);
+        lock.lock();
+        state->failed = state->failed || !written;
+        state->freeBuffers.push_back(buffer.first);
+        state->cond.notify_all();
+    }
+}
+
+/**
+ * Hands the current buffer to the writer thread, and takes a free one, waiting for the writer if there is none.
+ */
+void SubmitTraceBuffer() {
+    std::unique_lock<std::mutex> lock(trace->queueMutex);
+    trace->fullBuffers.push_back(std::make_pair(trace->current, trace->currentSize));
+    trace->cond.notify_all();
+    trace->cond.wait(lock, []() { return !trace->freeBuffers.empty(); });
+    trace->current = trace->freeBuffers.back();
+    trace->freeBuffers.pop_back();
+    trace->currentSize = 0;
+}
+
+void EnsureTraceSpace(size_t bytes) {
+    if ((TRACE_BUFFER_SIZE - trace->currentSize) < bytes) {
+        SubmitTraceBuffer();
+    }
+}
+
+void PutByte(uint8_t byte) {
+    trace->current[trace->currentSize++] = byte;
+}
+
+void PutVarint(uint64_t value) {
+    while (value >= 0x80) {
+        PutByte((uint8_t) (value | 0x80));
+        value >>= 7;
+    }
+    PutByte((uint8_t) value);
+}
+
+uint64_t ZigZag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+void PutDelta(uint64_t *lastAddress, uint64_t address) {
+    PutVarint(ZigZag((int64_t) (address - *lastAddress)));
+    *lastAddress = address;
+}
+
+/**
+ * Starts a record of up to MAX_RECORD_BYTES.
+ * @return false if nothing is recorded (a concurrent TraceClose may have won the race for recordMutex).
+ */
+bool BeginRecord(TraceOpcode opcode) {
+    if (trace == nullptr) {
+        return false;
+    }
+    EnsureTraceSpace(MAX_RECORD_BYTES);
+    PutByte((uint8_t) opcode);
+    return true;
+}
+
+/**
+ * Starts the record of an access to the virtual memory, after a TRACE_VM_SWITCH_ADDRESS_SPACE if the current address
+ * space of the calling thread is not the one of the previous access.
+ * @return false if nothing is recorded.
+ */
+bool BeginAccessRecord(TraceOpcode opcode) {
+    if (trace == nullptr) {
+        return false;
+    }
+    int addressSpace = GetCurrentAddressSpace();
+    if (addressSpace != trace->lastAddressSpace) {
+        BeginRecord(TRACE_VM_SWITCH_ADDRESS_SPACE);
+        PutVarint((uint64_t) addressSpace);
+        trace->lastAddressSpace = addressSpace;
+    }
+    return BeginRecord(opcode);
+}
+
+void CloseTraceAtExit() {
+    TraceClose();
+}
+
+bool TraceOpen(const char* path, bool recordPhysical) {
+    std::lock_guard<TraceMutex> recordLock(recordMutex);
+    if (trace != nullptr) {
+        return false;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    trace = new TraceState();
+    trace->fd = fd;
+    trace->stop = false;
+    trace->failed = false;
+    for (int buffer = 0; buffer < TRACE_NUM_BUFFERS; buffer++) {
+        trace->freeBuffers.push_back(new uint8_t[TRACE_BUFFER_SIZE]);
+    }
+    trace->current = trace->freeBuffers.back();
+    trace->freeBuffers.pop_back();
+    trace->currentSize = 0;
+    trace->lastVirtualAddress = 0;
+    trace->lastPhysicalAddress = 0;
+    trace->lastAddressSpace = 0;
+    trace->writer = std::thread(TraceWriterThread, trace);
+
+    TraceHeader header = {TRACE_MAGIC, TRACE_VERSION, OFFSET_WIDTH, PHYSICAL_ADDRESS_WIDTH, VIRTUAL_ADDRESS_WIDTH,
+                          (uint8_t) (recordPhysical ? 1 : 0)};
+    memcpy(trace->current, &header, sizeof(header));
+    trace->currentSize = sizeof(header);
+
+    // the records must be in the file before exit destroys the state that the writer thread uses:
+    static bool closeAtExitRegistered = false;
+    if (!closeAtExitRegistered) {
+        closeAtExitRegistered = true;
+        atexit(CloseTraceAtExit);
+    }
+    __atomic_store_n(&traceRecordingPhysical, recordPhysical, __ATOMIC_RELAXED);
+    __atomic_store_n(&traceRecordingVirtual, true, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool TraceClose() {
+    TraceState* state;
+    {
+        std::lock_guard<TraceMutex> recordLock(recordMutex);
+        if (trace == nullptr) {
+            return false;
+        }
+        __atomic_store_n(&traceRecordingVirtual, false, __ATOMIC_RELAXED);
+        __atomic_store_n(&traceRecordingPhysical, false, __ATOMIC_RELAXED);
+        state = trace;
+        trace = nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state->queueMutex);
+        state->fullBuffers.push_back(std::make_pair(state->current, state->currentSize));
+        state->stop = true;
+        state->cond.notify_all();
+    }
+    state->writer.join();
+    bool written = !state->failed;
+    if (close(state->fd) != 0) {
+        written = false;
+    }
+    for (uint8_t* buffer : state->freeBuffers) {
+        delete[] buffer;
+    }
+    delete state;
+    return written;
+}
+
+void TraceRecordInitialize(int policy) {
+    std::lock_guard<TraceMutex> recordLock(recordMutex);
+    if (BeginRecord(TRACE_VM_INITIALIZE)) {
+        PutVarint((uint64_t) policy);
+        // a replay is in address space 0 after the initialization, which may not be where the recording starts:
+        trace->lastAddressSpace = 0;
+    }
+}
+
+void TraceRecordRead(uint64_t virtualAddress) {
+    std::lock_guard<TraceMutex> recordLock(recordMutex);
+    if (BeginAccessRecord(TRACE_VM_READ)) {
+        PutDelta(&trace->lastVirtualAddress, virtualAddress);
+    }
+}
+
+void TraceRecordWrite(uint64_t virtualAddress, word_t value) {
+    std::lock_guard<TraceMutex> recordLock(recordMutex);
+    if (BeginAccessRecord(TRACE_VM_WRITE)) {
+        PutDelta(&trace->lastVirtualAddress, virtualAddress);
+        PutVarint(ZigZag(value));
+    }
+}
+
+void TraceRecordReadRange(uint64_t virtualAddress, uint64_t count) {
+    std::lock_guard<TraceMutex> recordLock(recordMutex);
+    if (BeginAccessRecord(TRACE_VM_READ_RANGE)) {
+        PutDelta(&trace->lastVirtualAddress, virtualAddress);
+        PutVarint(count);
+    }
+}
+
+void TraceRecordWriteRange(uint64_t virtualAddress, const word_t* values, uint64_t count) {
+    std::lock_guard<TraceMutex> recordLock(recordMutex);
+    if (BeginAccessRecord(TRACE_VM_WRITE_RANGE)) {
+        PutDelta(&trace->lastVirtualAddress, virtualAddress);
+        PutVarint(count);
+        for (uint64_t i = 0; i < count; i++) {
+            EnsureTraceSpace(MAX_VARINT_BYTES);
+            PutVarint(ZigZag(values[i]));
+        }
+    }
+}
+
+void TraceRecordFill(uint64_t virtualAddress, word_t value, uint64_t count) {
+    std::lock_guard<TraceMutex> recordLock(recordMutex);
+    if (BeginAccessRecord(TRACE_VM_FILL)) {
+        PutDelta(&trace->lastVirtualAddress, virtualAddress);
+        PutVarint(count);
+        PutVarint(ZigZag(value));
+    }
+}
+
+void TraceRecordCopy(uint64_t dstVirtualAddress, uint64_t srcVirtualAddress, uint64_t count) {
+    std::lock_guard<TraceMutex> recordLock(recordMutex);
+    if (BeginAccessRecord(TRACE_VM_COPY)) {
+        PutDelta(&trace->lastVirtualAddress, dstVirtualAddress);
+        PutVarint(ZigZag((int64_t) (srcVirtualAddress - dstVirtualAddress)));
+        PutVarint(count);
+    }
+}
+
+void TraceRecordAdvise(uint64_t virtualAddress, uint64_t count, int advice) {
+    std::lock_guard<TraceMutex> recordLock(recordMutex);
+    if (BeginAccessRecord(TRACE_VM_ADVISE)) {
+        PutDelta(&trace->lastVirtualAddress, virtualAddress);
+        PutVarint(count);
+        PutVarint((uint64_t) advice);
+    }
+}
+
+void TraceRecordAddressSpace(TraceOpcode opcode, int addressSpace) {
+    std::lock_guard<TraceMutex> recordLock(recordMutex);
+    // a fork is of the current address space of the calling thread, like an access:
+    bool begun = (opcode == TRACE_VM_FORK_ADDRESS_SPACE) ? BeginAccessRecord(opcode) : BeginRecord(opcode);
+    if (begun) {
+        PutVarint((uint64_t) addressSpace);
+        // a replay leaves an address space that it destroys, like the recording thread must have:
+        if ((opcode == TRACE_VM_DESTROY_ADDRESS_SPACE) && (addressSpace == trace->lastAddressSpace)) {
+            trace->lastAddressSpace = -1;
+        }
+    }
+}
+
+void TraceRecordPmAccess(TraceOpcode opcode, uint64_t physicalAddress, word_t value) {
+    std::lock_guard<TraceMutex> recordLock(recordMutex);
+    if (BeginRecord(opcode)) {
+        PutDelta(&trace->lastPhysicalAddress, physicalAddress);
+        if (opcode == TRACE_PM_WRITE) {
+            PutVarint(ZigZag(value));
+        }
+    }
+}
+
+void TraceRecordPmPage(TraceOpcode opcode, uint64_t frameIdx, uint64_t pageIdx) {
+    std::lock_guard<TraceMutex> recordLock(recordMutex);
+    if (BeginRecord(opcode)) {
+        PutVarint(frameIdx);
+        PutVarint(pageIdx);
+    }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "MemoryConstants.h"
+//#include "YaaraConstants.h"
+
+/*
+ * Records the accesses to the virtual memory, and optionally the physical memory operations, to a binary trace file.
+ * Records are encoded into large buffers, which a writer thread writes to the file in the background.
+ *
+ * The file starts with a TraceHeader, followed by the records. A record is an opcode byte followed by its operands,
+ * each an unsigned LEB128 varint. An address is encoded as the zigzag encoded delta from the previous address of the
+ * same record kind (virtual or physical), and a value is zigzag encoded, so nearby addresses and small values take a
+ * byte or two. Records may span the buffers, which are only chunks of one byte stream.
+ */
+
+#define TRACE_MAGIC 0x52544d56
+// version 2 added the address space records, version 3 the fork records, and version 4 the advice records, so an older
+// trace is also a valid trace of a newer version:
+#define TRACE_VERSION 4
+
+// the size of a buffer, and the number of buffers. recording blocks while all of them wait for the writer thread.
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE (1 << 20)
+#endif
+#ifndef TRACE_NUM_BUFFERS
+#define TRACE_NUM_BUFFERS 4
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    // the geometry of the recording build, which a replay must match:
+    uint8_t offsetWidth;
+    uint8_t physicalAddressWidth;
+    uint8_t virtualAddressWidth;
+    // whether the physical memory operations were recorded:
+    uint8_t recordsPhysical;
+} TraceHeader;
+
+/*
+ * The opcodes of the records, with their operands.
+ */
+typedef enum {
+    // policy
+    TRACE_VM_INITIALIZE = 1,
+    // address
+    TRACE_VM_READ = 2,
+    // address, value
+    TRACE_VM_WRITE = 3,
+    // address, count
+    TRACE_VM_READ_RANGE = 4,
+    // address, count, count values
+    TRACE_VM_WRITE_RANGE = 5,
+    // address, count, value
+    TRACE_VM_FILL = 6,
+    // destination address, source address (as a delta from the destination), count
+    TRACE_VM_COPY = 7,
+    // address space, which the accesses after it are in. recorded before an access that is in another address space
+    // than the previous one, since each thread has its own current address space
+    TRACE_VM_SWITCH_ADDRESS_SPACE = 8,
+    // the address space that was created
+    TRACE_VM_CREATE_ADDRESS_SPACE = 9,
+    // address space
+    TRACE_VM_DESTROY_ADDRESS_SPACE = 10,
+    // the address space that was forked from the current one
+    TRACE_VM_FORK_ADDRESS_SPACE = 11,
+    // address, count, advice
+    TRACE_VM_ADVISE = 12,
+    // physical address
+    TRACE_PM_READ = 16,
+    // physical address, value
+    TRACE_PM_WRITE = 17,
+    // frame, page
+    TRACE_PM_EVICT = 18,
+    TRACE_PM_RESTORE = 19
+} TraceOpcode;
+
+// whether the accesses to the virtual (or physical) memory are being recorded, checked on every access:
+extern bool traceRecordingVirtual;
+extern bool traceRecordingPhysical;
+
+inline bool TraceIsRecordingVirtual() {
+    return __atomic_load_n(&traceRecordingVirtual, __ATOMIC_RELAXED);
+}
+
+inline bool TraceIsRecordingPhysical() {
+    return __atomic_load_n(&traceRecordingPhysical, __ATOMIC_RELAXED);
+}
+
+/*
+ * Creates (or truncates) the trace file at the given path, and starts recording.
+ * returns false if the file cannot be opened, or if a recording is already in progress.
+ */
+bool TraceOpen(const char* path, bool recordPhysical);
+
+/*
+ * Stops recording, and waits until all of the records are in the file.
+ * returns false if writing the file failed (or if nothing was recorded), in which case the trace is incomplete.
+ */
+bool TraceClose();
+
+void TraceRecordInitialize(int policy);
+
+void TraceRecordRead(uint64_t virtualAddress);
+
+void TraceRecordWrite(uint64_t virtualAddress, word_t value);
+
+void TraceRecordReadRange(uint64_t virtualAddress, uint64_t count);
+
+void TraceRecordWriteRange(uint64_t virtualAddress, const word_t* values, uint64_t count);
+
+void TraceRecordFill(uint64_t virtualAddress, word_t value, uint64_t count);
+
+void TraceRecordCopy(uint64_t dstVirtualAddress, uint64_t srcVirtualAddress, uint64_t count);
+
+void TraceRecordAdvise(uint64_t virtualAddress, uint64_t count, int advice);
+
+/*
+ * Records a TRACE_VM_CREATE_ADDRESS_SPACE, TRACE_VM_DESTROY_ADDRESS_SPACE or TRACE_VM_FORK_ADDRESS_SPACE.
+ */
+void TraceRecordAddressSpace(TraceOpcode opcode, int addressSpace);
+
+/*
+ * Records a TRACE_PM_READ or TRACE_PM_WRITE (value is ignored for a read).
+ */
+void TraceRecordPmAccess(TraceOpcode opcode, uint64_t physicalAddress, word_t value);
+
+/*
+ * Records a TRACE_PM_EVICT or TRACE_PM_RESTORE.
+ */
+void TraceRecordPmPage(TraceOpcode opcode, uint64_t frameIdx, uint64_t pageIdx);
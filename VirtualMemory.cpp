@@ -1,242 +1,1910 @@
 #include "VirtualMemory.h"
 #include "PhysicalMemory.h"
+#include "Tlb.h"
+#include "PagingStructureCache.h"
+#include "AddressSpace.h"
+#include "FrameTable.h"
+#include "Geometry.h"
+#include "ReplacementPolicy.h"
+#include "Readahead.h"
+#include "Stats.h"
+#include "TraceRecorder.h"
+#include "Checkpoint.h"
 
-#define FRAME0_ADDRESS_WIDTH (VIRTUAL_ADDRESS_WIDTH - OFFSET_WIDTH - (OFFSET_WIDTH*(TABLES_DEPTH - 1)))
-#define FRAME0_USED_SIZE (1LL << FRAME0_ADDRESS_WIDTH)
+#include <algorithm>
+#include <utility>
+#include <vector>
 
-typedef struct {
-    bool foundEmpty;
-    word_t maxFrameIdx;
-    uint64_t maxCyclicDist;
-    word_t resultFrameIdx;
-    word_t resultFrameParentIdx;
-    uint64_t resultFrameOffsetInParent;
-    uint64_t resultPageIdx;
-} DfsData;
+#ifdef VM_CONCURRENT
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cstdlib>
+#endif
+
+// the shifts and masks of the translation are those of CompiledGeometry, which are compile time constants:
+#define FRAME0_USED_SIZE (1ULL << CompiledGeometry::Frame0AddressWidth())
+// the number of frames that the reclaimer evicts before it zeroes them without holding faultMutex:
+#define RECLAIMER_BATCH_SIZE 16
+// set in an entry on level TABLES_DEPTH - 1 that points to the first frame of a huge page, instead of to a leaf table:
+#define HUGE_PAGE_FLAG ((word_t) 1 << (WORD_WIDTH - 2))
+
+static_assert(NUM_FRAMES < HUGE_PAGE_FLAG, "a frame index must not collide with HUGE_PAGE_FLAG");
+
+ReplacementPolicy *replacementPolicy = nullptr;
+PageReplacementPolicy replacementPolicyType = CYCLIC_DISTANCE_POLICY;
+uint64_t pageFaultCount = 0;
+uint64_t cleanEvictionCount = 0;
+uint64_t dirtyEvictionCount = 0;
+// the page of the last page fault, which the reclaimer chooses its victims for:
+uint64_t lastFaultPageIdx = 0;
+uint64_t reclaimedFrameCount = 0;
+uint64_t freeFrameAllocationCount = 0;
+uint64_t reclaimerMissCount = 0;
+bool hugePagesEnabled = false;
+bool dedupEnabled = false;
 
 uint64_t GetIndexInRam(word_t frameIdx, uint64_t offset) {
-    return (frameIdx * PAGE_SIZE) + offset;
+    return (frameIdx * CompiledGeometry::PageSize()) + offset;
 }
 
 uint64_t GetPi(uint64_t virtualAddress, int index) {
-    if (index == 1) {
-        uint64_t mask = FRAME0_USED_SIZE - 1;
-        return (virtualAddress >> (VIRTUAL_ADDRESS_WIDTH - FRAME0_ADDRESS_WIDTH)) & mask;
-    }
-
-    // creates a mask with log2(PAGE_SIZE) bits turned on, on the right:
-    uint64_t mask = PAGE_SIZE - 1;
-    // shifts the virtualAddress to the right according to the index given and activates the mask:
-    return (virtualAddress >> (VIRTUAL_ADDRESS_WIDTH - FRAME0_ADDRESS_WIDTH - (OFFSET_WIDTH * (index - 1)))) &
-           mask;
+    return GeometryPi(CompiledGeometry(), virtualAddress, index);
 }
 
 uint64_t GetOffset(uint64_t virtualAddress) {
-    // creates a mask with OFFSET_WIDTH bits turned on, on the right:
-    uint64_t mask = (1LL << OFFSET_WIDTH) - 1;
-    // activates the mask:
-    return virtualAddress & mask;
+    return virtualAddress & (CompiledGeometry::PageSize() - 1);
 }
 
 uint64_t GetPageIdx(uint64_t virtualAddress) {
-    return virtualAddress >> OFFSET_WIDTH;
+    return virtualAddress >> CompiledGeometry::OffsetWidth();
+}
+
+bool IsHugePageEntry(word_t entry) {
+    return (entry & HUGE_PAGE_FLAG) != 0;
+}
+
+/**
+ * @return the frame of the page of virtualAddress, in the huge page that the given entry points to.
+ */
+word_t GetHugePageFrame(word_t entry, uint64_t virtualAddress) {
+    return (entry & ~HUGE_PAGE_FLAG) + (word_t) GetPi(virtualAddress, TABLES_DEPTH);
+}
+
+/**
+ * @return the page index accumulated along the path to the table entry of the given level, which is the cumulative
+ *         page index of the frame that this entry points to.
+ */
+uint64_t GetCumulativePageIdx(uint64_t virtualAddress, int level) {
+    return GeometryCumulativePageIdx(CompiledGeometry(), virtualAddress, level);
+}
+
+#ifdef VM_CONCURRENT
+// serialises the page faults, which are the only changes of the page table and of the frame bookkeeping:
+std::mutex faultMutex;
+// a spin lock per frame. a frame is locked while its page is accessed, and while it is taken for another node:
+std::atomic<bool> frameLocks[NUM_FRAMES];
+
+void LockFrame(word_t frameIdx) {
+    while (frameLocks[frameIdx].exchange(true, std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+}
+
+void UnlockFrame(word_t frameIdx) {
+    frameLocks[frameIdx].store(false, std::memory_order_release);
+}
+
+// the reclaimer thread, and its state. all of it is guarded by faultMutex:
+std::thread *reclaimerThread = nullptr;
+std::condition_variable reclaimerWakeup;
+bool reclaimerStop = false;
+uint64_t reclaimerLowWatermark = 0;
+uint64_t reclaimerHighWatermark = 0;
+
+bool IsReclaimerRunning() {
+    return reclaimerThread != nullptr;
 }
 
-uint64_t updateCumulativePageIdx(uint64_t cumulativePageIdx, uint64_t offset, bool isFrame0) {
-    if (isFrame0){
-        return (cumulativePageIdx << FRAME0_ADDRESS_WIDTH) + offset;
+// the dedup scanner thread, and its state. all of it is guarded by faultMutex:
+std::thread *dedupScannerThread = nullptr;
+std::condition_variable dedupScannerWakeup;
+bool dedupScannerStop = false;
+uint64_t dedupScanIntervalMs = 0;
+
+/**
+ * A page is only evicted ahead of time once the RAM is full, and while there is a page to evict.
+ */
+bool CanReclaim() {
+    return !HasUnusedFrame() && (GetNumResidentPages() > 0);
+}
+
+void WakeReclaimerIfNeeded() {
+    if (IsReclaimerRunning() && (GetNumFreeFrames() < reclaimerLowWatermark) && CanReclaim()) {
+        reclaimerWakeup.notify_one();
     }
-    return (cumulativePageIdx << OFFSET_WIDTH) + offset;
+}
+#else
+void LockFrame(word_t frameIdx) {
+    (void) frameIdx;
 }
 
-uint64_t calculateCyclicDistance(uint64_t pageIdx1, uint64_t pageIdx2) {
-    uint64_t dist1 = (pageIdx1 > pageIdx2) ? (pageIdx1 - pageIdx2) : (pageIdx2 - pageIdx1);
-    uint64_t dist2 = NUM_PAGES - dist1;
-    return (dist1 > dist2) ? dist2 : dist1;
+void UnlockFrame(word_t frameIdx) {
+    (void) frameIdx;
 }
 
-void InitFrame(word_t frameIdx, bool initPage, uint64_t pageIdx) {
-    if (initPage) {
-        PMrestore(frameIdx, pageIdx);
-    } else {
-        for (uint64_t offset = 0; offset < PAGE_SIZE; offset++) {
-            PMwrite((frameIdx * PAGE_SIZE) + offset, 0);
+bool IsReclaimerRunning() {
+    return false;
+}
+
+void WakeReclaimerIfNeeded() {
+}
+#endif
+
+/**
+ * Walks the page table of the context of the given tagged address without handling page faults, and without caching
+ * the tables it passes.
+ * @return the frame that holds the page of virtualAddress, or 0 if the page is not resident.
+ */
+word_t FindResidentFrame(uint64_t virtualAddress) {
+    word_t currFrameIdx = GetContextRoot(GetContextOfPage(GetPageIdx(virtualAddress)));
+    for (int level = 1; level <= TABLES_DEPTH; level++) {
+        PMread(GetIndexInRam(currFrameIdx, GetPi(virtualAddress, level)), &currFrameIdx);
+        if (IsHugePageEntry(currFrameIdx)) {
+            return GetHugePageFrame(currFrameIdx, virtualAddress);
+        }
+        if (currFrameIdx == 0) {
+            return 0;
         }
     }
+    return currFrameIdx;
 }
 
 /**
- * Change the parentData according to the priority noted in the pdf
+ * Copies the page of the given snapshot into frameIdx, from its frame if it is resident, and else from the swap file.
+ * @param pageIdx The page that is copied, tagged with the context that shares it with the snapshot.
  */
-void UpdateDfsData(DfsData &childData, DfsData &parentData) {
-    if (childData.foundEmpty) {
-        parentData = childData;
+void CopySnapshotPage(word_t frameIdx, uint64_t pageIdx, int snapshot) {
+    uint64_t snapshotAddress = RetagAddress(snapshot, pageIdx << OFFSET_WIDTH);
+    word_t snapshotFrameIdx = FindResidentFrame(snapshotAddress);
+    if (snapshotFrameIdx == 0) {
+        PMrestoreKeepSwap(frameIdx, GetPageIdx(snapshotAddress));
         return;
     }
-    if (childData.maxFrameIdx > parentData.maxFrameIdx) {
-        parentData.maxFrameIdx = childData.maxFrameIdx;
+    word_t buffer[PAGE_SIZE];
+    PMreadRange(GetIndexInRam(snapshotFrameIdx, 0), buffer, PAGE_SIZE);
+    PMwriteRange(GetIndexInRam(frameIdx, 0), buffer, PAGE_SIZE);
+}
+
+/**
+ * Initializes a frame that was just linked: a page is copied from the given snapshot if it is not -1, or else restored
+ * from the swap file, and a table is zeroed unless the frame is known to hold zeroes already.
+ */
+void InitFrame(word_t frameIdx, bool initPage, uint64_t pageIdx, bool isZeroed, int snapshot = -1) {
+    if (initPage && (snapshot >= 0)) {
+        // the copy is the first version of the page in its context, and has no copy in the swap file yet:
+        CopySnapshotPage(frameIdx, pageIdx, snapshot);
+        SetFrameDirty(frameIdx, true);
+        STATS_ADD(copyOnWriteFaults, 1);
+    } else if (initPage && (PMfindSharedFrame(pageIdx) != 0)) {
+        // a merged page (see DedupScan) that takes a frame of its own stops sharing the frame of the other page, which
+        // is not a copy that it can be dropped back to, so it is dirty:
+        PMrestore(frameIdx, pageIdx);
+        SetFrameDirty(frameIdx, true);
+        STATS_ADD(swapRestores, 1);
+    } else if (initPage) {
+        // the swap file keeps its copy of the page, so the page is clean unless it had no copy to restore:
+        bool restored = PMrestoreKeepSwap(frameIdx, pageIdx);
+        SetFrameDirty(frameIdx, !restored);
+        if (restored) {
+            STATS_ADD(swapRestores, 1);
+        } else {
+            STATS_ADD(neverEvictedRestores, 1);
+        }
+    } else if (!isZeroed) {
+        PMzeroFrame(frameIdx);
+    }
+}
+
+/**
+ * Tells the replacement policy and the readahead detector that the page in frameIdx was accessed.
+ */
+void OnPageAccessed(word_t frameIdx) {
+    replacementPolicy->OnPageAccessed(frameIdx);
+    ReadaheadOnAccess(frameIdx);
+}
+
+/**
+ * Copies the pages that were merged into frameIdx (see DedupScan) out of it, so the frame can be written or taken.
+ */
+void UnshareFrame(word_t frameIdx) {
+    PMunshareFrame(frameIdx);
+    STATS_ADD(dedupUnsharedFrames, 1);
+}
+
+/**
+ * Removes the node in frameIdx from the page table. A table is forgotten by the paging-structure cache. A page is
+ * forgotten by the replacement policy and the TLB, and is written back to the swap file if it is dirty, unless
+ * writeBack is false because the page is dropped with its address space. The tables above an evicted page stay
+ * linked, so their cache entries stay valid. The pages that were merged into the frame of a page are copied out first.
+ * Must be called while holding the lock of frameIdx.
+ */
+void RemoveFrame(word_t frameIdx, bool isPage, bool writeBack = true) {
+    if (isPage && PMisFrameShared(frameIdx)) {
+        UnshareFrame(frameIdx);
+    }
+    const FrameInfo &info = GetFrameInfo(frameIdx);
+    uint64_t evictedPageIdx = info.cumulativePageIdx;
+    bool evictedPageDirty = info.dirty;
+    if (!isPage) {
+        PscInvalidate(info.depth, info.cumulativePageIdx);
+    }
+    // remove the link to the frame from its parent. the entry of a huge page is replaced by SplitHugePage instead:
+    if (!info.huge) {
+        PMwrite(GetIndexInRam(info.parentFrameIdx, info.offsetInParent), 0);
+    }
+    UnlinkFrame(frameIdx);
+    if (isPage) {
+        replacementPolicy->OnPageEvicted(frameIdx, evictedPageIdx);
+        ReadaheadOnEvicted(frameIdx);
+        TlbInvalidatePage(evictedPageIdx);
+        if (!writeBack) {
+            return;
+        }
+        // a clean page is already in the swap file, so its frame can just be taken:
+        if (evictedPageDirty) {
+            PMevict(frameIdx, evictedPageIdx);
+            SetContextSwapped(GetContextOfPage(evictedPageIdx));
+            dirtyEvictionCount++;
+            STATS_ADD(dirtyEvictions, 1);
+        } else {
+            cleanEvictionCount++;
+            STATS_ADD(cleanEvictions, 1);
+        }
+    }
+}
+
+/**
+ * Splits the huge page that the page in frameIdx is a part of: the page is evicted, and its frame becomes a leaf table
+ * that the other pages of the huge page are moved under, in the frames they are in.
+ */
+void SplitHugePage(word_t frameIdx) {
+    const FrameInfo &info = GetFrameInfo(frameIdx);
+    word_t parentFrameIdx = info.parentFrameIdx;
+    uint64_t offsetInParent = info.offsetInParent;
+    uint64_t pageIdx = info.cumulativePageIdx;
+    uint64_t evictedOffset = pageIdx % PAGE_SIZE;
+    word_t firstFrameIdx = frameIdx - (word_t) evictedOffset;
+
+    // concurrent accesses to the evicted page wait until the frame holds the table:
+    LockFrame(frameIdx);
+    RemoveFrame(frameIdx, true);
+    for (uint64_t offset = 0; offset < PAGE_SIZE; offset++) {
+        PMwrite(GetIndexInRam(frameIdx, offset), (offset == evictedOffset) ? 0 : (firstFrameIdx + (word_t) offset));
     }
-    if (childData.maxCyclicDist > parentData.maxCyclicDist) {
-        parentData.maxCyclicDist = childData.maxCyclicDist;
-        parentData.resultFrameIdx = childData.resultFrameIdx;
-        parentData.resultPageIdx = childData.resultPageIdx;
-        parentData.resultFrameParentIdx = childData.resultFrameParentIdx;
-        parentData.resultFrameOffsetInParent = childData.resultFrameOffsetInParent;
+    LinkFrame(frameIdx, parentFrameIdx, offsetInParent, TABLES_DEPTH - 1, pageIdx >> OFFSET_WIDTH);
+    for (uint64_t offset = 0; offset < PAGE_SIZE; offset++) {
+        if (offset != evictedOffset) {
+            MoveFrame(firstFrameIdx + (word_t) offset, frameIdx, offset);
+            SetFrameHuge(firstFrameIdx + (word_t) offset, false);
+        }
     }
+    // the table is complete before it replaces the entry of the huge page:
+    PMwrite(GetIndexInRam(parentFrameIdx, offsetInParent), frameIdx);
+    UnlockFrame(frameIdx);
+    STATS_ADD(hugePageSplits, 1);
 }
 
-//TODO: do we need to check if all of the frames contain table entries so we don't have page to evict? is that an error?
+/**
+ * @return true if all of the PAGE_SIZE frames from firstFrameIdx can be taken for a huge page: each is free, or holds
+ *         a page that can be evicted. A page of a huge page can only be evicted with all of the others.
+ */
+bool CanReclaimFrameRun(word_t firstFrameIdx) {
+    for (word_t frameIdx = firstFrameIdx; frameIdx < (firstFrameIdx + PAGE_SIZE); frameIdx++) {
+        if (IsFrameFree(frameIdx)) {
+            continue;
+        }
+        // a table, or a frame that the reclaimer is zeroing:
+        const FrameInfo &info = GetFrameInfo(frameIdx);
+        if (!info.used || (info.depth != TABLES_DEPTH)) {
+            return false;
+        }
+        if (info.huge && ((frameIdx - (word_t) (info.cumulativePageIdx % PAGE_SIZE)) != firstFrameIdx)) {
+            return false;
+        }
+    }
+    return true;
+}
 
 /**
- * Uses recursive DFS to traverse the hierarchical page table, while maintaining a DfsData struct instance that holds
- * the data needed for finding a frame in the RAM.
- * @param virtualAddress The virtual address that we want to map to the physical memory.
- * @param ignoreFrameIdx The index of the last frame that was visited before the page fault occurred. This frame will
- *                       be empty, but we'll ignore that and won't consider it as an available frame.
- * @param cumulativePageIdx An accumulated value, calculated while traversing the hierarchical page table.
- *                          When we get to a leaf in the table (the base of the recursion), it will hold the page
- *                          index in the virtual memory which represents the leaf we are at.
- * @param currDepth The current depth in the hierarchical page table.
- * @param currFrameIdx The index of the current frame that we are at.
- * @param parentFrameIdx The index of the frame that we got from in the DFS algorithm.
- * @param offsetInParent The offset in the parent frame, where the current frame index is at.
- * @return the DfsData that holds the current data we have in our DFS traversal.
- */
-DfsData HandlePageFaultHelper(uint64_t virtualAddress,
-                              word_t ignoreFrameIdx,
-                              uint64_t cumulativePageIdx = 0,
-                              int currDepth = 0,
-                              word_t currFrameIdx = 0,
-                              word_t parentFrameIdx = 0,
-                              uint64_t offsetInParent = 0) {
-    DfsData dfsData = {false, currFrameIdx, 0, 0, 0, 0, cumulativePageIdx};
-    // Leaf base case:
-    if (currDepth == TABLES_DEPTH) {
-        dfsData.maxCyclicDist = calculateCyclicDistance(cumulativePageIdx, GetPageIdx(virtualAddress));
-        dfsData.resultFrameIdx = currFrameIdx;
-        dfsData.resultPageIdx = cumulativePageIdx;
-        dfsData.resultFrameParentIdx = parentFrameIdx;
-        dfsData.resultFrameOffsetInParent = offsetInParent;
-        return dfsData;
-    }
-
-    uint64_t frameSize = (currFrameIdx == 0) ? FRAME0_USED_SIZE : PAGE_SIZE;
-
-    bool emptyFrame = true;
-    // Iterating over the entries of the current frame, recursively exploring each one of them:
-    for (uint64_t offset = 0; offset < frameSize; offset++) {
-        word_t currChildFrameIdx;
-        PMread(GetIndexInRam(currFrameIdx, offset), &currChildFrameIdx);
-        if (currChildFrameIdx != 0) {
-            emptyFrame = false;
-            DfsData currChildDfsData = HandlePageFaultHelper(virtualAddress,
-                                                             ignoreFrameIdx,
-                                                             updateCumulativePageIdx(cumulativePageIdx, offset, (currFrameIdx == 0)),
-                                                             currDepth + 1,
-                                                             currChildFrameIdx,
-                                                             currFrameIdx,
-                                                             offset);
-            UpdateDfsData(currChildDfsData, dfsData);
-            // trusts that UpdateDfsData updated the foundEmpty flag according to the flag of the child:
-            if (dfsData.foundEmpty) {
-                return dfsData;
-            }
-        }
-    }
-
-    // if frameIndex is the ignoreFrameIdx, it is not considered as empty:
-    if (emptyFrame && (currFrameIdx != ignoreFrameIdx)) {
-        dfsData.foundEmpty = true;
-        dfsData.resultFrameIdx = currFrameIdx;
-        dfsData.resultFrameParentIdx = parentFrameIdx;
-        dfsData.resultFrameOffsetInParent = offsetInParent;
-        return dfsData;
-    }
-
-    return dfsData;
-}
-
-/**
- * Uses the helper function to traverse the hierarchical page table in DFS order, keeping the relevant data in a
- * DfsData struct instance.
+ * Makes room for a huge page when there is no run of free frames for it, by evicting all of the pages in the first
+ * run of PAGE_SIZE frames around the victim of the replacement policy that can be taken.
+ * @param pageIdx The page that faulted, which the victim is chosen for.
+ * @return true and puts the index of the first frame of the run in 'firstFrameIdx', or false if the frames around the
+ *         victim can't be taken.
+ */
+bool ReclaimFrameRun(uint64_t pageIdx, word_t *firstFrameIdx) {
+    if (GetNumResidentPages() == 0) {
+        return false;
+    }
+    word_t victimFrameIdx = replacementPolicy->ChooseVictim(pageIdx);
+    word_t first = (victimFrameIdx > PAGE_SIZE) ? (victimFrameIdx - PAGE_SIZE + 1) : 1;
+    while ((first <= victimFrameIdx) && ((first + PAGE_SIZE) <= NUM_FRAMES) && !CanReclaimFrameRun(first)) {
+        first++;
+    }
+    if ((first > victimFrameIdx) || ((first + PAGE_SIZE) > NUM_FRAMES)) {
+        return false;
+    }
+
+    // a huge page in the run fills it, and its entry is cleared once all of its pages are evicted:
+    const FrameInfo &firstInfo = GetFrameInfo(first);
+    bool isHugePage = !IsFrameFree(first) && firstInfo.huge;
+    uint64_t hugePageEntryAddress = GetIndexInRam(firstInfo.parentFrameIdx, firstInfo.offsetInParent);
+    for (word_t frameIdx = first; frameIdx < (first + PAGE_SIZE); frameIdx++) {
+        if (!IsFrameFree(frameIdx)) {
+            // the frame is released, so concurrent accesses to its page don't find it anymore:
+            LockFrame(frameIdx);
+            RemoveFrame(frameIdx, true);
+            ReleaseFrame(frameIdx);
+            UnlockFrame(frameIdx);
+        }
+    }
+    if (isHugePage) {
+        PMwrite(hugePageEntryAddress, 0);
+    }
+    TakeFrameRun(first, PAGE_SIZE);
+    *firstFrameIdx = first;
+    return true;
+}
+
+/**
+ * Maps the PAGE_SIZE pages under the missing leaf table on the path to virtualAddress as a huge page, in a run of
+ * consecutive free frames, or else in a run that ReclaimFrameRun evicts. The entry of the missing leaf table points to
+ * the first frame instead, with HUGE_PAGE_FLAG set.
+ * @param parentFrameIdx The table on depth TABLES_DEPTH - 2 of the path, whose entry is missing.
+ * @param offsetInParent The offset of the missing entry in parentFrameIdx.
+ * @param entry Gets the entry of the huge page.
+ * @return true if the huge page was mapped, false if no run of frames could be found for it.
+ */
+bool MapHugePage(uint64_t virtualAddress, word_t parentFrameIdx, uint64_t offsetInParent, word_t *entry) {
+    STATS_FAULT_START();
+    word_t firstFrameIdx;
+    if (!AllocateFrameRun(PAGE_SIZE, &firstFrameIdx) &&
+        !ReclaimFrameRun(GetPageIdx(virtualAddress), &firstFrameIdx)) {
+        // the fault is handled as a fault on the leaf table, which is measured from here:
+        STATS_FAULT_HAND_OVER();
+        return false;
+    }
+    uint64_t firstPageIdx = GetCumulativePageIdx(virtualAddress, TABLES_DEPTH - 1) << OFFSET_WIDTH;
+    for (uint64_t offset = 0; offset < PAGE_SIZE; offset++) {
+        word_t frameIdx = firstFrameIdx + (word_t) offset;
+        LockFrame(frameIdx);
+        LinkFrame(frameIdx, parentFrameIdx, offsetInParent, TABLES_DEPTH, firstPageIdx + offset);
+        SetFrameHuge(frameIdx, true);
+        InitFrame(frameIdx, true, firstPageIdx + offset, false);
+        replacementPolicy->OnPageMapped(frameIdx, firstPageIdx + offset);
+        UnlockFrame(frameIdx);
+    }
+    *entry = firstFrameIdx | HUGE_PAGE_FLAG;
+    PMwrite(GetIndexInRam(parentFrameIdx, offsetInParent), *entry);
+    lastFaultPageIdx = GetPageIdx(virtualAddress);
+    pageFaultCount++;
+    WakeReclaimerIfNeeded();
+    STATS_ADD(faultsPerLevel[TABLES_DEPTH - 2], 1);
+    STATS_ADD(hugePageMappings, 1);
+    return true;
+}
+
+/**
+ * Checks the page that the replacement policy would evict for a readahead fault on pageIdx without letting the policy
+ * move on, so a readahead that gives up leaves the policy as it was (the hand and the referenced bits of CLOCK, say).
+ * @return false if that page is huge, dirty, or the page in protectedFrameIdx.
+ */
+bool CanReadaheadEvict(uint64_t pageIdx, word_t protectedFrameIdx) {
+    word_t frameIdx = replacementPolicy->PeekVictim(pageIdx);
+    LockFrame(frameIdx);
+    const FrameInfo &info = GetFrameInfo(frameIdx);
+    bool canEvict = !info.huge && !info.dirty && (frameIdx != protectedFrameIdx);
+    UnlockFrame(frameIdx);
+    return canEvict;
+}
+
+/**
+ * Finds a frame for the faulty node using the frame bookkeeping, by the priority noted in the pdf: an empty table,
+ * then an unused frame, then a free frame that the reclaimer prepared, and finally the frame of the page that the
+ * replacement policy chooses, which is evicted. A huge page that the policy chooses a page of is split first, and the
+ * policy chooses again.
  * Then removes the link to the targetFrame from its parentFrame (if it was linked already),
  * links it to its new parent (lastBeforeFaultFrame), and initializes it.
  * @param virtualAddress The virtual address that we want to map to the physical memory.
  * @param lastBeforeFaultFrameIdx The index of the last frame that was visited before the page fault occurred.
  * @param lastBeforeFaultOffset The offset in the last frame that was visited before the page fault occurred.
  * @param level The level in the hierarchical page table where the page fault occurred.
- * @return the index of the frame in the RAM that was mapped for the faulty node.
+ * @param isReadahead Whether the node is mapped ahead of its first access. Such a fault gives up rather than evict a
+ *                    dirty page or the page in protectedFrameIdx, or split a huge page.
+ * @param protectedFrameIdx The frame of the page whose fault triggered the readahead.
+ * @param snapshot The snapshot to copy the faulty page from, on the first write to a page that the context of
+ *                 virtualAddress shares with it, or -1.
+ * @return the index of the frame in the RAM that was mapped for the faulty node, or 0 if a readahead fault gave up.
  */
 word_t HandlePageFault(uint64_t virtualAddress,
                        word_t lastBeforeFaultFrameIdx,
                        uint64_t lastBeforeFaultOffset,
-                       int level) {
-    auto dfsResult = HandlePageFaultHelper(virtualAddress, lastBeforeFaultFrameIdx);
+                       int level,
+                       bool isReadahead = false,
+                       word_t protectedFrameIdx = 0,
+                       int snapshot = -1) {
+    STATS_FAULT_START();
     word_t targetFrameIdx;
 
-    if (dfsResult.foundEmpty) {
-        // remove the link to the empty frame from its parent:
-        PMwrite(GetIndexInRam(dfsResult.resultFrameParentIdx, dfsResult.resultFrameOffsetInParent), 0);
-        targetFrameIdx = dfsResult.resultFrameIdx;
-    } else if ((dfsResult.maxFrameIdx + 1) < NUM_FRAMES) {
-        targetFrameIdx = dfsResult.maxFrameIdx + 1;
-    } else {
-        // remove the link to the frame from its parent:
-        PMwrite(GetIndexInRam(dfsResult.resultFrameParentIdx, dfsResult.resultFrameOffsetInParent), 0);
-        PMevict(dfsResult.resultFrameIdx, dfsResult.resultPageIdx);
-        targetFrameIdx = dfsResult.resultFrameIdx;
+    // lastBeforeFaultFrameIdx is empty, but we'll ignore that and won't consider it as an available frame:
+    bool foundEmpty = FindEmptyTable(lastBeforeFaultFrameIdx, &targetFrameIdx);
+    bool foundUnused = !foundEmpty && AllocateUnusedFrame(&targetFrameIdx);
+    bool foundFree = !foundEmpty && !foundUnused && PopFreeFrame(&targetFrameIdx);
+    bool foundVictim = !foundEmpty && !foundUnused && !foundFree;
+    if (foundVictim && isReadahead && !CanReadaheadEvict(GetPageIdx(virtualAddress), protectedFrameIdx)) {
+        return 0;
+    }
+    if (foundVictim) {
+        targetFrameIdx = replacementPolicy->ChooseVictim(GetPageIdx(virtualAddress));
+        while (GetFrameInfo(targetFrameIdx).huge) {
+            if (isReadahead) {
+                return 0;
+            }
+            SplitHugePage(targetFrameIdx);
+            targetFrameIdx = replacementPolicy->ChooseVictim(GetPageIdx(virtualAddress));
+        }
+    }
+    lastFaultPageIdx = GetPageIdx(virtualAddress);
+
+    // concurrent accesses to the page that is evicted from the frame wait until the frame is taken. The victim is
+    // checked again, since an access may have changed the choice of the policy since CanReadaheadEvict:
+    LockFrame(targetFrameIdx);
+    if (isReadahead && foundVictim &&
+        (GetFrameInfo(targetFrameIdx).dirty || (targetFrameIdx == protectedFrameIdx))) {
+        UnlockFrame(targetFrameIdx);
+        return 0;
+    }
+    if (foundEmpty || foundVictim) {
+        RemoveFrame(targetFrameIdx, foundVictim);
+    }
+    if (foundEmpty) {
+        STATS_ADD(emptyTableReuses, 1);
+    } else if (foundUnused) {
+        STATS_ADD(unusedFrameAllocations, 1);
+    }
+    if (foundFree) {
+        freeFrameAllocationCount++;
+        STATS_ADD(freeFrameAllocations, 1);
+    } else if (foundVictim && IsReclaimerRunning()) {
+        reclaimerMissCount++;
     }
+    WakeReclaimerIfNeeded();
 
     // link the empty frame to the lastBeforeFaultFrameIdx:
     PMwrite(GetIndexInRam(lastBeforeFaultFrameIdx, lastBeforeFaultOffset), targetFrameIdx);
-    InitFrame(targetFrameIdx, (level == TABLES_DEPTH), GetPageIdx(virtualAddress));
+    LinkFrame(targetFrameIdx, lastBeforeFaultFrameIdx, lastBeforeFaultOffset, level,
+              GetCumulativePageIdx(virtualAddress, level));
+    InitFrame(targetFrameIdx, (level == TABLES_DEPTH), GetPageIdx(virtualAddress), foundFree, snapshot);
+    if (level == TABLES_DEPTH) {
+        replacementPolicy->OnPageMapped(targetFrameIdx, GetPageIdx(virtualAddress));
+        if (isReadahead) {
+            ReadaheadOnPrefetched(targetFrameIdx);
+        } else {
+            pageFaultCount++;
+        }
+    }
+    UnlockFrame(targetFrameIdx);
+    STATS_ADD(faultsPerLevel[level - 1], 1);
     return targetFrameIdx;
 }
 
+#ifdef VM_CONCURRENT
 /**
- * Gets a physical address in the ram, that is mapped to the page index in the given virtualAddress.
- * if a page fault occurs during the run of the function, the page fault handler is called to solve it.
- * @param virtualAddress a number with VIRTUAL_ADDRESS_WIDTH bits. the right most OFFSET_WIDTH bits are the offset in
- *                       the designated frame. and the VIRTUAL_ADDRESS_WIDTH-OFFSET_WIDTH left most bits are the
- *                       pageIdx in the virtual memory.
- * @return the physical address in the ram. a number with PHYSICAL_ADDRESS_WIDTH bits.
+ * Evicts pages from the frames that the replacement policy chooses, until the pool of free frames is back at the high
+ * watermark. Each batch of frames is zeroed without holding faultMutex, so page faults can go on meanwhile.
+ * @param faultLock A lock of faultMutex, which is held when the function is called and when it returns.
  */
-uint64_t GetPhysicalAddress(uint64_t virtualAddress) {
-    word_t currFrameIdx = 0;
-    for (int level = 1; level <= TABLES_DEPTH; level++) {
+void RefillFreeFrames(std::unique_lock<std::mutex> &faultLock) {
+    while (!reclaimerStop && (GetNumFreeFrames() < reclaimerHighWatermark) && CanReclaim()) {
+        word_t batch[RECLAIMER_BATCH_SIZE];
+        uint64_t batchSize = 0;
+        while ((batchSize < RECLAIMER_BATCH_SIZE) &&
+               ((GetNumFreeFrames() + batchSize) < reclaimerHighWatermark) && CanReclaim()) {
+            word_t frameIdx = replacementPolicy->ChooseVictim(lastFaultPageIdx);
+            if (GetFrameInfo(frameIdx).huge) {
+                SplitHugePage(frameIdx);
+                continue;
+            }
+            LockFrame(frameIdx);
+            RemoveFrame(frameIdx, true);
+            ReleaseFrame(frameIdx);
+            UnlockFrame(frameIdx);
+            batch[batchSize++] = frameIdx;
+        }
+
+        // the released frames are out of the page table and out of the pool, so nothing else touches them:
+        faultLock.unlock();
+        for (uint64_t i = 0; i < batchSize; i++) {
+            PMzeroFrame(batch[i]);
+        }
+        faultLock.lock();
+        for (uint64_t i = 0; i < batchSize; i++) {
+            PushFreeFrame(batch[i]);
+        }
+        reclaimedFrameCount += batchSize;
+    }
+}
+
+/**
+ * The body of the reclaimer thread: sleeps until the pool of free frames drops below the low watermark, and refills
+ * it up to the high watermark.
+ */
+void RunReclaimer() {
+    std::unique_lock<std::mutex> faultLock(faultMutex);
+    while (!reclaimerStop) {
+        reclaimerWakeup.wait(faultLock, [] {
+            return reclaimerStop || ((GetNumFreeFrames() < reclaimerLowWatermark) && CanReclaim());
+        });
+        RefillFreeFrames(faultLock);
+    }
+}
+#endif
+
+/**
+ * Finds the deepest table on the path to virtualAddress that the paging-structure cache holds, so that a walk can skip
+ * the levels above it.
+ * @param virtualAddress A tagged address (see AddressSpace.h).
+ * @param frameIdx Gets the frame of that table, or the root table of the context of virtualAddress if no table on the
+ *                 path is cached, which is NO_ROOT if the context does not exist.
+ * @param validate Whether to check the cached table against the frame bookkeeping, which a walk that may handle page
+ *                 faults must do in a VM_CONCURRENT build, since the tables removed by other threads are only dropped
+ *                 from their own caches. Must be called while holding faultMutex if set.
+ * @return the level of the page table to continue the walk from.
+ */
+int FindWalkStart(uint64_t virtualAddress, word_t *frameIdx, bool validate) {
+    for (int depth = TABLES_DEPTH - 1; depth > 0; depth--) {
+        uint64_t prefix = GetCumulativePageIdx(virtualAddress, depth);
+        if (!PscLookup(depth, prefix, frameIdx)) {
+            continue;
+        }
+#ifdef VM_CONCURRENT
+        const FrameInfo &info = GetFrameInfo(*frameIdx);
+        if (validate && !(info.used && (info.depth == depth) && (info.cumulativePageIdx == prefix))) {
+            PscInvalidate(depth, prefix);
+            continue;
+        }
+#else
+        (void) validate;
+#endif
+        STATS_ADD(pagingStructureCacheHits, 1);
+        return depth + 1;
+    }
+    STATS_ADD(pagingStructureCacheMisses, 1);
+    *frameIdx = GetContextRoot(GetContextOfPage(GetPageIdx(virtualAddress)));
+    return 1;
+}
+
+/**
+ * Maps the given page ahead of its first access, if it can be done without evicting a dirty page or the page in
+ * protectedFrameIdx. The tables on its path are mapped as needed.
+ * @return true if the page is mapped.
+ */
+bool ReadaheadPage(uint64_t pageIdx, word_t protectedFrameIdx) {
+    uint64_t virtualAddress = pageIdx << OFFSET_WIDTH;
+    word_t currFrameIdx;
+    for (int level = FindWalkStart(virtualAddress, &currFrameIdx, true); level <= TABLES_DEPTH; level++) {
+        uint64_t currPi = GetPi(virtualAddress, level);
+        word_t prevFrameIdx = currFrameIdx;
+        PMread(GetIndexInRam(currFrameIdx, currPi), &currFrameIdx);
+        STATS_ADD(pageTableEntriesRead, 1);
+        if (IsHugePageEntry(currFrameIdx)) {
+            return true;
+        }
+        if (currFrameIdx == 0) {
+            currFrameIdx = HandlePageFault(virtualAddress, prevFrameIdx, currPi, level, true, protectedFrameIdx);
+            if (currFrameIdx == 0) {
+                return false;
+            }
+        }
+        if (level < TABLES_DEPTH) {
+            PscInsert(level, GetCumulativePageIdx(virtualAddress, level), currFrameIdx);
+        }
+    }
+    return true;
+}
+
+/**
+ * Tells the replacement policy that the resident pages of the sequential range behind the fault on pageIdx, down to
+ * the page before the window of the previous fault, are not needed anymore, since the range is accessed in page order.
+ */
+void DropBehind(uint64_t pageIdx, uint64_t window) {
+    int addressSpace = GetCurrentAddressSpace();
+    uint64_t contextPageIdx = pageIdx % NUM_PAGES;
+    for (uint64_t behind = 1; (behind <= (window + 1)) && (behind <= contextPageIdx); behind++) {
+        if (GetAddressSpaceAdvice(addressSpace, contextPageIdx - behind) != ADVISE_SEQUENTIAL) {
+            break;
+        }
+        word_t frameIdx = FindResidentFrame((pageIdx - behind) << OFFSET_WIDTH);
+        if (frameIdx != 0) {
+            replacementPolicy->OnPageUnneeded(frameIdx);
+        }
+    }
+}
+
+/**
+ * Reads ahead the pages of the stream that the fault on pageIdx belongs to, if the detector found one, or if the page
+ * is in a sequential range (see VMadvise), which also drops the pages behind it. Stops at the end of the context of
+ * pageIdx, or at the first page that can't be mapped cheaply.
+ * @param frameIdx The frame that the faulting page was mapped to, which must stay mapped.
+ */
+void Readahead(uint64_t pageIdx, word_t frameIdx) {
+    PageAdvice advice = GetAddressSpaceAdvice(GetCurrentAddressSpace(), pageIdx % NUM_PAGES);
+    int64_t stride;
+    uint64_t window = ReadaheadOnFault(pageIdx, advice, &stride);
+    if (advice == ADVISE_SEQUENTIAL) {
+        DropBehind(pageIdx, window);
+    }
+    uint64_t lastPageIdx = pageIdx;
+    for (uint64_t i = 0; i < window; i++) {
+        int64_t nextPageIdx = (int64_t) lastPageIdx + stride;
+        if ((nextPageIdx < 0) || (GetContextOfPage((uint64_t) nextPageIdx) != GetContextOfPage(pageIdx)) ||
+            !ReadaheadPage((uint64_t) nextPageIdx, frameIdx)) {
+            break;
+        }
+        lastPageIdx = (uint64_t) nextPageIdx;
+    }
+    if ((lastPageIdx != pageIdx) && (advice == ADVISE_NORMAL)) {
+        ReadaheadOnWindowDone(lastPageIdx);
+    }
+}
+
+/**
+ * Finds the snapshot that the page of virtualAddress is read from while its context does not hold it: the first one
+ * that holds the page among the snapshot of the context, the snapshot of that snapshot, and so on.
+ * Must be called while the page is not resident in its context.
+ * @return the snapshot, or -1 if the context holds the page in the swap file, or if no snapshot holds the page.
+ */
+int FindSnapshotOfPage(uint64_t virtualAddress) {
+    uint64_t pageIdx = GetPageIdx(virtualAddress);
+    if (PMcontains(pageIdx)) {
+        return -1;
+    }
+    for (int snapshot = GetContextSnapshot(GetContextOfPage(pageIdx)); snapshot >= 0;
+         snapshot = GetContextSnapshot(snapshot)) {
+        uint64_t snapshotAddress = RetagAddress(snapshot, virtualAddress);
+        if ((FindResidentFrame(snapshotAddress) != 0) || PMcontains(GetPageIdx(snapshotAddress))) {
+            return snapshot;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Walks the hierarchical page table from the deepest table that the paging-structure cache holds (or from the root
+ * table of the context) down to the frame that holds the page of the given virtualAddress, and caches the tables it
+ * passes. A walk that reaches a huge page ends one level early.
+ * if a page fault occurs during the walk, the page fault handler is called to solve it, and a page fault on the page
+ * itself may read ahead the pages that are expected to fault next. If huge pages are enabled, a missing leaf table is
+ * mapped as a huge page when there are frames for it.
+ * A page that the context shares with a snapshot is read in the frame of the snapshot, and is copied into the context
+ * on its first write. Such a context reads nothing ahead and maps no huge pages, which would hide the pages of the
+ * snapshot. In the same way, a page that was merged into the frame of an identical page (see DedupScan) is read in
+ * that frame, and is restored on its first write.
+ * @param virtualAddress The tagged address whose page we want to find in the RAM. Its context must exist.
+ * @param isWrite Whether the page is about to be written.
+ * @param fromSnapshot Gets whether the frame holds the page of a snapshot, or the page that the page of virtualAddress
+ *                     was merged into, which must not be written or cached for the context of virtualAddress.
+ * @return the index of the frame in the RAM that holds the page.
+ */
+word_t WalkPageTable(uint64_t virtualAddress, bool isWrite, bool *fromSnapshot) {
+    bool hasSnapshot = GetContextSnapshot(GetContextOfPage(GetPageIdx(virtualAddress))) >= 0;
+    bool snapshotChecked = false;
+    int snapshot = -1;
+    *fromSnapshot = false;
+    word_t currFrameIdx;
+    int startLevel = FindWalkStart(virtualAddress, &currFrameIdx, true);
+    for (int level = startLevel; level <= TABLES_DEPTH; level++) {
         uint64_t currPi = GetPi(virtualAddress, level);
         word_t prevFrameIdx = currFrameIdx;
         PMread(GetIndexInRam(currFrameIdx, currPi), &currFrameIdx);
+        if ((currFrameIdx == 0) && hasSnapshot && !snapshotChecked) {
+            snapshotChecked = true;
+            snapshot = FindSnapshotOfPage(virtualAddress);
+            if ((snapshot >= 0) && !isWrite) {
+                // the snapshot holds the page itself, so its walk does not go on to another snapshot:
+                STATS_ADD(pageTableEntriesRead, level - startLevel + 1);
+                STATS_ADD(snapshotPageReads, 1);
+                bool snapshotOfSnapshot;
+                *fromSnapshot = true;
+                return WalkPageTable(RetagAddress(snapshot, virtualAddress), false, &snapshotOfSnapshot);
+            }
+        }
+        word_t sharedFrameIdx = ((currFrameIdx == 0) && !isWrite) ?
+                                (word_t) PMfindSharedFrame(GetPageIdx(virtualAddress)) : 0;
+        if (sharedFrameIdx != 0) {
+            STATS_ADD(pageTableEntriesRead, level - startLevel + 1);
+            STATS_ADD(dedupSharedReads, 1);
+            OnPageAccessed(sharedFrameIdx);
+            *fromSnapshot = true;
+            return sharedFrameIdx;
+        }
+        bool mappedHugePage = (level == TABLES_DEPTH - 1) && (currFrameIdx == 0) && hugePagesEnabled && !hasSnapshot &&
+                              MapHugePage(virtualAddress, prevFrameIdx, currPi, &currFrameIdx);
+        if (IsHugePageEntry(currFrameIdx)) {
+            currFrameIdx = GetHugePageFrame(currFrameIdx, virtualAddress);
+            if (!mappedHugePage) {
+                OnPageAccessed(currFrameIdx);
+            }
+            STATS_ADD(pageTableEntriesRead, level - startLevel + 1);
+            return currFrameIdx;
+        }
         if (currFrameIdx == 0) {
-            currFrameIdx = HandlePageFault(virtualAddress, prevFrameIdx, currPi, level);
+            currFrameIdx = HandlePageFault(virtualAddress, prevFrameIdx, currPi, level, false, 0,
+                                           (level == TABLES_DEPTH) ? snapshot : -1);
+            if ((level == TABLES_DEPTH) && !hasSnapshot) {
+                Readahead(GetPageIdx(virtualAddress), currFrameIdx);
+            }
+        } else if (level == TABLES_DEPTH) {
+            // a page that was just mapped by the page fault handler was not accessed yet as far as the policy knows:
+            OnPageAccessed(currFrameIdx);
+        }
+        if (level < TABLES_DEPTH) {
+            PscInsert(level, GetCumulativePageIdx(virtualAddress, level), currFrameIdx);
+        }
+    }
+    STATS_ADD(pageTableEntriesRead, TABLES_DEPTH - startLevel + 1);
+    return currFrameIdx;
+}
+
+/**
+ * Gets a physical address in the ram, that is mapped to the page index in the given virtualAddress.
+ * The TLB is checked first, and only on a miss the hierarchical page table is walked (and the result is cached, unless
+ * the page is read from a snapshot).
+ * Either way, the replacement policy is told that the page was accessed.
+ * @param virtualAddress a tagged address. the right most OFFSET_WIDTH bits are the offset in the designated frame. and
+ *                       the bits to their left are the pageIdx, tagged with its context.
+ * @param isWrite Whether the page is about to be written.
+ * @return the physical address in the ram. a number with PHYSICAL_ADDRESS_WIDTH bits.
+ */
+uint64_t GetPhysicalAddress(uint64_t virtualAddress, bool isWrite) {
+    uint64_t pageIdx = GetPageIdx(virtualAddress);
+    word_t frameIdx;
+    if (TlbLookup(pageIdx, &frameIdx)) {
+        OnPageAccessed(frameIdx);
+    } else {
+        bool fromSnapshot;
+        frameIdx = WalkPageTable(virtualAddress, isWrite, &fromSnapshot);
+        if (!fromSnapshot) {
+            TlbInsert(pageIdx, frameIdx);
         }
     }
+    if (isWrite && PMisFrameShared(frameIdx)) {
+        UnshareFrame(frameIdx);
+    }
     uint64_t offset = GetOffset(virtualAddress);
-    return GetIndexInRam(currFrameIdx, offset);
+    return GetIndexInRam(frameIdx, offset);
+}
+
+#ifdef VM_CONCURRENT
+/**
+ * Walks the page table without taking any lock and without handling page faults. The walk may race with a page fault
+ * that changes the table, so the frame it reaches must be validated under the frame lock.
+ * @return true and puts the index of the frame that was reached in 'frameIdx', or false if a page fault is needed.
+ */
+bool TryWalkPageTable(uint64_t virtualAddress, word_t *frameIdx) {
+    word_t currFrameIdx;
+    // a stale cached table can't be validated without faultMutex, but it only leads to a frame that fails validation:
+    int startLevel = FindWalkStart(virtualAddress, &currFrameIdx, false);
+    if (currFrameIdx == NO_ROOT) {
+        return false;
+    }
+    for (int level = startLevel; level <= TABLES_DEPTH; level++) {
+        PMread(GetIndexInRam(currFrameIdx, GetPi(virtualAddress, level)), &currFrameIdx);
+        STATS_ADD(pageTableEntriesRead, 1);
+        if ((level == TABLES_DEPTH - 1) && IsHugePageEntry(currFrameIdx)) {
+            // the walk ends one level early, at the frame of the page in the huge page:
+            currFrameIdx = GetHugePageFrame(currFrameIdx, virtualAddress);
+            level = TABLES_DEPTH;
+        }
+        // a racing page fault may have turned a table on the way into a page, holding any value:
+        if ((currFrameIdx <= 0) || (currFrameIdx >= NUM_FRAMES)) {
+            return false;
+        }
+        if (level < TABLES_DEPTH) {
+            PscInsert(level, GetCumulativePageIdx(virtualAddress, level), currFrameIdx);
+        }
+    }
+    *frameIdx = currFrameIdx;
+    return true;
+}
+
+/**
+ * Must be called while holding the lock of frameIdx.
+ * @return true if frameIdx holds the given page.
+ */
+bool IsFrameOfPage(word_t frameIdx, uint64_t pageIdx) {
+    const FrameInfo &info = GetFrameInfo(frameIdx);
+    return info.used && (info.depth == TABLES_DEPTH) && (info.cumulativePageIdx == pageIdx);
+}
+#endif
+
+/**
+ * Translates virtualAddress in the current address space of the calling thread and calls access with its physical
+ * address, while its page is guaranteed to stay in its frame. If isWrite is true, the page is marked as dirty.
+ * In a VM_CONCURRENT build, a resident page is found through the thread's TLB or a lock-free walk, and only its frame is
+ * locked during the access. Translations that need a page fault are serialised on faultMutex, and so are the accesses
+ * to the pages that the address space shares with a snapshot.
+ * @return false if the current address space was destroyed by another thread, in which case nothing is accessed.
+ */
+template<typename Access>
+bool AccessVirtualAddress(uint64_t virtualAddress, bool isWrite, Access access) {
+    int context = GetAddressSpaceContext(GetCurrentAddressSpace());
+    if (context < 0) {
+        return false;
+    }
+    uint64_t taggedAddress = TagAddress(context, virtualAddress);
+#ifdef VM_CONCURRENT
+    uint64_t pageIdx = GetPageIdx(taggedAddress);
+    uint64_t offset = GetOffset(taggedAddress);
+    word_t frameIdx;
+    bool fromTlb = TlbLookup(pageIdx, &frameIdx);
+    if (fromTlb || TryWalkPageTable(taggedAddress, &frameIdx)) {
+        LockFrame(frameIdx);
+        // the context may have been frozen by a fork since it was looked up, and a snapshot is never written. neither
+        // is a frame that other pages were merged into, until they are copied out, which takes faultMutex:
+        if (IsFrameOfPage(frameIdx, pageIdx) && !(isWrite && (IsContextFrozen(context) || PMisFrameShared(frameIdx)))) {
+            OnPageAccessed(frameIdx);
+            if (isWrite) {
+                SetFrameDirty(frameIdx, true);
+            }
+            access(GetIndexInRam(frameIdx, offset));
+            UnlockFrame(frameIdx);
+            if (!fromTlb) {
+                TlbInsert(pageIdx, frameIdx);
+            }
+            return true;
+        }
+        UnlockFrame(frameIdx);
+        if (fromTlb) {
+            TlbInvalidatePage(pageIdx);
+        }
+    }
+
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+    // forks and destructions are serialised on faultMutex too, so the context is looked up again:
+    context = GetAddressSpaceContext(GetCurrentAddressSpace());
+    if (context < 0) {
+        return false;
+    }
+    taggedAddress = TagAddress(context, virtualAddress);
+    pageIdx = GetPageIdx(taggedAddress);
+    bool fromSnapshot;
+    frameIdx = WalkPageTable(taggedAddress, isWrite, &fromSnapshot);
+    LockFrame(frameIdx);
+    if (isWrite && PMisFrameShared(frameIdx)) {
+        UnshareFrame(frameIdx);
+    }
+    if (isWrite) {
+        SetFrameDirty(frameIdx, true);
+    }
+    access(GetIndexInRam(frameIdx, offset));
+    UnlockFrame(frameIdx);
+    if (!fromSnapshot) {
+        TlbInsert(pageIdx, frameIdx);
+    }
+#else
+    uint64_t physicalAddress = GetPhysicalAddress(taggedAddress, isWrite);
+    if (isWrite) {
+        SetFrameDirty(physicalAddress / PAGE_SIZE, true);
+    }
+    access(physicalAddress);
+#endif
+    return true;
 }
 
 void VMinitialize() {
+    VMinitialize(CYCLIC_DISTANCE_POLICY);
+}
+
+void VMinitialize(PageReplacementPolicy policy) {
+    VMstopReclaimer();
+    VMstopDedupScanner();
+    if (TraceIsRecordingVirtual()) {
+        TraceRecordInitialize(policy);
+    }
+    PMinitialize();
+    // PMinitialize keeps the RAM of an earlier session as it is, and the frames are then reused by the new page table,
+    // so a frame that pages were merged into is first evicted as the copy of each of them, while it still holds them:
+    for (word_t frameIdx = 0; frameIdx < NUM_FRAMES; frameIdx++) {
+        if (PMisFrameShared(frameIdx)) {
+            PMunshareFrame(frameIdx);
+        }
+    }
+    TlbInitialize();
+    PscInitialize();
+    FrameTableInitialize();
+    AddressSpacesInitialize();
+    // the swap file outlives the contexts, and a page left in it by an old context would hide the page of a snapshot:
+    PMdiscard(GetPageIdx(TagAddress(1, 0)), (uint64_t) (MAX_CONTEXTS - 1) * NUM_PAGES);
+    delete replacementPolicy;
+    replacementPolicy = CreateReplacementPolicy(policy);
+    replacementPolicyType = policy;
+    ReadaheadInitialize(0);
+    pageFaultCount = 0;
+    cleanEvictionCount = 0;
+    dirtyEvictionCount = 0;
+    VMresetStats();
+    lastFaultPageIdx = 0;
+    reclaimedFrameCount = 0;
+    freeFrameAllocationCount = 0;
+    reclaimerMissCount = 0;
+    hugePagesEnabled = false;
+    dedupEnabled = false;
+    PMsetDedup(0);
     for (int cell = 0; cell < PAGE_SIZE; cell++) {
         PMwrite(cell, 0);
     }
 }
 
-int VMread(uint64_t virtualAddress, word_t *value) {
-    if ((virtualAddress >= VIRTUAL_MEMORY_SIZE) || (value == nullptr)) {
+void VMgetPagingStats(uint64_t *pageFaults, uint64_t *evictions) {
+    if (pageFaults != nullptr) {
+        *pageFaults = pageFaultCount;
+    }
+    if (evictions != nullptr) {
+        *evictions = cleanEvictionCount + dirtyEvictionCount;
+    }
+}
+
+void VMgetEvictionStats(uint64_t *cleanEvictions, uint64_t *dirtyEvictions) {
+    if (cleanEvictions != nullptr) {
+        *cleanEvictions = cleanEvictionCount;
+    }
+    if (dirtyEvictions != nullptr) {
+        *dirtyEvictions = dirtyEvictionCount;
+    }
+}
+
+int VMstartReclaimer(uint64_t lowWatermark, uint64_t highWatermark) {
+#ifdef VM_CONCURRENT
+    // the pool must leave room for the tables and for at least one page:
+    if ((lowWatermark == 0) || (lowWatermark > highWatermark) ||
+        (highWatermark >= (uint64_t) (NUM_FRAMES - TABLES_DEPTH - 1))) {
         return 0;
     }
-    uint64_t physicalAddress = GetPhysicalAddress(virtualAddress);
-    PMread(physicalAddress, value);
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+    if (IsReclaimerRunning()) {
+        return 0;
+    }
+    reclaimerLowWatermark = lowWatermark;
+    reclaimerHighWatermark = highWatermark;
+    reclaimerStop = false;
+    reclaimerThread = new std::thread(RunReclaimer);
+    // the thread must be gone before exit destroys the bookkeeping that it uses:
+    static bool stopAtExitRegistered = false;
+    if (!stopAtExitRegistered) {
+        stopAtExitRegistered = true;
+        std::atexit(VMstopReclaimer);
+    }
     return 1;
+#else
+    (void) lowWatermark;
+    (void) highWatermark;
+    return 0;
+#endif
 }
 
-int VMwrite(uint64_t virtualAddress, word_t value) {
-    if (virtualAddress >= VIRTUAL_MEMORY_SIZE) {
+void VMstopReclaimer() {
+#ifdef VM_CONCURRENT
+    std::thread *thread;
+    {
+        std::lock_guard<std::mutex> faultLock(faultMutex);
+        thread = reclaimerThread;
+        reclaimerStop = true;
+    }
+    if (thread == nullptr) {
+        return;
+    }
+    reclaimerWakeup.notify_one();
+    thread->join();
+    delete thread;
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+    reclaimerThread = nullptr;
+#endif
+}
+
+void VMgetReclaimerStats(uint64_t *reclaimedFrames, uint64_t *freeFrameFaults, uint64_t *missedFaults) {
+#ifdef VM_CONCURRENT
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+#endif
+    if (reclaimedFrames != nullptr) {
+        *reclaimedFrames = reclaimedFrameCount;
+    }
+    if (freeFrameFaults != nullptr) {
+        *freeFrameFaults = freeFrameAllocationCount;
+    }
+    if (missedFaults != nullptr) {
+        *missedFaults = reclaimerMissCount;
+    }
+}
+
+void VMsetReadahead(uint64_t maxWindow) {
+    ReadaheadInitialize(maxWindow);
+}
+
+int VMsetHugePages(int enable) {
+    if (enable && ((TABLES_DEPTH < 2) || (PAGE_SIZE >= NUM_FRAMES))) {
         return 0;
     }
-    uint64_t physicalAddress = GetPhysicalAddress(virtualAddress);
-    PMwrite(physicalAddress, value);
+#ifdef VM_CONCURRENT
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+#endif
+    hugePagesEnabled = (enable != 0);
     return 1;
 }
 
-
+/**
+ * Takes a frame for the root table of the given context, by the priority of HandlePageFault, and links it as that
+ * root.
+ * @return the index of the frame, which holds zeroes.
+ */
+word_t MapRootFrame(int context) {
+    word_t frameIdx;
+    bool foundEmpty = FindEmptyTable(0, &frameIdx);
+    bool foundUnused = !foundEmpty && AllocateUnusedFrame(&frameIdx);
+    bool foundFree = !foundEmpty && !foundUnused && PopFreeFrame(&frameIdx);
+    bool foundVictim = !foundEmpty && !foundUnused && !foundFree;
+    if (foundVictim) {
+        frameIdx = replacementPolicy->ChooseVictim(lastFaultPageIdx);
+        while (GetFrameInfo(frameIdx).huge) {
+            SplitHugePage(frameIdx);
+            frameIdx = replacementPolicy->ChooseVictim(lastFaultPageIdx);
+        }
+    }
+
+    LockFrame(frameIdx);
+    if (foundEmpty || foundVictim) {
+        RemoveFrame(frameIdx, foundVictim);
+    }
+    if (!foundFree) {
+        PMzeroFrame(frameIdx);
+    }
+    LinkRootFrame(frameIdx, context);
+    UnlockFrame(frameIdx);
+    return frameIdx;
+}
+
+/**
+ * Removes the node in frameIdx from the page table, without writing it back unless writeBack is true, and puts its
+ * frame in the pool of free frames.
+ */
+void DropFrame(word_t frameIdx, bool isPage, bool writeBack = false) {
+    LockFrame(frameIdx);
+    RemoveFrame(frameIdx, isPage, writeBack);
+    ReleaseFrame(frameIdx);
+    UnlockFrame(frameIdx);
+    PMzeroFrame(frameIdx);
+    PushFreeFrame(frameIdx);
+}
+
+/**
+ * @return the offset of the first entry of the given table from 'offset' onwards that is not empty, or numEntries if
+ *         there is none.
+ */
+uint64_t FindNextEntry(word_t tableFrameIdx, uint64_t offset, uint64_t numEntries) {
+    if (offset >= numEntries) {
+        return numEntries;
+    }
+    return offset + PMfindNonZero(GetIndexInRam(tableFrameIdx, offset), numEntries - offset);
+}
+
+/**
+ * Drops the nodes under the table in tableFrameIdx, which is on the given depth of the page table, writing back their
+ * dirty pages if writeBack is true.
+ */
+void DropSubtree(word_t tableFrameIdx, int depth, bool writeBack) {
+    uint64_t numEntries = (depth == 0) ? FRAME0_USED_SIZE : PAGE_SIZE;
+    for (uint64_t offset = FindNextEntry(tableFrameIdx, 0, numEntries); offset < numEntries;
+         offset = FindNextEntry(tableFrameIdx, offset + 1, numEntries)) {
+        word_t entry;
+        PMread(GetIndexInRam(tableFrameIdx, offset), &entry);
+        if (IsHugePageEntry(entry)) {
+            for (uint64_t pageOffset = 0; pageOffset < PAGE_SIZE; pageOffset++) {
+                DropFrame((entry & ~HUGE_PAGE_FLAG) + (word_t) pageOffset, true, writeBack);
+            }
+            PMwrite(GetIndexInRam(tableFrameIdx, offset), 0);
+            continue;
+        }
+        if ((depth + 1) < TABLES_DEPTH) {
+            DropSubtree(entry, depth + 1, writeBack);
+        }
+        DropFrame(entry, (depth + 1) == TABLES_DEPTH, writeBack);
+    }
+}
+
+/**
+ * Drops the resident pages under the table in tableFrameIdx, which is on the given depth of the page table of a
+ * snapshot, whose copies in the swap file the given context replaces. A huge page is split first.
+ */
+void DropReplacedPages(word_t tableFrameIdx, int depth, int context) {
+    uint64_t numEntries = (depth == 0) ? FRAME0_USED_SIZE : PAGE_SIZE;
+    for (uint64_t offset = FindNextEntry(tableFrameIdx, 0, numEntries); offset < numEntries;
+         offset = FindNextEntry(tableFrameIdx, offset + 1, numEntries)) {
+        word_t entry;
+        PMread(GetIndexInRam(tableFrameIdx, offset), &entry);
+        if (IsHugePageEntry(entry)) {
+            for (uint64_t pageOffset = 0; pageOffset < PAGE_SIZE; pageOffset++) {
+                word_t frameIdx = (entry & ~HUGE_PAGE_FLAG) + (word_t) pageOffset;
+                uint64_t pageIdx = GetFrameInfo(frameIdx).cumulativePageIdx;
+                if (PMcontains(GetPageIdx(RetagAddress(context, pageIdx << OFFSET_WIDTH)))) {
+                    // the frame of the page becomes the leaf table of the others, which are then looked at again:
+                    SplitHugePage(frameIdx);
+                    DropReplacedPages(frameIdx, depth + 1, context);
+                    break;
+                }
+            }
+            continue;
+        }
+        if ((depth + 1) < TABLES_DEPTH) {
+            DropReplacedPages(entry, depth + 1, context);
+            continue;
+        }
+        uint64_t pageIdx = GetFrameInfo(entry).cumulativePageIdx;
+        if (PMcontains(GetPageIdx(RetagAddress(context, pageIdx << OFFSET_WIDTH)))) {
+            DropFrame(entry, true);
+        }
+    }
+}
+
+/**
+ * Drops the resident pages from firstPageIdx to lastPageIdx under the table in tableFrameIdx, which is on the given
+ * depth of the page table, and drops the tables under it that are left empty. A huge page that is only partly in the
+ * range is split first.
+ * @param tablePageIdx The first page under the table.
+ */
+void DropPageRange(word_t tableFrameIdx, int depth, uint64_t tablePageIdx, uint64_t firstPageIdx,
+                   uint64_t lastPageIdx) {
+    uint64_t numEntries = (depth == 0) ? FRAME0_USED_SIZE : PAGE_SIZE;
+    uint64_t entryPages = 1ULL << (OFFSET_WIDTH * (TABLES_DEPTH - 1 - depth));
+    uint64_t firstOffset = (firstPageIdx > tablePageIdx) ? ((firstPageIdx - tablePageIdx) / entryPages) : 0;
+    uint64_t endOffset = ((lastPageIdx - tablePageIdx) / entryPages) + 1;
+    endOffset = (endOffset < numEntries) ? endOffset : numEntries;
+    for (uint64_t offset = FindNextEntry(tableFrameIdx, firstOffset, endOffset); offset < endOffset;
+         offset = FindNextEntry(tableFrameIdx, offset + 1, endOffset)) {
+        word_t entry;
+        PMread(GetIndexInRam(tableFrameIdx, offset), &entry);
+        uint64_t entryPageIdx = tablePageIdx + (offset * entryPages);
+        if (IsHugePageEntry(entry)) {
+            word_t firstFrameIdx = entry & ~HUGE_PAGE_FLAG;
+            if ((entryPageIdx >= firstPageIdx) && ((entryPageIdx + PAGE_SIZE - 1) <= lastPageIdx)) {
+                for (uint64_t pageOffset = 0; pageOffset < PAGE_SIZE; pageOffset++) {
+                    DropFrame(firstFrameIdx + (word_t) pageOffset, true);
+                }
+                PMwrite(GetIndexInRam(tableFrameIdx, offset), 0);
+                STATS_ADD(advisedDroppedPages, PAGE_SIZE);
+                continue;
+            }
+            // the frame of the first page in the range becomes the leaf table of the others:
+            uint64_t splitOffset = (firstPageIdx > entryPageIdx) ? (firstPageIdx - entryPageIdx) : 0;
+            word_t splitFrameIdx = firstFrameIdx + (word_t) splitOffset;
+            SplitHugePage(splitFrameIdx);
+            entry = splitFrameIdx;
+        }
+        if ((depth + 1) < TABLES_DEPTH) {
+            DropPageRange(entry, depth + 1, entryPageIdx, firstPageIdx, lastPageIdx);
+            if (GetFrameInfo(entry).numChildren == 0) {
+                DropFrame(entry, false);
+                STATS_ADD(advisedDroppedTables, 1);
+            }
+            continue;
+        }
+        DropFrame(entry, true);
+        STATS_ADD(advisedDroppedPages, 1);
+    }
+}
+
+/**
+ * Drops the 'count' pages of a context from firstPageIdx onwards (see ADVISE_DONTNEED): their frames are freed, with
+ * the tables that are left empty, and so are their copies in the swap file. The pages that a snapshot of the context
+ * holds are then kept as pages of zeroes in the swap file, so they are not read from the snapshot anymore.
+ */
+void DropPages(int context, uint64_t firstPageIdx, uint64_t count) {
+    DropPageRange(GetContextRoot(context), 0, GetPageIdx(TagAddress(context, 0)), firstPageIdx,
+                  firstPageIdx + count - 1);
+    // splitting a huge page may have written one of the pages back:
+    if (IsContextSwapped(context)) {
+        PMdiscard(firstPageIdx, count);
+    }
+    if (GetContextSnapshot(context) < 0) {
+        return;
+    }
+    for (uint64_t pageIdx = firstPageIdx; pageIdx < (firstPageIdx + count); pageIdx++) {
+        if (FindSnapshotOfPage(pageIdx << OFFSET_WIDTH) >= 0) {
+            PMevictZeroPage(pageIdx);
+            SetContextSwapped(context);
+        }
+    }
+}
+
+/**
+ * Restores the 'count' pages from firstPageIdx onwards that are in the swap file ahead of their first access (see
+ * ADVISE_WILLNEED), in page order, like the pages that are read ahead. A page that the context shares with a snapshot
+ * is restored in the snapshot, where it is read from. The pages that were never evicted are skipped, since they hold
+ * zeroes, which their first access maps as cheaply.
+ * Stops at the first page that can't be mapped without evicting a dirty page, or after restoring half of the frames, so
+ * the pages that were restored first are not evicted by the last ones.
+ */
+void PrefetchPages(uint64_t firstPageIdx, uint64_t count) {
+    bool hasSnapshot = GetContextSnapshot(GetContextOfPage(firstPageIdx)) >= 0;
+    uint64_t prefetched = 0;
+    for (uint64_t pageIdx = firstPageIdx; (pageIdx < (firstPageIdx + count)) && (prefetched < (NUM_FRAMES / 2));
+         pageIdx++) {
+        uint64_t virtualAddress = pageIdx << OFFSET_WIDTH;
+        if (FindResidentFrame(virtualAddress) != 0) {
+            continue;
+        }
+        if (!PMcontains(pageIdx)) {
+            int snapshot = hasSnapshot ? FindSnapshotOfPage(virtualAddress) : -1;
+            if (snapshot < 0) {
+                continue;
+            }
+            virtualAddress = RetagAddress(snapshot, virtualAddress);
+            if (FindResidentFrame(virtualAddress) != 0) {
+                continue;
+            }
+        }
+        if (!ReadaheadPage(GetPageIdx(virtualAddress), 0)) {
+            break;
+        }
+        prefetched++;
+    }
+    STATS_ADD(advisedPrefetches, prefetched);
+}
+
+/**
+ * Creates a context with a root table of its own, which reads the pages it does not hold from the given snapshot.
+ * @param snapshot A context, or -1 for none.
+ * @return the new context, or -1 if MAX_CONTEXTS exist.
+ */
+int CreateContext(int snapshot) {
+    int context = FindFreeContext();
+    if (context < 0) {
+        return -1;
+    }
+    SetContextRoot(context, MapRootFrame(context));
+    SetContextSnapshot(context, snapshot);
+    return context;
+}
+
+/**
+ * Drops the tables and the pages of a context, and frees their frames and the frame of its root table, which destroys
+ * the context. Its dirty pages are written back if writeBack is true, and its snapshot is kept.
+ */
+void DropContext(int context, bool writeBack) {
+    // lock-free walks stop at the missing root, before the frames of the context are taken for other nodes:
+    word_t rootFrameIdx = GetContextRoot(context);
+    SetContextRoot(context, NO_ROOT);
+    DropSubtree(rootFrameIdx, 0, writeBack);
+    LockFrame(rootFrameIdx);
+    ReleaseFrame(rootFrameIdx);
+    UnlockFrame(rootFrameIdx);
+    PMzeroFrame(rootFrameIdx);
+    PushFreeFrame(rootFrameIdx);
+}
+
+/**
+ * Merges a context into its snapshot, which no other context shares anymore: the pages of the context replace those
+ * of the snapshot, and the snapshot takes the place of the context, in its address space or as the snapshot of the
+ * contexts that share it. The pages of the context are written back and moved in the swap file, so the merge costs in
+ * proportion to the pages that were written in the context, and not to the pages of the snapshot.
+ */
+void MergeIntoSnapshot(int context) {
+    int snapshot = GetContextSnapshot(context);
+    DropContext(context, true);
+    if (IsContextSwapped(context)) {
+        DropReplacedPages(GetContextRoot(snapshot), 0, context);
+        PMmove(GetPageIdx(TagAddress(context, 0)), NUM_PAGES, GetPageIdx(TagAddress(snapshot, 0)));
+        SetContextSwapped(snapshot);
+    }
+    SetContextSnapshot(context, -1);
+    for (int sharer = 0; sharer < MAX_CONTEXTS; sharer++) {
+        if ((GetContextRoot(sharer) != NO_ROOT) && (GetContextSnapshot(sharer) == context)) {
+            SetContextSnapshot(sharer, snapshot);
+        }
+    }
+    for (int addressSpace = 0; addressSpace < MAX_ADDRESS_SPACES; addressSpace++) {
+        if (GetAddressSpaceContext(addressSpace) == context) {
+            SetAddressSpaceContext(addressSpace, snapshot);
+        }
+    }
+}
+
+/**
+ * Destroys a context that no other context shares: its pages are dropped with their copies in the swap file. Then its
+ * snapshot is destroyed in the same way if no other context shares it, and so on, or else, if a single context still
+ * shares the snapshot, that context is merged into it. Thus every snapshot is shared by two contexts at least, so the
+ * snapshots are fewer than the address spaces.
+ * Context 0 is never destroyed, since it is at the end of the snapshots of address space 0.
+ */
+void DestroyContext(int context) {
+    while ((context >= 0) && (GetNumContextSharers(context) == 0)) {
+        int snapshot = GetContextSnapshot(context);
+        SetContextSnapshot(context, -1);
+        DropContext(context, false);
+        if (IsContextSwapped(context)) {
+            PMdiscard(GetPageIdx(TagAddress(context, 0)), NUM_PAGES);
+        }
+        if ((snapshot >= 0) && (GetNumContextSharers(snapshot) == 1)) {
+            for (int sharer = 0; sharer < MAX_CONTEXTS; sharer++) {
+                if ((GetContextRoot(sharer) != NO_ROOT) && (GetContextSnapshot(sharer) == snapshot)) {
+                    MergeIntoSnapshot(sharer);
+                    break;
+                }
+            }
+            return;
+        }
+        context = snapshot;
+    }
+}
+
+int VMcreateAddressSpace() {
+#ifdef VM_CONCURRENT
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+#endif
+    int addressSpace = FindFreeAddressSpace();
+    // the frames that are not roots must still fit a whole walk of the page table:
+    if ((addressSpace < 0) || ((GetNumContexts() + TABLES_DEPTH) >= NUM_FRAMES)) {
+        return -1;
+    }
+    int context = CreateContext(-1);
+    if (context < 0) {
+        return -1;
+    }
+    SetAddressSpaceContext(addressSpace, context);
+    if (TraceIsRecordingVirtual()) {
+        TraceRecordAddressSpace(TRACE_VM_CREATE_ADDRESS_SPACE, addressSpace);
+    }
+    return addressSpace;
+}
+
+int VMdestroyAddressSpace(int addressSpace) {
+#ifdef VM_CONCURRENT
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+#endif
+    if ((addressSpace <= 0) || (addressSpace >= MAX_ADDRESS_SPACES) ||
+        (GetAddressSpaceContext(addressSpace) < 0) || (addressSpace == GetCurrentAddressSpace())) {
+        return 0;
+    }
+    if (TraceIsRecordingVirtual()) {
+        TraceRecordAddressSpace(TRACE_VM_DESTROY_ADDRESS_SPACE, addressSpace);
+    }
+    int context = GetAddressSpaceContext(addressSpace);
+    SetAddressSpaceContext(addressSpace, -1);
+    DestroyContext(context);
+    return 1;
+}
+
+int VMswitchAddressSpace(int addressSpace) {
+    if ((addressSpace < 0) || (addressSpace >= MAX_ADDRESS_SPACES) || (GetAddressSpaceContext(addressSpace) < 0)) {
+        return 0;
+    }
+    SetCurrentAddressSpace(addressSpace);
+    return 1;
+}
+
+int VMgetAddressSpace() {
+    return GetCurrentAddressSpace();
+}
+
+int VMfork() {
+#ifdef VM_CONCURRENT
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+#endif
+    int addressSpace = GetCurrentAddressSpace();
+    int snapshot = GetAddressSpaceContext(addressSpace);
+    int child = FindFreeAddressSpace();
+    // the two new contexts take a root table each, and the frames that are left must still fit a whole walk:
+    if ((snapshot < 0) || (child < 0) || ((GetNumContexts() + 2) > MAX_CONTEXTS) ||
+        ((GetNumContexts() + 1 + TABLES_DEPTH) >= NUM_FRAMES)) {
+        return -1;
+    }
+    // the context of the address space becomes the snapshot, as it is, so nothing is copied:
+    SetAddressSpaceContext(addressSpace, CreateContext(snapshot));
+    SetAddressSpaceContext(child, CreateContext(snapshot));
+#ifdef VM_CONCURRENT
+    // a write that found its page in the snapshot before the snapshot froze completes before the fork returns, and
+    // the writes that lock the frame of the page after that see that the snapshot is frozen:
+    for (word_t frameIdx = 0; frameIdx < NUM_FRAMES; frameIdx++) {
+        LockFrame(frameIdx);
+        UnlockFrame(frameIdx);
+    }
+#endif
+    if (TraceIsRecordingVirtual()) {
+        TraceRecordAddressSpace(TRACE_VM_FORK_ADDRESS_SPACE, child);
+    }
+    return child;
+}
+
+void VMgetReadaheadStats(uint64_t *prefetched, uint64_t *hits, uint64_t *wasted) {
+    uint64_t prefetchedPages, readaheadHits, wastedPages;
+    ReadaheadGetStats(&prefetchedPages, &readaheadHits, &wastedPages);
+    if (prefetched != nullptr) {
+        *prefetched = prefetchedPages;
+    }
+    if (hits != nullptr) {
+        *hits = readaheadHits;
+    }
+    if (wasted != nullptr) {
+        *wasted = wastedPages;
+    }
+}
+
+int VMstartRecording(const char *path, int recordPhysical) {
+    if ((path == nullptr) || !TraceOpen(path, recordPhysical != 0)) {
+        return 0;
+    }
+    // a replay starts from the policy that is in use, since the recording may start after VMinitialize:
+    TraceRecordInitialize(replacementPolicyType);
+    return 1;
+}
+
+int VMstopRecording() {
+    return TraceClose() ? 1 : 0;
+}
+
+int VMread(uint64_t virtualAddress, word_t *value) {
+    if ((virtualAddress >= VIRTUAL_MEMORY_SIZE) || (value == nullptr)) {
+        return 0;
+    }
+    if (TraceIsRecordingVirtual()) {
+        TraceRecordRead(virtualAddress);
+    }
+    bool accessed = AccessVirtualAddress(virtualAddress, false, [value](uint64_t physicalAddress) {
+        PMread(physicalAddress, value);
+    });
+    return accessed ? 1 : 0;
+}
+
+int VMwrite(uint64_t virtualAddress, word_t value) {
+    if (virtualAddress >= VIRTUAL_MEMORY_SIZE) {
+        return 0;
+    }
+    if (TraceIsRecordingVirtual()) {
+        TraceRecordWrite(virtualAddress, value);
+    }
+    bool accessed = AccessVirtualAddress(virtualAddress, true, [value](uint64_t physicalAddress) {
+        PMwrite(physicalAddress, value);
+    });
+    return accessed ? 1 : 0;
+}
+
+bool IsValidRange(uint64_t virtualAddress, uint64_t count) {
+    return (count <= VIRTUAL_MEMORY_SIZE) && (virtualAddress <= (VIRTUAL_MEMORY_SIZE - count));
+}
+
+/**
+ * @return the number of words from virtualAddress onwards that are in its page, up to count.
+ */
+uint64_t GetRunLength(uint64_t virtualAddress, uint64_t count) {
+    uint64_t leftInPage = PAGE_SIZE - GetOffset(virtualAddress);
+    return (count < leftInPage) ? count : leftInPage;
+}
+
+int VMreadRange(uint64_t virtualAddress, word_t *values, uint64_t count) {
+    if (!IsValidRange(virtualAddress, count) || (values == nullptr)) {
+        return 0;
+    }
+    if (TraceIsRecordingVirtual()) {
+        TraceRecordReadRange(virtualAddress, count);
+    }
+    while (count > 0) {
+        uint64_t runLength = GetRunLength(virtualAddress, count);
+        bool accessed = AccessVirtualAddress(virtualAddress, false, [values, runLength](uint64_t physicalAddress) {
+            PMreadRange(physicalAddress, values, runLength);
+        });
+        if (!accessed) {
+            return 0;
+        }
+        virtualAddress += runLength;
+        values += runLength;
+        count -= runLength;
+    }
+    return 1;
+}
+
+int VMwriteRange(uint64_t virtualAddress, const word_t *values, uint64_t count) {
+    if (!IsValidRange(virtualAddress, count) || (values == nullptr)) {
+        return 0;
+    }
+    if (TraceIsRecordingVirtual()) {
+        TraceRecordWriteRange(virtualAddress, values, count);
+    }
+    while (count > 0) {
+        uint64_t runLength = GetRunLength(virtualAddress, count);
+        bool accessed = AccessVirtualAddress(virtualAddress, true, [values, runLength](uint64_t physicalAddress) {
+            PMwriteRange(physicalAddress, values, runLength);
+        });
+        if (!accessed) {
+            return 0;
+        }
+        virtualAddress += runLength;
+        values += runLength;
+        count -= runLength;
+    }
+    return 1;
+}
+
+int VMfill(uint64_t virtualAddress, word_t value, uint64_t count) {
+    if (!IsValidRange(virtualAddress, count)) {
+        return 0;
+    }
+    if (TraceIsRecordingVirtual()) {
+        TraceRecordFill(virtualAddress, value, count);
+    }
+    while (count > 0) {
+        uint64_t runLength = GetRunLength(virtualAddress, count);
+        bool accessed = AccessVirtualAddress(virtualAddress, true, [value, runLength](uint64_t physicalAddress) {
+            PMfill(physicalAddress, value, runLength);
+        });
+        if (!accessed) {
+            return 0;
+        }
+        virtualAddress += runLength;
+        count -= runLength;
+    }
+    return 1;
+}
+
+/**
+ * Copies the words through a buffer of one page, since translating the destination may evict the source page.
+ * The runs are copied in page order, unless the destination overlaps the end of the source, in which case they are
+ * copied from the last run backwards (like memmove).
+ */
+int VMcopy(uint64_t dstVirtualAddress, uint64_t srcVirtualAddress, uint64_t count) {
+    if (!IsValidRange(dstVirtualAddress, count) || !IsValidRange(srcVirtualAddress, count)) {
+        return 0;
+    }
+    if (TraceIsRecordingVirtual()) {
+        TraceRecordCopy(dstVirtualAddress, srcVirtualAddress, count);
+    }
+    word_t buffer[PAGE_SIZE];
+    bool backwards = (dstVirtualAddress > srcVirtualAddress) && (dstVirtualAddress < (srcVirtualAddress + count));
+
+    while (count > 0) {
+        uint64_t runLength;
+        uint64_t srcRunAddress;
+        uint64_t dstRunAddress;
+        if (backwards) {
+            // the run ends at the last word that was not copied yet:
+            uint64_t srcLeftInPage = GetOffset(srcVirtualAddress + count - 1) + 1;
+            uint64_t dstLeftInPage = GetOffset(dstVirtualAddress + count - 1) + 1;
+            runLength = (srcLeftInPage < dstLeftInPage) ? srcLeftInPage : dstLeftInPage;
+            runLength = (count < runLength) ? count : runLength;
+            srcRunAddress = srcVirtualAddress + count - runLength;
+            dstRunAddress = dstVirtualAddress + count - runLength;
+        } else {
+            runLength = GetRunLength(dstVirtualAddress, GetRunLength(srcVirtualAddress, count));
+            srcRunAddress = srcVirtualAddress;
+            dstRunAddress = dstVirtualAddress;
+            srcVirtualAddress += runLength;
+            dstVirtualAddress += runLength;
+        }
+        bool accessed = AccessVirtualAddress(srcRunAddress, false, [&buffer, runLength](uint64_t physicalAddress) {
+            PMreadRange(physicalAddress, buffer, runLength);
+        }) && AccessVirtualAddress(dstRunAddress, true, [&buffer, runLength](uint64_t physicalAddress) {
+            PMwriteRange(physicalAddress, buffer, runLength);
+        });
+        if (!accessed) {
+            return 0;
+        }
+        count -= runLength;
+    }
+    return 1;
+}
+
+int VMadvise(uint64_t virtualAddress, uint64_t count, PageAdvice advice) {
+    if (!IsValidRange(virtualAddress, count) || (GetOffset(virtualAddress) != 0) || (advice < ADVISE_NORMAL) ||
+        (advice > ADVISE_DONTNEED)) {
+        return 0;
+    }
+#ifdef VM_CONCURRENT
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+#endif
+    int addressSpace = GetCurrentAddressSpace();
+    int context = GetAddressSpaceContext(addressSpace);
+    if (context < 0) {
+        return 0;
+    }
+    uint64_t numPages = (count + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (advice == ADVISE_DONTNEED) {
+        if (numPages > 0) {
+            DropPages(context, GetPageIdx(TagAddress(context, virtualAddress)), numPages);
+        }
+    } else if (advice == ADVISE_WILLNEED) {
+        PrefetchPages(GetPageIdx(TagAddress(context, virtualAddress)), numPages);
+    } else if (!SetAddressSpaceAdvice(addressSpace, GetPageIdx(virtualAddress), numPages, advice)) {
+        return 0;
+    }
+    if (TraceIsRecordingVirtual()) {
+        TraceRecordAdvise(virtualAddress, count, advice);
+    }
+    return 1;
+}
+
+// the frame of a page that is only in the swap file, among the pages of a checkpoint:
+#define SWAPPED_PAGE_FRAME ((word_t) -1)
+
+/**
+ * @return the page index and the frame (or SWAPPED_PAGE_FRAME) of every page that a context holds, in page order. A
+ *         page that is in the RAM is taken from its frame, even if it still has its copy in the swap file.
+ */
+std::vector<std::pair<uint64_t, word_t>> FindCheckpointPages() {
+    std::vector<std::pair<uint64_t, word_t>> pages;
+    for (word_t frameIdx = 0; frameIdx < NUM_FRAMES; frameIdx++) {
+        const FrameInfo &info = GetFrameInfo(frameIdx);
+        if (info.used && (info.depth == TABLES_DEPTH)) {
+            pages.push_back(std::make_pair(info.cumulativePageIdx, frameIdx));
+        }
+    }
+    for (int context = 0; context < MAX_CONTEXTS; context++) {
+        if ((GetContextRoot(context) == NO_ROOT) || !IsContextSwapped(context)) {
+            continue;
+        }
+        for (uint64_t pageIdx : PMfindSwapped(GetPageIdx(TagAddress(context, 0)), NUM_PAGES)) {
+            pages.push_back(std::make_pair(pageIdx, SWAPPED_PAGE_FRAME));
+        }
+    }
+    // the frame of a page comes before its copy in the swap file, which is then dropped:
+    std::sort(pages.begin(), pages.end(), [](const std::pair<uint64_t, word_t> &a,
+                                             const std::pair<uint64_t, word_t> &b) {
+        return (a.first != b.first) ? (a.first < b.first) : (b.second == SWAPPED_PAGE_FRAME) && (a.second != b.second);
+    });
+    pages.erase(std::unique(pages.begin(), pages.end(), [](const std::pair<uint64_t, word_t> &a,
+                                                           const std::pair<uint64_t, word_t> &b) {
+        return a.first == b.first;
+    }), pages.end());
+    return pages;
+}
+
+int VMcheckpoint(const char *path) {
+    if (path == nullptr) {
+        return 0;
+    }
+#ifdef VM_CONCURRENT
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+#endif
+    CheckpointContexts contexts;
+    for (int context = 0; context < MAX_CONTEXTS; context++) {
+        contexts.contextSnapshots[context] =
+                (GetContextRoot(context) == NO_ROOT) ? CHECKPOINT_NO_CONTEXT : GetContextSnapshot(context);
+    }
+    for (int addressSpace = 0; addressSpace < MAX_ADDRESS_SPACES; addressSpace++) {
+        contexts.addressSpaceContexts[addressSpace] = GetAddressSpaceContext(addressSpace);
+    }
+    std::vector<std::pair<uint64_t, word_t>> pages = FindCheckpointPages();
+    if (!CheckpointBeginWrite(path, replacementPolicyType, hugePagesEnabled, contexts, pages.size())) {
+        return 0;
+    }
+    word_t page[PAGE_SIZE];
+    for (const std::pair<uint64_t, word_t> &entry : pages) {
+        if (entry.second == SWAPPED_PAGE_FRAME) {
+            PMreadSwapped(entry.first, page);
+        } else {
+            // the lock-free accesses of the other threads write a page while holding the lock of its frame:
+            LockFrame(entry.second);
+            PMreadRange(GetIndexInRam(entry.second, 0), page, PAGE_SIZE);
+            UnlockFrame(entry.second);
+        }
+        CheckpointWritePage(entry.first, page);
+    }
+    return CheckpointFinishWrite() ? 1 : 0;
+}
+
+int VMrestoreCheckpoint(const char *path) {
+    CheckpointFile file;
+    if ((path == nullptr) || !CheckpointOpen(path, &file)) {
+        return 0;
+    }
+    VMinitialize((PageReplacementPolicy) file.header->policy);
+    // VMinitialize keeps the copies of context 0 in the swap file, which the checkpoint replaces, so no page is left
+    // in the checkpoint that was in use before:
+    PMdiscard(GetPageIdx(TagAddress(0, 0)), NUM_PAGES);
+    CheckpointUse(file);
+
+    const CheckpointContexts &contexts = *file.contexts;
+    for (int context = 1; context < MAX_CONTEXTS; context++) {
+        if (contexts.contextSnapshots[context] != CHECKPOINT_NO_CONTEXT) {
+            SetContextRoot(context, MapRootFrame(context));
+        }
+    }
+    for (int context = 0; context < MAX_CONTEXTS; context++) {
+        if (contexts.contextSnapshots[context] >= 0) {
+            SetContextSnapshot(context, (int) contexts.contextSnapshots[context]);
+        }
+    }
+    for (int addressSpace = 0; addressSpace < MAX_ADDRESS_SPACES; addressSpace++) {
+        if (contexts.addressSpaceContexts[addressSpace] >= 0) {
+            SetAddressSpaceContext(addressSpace, (int) contexts.addressSpaceContexts[addressSpace]);
+        }
+    }
+    // the pages are only recorded as swapped out, and are read from the mapping of the file on their first access:
+    for (uint64_t entry = 0; entry < file.header->numPages; entry++) {
+        const CheckpointPage &page = file.pages[entry];
+        if (page.dataPage == CHECKPOINT_ZERO_PAGE) {
+            PMevictZeroPage(page.pageIdx);
+        } else {
+            PMmapCheckpointPage(page.pageIdx, page.dataPage);
+        }
+        SetContextSwapped(GetContextOfPage(page.pageIdx));
+    }
+    hugePagesEnabled = (file.header->hugePages != 0);
+    return 1;
+}
+
+/**
+ * Merges the page in frameIdx into ownerFrameIdx if the two pages are identical: the page leaves its frame, which is
+ * freed, and is read in ownerFrameIdx from then on (see PMshareFrame).
+ * @return true if the page was merged.
+ */
+bool MergeFrame(word_t frameIdx, word_t ownerFrameIdx) {
+    word_t page[PAGE_SIZE];
+    word_t ownerPage[PAGE_SIZE];
+    // the lock-free accesses of the other threads write a page while holding the lock of its frame:
+    LockFrame(ownerFrameIdx);
+    LockFrame(frameIdx);
+    PMreadRange(GetIndexInRam(frameIdx, 0), page, PAGE_SIZE);
+    PMreadRange(GetIndexInRam(ownerFrameIdx, 0), ownerPage, PAGE_SIZE);
+    bool identical = std::equal(page, page + PAGE_SIZE, ownerPage);
+    if (identical) {
+        uint64_t pageIdx = GetFrameInfo(frameIdx).cumulativePageIdx;
+        // the frame of the owner replaces the copy of the page in the swap file, so the page is not written back:
+        RemoveFrame(frameIdx, true, false);
+        ReleaseFrame(frameIdx);
+        PMshareFrame(pageIdx, ownerFrameIdx);
+        SetContextSwapped(GetContextOfPage(pageIdx));
+    }
+    UnlockFrame(frameIdx);
+    UnlockFrame(ownerFrameIdx);
+    if (identical) {
+        PMzeroFrame(frameIdx);
+        PushFreeFrame(frameIdx);
+    }
+    return identical;
+}
+
+/**
+ * Hashes the pages in the RAM, and merges each page into the frame of the first identical page, or of an identical
+ * page that other pages were merged into already. A frame that other pages were merged into is never merged itself,
+ * and neither is a huge page. Does nothing unless dedup is on.
+ * @return the number of pages that were merged, which is the number of frames that were freed.
+ */
+uint64_t DedupScan() {
+    if (!dedupEnabled) {
+        return 0;
+    }
+    std::vector<std::pair<uint64_t, word_t>> hashes;
+    for (word_t frameIdx = 0; frameIdx < NUM_FRAMES; frameIdx++) {
+        const FrameInfo &info = GetFrameInfo(frameIdx);
+        if (info.used && (info.depth == TABLES_DEPTH) && !info.huge) {
+            LockFrame(frameIdx);
+            hashes.push_back(std::make_pair(PMhashFrame(frameIdx), frameIdx));
+            UnlockFrame(frameIdx);
+        }
+    }
+    STATS_ADD(dedupScannedPages, hashes.size());
+    std::sort(hashes.begin(), hashes.end());
+    uint64_t merged = 0;
+    for (size_t first = 0, end = 0; first < hashes.size(); first = end) {
+        word_t ownerFrameIdx = hashes[first].second;
+        for (end = first; (end < hashes.size()) && (hashes[end].first == hashes[first].first); end++) {
+            if (PMisFrameShared(hashes[end].second)) {
+                ownerFrameIdx = hashes[end].second;
+            }
+        }
+        for (size_t entry = first; entry < end; entry++) {
+            word_t frameIdx = hashes[entry].second;
+            if ((frameIdx != ownerFrameIdx) && !PMisFrameShared(frameIdx) && MergeFrame(frameIdx, ownerFrameIdx)) {
+                merged++;
+            }
+        }
+    }
+    STATS_ADD(dedupMergedPages, merged);
+    return merged;
+}
+
+#ifdef VM_CONCURRENT
+/**
+ * The body of the dedup scanner thread: scans the RAM every dedupScanIntervalMs milliseconds, until it is stopped.
+ */
+void RunDedupScanner() {
+    std::unique_lock<std::mutex> faultLock(faultMutex);
+    while (!dedupScannerStop) {
+        dedupScannerWakeup.wait_for(faultLock, std::chrono::milliseconds(dedupScanIntervalMs), [] {
+            return dedupScannerStop;
+        });
+        if (!dedupScannerStop) {
+            DedupScan();
+        }
+    }
+}
+#endif
+
+void VMsetDedup(int enable) {
+#ifdef VM_CONCURRENT
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+#endif
+    dedupEnabled = (enable != 0);
+    PMsetDedup(enable);
+}
+
+uint64_t VMdedupScan() {
+#ifdef VM_CONCURRENT
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+#endif
+    return DedupScan();
+}
+
+int VMstartDedupScanner(uint64_t intervalMs) {
+#ifdef VM_CONCURRENT
+    if (intervalMs == 0) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+    if (dedupScannerThread != nullptr) {
+        return 0;
+    }
+    dedupScanIntervalMs = intervalMs;
+    dedupScannerStop = false;
+    dedupScannerThread = new std::thread(RunDedupScanner);
+    // the thread must be gone before exit destroys the bookkeeping that it uses:
+    static bool stopAtExitRegistered = false;
+    if (!stopAtExitRegistered) {
+        stopAtExitRegistered = true;
+        std::atexit(VMstopDedupScanner);
+    }
+    return 1;
+#else
+    (void) intervalMs;
+    return 0;
+#endif
+}
+
+void VMstopDedupScanner() {
+#ifdef VM_CONCURRENT
+    std::thread *thread;
+    {
+        std::lock_guard<std::mutex> faultLock(faultMutex);
+        thread = dedupScannerThread;
+        dedupScannerStop = true;
+    }
+    if (thread == nullptr) {
+        return;
+    }
+    dedupScannerWakeup.notify_one();
+    thread->join();
+    delete thread;
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+    dedupScannerThread = nullptr;
+#endif
+}
+
+void VMgetDedupStats(uint64_t *savedFrames, uint64_t *savedSwapPages, uint64_t *savedSwapBytes) {
+#ifdef VM_CONCURRENT
+    std::lock_guard<std::mutex> faultLock(faultMutex);
+#endif
+    uint64_t framePages;
+    uint64_t slotPages;
+    uint64_t slotBytes;
+    PMgetDedupUsage(&framePages, &slotPages, &slotBytes);
+    if (savedFrames != nullptr) {
+        *savedFrames = framePages;
+    }
+    if (savedSwapPages != nullptr) {
+        *savedSwapPages = slotPages;
+    }
+    if (savedSwapBytes != nullptr) {
+        *savedSwapBytes = slotBytes;
+    }
+}
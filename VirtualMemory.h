@@ -4,10 +4,117 @@
 //#include "YaaraConstants.h"
 
 /*
- * Initialize the virtual memory.
+ * The policies for choosing the page to evict when the RAM is full.
+ */
+typedef enum {
+    // the page with the largest cyclic distance from the faulting page (the policy in the pdf)
+    CYCLIC_DISTANCE_POLICY,
+    // the least recently used page
+    LRU_POLICY,
+    // second chance: the first page, in frame order from a moving hand, that was not accessed since the hand passed it
+    CLOCK_POLICY,
+    // Adaptive Replacement Cache, which balances between recently and frequently used pages
+    ARC_POLICY
+} PageReplacementPolicy;
+
+/*
+ * The hints of VMadvise about how a range of pages is going to be accessed.
+ */
+typedef enum {
+    // no particular pattern, which forgets the pattern that was advised for the range (the default)
+    ADVISE_NORMAL,
+    // accessed in no particular order, so faults in the range read nothing ahead
+    ADVISE_RANDOM,
+    // accessed in page order, so faults in the range read ahead eagerly, and the pages behind them are evicted first
+    ADVISE_SEQUENTIAL,
+    // accessed soon, so the pages of the range are restored now
+    ADVISE_WILLNEED,
+    // not accessed anymore, so the pages of the range are dropped, as if they were never written
+    ADVISE_DONTNEED
+} PageAdvice;
+
+// the number of buckets in the latency histogram of VMstats. bucket i counts the page faults that took
+// [2^i, 2^(i+1)) nanoseconds, and the last bucket also counts the longer ones
+#define VM_STATS_LATENCY_BUCKETS 32
+
+/*
+ * Counters of the paging activity, see VMgetStats.
+ */
+typedef struct {
+    // page faults on each level of the page table, so faultsPerLevel[TABLES_DEPTH - 1] counts the faults on pages
+    // (including the pages that are read ahead)
+    uint64_t faultsPerLevel[TABLES_DEPTH];
+    // page faults that took an empty table, a frame that was never used, or a frame freed by the reclaimer
+    uint64_t emptyTableReuses;
+    uint64_t unusedFrameAllocations;
+    uint64_t freeFrameAllocations;
+    // evictions of pages that had to be written to the swap file (dirty) or not (clean)
+    uint64_t cleanEvictions;
+    uint64_t dirtyEvictions;
+    // pages that were restored from the swap file, and pages that were never evicted, so there was nothing to restore
+    uint64_t swapRestores;
+    uint64_t neverEvictedRestores;
+    // translations that were served by the TLB, and translations that missed it (see VMgetTlbStats)
+    uint64_t tlbHits;
+    uint64_t tlbMisses;
+    // page table entries read by the translations that walked the page table
+    uint64_t pageTableEntriesRead;
+    // page table walks that started at a table from the paging-structure cache, and walks that started at frame 0
+    uint64_t pagingStructureCacheHits;
+    uint64_t pagingStructureCacheMisses;
+    // huge pages that were mapped, and huge pages that were split to evict one of their pages
+    uint64_t hugePageMappings;
+    uint64_t hugePageSplits;
+    // first writes to pages that an address space shared with its snapshot (see VMfork), which copied the pages, and
+    // reads of such pages, which were read from the snapshot
+    uint64_t copyOnWriteFaults;
+    uint64_t snapshotPageReads;
+    // pages that the swap store saved, pages of zeroes among them, which it kept as a flag, and pages that it spilled
+    // to the swap file (see PMsetSwapStoreLimit)
+    uint64_t swapSavedPages;
+    uint64_t swapZeroPages;
+    uint64_t swapSpilledPages;
+    // pages that the swap store saved in the slot of an identical page, with dedup on (see VMsetDedup)
+    uint64_t swapDedupPages;
+    // bytes of the other pages that the swap store saved, and of the compressed copies that it kept of them, so their
+    // ratio is the compression ratio, and the time it took to compress and decompress pages, in nanoseconds
+    uint64_t swapUncompressedBytes;
+    uint64_t swapCompressedBytes;
+    uint64_t swapCompressNs;
+    uint64_t swapDecompressNs;
+    // pages and tables that were dropped by ADVISE_DONTNEED, and pages that were restored by ADVISE_WILLNEED
+    uint64_t advisedDroppedPages;
+    uint64_t advisedDroppedTables;
+    uint64_t advisedPrefetches;
+    // pages that were loaded from the checkpoint of VMrestoreCheckpoint, which happens on their first access
+    uint64_t checkpointRestores;
+    // pages that the dedup scans hashed, pages that they merged into the frame of an identical page, reads of merged
+    // pages, which read that frame, and frames whose merged pages were copied out, since the frame was written or
+    // taken (see VMdedupScan)
+    uint64_t dedupScannedPages;
+    uint64_t dedupMergedPages;
+    uint64_t dedupSharedReads;
+    uint64_t dedupUnsharedFrames;
+    // words read and written in the physical memory, only counted in a build with PM_COUNT_ACCESSES
+    uint64_t pmReads;
+    uint64_t pmWrites;
+    // the time it took to handle each page fault, only measured in a build with VM_STATS_LATENCY
+    uint64_t faultLatencyHistogram[VM_STATS_LATENCY_BUCKETS];
+} VMstats;
+
+/*
+ * Initialize the virtual memory, evicting pages by the cyclic distance policy.
+ *
+ * In a build with VM_CONCURRENT defined, all of the other functions may be
+ * called from several threads at once, but not concurrently with this one.
  */
 void VMinitialize();
 
+/*
+ * Initialize the virtual memory, evicting pages by the given policy.
+ */
+void VMinitialize(PageReplacementPolicy policy);
+
 /* Reads a word from the given virtual address
  * and puts its content in *value.
  *
@@ -24,3 +131,330 @@ int VMread(uint64_t virtualAddress, word_t* value);
  * address for any reason)
  */
 int VMwrite(uint64_t virtualAddress, word_t value);
+
+/* Reads 'count' consecutive words, starting at the given virtual address,
+ * into 'values'. Every page of the range is translated once, in page order.
+ *
+ * returns 1 on success.
+ * returns 0 on failure (if the range exceeds the virtual memory, or 'values'
+ * is null)
+ */
+int VMreadRange(uint64_t virtualAddress, word_t* values, uint64_t count);
+
+/* Writes 'count' consecutive words from 'values', starting at the given
+ * virtual address. Every page of the range is translated once, in page order.
+ *
+ * returns 1 on success.
+ * returns 0 on failure (if the range exceeds the virtual memory, or 'values'
+ * is null)
+ */
+int VMwriteRange(uint64_t virtualAddress, const word_t* values, uint64_t count);
+
+/* Writes 'value' to 'count' consecutive words, starting at the given virtual
+ * address. Every page of the range is translated once, in page order.
+ *
+ * returns 1 on success.
+ * returns 0 on failure (if the range exceeds the virtual memory)
+ */
+int VMfill(uint64_t virtualAddress, word_t value, uint64_t count);
+
+/* Copies 'count' consecutive words from the source virtual address to the
+ * destination virtual address. The ranges may overlap.
+ *
+ * returns 1 on success.
+ * returns 0 on failure (if one of the ranges exceeds the virtual memory)
+ */
+int VMcopy(uint64_t dstVirtualAddress, uint64_t srcVirtualAddress, uint64_t count);
+
+/* Puts the number of page faults on a page (not on a table) since VMinitialize
+ * in *pageFaults, and the number of pages that were evicted in *evictions.
+ */
+void VMgetPagingStats(uint64_t* pageFaults, uint64_t* evictions);
+
+/* Puts the number of evictions of pages that were not modified since they were
+ * restored in *cleanEvictions, and of the others in *dirtyEvictions.
+ * A clean page still has its copy in the swap file, so its eviction copies
+ * nothing.
+ */
+void VMgetEvictionStats(uint64_t* cleanEvictions, uint64_t* dirtyEvictions);
+
+/* Puts the number of translations that were served by the TLB in *hits,
+ * and the number of translations that had to walk the page table in *misses.
+ * Both counters are reset by VMinitialize, and are 0 in a build with
+ * VM_NO_STATS.
+ */
+void VMgetTlbStats(uint64_t* hits, uint64_t* misses);
+
+/* Starts a background thread that evicts pages ahead of time, so that page
+ * faults on a full RAM can take a free frame instead of evicting a page on
+ * the spot. Whenever fewer than lowWatermark free frames are left, the thread
+ * evicts the pages that the replacement policy chooses and zeroes their
+ * frames, until highWatermark frames are free. When the pool runs dry, a page
+ * fault evicts a page itself, as without the reclaimer.
+ * Only available in a VM_CONCURRENT build. The thread runs until
+ * VMstopReclaimer, VMinitialize or the exit of the program.
+ * returns 1 on success, or 0 if the watermarks are invalid (lowWatermark must
+ * be positive and at most highWatermark, which must leave room for a path of
+ * tables and a page), if the reclaimer is already running, or if the build is
+ * not VM_CONCURRENT.
+ */
+int VMstartReclaimer(uint64_t lowWatermark, uint64_t highWatermark);
+
+/* Stops the reclaimer thread and waits for it to exit, if it is running.
+ * The frames it already freed stay available to page faults.
+ */
+void VMstopReclaimer();
+
+/* Puts the number of frames that the reclaimer freed in *reclaimedFrames, the
+ * number of page faults that took a free frame in *freeFrameFaults, and the
+ * number of page faults that found the pool empty and had to evict a page
+ * while the reclaimer was running in *missedFaults. The counters are reset by
+ * VMinitialize.
+ */
+void VMgetReclaimerStats(uint64_t* reclaimedFrames, uint64_t* freeFrameFaults, uint64_t* missedFaults);
+
+/* Puts the counters of the paging activity since the last VMresetStats (or
+ * VMinitialize) in *stats.
+ * Each thread counts in its own cache line, and the counters of all of the
+ * threads (including the ones that exited) are summed here.
+ * In a build with VM_NO_STATS the counters are compiled out, and all of them
+ * are 0.
+ */
+void VMgetStats(VMstats* stats);
+
+/* Starts the counters of VMgetStats over, e.g. to scrape them per interval.
+ */
+void VMresetStats();
+
+/* Starts recording every VMinitialize, VMread, VMwrite, VMreadRange,
+ * VMwriteRange, VMfill, VMcopy and VMadvise that succeeds to a binary trace
+ * file at the given path (see TraceRecorder.h for the format), to be replayed
+ * by traceReplay. If recordPhysical is not 0, every PMevict and PMrestore is
+ * recorded as well, and so is every PMread and PMwrite in a build with
+ * PM_TRACE_ACCESSES.
+ * The records are written by a background thread. The recording stops on
+ * VMstopRecording, or when the program exits.
+ * In a VM_CONCURRENT build, the records of concurrent accesses are in the
+ * order in which they were recorded, which only matches the order of the
+ * accesses if the program has no data races.
+ *
+ * returns 1 on success.
+ * returns 0 on failure (if the file cannot be opened, or a recording is
+ * already in progress)
+ */
+int VMstartRecording(const char* path, int recordPhysical);
+
+/* Stops the recording, and waits until the whole trace is in its file.
+ *
+ * returns 1 on success.
+ * returns 0 on failure (if nothing was being recorded, or writing the trace
+ * failed, in which case it is incomplete)
+ */
+int VMstopRecording();
+
+/* Enables readahead: when page faults follow a sequential or constant-stride
+ * pattern, the pages that are expected to fault next are restored on the same
+ * fault, up to maxWindow pages at a time. The window adapts to how many of the
+ * pages read ahead are used. Pages are only read ahead into frames that can be
+ * taken without writing a dirty page back.
+ * maxWindow = 0 disables readahead, which is the default after VMinitialize.
+ */
+void VMsetReadahead(uint64_t maxWindow);
+
+/* Enables huge pages: a page fault on a missing leaf table maps all of the
+ * PAGE_SIZE pages under it at once, to PAGE_SIZE consecutive frames. The frames
+ * are free ones if there are such, and otherwise the frames around the victim
+ * of the replacement policy, whose pages are all evicted (so huge pages suit
+ * dense accesses, and hurt scattered ones). The walks of the pages of a huge
+ * page end one level early. To evict a single page of a huge page, the huge
+ * page is split: the frame of the page becomes a leaf table of the others.
+ * enable = 0 disables huge pages, which is the default after VMinitialize.
+ * Huge pages that are mapped already are kept until they are evicted or split.
+ *
+ * returns 1 on success.
+ * returns 0 if huge pages don't fit the geometry (a single level page table,
+ * or fewer frames than PAGE_SIZE + 1).
+ */
+int VMsetHugePages(int enable);
+
+/* Tells how the pages of the 'count' words from the given virtual address (of
+ * the current address space) are going to be accessed, which must start at a
+ * page. The range is rounded up to whole pages.
+ * ADVISE_DONTNEED frees the frames of the pages and their copies in the swap
+ * file, as well as the tables that are left empty, so the pages are as if they
+ * were never written in the address space. The pages that it shares with
+ * another address space (see VMfork) thus read as zeroes, while the other
+ * address space keeps them.
+ * ADVISE_WILLNEED restores the pages that are in the swap file in one batch,
+ * in page order, like readahead does: the batch stops at the first page that
+ * would evict a dirty page, or once it has restored half of the frames.
+ * ADVISE_RANDOM and ADVISE_SEQUENTIAL set the pattern of the range, and
+ * ADVISE_NORMAL forgets it. Faults in a random range read nothing ahead, and
+ * faults in a sequential range read ahead the largest window (see
+ * VMsetReadahead, or READAHEAD_SEQUENTIAL_WINDOW pages if readahead is
+ * disabled), and tell the replacement policy to evict the pages that the
+ * previous window read ahead before the others. Neither takes part in the
+ * detection of streams. The patterns are those of the address space, so they
+ * are forgotten when it is destroyed, and a forked address space starts
+ * without any, but they don't matter while it shares pages.
+ *
+ * returns 1 on success.
+ * returns 0 on failure (if the range exceeds the virtual memory, does not
+ * start at a page, or the pattern would split the address space into more
+ * than MAX_ADVISED_RANGES ranges, see AddressSpace.h)
+ */
+int VMadvise(uint64_t virtualAddress, uint64_t count, PageAdvice advice);
+
+/* Puts the number of pages that were read ahead in *prefetched, the number of
+ * them that were accessed in *hits, and the number of them that were evicted
+ * before being accessed in *wasted. The counters are reset by VMsetReadahead
+ * and VMinitialize.
+ */
+void VMgetReadaheadStats(uint64_t* prefetched, uint64_t* hits, uint64_t* wasted);
+
+/* Creates an address space with a page table of its own. Its pages share the
+ * RAM and the swap file with the pages of the other address spaces, and the
+ * replacement policy chooses the victims among the pages of all of them. The
+ * root table of the address space takes a frame of its own until it is
+ * destroyed. Address space 0 always exists, and VMinitialize destroys all of
+ * the others.
+ *
+ * returns the id of the new address space, which has no pages yet.
+ * returns -1 if MAX_ADDRESS_SPACES (see AddressSpace.h) address spaces exist,
+ * or MAX_CONTEXTS page tables (counting the snapshots of VMfork), or if the
+ * frames that are left besides the root tables would not fit a walk of the
+ * page table.
+ */
+int VMcreateAddressSpace();
+
+/* Destroys an address space: its pages are dropped without being written to
+ * the swap file, and the frames of its tables and pages are freed. The pages
+ * that it shares with other address spaces (see VMfork) are kept until the
+ * last of them is destroyed.
+ * In a VM_CONCURRENT build, the accesses of the other threads that are still
+ * in the address space fail from now on, until its id is given to a new
+ * address space (the ids go round, like process ids).
+ *
+ * returns 1 on success.
+ * returns 0 if the address space does not exist, is 0, or is the current
+ * address space of the calling thread.
+ */
+int VMdestroyAddressSpace(int addressSpace);
+
+/* Makes the given address space the current one, which the virtual addresses
+ * of the following calls are translated in. In a VM_CONCURRENT build every
+ * thread has its own current address space. The TLB is not flushed, since its
+ * entries are tagged with their address space.
+ *
+ * returns 1 on success.
+ * returns 0 if the address space does not exist.
+ */
+int VMswitchAddressSpace(int addressSpace);
+
+/* returns the current address space (of the calling thread).
+ */
+int VMgetAddressSpace();
+
+/* Forks the current address space (of the calling thread): creates an address
+ * space that starts with the same contents, without copying any page. Both
+ * address spaces share the pages, in the RAM and in the swap file, as a
+ * read-only snapshot. The first write of either of them to a shared page
+ * copies the page for it, in the page fault, so a fork costs in proportion to
+ * the pages that are written after it, and not to the size of the address
+ * space. The snapshot keeps the shared pages until both address spaces are
+ * destroyed, and a fork of an address space that was forked before shares the
+ * snapshots of all of its forks.
+ * The reads of a shared page skip the TLB, and in a VM_CONCURRENT build are
+ * serialised with the page faults, until the page is written. Readahead and
+ * huge pages are not used in an address space that shares pages.
+ *
+ * returns the id of the new address space, which the calling thread is not
+ * switched to.
+ * returns -1 if MAX_ADDRESS_SPACES address spaces exist, or if the two page
+ * tables that a fork takes would exceed MAX_CONTEXTS, or would not leave
+ * enough frames for a walk of the page table.
+ */
+int VMfork();
+
+/* Writes every page of every address space, and the address spaces with the
+ * snapshots that they share (see VMfork), to a checkpoint file at the given
+ * path, for VMrestoreCheckpoint (see Checkpoint.h for the format). The pages
+ * are taken from the RAM or from the swap file, wherever they are, and nothing
+ * is evicted or restored to take them. The replacement policy and whether huge
+ * pages are enabled are kept too, but the other settings, the patterns of
+ * VMadvise and the counters are not.
+ * The file is written under a temporary name, and replaces the file at the
+ * path once it is complete. In a VM_CONCURRENT build, the page faults of the
+ * other threads wait until the checkpoint is written, and every page is taken
+ * as it was at one moment, but the writes of the other threads to pages that
+ * are in the RAM may go on meanwhile, so the checkpoint only holds a single
+ * moment of the whole virtual memory if they stop.
+ *
+ * returns 1 on success.
+ * returns 0 on failure (if the file cannot be written)
+ */
+int VMcheckpoint(const char* path);
+
+/* Replaces the whole virtual memory with the one in the checkpoint file at the
+ * given path, which must have been written by a build of the same geometry
+ * (see MemoryConstants.h and AddressSpace.h). Like VMinitialize, this empties
+ * the RAM, and makes address space 0 the current one of the calling thread.
+ * The file is mapped to the memory, and no page is read here: every page of
+ * the checkpoint is recorded as swapped out, and is read from the mapping on
+ * its first access, which is a page fault like the restoring of any swapped
+ * page. The file must thus be kept as it is until the next
+ * VMrestoreCheckpoint. The checksum of the index of the pages is checked
+ * here, and the checksum of each page when it is read, where a page that does
+ * not match is fatal.
+ * Must not be called concurrently with any other function. A recording (see
+ * VMstartRecording) should start after it, since the trace would not hold the
+ * restored pages.
+ *
+ * returns 1 on success.
+ * returns 0 on failure (if the file cannot be read, is not a complete
+ * checkpoint, is of another geometry or version, or does not match its
+ * checksum), in which case the virtual memory is left as it was.
+ */
+int VMrestoreCheckpoint(const char* path);
+
+/* Turns the dedup of identical pages on or off (it is off by default, and
+ * VMinitialize turns it off). With dedup on, a page that is evicted is hashed,
+ * and if an identical page is in the swap file, the page shares its copy
+ * instead of taking a copy of its own, and VMdedupScan merges the identical
+ * pages in the RAM. Turning dedup off keeps the pages that already share a
+ * copy or a frame as they are.
+ */
+void VMsetDedup(int enable);
+
+/* Hashes every page in the RAM, and merges the pages that are identical to
+ * another page: such a page leaves its frame, which is freed, and is read in
+ * the frame of the page it is identical to, until that frame is written or
+ * evicted, which copies the page out first, or until the page itself is
+ * written, which faults it into a frame of its own. Huge pages are not
+ * merged. Does nothing if dedup is off (see VMsetDedup).
+ * In a VM_CONCURRENT build, the page faults of the other threads wait until
+ * the scan is over.
+ *
+ * returns the number of frames that were freed.
+ */
+uint64_t VMdedupScan();
+
+/* Starts a background thread that calls VMdedupScan every intervalMs
+ * milliseconds. Only available in a VM_CONCURRENT build. The thread runs
+ * until VMstopDedupScanner, VMinitialize or the exit of the program.
+ * returns 1 on success, or 0 if intervalMs is 0, if the scanner is already
+ * running, or if the build is not VM_CONCURRENT.
+ */
+int VMstartDedupScanner(uint64_t intervalMs);
+
+/* Stops the dedup scanner thread and waits for it to exit, if it is running.
+ * The pages it already merged stay merged.
+ */
+void VMstopDedupScanner();
+
+/* Puts the number of frames that the pages merged by VMdedupScan save right
+ * now in *savedFrames, the number of pages that share the copy of another
+ * page in the swap file in *savedSwapPages, and the bytes that their copies
+ * would have taken in *savedSwapBytes.
+ */
+void VMgetDedupStats(uint64_t* savedFrames, uint64_t* savedSwapPages, uint64_t* savedSwapBytes);
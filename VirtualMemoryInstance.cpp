@@ -0,0 +1,5 @@
+#include "VirtualMemoryInstance.h"
+
+template class VirtualMemoryInstance<RuntimeGeometry>;
+template class VirtualMemoryInstance<CompiledGeometry>;
+template class VirtualMemoryInstance<LargeGeometry>;
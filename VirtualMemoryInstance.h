@@ -0,0 +1,188 @@
+#pragma once
+
+#include "Geometry.h"
+#include "FrameIndex.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * A virtual memory with its own RAM, swap and page table, in the given geometry, so one process can host several
+ * layouts side by side. It handles its page faults like the global virtual memory with CYCLIC_DISTANCE_POLICY, with a
+ * FrameIndex of its own: an empty table, then an unused frame, then the frame of the resident page with the largest
+ * cyclic distance from the faulting page. It has no TLB, readahead or reclaimer, and it must be used by a single thread
+ * at a time.
+ * It is a reduced model of the global virtual memory, for comparing layouts, not a replacement of it: the global
+ * virtual memory is not templated, and takes the shifts and masks of its translation from CompiledGeometry, which makes
+ * them compile time constants too. The two share the frame bookkeeping (FrameIndex) and the translation of an address
+ * (GeometryPi), so they fault and evict the same pages as long as the global one keeps its defaults (after
+ * VMinitialize), but its other policies, its swap device and the rest of its features are not modelled here.
+ * With a StaticGeometry every shift and mask of the translation is a compile time constant, which speeds up the walk.
+ * A fault costs the same in every geometry, so a workload that mostly faults gains nothing (see GeometryBenchmark).
+ * The geometries in Geometry.h are instantiated once, in VirtualMemoryInstance.cpp.
+ */
+template<typename Geometry>
+class VirtualMemoryInstance {
+public:
+    /*
+     * Creates a virtual memory whose pages were never written. A RuntimeGeometry must be valid (VMisValidGeometry).
+     */
+    explicit VirtualMemoryInstance(const Geometry &geometry = Geometry());
+
+    /*
+     * Clears the RAM, the swap and the page table, like VMinitialize.
+     */
+    void Initialize();
+
+    /*
+     * Like VMread and VMwrite, in the address space of this instance.
+     */
+    int Read(uint64_t virtualAddress, word_t *value);
+
+    int Write(uint64_t virtualAddress, word_t value);
+
+    /*
+     * Puts the number of page faults on pages and the number of evictions since the last Initialize.
+     */
+    void GetPagingStats(uint64_t *pageFaults, uint64_t *evictions) const;
+
+    const Geometry &GetGeometry() const {
+        return geometry;
+    }
+
+private:
+    uint64_t GetIndexInRam(word_t frameIdx, uint64_t offset) const;
+
+    word_t HandlePageFault(uint64_t virtualAddress, word_t lastBeforeFaultFrameIdx, uint64_t lastBeforeFaultOffset,
+                           int level);
+
+    word_t WalkPageTable(uint64_t virtualAddress);
+
+    Geometry geometry;
+    std::vector<word_t> ram;
+    // the evicted pages, by page index:
+    std::unordered_map<uint64_t, std::vector<word_t> > swap;
+    FrameIndex<Geometry> frameIndex;
+    uint64_t pageFaultCount;
+    uint64_t evictionCount;
+};
+
+template<typename Geometry>
+VirtualMemoryInstance<Geometry>::VirtualMemoryInstance(const Geometry &geometry)
+        : geometry(geometry), frameIndex(geometry) {
+    Initialize();
+}
+
+template<typename Geometry>
+void VirtualMemoryInstance<Geometry>::Initialize() {
+    ram.assign(geometry.NumFrames() * geometry.PageSize(), 0);
+    swap.clear();
+    frameIndex.Initialize();
+    pageFaultCount = 0;
+    evictionCount = 0;
+}
+
+template<typename Geometry>
+uint64_t VirtualMemoryInstance<Geometry>::GetIndexInRam(word_t frameIdx, uint64_t offset) const {
+    return (frameIdx * geometry.PageSize()) + offset;
+}
+
+/**
+ * Finds a frame for the faulty node, by the priority noted in the pdf: an empty table, then an unused frame, and
+ * finally the frame of the page with the largest cyclic distance, which is evicted. Then links the frame to its new
+ * parent, and initializes it.
+ * @return the index of the frame that was mapped for the faulty node.
+ */
+template<typename Geometry>
+word_t VirtualMemoryInstance<Geometry>::HandlePageFault(uint64_t virtualAddress, word_t lastBeforeFaultFrameIdx,
+                                                        uint64_t lastBeforeFaultOffset, int level) {
+    word_t targetFrameIdx = 0;
+    // lastBeforeFaultFrameIdx is empty, but we'll ignore that and won't consider it as an available frame:
+    bool foundEmpty = frameIndex.FindEmptyTable(lastBeforeFaultFrameIdx, &targetFrameIdx);
+    bool foundUnused = !foundEmpty && frameIndex.AllocateUnusedFrame(&targetFrameIdx);
+    if (!foundEmpty && !foundUnused) {
+        targetFrameIdx = frameIndex.FindVictimFrame(virtualAddress >> geometry.OffsetWidth());
+    }
+
+    uint64_t pageSize = geometry.PageSize();
+    if (!foundUnused) {
+        const FrameInfo &info = frameIndex.GetFrameInfo(targetFrameIdx);
+        uint64_t evictedPageIdx = info.cumulativePageIdx;
+        // remove the link to the frame from its parent:
+        ram[GetIndexInRam(info.parentFrameIdx, info.offsetInParent)] = 0;
+        frameIndex.UnlinkFrame(targetFrameIdx);
+        if (!foundEmpty) {
+            auto frameStart = ram.begin() + GetIndexInRam(targetFrameIdx, 0);
+            swap[evictedPageIdx].assign(frameStart, frameStart + pageSize);
+            evictionCount++;
+        }
+    }
+
+    // link the frame to lastBeforeFaultFrameIdx, and initialize it:
+    ram[GetIndexInRam(lastBeforeFaultFrameIdx, lastBeforeFaultOffset)] = targetFrameIdx;
+    frameIndex.LinkFrame(targetFrameIdx, lastBeforeFaultFrameIdx, lastBeforeFaultOffset, level,
+                         GeometryCumulativePageIdx(geometry, virtualAddress, level));
+    auto frameStart = ram.begin() + GetIndexInRam(targetFrameIdx, 0);
+    if (level == geometry.TablesDepth()) {
+        // a page that was never evicted is left as it is, like PMrestore does:
+        auto swapped = swap.find(virtualAddress >> geometry.OffsetWidth());
+        if (swapped != swap.end()) {
+            std::copy(swapped->second.begin(), swapped->second.end(), frameStart);
+            swap.erase(swapped);
+        }
+        pageFaultCount++;
+    } else {
+        std::fill(frameStart, frameStart + pageSize, 0);
+    }
+    return targetFrameIdx;
+}
+
+template<typename Geometry>
+word_t VirtualMemoryInstance<Geometry>::WalkPageTable(uint64_t virtualAddress) {
+    word_t currFrameIdx = 0;
+    for (int level = 1; level <= geometry.TablesDepth(); level++) {
+        uint64_t currPi = GeometryPi(geometry, virtualAddress, level);
+        word_t prevFrameIdx = currFrameIdx;
+        currFrameIdx = ram[GetIndexInRam(currFrameIdx, currPi)];
+        if (currFrameIdx == 0) {
+            currFrameIdx = HandlePageFault(virtualAddress, prevFrameIdx, currPi, level);
+        }
+    }
+    return currFrameIdx;
+}
+
+template<typename Geometry>
+int VirtualMemoryInstance<Geometry>::Read(uint64_t virtualAddress, word_t *value) {
+    if ((virtualAddress >= geometry.VirtualMemorySize()) || (value == nullptr)) {
+        return 0;
+    }
+    word_t frameIdx = WalkPageTable(virtualAddress);
+    *value = ram[GetIndexInRam(frameIdx, virtualAddress & (geometry.PageSize() - 1))];
+    return 1;
+}
+
+template<typename Geometry>
+int VirtualMemoryInstance<Geometry>::Write(uint64_t virtualAddress, word_t value) {
+    if (virtualAddress >= geometry.VirtualMemorySize()) {
+        return 0;
+    }
+    word_t frameIdx = WalkPageTable(virtualAddress);
+    ram[GetIndexInRam(frameIdx, virtualAddress & (geometry.PageSize() - 1))] = value;
+    return 1;
+}
+
+template<typename Geometry>
+void VirtualMemoryInstance<Geometry>::GetPagingStats(uint64_t *pageFaults, uint64_t *evictions) const {
+    if (pageFaults != nullptr) {
+        *pageFaults = pageFaultCount;
+    }
+    if (evictions != nullptr) {
+        *evictions = evictionCount;
+    }
+}
+
+// the instances of the geometries in Geometry.h are compiled once, in VirtualMemoryInstance.cpp:
+extern template class VirtualMemoryInstance<RuntimeGeometry>;
+extern template class VirtualMemoryInstance<CompiledGeometry>;
+extern template class VirtualMemoryInstance<LargeGeometry>;
@@ -0,0 +1,113 @@
+/*
+ * Runs several tenants in one process, each in an address space of its own, and prints a CSV line per policy, number
+ * of tenants and quantum with the throughput and the paging activity. The tenants take turns of 'quantum' accesses,
+ * switching address spaces between the turns, and all of them use the same virtual addresses: uniform over the words
+ * of half the RAM, so two tenants fill the RAM, and more compete for its frames. One access in 4 is a write of a value
+ * that only its tenant writes, and every read of a written word is checked against the value its tenant wrote there.
+ *
+ * usage: addressSpaceBenchmark [opsPerRun]
+ */
+#include "VirtualMemory.h"
+#include "AddressSpace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#define WRITE_EVERY 4
+
+typedef struct {
+    const char* name;
+    PageReplacementPolicy policy;
+} PolicyEntry;
+
+typedef struct {
+    double seconds;
+    uint64_t pageFaults;
+    uint64_t evictions;
+    uint64_t tlbHits;
+    uint64_t tlbMisses;
+    uint64_t mismatches;
+} RunResult;
+
+/**
+ * Runs the tenants in address spaces that are created for the run, and destroyed after it.
+ */
+RunResult Run(PageReplacementPolicy policy, int numTenants, uint64_t quantum, uint64_t ops) {
+    VMinitialize(policy);
+    std::vector<int> addressSpaces(1, 0);
+    for (int tenant = 1; tenant < numTenants; tenant++) {
+        addressSpaces.push_back(VMcreateAddressSpace());
+    }
+    std::vector<std::unordered_map<uint64_t, word_t> > written(numTenants);
+    uint64_t words = ((NUM_FRAMES / 2) * PAGE_SIZE < VIRTUAL_MEMORY_SIZE) ? (NUM_FRAMES / 2) * PAGE_SIZE
+                                                                           : VIRTUAL_MEMORY_SIZE;
+    std::mt19937_64 rng(1);
+    RunResult result = {0, 0, 0, 0, 0, 0};
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t op = 0; op < ops; op++) {
+        int tenant = (int) ((op / quantum) % numTenants);
+        if ((op % quantum) == 0) {
+            VMswitchAddressSpace(addressSpaces[tenant]);
+        }
+        uint64_t address = rng() % words;
+        if ((op % WRITE_EVERY) == 0) {
+            word_t value = (word_t) ((op << 4) | (uint64_t) tenant);
+            VMwrite(address, value);
+            written[tenant][address] = value;
+        } else {
+            word_t value;
+            auto it = written[tenant].find(address);
+            if (!VMread(address, &value) || ((it != written[tenant].end()) && (value != it->second))) {
+                result.mismatches++;
+            }
+        }
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    VMgetPagingStats(&result.pageFaults, &result.evictions);
+    VMgetTlbStats(&result.tlbHits, &result.tlbMisses);
+
+    VMswitchAddressSpace(0);
+    for (int tenant = 1; tenant < numTenants; tenant++) {
+        VMdestroyAddressSpace(addressSpaces[tenant]);
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    uint64_t ops = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 1000000;
+    if (ops == 0) {
+        fprintf(stderr, "opsPerRun must be positive\n");
+        return 1;
+    }
+    const PolicyEntry policies[] = {{"cyclic", CYCLIC_DISTANCE_POLICY}, {"lru", LRU_POLICY}};
+    const int tenantCounts[] = {1, 2, 4, 8};
+    const uint64_t quanta[] = {16, 1024};
+
+    printf("policy,tenants,quantum,ops,seconds,ops_per_sec,page_faults,evictions,tlb_hit_rate,mismatches\n");
+    uint64_t mismatches = 0;
+    for (const PolicyEntry &policy : policies) {
+        for (int numTenants : tenantCounts) {
+            // every tenant but the first takes a frame for its root table:
+            if ((numTenants > MAX_ADDRESS_SPACES) || ((numTenants + TABLES_DEPTH) > NUM_FRAMES)) {
+                continue;
+            }
+            for (uint64_t quantum : quanta) {
+                RunResult result = Run(policy.policy, numTenants, quantum, ops);
+                uint64_t lookups = result.tlbHits + result.tlbMisses;
+                printf("%s,%d,%llu,%llu,%.6f,%.0f,%llu,%llu,%.4f,%llu\n", policy.name, numTenants,
+                       (unsigned long long) quantum, (unsigned long long) ops, result.seconds,
+                       (double) ops / result.seconds, (unsigned long long) result.pageFaults,
+                       (unsigned long long) result.evictions,
+                       (lookups > 0) ? (double) result.tlbHits / (double) lookups : 0.0,
+                       (unsigned long long) result.mismatches);
+                mismatches += result.mismatches;
+            }
+        }
+    }
+    return (mismatches == 0) ? 0 : 1;
+}
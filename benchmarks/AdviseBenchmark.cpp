@@ -0,0 +1,124 @@
+/*
+ * Measures what the hints of VMadvise save on a phase-structured workload, and prints a CSV line per policy, with and
+ * without the hints. A table of half the RAM is written first. Then each phase fills a scratch region of the size of the
+ * RAM and scans it in page order, which leaves it dead, so the next phase writes another one, and then scans the
+ * table. With the hints, the table is advised ADVISE_SEQUENTIAL, the scratch region is dropped by ADVISE_DONTNEED once
+ * it is dead, so its dirty pages are never written to the swap file, and the table is restored by ADVISE_WILLNEED
+ * into the frames that it leaves. Every word that the scans read is checked.
+ *
+ * usage: adviseBenchmark [phases]
+ */
+#include "VirtualMemory.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+typedef struct {
+    const char* name;
+    PageReplacementPolicy policy;
+} PolicyEntry;
+
+typedef struct {
+    double seconds;
+    uint64_t pageFaults;
+    uint64_t dirtyEvictions;
+    uint64_t swapRestores;
+    uint64_t swapSavedPages;
+    uint64_t droppedPages;
+    uint64_t prefetchedPages;
+    uint64_t mismatches;
+} RunResult;
+
+/**
+ * @return the value in the first word of the given page of the given phase (the table is phase 0).
+ */
+word_t PageValue(uint64_t page, uint64_t phase) {
+    return (word_t) (page * 7 + phase + 1);
+}
+
+/**
+ * Reads the first word of the 'pages' pages from firstPage onwards in page order.
+ * @return the number of pages whose word is not the one of the given phase.
+ */
+uint64_t Scan(uint64_t firstPage, uint64_t pages, uint64_t phase) {
+    uint64_t mismatches = 0;
+    for (uint64_t page = firstPage; page < (firstPage + pages); page++) {
+        word_t value;
+        if (!VMread(page * PAGE_SIZE, &value) || (value != PageValue(page, phase))) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+RunResult Run(PageReplacementPolicy policy, bool advise, uint64_t phases) {
+    VMinitialize(policy);
+    uint64_t tablePages = NUM_FRAMES / 2;
+    uint64_t scratchPages = NUM_FRAMES;
+    for (uint64_t page = 0; page < tablePages; page++) {
+        VMwrite(page * PAGE_SIZE, PageValue(page, 0));
+    }
+    if (advise) {
+        VMadvise(0, tablePages * PAGE_SIZE, ADVISE_SEQUENTIAL);
+    }
+    RunResult result = {0, 0, 0, 0, 0, 0, 0, 0};
+    VMresetStats();
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t phase = 1; phase <= phases; phase++) {
+        // the scratch regions of consecutive phases take turns, so a dead one is written again two phases later:
+        uint64_t scratchPage = tablePages + ((phase % 2) * scratchPages);
+        for (uint64_t page = scratchPage; page < (scratchPage + scratchPages); page++) {
+            VMwrite(page * PAGE_SIZE, PageValue(page, phase));
+        }
+        result.mismatches += Scan(scratchPage, scratchPages, phase);
+        if (advise) {
+            VMadvise(scratchPage * PAGE_SIZE, scratchPages * PAGE_SIZE, ADVISE_DONTNEED);
+            VMadvise(0, tablePages * PAGE_SIZE, ADVISE_WILLNEED);
+        }
+        result.mismatches += Scan(0, tablePages, 0);
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    VMstats stats;
+    VMgetStats(&stats);
+    result.pageFaults = stats.faultsPerLevel[TABLES_DEPTH - 1];
+    result.dirtyEvictions = stats.dirtyEvictions;
+    result.swapRestores = stats.swapRestores;
+    result.swapSavedPages = stats.swapSavedPages;
+    result.droppedPages = stats.advisedDroppedPages;
+    result.prefetchedPages = stats.advisedPrefetches;
+    return result;
+}
+
+int main(int argc, char** argv) {
+    int phases = (argc > 1) ? atoi(argv[1]) : 20;
+    if (phases <= 0) {
+        fprintf(stderr, "phases must be positive\n");
+        return 1;
+    }
+    if ((NUM_FRAMES / 2 + 2 * NUM_FRAMES) > NUM_PAGES) {
+        fprintf(stderr, "the virtual memory is too small for the table and two scratch regions\n");
+        return 1;
+    }
+    const PolicyEntry policies[] = {{"cyclic", CYCLIC_DISTANCE_POLICY}, {"lru", LRU_POLICY}, {"clock", CLOCK_POLICY},
+                                    {"arc", ARC_POLICY}};
+    const bool advises[] = {false, true};
+
+    printf("policy,advise,phases,ms,page_faults,dirty_evictions,swap_restores,swap_saved_pages,dropped_pages,"
+           "prefetched_pages,mismatches\n");
+    uint64_t mismatches = 0;
+    for (const PolicyEntry &policy : policies) {
+        for (bool advise : advises) {
+            RunResult result = Run(policy.policy, advise, (uint64_t) phases);
+            printf("%s,%d,%d,%.2f,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", policy.name, advise ? 1 : 0, phases,
+                   result.seconds * 1e3, (unsigned long long) result.pageFaults,
+                   (unsigned long long) result.dirtyEvictions, (unsigned long long) result.swapRestores,
+                   (unsigned long long) result.swapSavedPages, (unsigned long long) result.droppedPages,
+                   (unsigned long long) result.prefetchedPages, (unsigned long long) result.mismatches);
+            mismatches += result.mismatches;
+        }
+    }
+    return (mismatches == 0) ? 0 : 1;
+}
@@ -0,0 +1,373 @@
+/*
+ * Compares a warm restart from a checkpoint with rebuilding the virtual memory by VMwrite. A region that is several
+ * times larger than the RAM is written in full, page by page (rebuild), written to a checkpoint file by VMcheckpoint,
+ * and read back by VMrestoreCheckpoint (restore), which reads no page, and by a scan of the whole region, which loads
+ * every page from the file on its first access (touch). Every word that the scan reads is checked.
+ * Then a forked layout is checkpointed: a parent with pages dropped by ADVISE_DONTNEED, a fork of it that writes and
+ * drops pages of its own, and an address space that shares nothing, all of which are checked after a restore. Copies
+ * of that checkpoint are broken in the ways that VMrestoreCheckpoint must catch (a truncated file, a wrong version, a
+ * flipped byte of the page index, a cycle of snapshots, pages out of order), and each must be rejected with the virtual
+ * memory left as it was, which is checked again. The last copy has a flipped byte in a data page, which is only caught
+ * when the page is loaded, and is fatal, so it is restored and read in a child process, which must exit with 1.
+ *
+ * usage: checkpointBenchmark [checkpointPath] [regionPages]
+ */
+#include "VirtualMemory.h"
+#include "Checkpoint.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// the tags of the pages of a layout that are not written by any address space:
+#define ZERO_TAG (-1)
+#define UNKNOWN_TAG (-2)
+
+/*
+ * The address spaces of a layout, and the tag of every page of their regions: the address space whose WordValue it
+ * holds, ZERO_TAG, or UNKNOWN_TAG for a page that was never written (or dropped) in it, which holds whatever was left in
+ * its frame.
+ */
+typedef struct {
+    std::vector<int> addressSpaces;
+    std::vector<std::vector<int> > tags;
+} Layout;
+
+typedef struct {
+    const char* name;
+    // whether the copy is resealed with a metadata checksum that matches it, so the check behind the checksum sees it:
+    bool reseal;
+    void (*corrupt)(std::vector<char>& bytes);
+} Corruption;
+
+/**
+ * @return the value of the given word of the given page.
+ */
+word_t WordValue(uint64_t page, uint64_t word) {
+    return (word_t) ((page * PAGE_SIZE + word) * 3 + 1);
+}
+
+/**
+ * @return the value of the given word of the given page, as written by the given tag of a layout.
+ */
+word_t TaggedValue(int tag, uint64_t page, uint64_t word) {
+    return (tag == ZERO_TAG) ? 0 : WordValue(((uint64_t) tag + 1) * NUM_PAGES / MAX_ADDRESS_SPACES + page, word);
+}
+
+/**
+ * Writes the given pages of the current address space, which is the given one of the layout, with its own values.
+ */
+void WriteLayoutPages(Layout& layout, int space, uint64_t firstPage, uint64_t numPages) {
+    word_t page[PAGE_SIZE];
+    for (uint64_t pageIdx = firstPage; pageIdx < firstPage + numPages; pageIdx++) {
+        for (uint64_t word = 0; word < PAGE_SIZE; word++) {
+            page[word] = TaggedValue(space, pageIdx, word);
+        }
+        VMwriteRange(pageIdx * PAGE_SIZE, page, PAGE_SIZE);
+        layout.tags[space][pageIdx] = space;
+    }
+}
+
+/**
+ * Drops the given pages of the current address space, which is the given one of the layout, by ADVISE_DONTNEED.
+ * @param shared Whether the pages are shared with the address space that it was forked from, so they read as zeroes.
+ */
+void DropLayoutPages(Layout& layout, int space, uint64_t firstPage, uint64_t numPages, bool shared) {
+    VMadvise(firstPage * PAGE_SIZE, numPages * PAGE_SIZE, ADVISE_DONTNEED);
+    for (uint64_t pageIdx = firstPage; pageIdx < firstPage + numPages; pageIdx++) {
+        layout.tags[space][pageIdx] = shared ? ZERO_TAG : UNKNOWN_TAG;
+    }
+}
+
+/**
+ * Builds a parent with dropped pages, a fork of it that writes and drops pages of its own, and an unrelated address
+ * space, each with a region of the given number of pages.
+ */
+Layout BuildForkedLayout(uint64_t regionPages) {
+    Layout layout;
+    layout.addressSpaces.push_back(0);
+    layout.tags.push_back(std::vector<int>(regionPages, UNKNOWN_TAG));
+    VMinitialize(LRU_POLICY);
+    WriteLayoutPages(layout, 0, 0, regionPages);
+    DropLayoutPages(layout, 0, regionPages / 4, regionPages / 8, false);
+
+    layout.addressSpaces.push_back(VMfork());
+    layout.tags.push_back(layout.tags[0]);
+    VMswitchAddressSpace(layout.addressSpaces[1]);
+    WriteLayoutPages(layout, 1, 0, regionPages / 8);
+    DropLayoutPages(layout, 1, regionPages / 2, regionPages / 8, true);
+
+    layout.addressSpaces.push_back(VMcreateAddressSpace());
+    layout.tags.push_back(std::vector<int>(regionPages, UNKNOWN_TAG));
+    VMswitchAddressSpace(layout.addressSpaces[2]);
+    WriteLayoutPages(layout, 2, 0, regionPages / 2);
+    VMswitchAddressSpace(0);
+    return layout;
+}
+
+/**
+ * @return the number of words of the layout that the virtual memory does not hold, counting a whole address space
+ *         that can't be switched to, and whether address space 0 is the current one.
+ */
+uint64_t CheckLayout(const Layout& layout) {
+    word_t page[PAGE_SIZE];
+    uint64_t mismatches = (VMgetAddressSpace() == 0) ? 0 : 1;
+    for (size_t space = 0; space < layout.addressSpaces.size(); space++) {
+        if (!VMswitchAddressSpace(layout.addressSpaces[space])) {
+            mismatches += layout.tags[space].size() * PAGE_SIZE;
+            continue;
+        }
+        for (uint64_t pageIdx = 0; pageIdx < layout.tags[space].size(); pageIdx++) {
+            int tag = layout.tags[space][pageIdx];
+            if (tag == UNKNOWN_TAG) {
+                continue;
+            }
+            VMreadRange(pageIdx * PAGE_SIZE, page, PAGE_SIZE);
+            for (uint64_t word = 0; word < PAGE_SIZE; word++) {
+                if (page[word] != TaggedValue(tag, pageIdx, word)) {
+                    mismatches++;
+                }
+            }
+        }
+    }
+    VMswitchAddressSpace(0);
+    return mismatches;
+}
+
+/**
+ * @return the bytes of the given file, or none if it can't be read.
+ */
+std::vector<char> ReadFile(const std::string& path) {
+    std::vector<char> bytes;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return bytes;
+    }
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        bytes.insert(bytes.end(), buffer, buffer + read);
+    }
+    fclose(file);
+    return bytes;
+}
+
+/**
+ * @return true if the given bytes were written to the given file.
+ */
+bool WriteFile(const std::string& path, const std::vector<char>& bytes) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return (fclose(file) == 0) && written;
+}
+
+CheckpointHeader* HeaderOf(std::vector<char>& bytes) {
+    return (CheckpointHeader*) bytes.data();
+}
+
+CheckpointContexts* ContextsOf(std::vector<char>& bytes) {
+    return (CheckpointContexts*) (bytes.data() + sizeof(CheckpointHeader));
+}
+
+CheckpointPage* PagesOf(std::vector<char>& bytes) {
+    return (CheckpointPage*) (bytes.data() + HeaderOf(bytes)->indexOffset);
+}
+
+/**
+ * Sets the metadata checksum of the given checkpoint to the one that matches it.
+ */
+void Reseal(std::vector<char>& bytes) {
+    CheckpointHeader* header = HeaderOf(bytes);
+    const uint64_t* dataChecksums = (const uint64_t*) (PagesOf(bytes) + header->numPages);
+    header->checksum = CheckpointChecksumMetadata(*header, *ContextsOf(bytes), PagesOf(bytes), dataChecksums);
+}
+
+void Truncate(std::vector<char>& bytes) {
+    bytes.resize(bytes.size() / 2);
+}
+
+void BumpVersion(std::vector<char>& bytes) {
+    HeaderOf(bytes)->version = CHECKPOINT_VERSION + 1;
+}
+
+void FlipIndexByte(std::vector<char>& bytes) {
+    bytes[HeaderOf(bytes)->indexOffset + sizeof(CheckpointPage) / 2] ^= 1;
+}
+
+/**
+ * Makes the snapshot of the first context that has one its own snapshot.
+ */
+void MakeSnapshotCycle(std::vector<char>& bytes) {
+    CheckpointContexts* contexts = ContextsOf(bytes);
+    for (int context = 0; context < MAX_CONTEXTS; context++) {
+        int64_t snapshot = contexts->contextSnapshots[context];
+        if (snapshot >= 0) {
+            contexts->contextSnapshots[snapshot] = snapshot;
+            return;
+        }
+    }
+}
+
+void SwapFirstPages(std::vector<char>& bytes) {
+    CheckpointPage* pages = PagesOf(bytes);
+    CheckpointPage first = pages[0];
+    pages[0] = pages[1];
+    pages[1] = first;
+}
+
+void FlipDataByte(std::vector<char>& bytes) {
+    bytes[HeaderOf(bytes)->dataOffset] ^= 1;
+}
+
+/**
+ * Restores the given checkpoint, whose first data page does not match its checksum, and reads the layout in a child
+ * process, since loading that page is fatal.
+ * @return true if the child exited with 1, after the restore succeeded.
+ */
+bool IsDataPageFatal(const std::string& path, const Layout& layout) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        // the message of the fatal error is expected:
+        if (freopen("/dev/null", "w", stderr) == nullptr) {
+            _exit(3);
+        }
+        if (!VMrestoreCheckpoint(path.c_str())) {
+            _exit(2);
+        }
+        CheckLayout(layout);
+        _exit(0);
+    }
+    int status;
+    return (child > 0) && (waitpid(child, &status, 0) == child) && WIFEXITED(status) && (WEXITSTATUS(status) == 1);
+}
+
+/**
+ * Checkpoints and restores a forked layout, and checks that broken copies of the checkpoint are rejected without
+ * touching the virtual memory, printing a line per check.
+ * @return the number of checks that failed.
+ */
+uint64_t CheckForkedLayout(const std::string& path, uint64_t regionPages) {
+    const Corruption corruptions[] = {
+            {"truncated", false, Truncate},
+            {"wrong_version", true, BumpVersion},
+            {"flipped_index_byte", false, FlipIndexByte},
+            {"snapshot_cycle", true, MakeSnapshotCycle},
+            {"pages_out_of_order", true, SwapFirstPages},
+    };
+    Layout layout = BuildForkedLayout(regionPages);
+    std::string brokenPath = path + ".broken";
+    uint64_t failures = 0;
+    printf("check,restored,mismatches\n");
+
+    bool checkpointed = VMcheckpoint(path.c_str());
+    VMinitialize(LRU_POLICY);
+    bool restored = checkpointed && VMrestoreCheckpoint(path.c_str());
+    uint64_t mismatches = CheckLayout(layout);
+    printf("forked_round_trip,%d,%llu\n", restored ? 1 : 0, (unsigned long long) mismatches);
+    failures += (restored && (mismatches == 0)) ? 0 : 1;
+    std::vector<char> good = ReadFile(path);
+    if (!restored || (good.size() < sizeof(CheckpointHeader) + sizeof(CheckpointContexts))) {
+        return failures + 1;
+    }
+
+    for (const Corruption& corruption : corruptions) {
+        std::vector<char> broken = good;
+        corruption.corrupt(broken);
+        if (corruption.reseal) {
+            Reseal(broken);
+        }
+        restored = WriteFile(brokenPath, broken) && VMrestoreCheckpoint(brokenPath.c_str());
+        mismatches = CheckLayout(layout);
+        printf("%s,%d,%llu\n", corruption.name, restored ? 1 : 0, (unsigned long long) mismatches);
+        failures += (!restored && (mismatches == 0)) ? 0 : 1;
+    }
+
+    std::vector<char> broken = good;
+    FlipDataByte(broken);
+    bool fatal = WriteFile(brokenPath, broken) && IsDataPageFatal(brokenPath, layout);
+    printf("flipped_data_byte,%d,%llu\n", fatal ? 1 : 0, (unsigned long long) CheckLayout(layout));
+    failures += fatal ? 0 : 1;
+    unlink(brokenPath.c_str());
+    return failures;
+}
+
+/**
+ * @return the seconds since the given time.
+ */
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    const char* path = (argc > 1) ? argv[1] : "checkpointBenchmark.ckpt";
+    uint64_t regionPages = (argc > 2) ? strtoull(argv[2], nullptr, 10) : (4 * NUM_FRAMES);
+    if ((regionPages == 0) || (regionPages > NUM_PAGES)) {
+        fprintf(stderr, "regionPages must be between 1 and %llu\n", (unsigned long long) NUM_PAGES);
+        return 1;
+    }
+    word_t page[PAGE_SIZE];
+
+    VMinitialize(LRU_POLICY);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t pageIdx = 0; pageIdx < regionPages; pageIdx++) {
+        for (uint64_t word = 0; word < PAGE_SIZE; word++) {
+            page[word] = WordValue(pageIdx, word);
+        }
+        VMwriteRange(pageIdx * PAGE_SIZE, page, PAGE_SIZE);
+    }
+    double rebuildSeconds = SecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    if (!VMcheckpoint(path)) {
+        fprintf(stderr, "cannot write the checkpoint to %s\n", path);
+        return 1;
+    }
+    double checkpointSeconds = SecondsSince(start);
+    struct stat fileStat;
+    uint64_t fileBytes = (stat(path, &fileStat) == 0) ? (uint64_t) fileStat.st_size : 0;
+
+    start = std::chrono::steady_clock::now();
+    if (!VMrestoreCheckpoint(path)) {
+        fprintf(stderr, "cannot restore the checkpoint from %s\n", path);
+        return 1;
+    }
+    double restoreSeconds = SecondsSince(start);
+
+    VMresetStats();
+    uint64_t mismatches = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint64_t pageIdx = 0; pageIdx < regionPages; pageIdx++) {
+        VMreadRange(pageIdx * PAGE_SIZE, page, PAGE_SIZE);
+        for (uint64_t word = 0; word < PAGE_SIZE; word++) {
+            if (page[word] != WordValue(pageIdx, word)) {
+                mismatches++;
+            }
+        }
+    }
+    double touchSeconds = SecondsSince(start);
+    VMstats stats;
+    VMgetStats(&stats);
+
+    printf("region_pages,file_bytes,rebuild_ms,checkpoint_ms,restore_ms,touch_ms,checkpoint_restores,mismatches\n");
+    printf("%llu,%llu,%.2f,%.2f,%.3f,%.2f,%llu,%llu\n", (unsigned long long) regionPages,
+           (unsigned long long) fileBytes, rebuildSeconds * 1e3, checkpointSeconds * 1e3, restoreSeconds * 1e3,
+           touchSeconds * 1e3, (unsigned long long) stats.checkpointRestores, (unsigned long long) mismatches);
+
+    // the checkpoint stays mapped until the next restore, but its file can go:
+    unlink(path);
+
+    uint64_t failures = CheckForkedLayout(path, (regionPages < NUM_PAGES / 2) ? regionPages : (NUM_PAGES / 2));
+    unlink(path);
+    return ((mismatches == 0) && (failures == 0)) ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+/*
+ * Multithreaded stress benchmark for a VM_CONCURRENT build of the library.
+ * Every thread mostly accesses a hot set of pages that fits in the RAM, and sometimes a random page of the whole
+ * virtual memory, which faults. Each thread writes only its own word in every page, so it can check every value it
+ * reads back.
+ * If reclaimLow and reclaimHigh are given, the background reclaimer keeps that many free frames.
+ *
+ * usage: concurrentStress [maxThreads] [opsPerThread] [hotPages] [coldPercent] [reclaimLow reclaimHigh]
+ */
+#include "VirtualMemory.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef VM_CONCURRENT
+#error "concurrentStress must be built with -DVM_CONCURRENT"
+#endif
+
+typedef struct {
+    uint64_t opsPerThread;
+    uint64_t hotPages;
+    unsigned int coldPercent;
+    uint64_t reclaimLow;
+    uint64_t reclaimHigh;
+} StressConfig;
+
+/**
+ * Runs the workload of one thread.
+ * @return the number of reads that returned a wrong value.
+ */
+uint64_t RunStressThread(const StressConfig &config, int threadIdx, int numThreads) {
+    std::mt19937_64 rng(threadIdx + 1);
+    std::unordered_map<uint64_t, word_t> written;
+    uint64_t wordInPage = threadIdx % PAGE_SIZE;
+    bool validate = (numThreads <= PAGE_SIZE);
+    uint64_t errors = 0;
+
+    for (uint64_t op = 0; op < config.opsPerThread; op++) {
+        uint64_t pageIdx = ((rng() % 100) < config.coldPercent) ? (rng() % NUM_PAGES) : (rng() % config.hotPages);
+        uint64_t virtualAddress = (pageIdx * PAGE_SIZE) + wordInPage;
+        if ((rng() % 10) == 0) {
+            word_t value = (word_t) (rng() & 0xffff);
+            VMwrite(virtualAddress, value);
+            written[virtualAddress] = value;
+        } else {
+            word_t value;
+            VMread(virtualAddress, &value);
+            auto it = written.find(virtualAddress);
+            if (validate && (it != written.end()) && (it->second != value)) {
+                errors++;
+            }
+        }
+    }
+    return errors;
+}
+
+int main(int argc, char **argv) {
+    int maxThreads = (argc > 1) ? atoi(argv[1]) : 8;
+    StressConfig config;
+    config.opsPerThread = (argc > 2) ? strtoull(argv[2], nullptr, 10) : 1000000;
+    config.hotPages = (argc > 3) ? strtoull(argv[3], nullptr, 10) : (NUM_FRAMES / 4);
+    config.coldPercent = (argc > 4) ? atoi(argv[4]) : 1;
+    config.reclaimLow = (argc > 6) ? strtoull(argv[5], nullptr, 10) : 0;
+    config.reclaimHigh = (argc > 6) ? strtoull(argv[6], nullptr, 10) : 0;
+
+    double baseOpsPerSec = 0;
+    for (int numThreads = 1; numThreads <= maxThreads; numThreads *= 2) {
+        VMinitialize();
+        if ((config.reclaimHigh != 0) && !VMstartReclaimer(config.reclaimLow, config.reclaimHigh)) {
+            fprintf(stderr, "invalid reclaimer watermarks\n");
+            return 1;
+        }
+        std::vector<std::thread> threads;
+        std::vector<uint64_t> errors(numThreads, 0);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int threadIdx = 0; threadIdx < numThreads; threadIdx++) {
+            threads.emplace_back([&config, &errors, threadIdx, numThreads]() {
+                errors[threadIdx] = RunStressThread(config, threadIdx, numThreads);
+            });
+        }
+        uint64_t totalErrors = 0;
+        for (int threadIdx = 0; threadIdx < numThreads; threadIdx++) {
+            threads[threadIdx].join();
+            totalErrors += errors[threadIdx];
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        VMstopReclaimer();
+
+        double opsPerSec = (double) (config.opsPerThread * numThreads) / seconds;
+        if (numThreads == 1) {
+            baseOpsPerSec = opsPerSec;
+        }
+        printf("threads=%d ops=%llu seconds=%.3f ops_per_sec=%.0f speedup=%.2f errors=%llu\n",
+               numThreads, (unsigned long long) (config.opsPerThread * numThreads), seconds, opsPerSec,
+               opsPerSec / baseOpsPerSec, (unsigned long long) totalErrors);
+        if (config.reclaimHigh != 0) {
+            uint64_t reclaimedFrames, freeFrameFaults, missedFaults;
+            VMgetReclaimerStats(&reclaimedFrames, &freeFrameFaults, &missedFaults);
+            printf("  reclaimed=%llu free_frame_faults=%llu missed_faults=%llu\n",
+                   (unsigned long long) reclaimedFrames, (unsigned long long) freeFrameFaults,
+                   (unsigned long long) missedFaults);
+        }
+        if (totalErrors != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
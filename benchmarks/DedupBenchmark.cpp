@@ -0,0 +1,276 @@
+/*
+ * Measures the dedup of identical pages (see VMsetDedup) on a region of the virtual memory that is several times larger
+ * than the RAM, whose pages are copies of a few records, like the pages of forked processes or of a cache of repeated
+ * objects, and every eighth of them a page of zeroes. The region is written in full, and random words of the region
+ * are then read and checked, while the RAM is scanned by VMdedupScan every SCAN_INTERVAL reads, with dedup off and on.
+ * For each run it prints the time of the scans and the frames they freed, the page faults and evictions of the reads,
+ * the pages and bytes in the swap store, and the frames and swap pages and bytes that dedup saves at the end.
+ * Then it checks that the sharing of a merged page is broken right: a page is copied into SHARING_COPIES address spaces
+ * and merged, and each of the copies is read back after a write to one that was merged (a sharer), after a write to the
+ * one that the others were merged into (the owner), after the eviction of the owner, and after the destruction of the
+ * address space of the owner. In a VM_CONCURRENT build (dedupConcurrentBenchmark) the copies that the case does not
+ * change are also read by threads of their own meanwhile, except while the owner is evicted, since their reads would
+ * keep it in the RAM. It prints a line per case, with the frames that dedup saves after it.
+ *
+ * usage: dedupBenchmark [regionPages] [records] [ops]
+ */
+#include "VirtualMemory.h"
+#include "PhysicalMemory.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+// the number of reads between two scans of the RAM:
+#define SCAN_INTERVAL 1000
+// the number of address spaces that hold a copy of the page in the sharing checks, and the page that it is in each:
+#define SHARING_COPIES 4
+#define SHARED_PAGE 5
+
+typedef enum {
+    WRITE_SHARER,
+    WRITE_OWNER,
+    EVICT_OWNER,
+    DESTROY_OWNER,
+    NUM_SHARING_CASES
+} SharingCase;
+
+const char* SHARING_CASE_NAMES[NUM_SHARING_CASES] = {"write_sharer", "write_owner", "evict_owner", "destroy_owner"};
+
+typedef struct {
+    uint64_t mergedFrames;
+    uint64_t unsharedFrames;
+    uint64_t savedFrames;
+    uint64_t mismatches;
+} SharingResult;
+
+/**
+ * @return the value of the given word of the given page, which is a copy of one of the records.
+ */
+word_t WordValue(uint64_t page, uint64_t word, uint64_t records) {
+    if (page % 8 == 0) {
+        return 0;
+    }
+    uint64_t record = page % records;
+    return (word_t) ((record * PAGE_SIZE + word) * 5 + 3);
+}
+
+/**
+ * @return the seconds since the given time.
+ */
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Writes the region with dedup on or off, scans the RAM, reads random words of the region, and prints the results.
+ * @return the number of words that were read wrong.
+ */
+uint64_t RunDedup(bool dedup, uint64_t regionPages, uint64_t records, uint64_t ops) {
+    word_t page[PAGE_SIZE];
+    VMinitialize(LRU_POLICY);
+    VMsetDedup(dedup ? 1 : 0);
+    for (uint64_t pageIdx = 0; pageIdx < regionPages; pageIdx++) {
+        for (uint64_t word = 0; word < PAGE_SIZE; word++) {
+            page[word] = WordValue(pageIdx, word, records);
+        }
+        VMwriteRange(pageIdx * PAGE_SIZE, page, PAGE_SIZE);
+    }
+
+    uint64_t faultsBefore, evictionsBefore;
+    VMgetPagingStats(&faultsBefore, &evictionsBefore);
+    std::mt19937_64 generator(42);
+    uint64_t mismatches = 0;
+    uint64_t mergedFrames = 0;
+    double scanSeconds = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t op = 0; op < ops; op++) {
+        if (op % SCAN_INTERVAL == 0) {
+            auto scanStart = std::chrono::steady_clock::now();
+            mergedFrames += VMdedupScan();
+            scanSeconds += SecondsSince(scanStart);
+        }
+        uint64_t address = generator() % (regionPages * PAGE_SIZE);
+        word_t value;
+        VMread(address, &value);
+        if (value != WordValue(address / PAGE_SIZE, address % PAGE_SIZE, records)) {
+            mismatches++;
+        }
+    }
+    // the scans are timed on their own:
+    double readSeconds = SecondsSince(start) - scanSeconds;
+    uint64_t faults, evictions;
+    VMgetPagingStats(&faults, &evictions);
+
+    uint64_t swapPages, swapBytes;
+    PMgetSwapStoreUsage(&swapPages, &swapBytes);
+    uint64_t savedFrames, savedSwapPages, savedSwapBytes;
+    VMgetDedupStats(&savedFrames, &savedSwapPages, &savedSwapBytes);
+    printf("%s,%llu,%llu,%.3f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.2f,%llu\n", dedup ? "on" : "off",
+           (unsigned long long) regionPages, (unsigned long long) records, scanSeconds * 1e3,
+           (unsigned long long) mergedFrames, (unsigned long long) (faults - faultsBefore),
+           (unsigned long long) (evictions - evictionsBefore), (unsigned long long) swapPages,
+           (unsigned long long) swapBytes, (unsigned long long) savedFrames, (unsigned long long) savedSwapPages,
+           (unsigned long long) savedSwapBytes, readSeconds * 1e3, (unsigned long long) mismatches);
+    return mismatches;
+}
+
+/**
+ * @return the number of words of the copy in the given address space that are not the expected ones.
+ */
+uint64_t ReadCopy(int addressSpace, const word_t* expected) {
+    word_t page[PAGE_SIZE];
+    uint64_t mismatches = 0;
+    if (!VMswitchAddressSpace(addressSpace) || !VMreadRange(SHARED_PAGE * PAGE_SIZE, page, PAGE_SIZE)) {
+        return PAGE_SIZE;
+    }
+    for (uint64_t word = 0; word < PAGE_SIZE; word++) {
+        if (page[word] != expected[word]) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+/**
+ * Writes twice as many pages of address space 0 as the RAM holds, which evicts every other page, since in a
+ * VM_CONCURRENT build the policy only moves a page that was accessed when it reaches the back.
+ */
+void FillRam() {
+    for (uint64_t pageIdx = 0; pageIdx < 2 * NUM_FRAMES; pageIdx++) {
+        VMwrite(pageIdx * PAGE_SIZE, (word_t) pageIdx);
+    }
+}
+
+/**
+ * @return the copy that the other copies were merged into, which is the only one that is read without going through
+ *         the frame of another page, or -1 if there is none.
+ */
+int FindOwner(const int* addressSpaces) {
+    int owner = -1;
+    for (int copy = 0; copy < SHARING_COPIES; copy++) {
+        VMstats before, after;
+        word_t value;
+        VMswitchAddressSpace(addressSpaces[copy]);
+        VMgetStats(&before);
+        VMread(SHARED_PAGE * PAGE_SIZE, &value);
+        VMgetStats(&after);
+        if (after.dedupSharedReads == before.dedupSharedReads) {
+            owner = (owner == -1) ? copy : -2;
+        }
+    }
+    VMswitchAddressSpace(0);
+    return (owner >= 0) ? owner : -1;
+}
+
+/**
+ * Merges the copies of a page in SHARING_COPIES address spaces, breaks their sharing as the case says, and reads every
+ * copy that is left back.
+ */
+SharingResult CheckSharing(SharingCase sharingCase) {
+    SharingResult result = {0, 0, 0, 0};
+    word_t expected[SHARING_COPIES][PAGE_SIZE];
+    int addressSpaces[SHARING_COPIES];
+    VMinitialize(LRU_POLICY);
+    VMsetDedup(1);
+    for (int copy = 0; copy < SHARING_COPIES; copy++) {
+        for (uint64_t word = 0; word < PAGE_SIZE; word++) {
+            expected[copy][word] = WordValue(1, word, 1);
+        }
+        addressSpaces[copy] = VMcreateAddressSpace();
+        VMswitchAddressSpace(addressSpaces[copy]);
+        VMwriteRange(SHARED_PAGE * PAGE_SIZE, expected[copy], PAGE_SIZE);
+    }
+    VMswitchAddressSpace(0);
+    result.mergedFrames = VMdedupScan();
+    int owner = FindOwner(addressSpaces);
+    if ((result.mergedFrames != SHARING_COPIES - 1) || (owner < 0)) {
+        result.mismatches++;
+        return result;
+    }
+    VMstats before;
+    VMgetStats(&before);
+
+    // the copy that the case changes, which the threads do not read:
+    int changed = (sharingCase == WRITE_SHARER) ? ((owner + 1) % SHARING_COPIES) : owner;
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> readerMismatches(0);
+    std::vector<std::thread> readers;
+#ifdef VM_CONCURRENT
+    for (int copy = 0; (copy < SHARING_COPIES) && (sharingCase != EVICT_OWNER); copy++) {
+        if (copy != changed) {
+            readers.emplace_back([&, copy] {
+                do {
+                    readerMismatches += ReadCopy(addressSpaces[copy], expected[copy]);
+                } while (!stop);
+            });
+        }
+    }
+#endif
+    switch (sharingCase) {
+        case WRITE_SHARER:
+        case WRITE_OWNER:
+            expected[changed][0]++;
+            VMswitchAddressSpace(addressSpaces[changed]);
+            VMwrite(SHARED_PAGE * PAGE_SIZE, expected[changed][0]);
+            VMswitchAddressSpace(0);
+            break;
+        case EVICT_OWNER:
+            FillRam();
+            break;
+        default:
+            VMdestroyAddressSpace(addressSpaces[owner]);
+            break;
+    }
+    stop = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    result.mismatches += readerMismatches;
+
+    VMstats after;
+    VMgetStats(&after);
+    result.unsharedFrames = after.dedupUnsharedFrames - before.dedupUnsharedFrames;
+    VMgetDedupStats(&result.savedFrames, nullptr, nullptr);
+    // the copies are read in the RAM, and again from the swap file, which a copy that was left dirty is written to:
+    for (int pass = 0; pass < 2; pass++) {
+        for (int copy = 0; copy < SHARING_COPIES; copy++) {
+            if ((sharingCase != DESTROY_OWNER) || (copy != owner)) {
+                result.mismatches += ReadCopy(addressSpaces[copy], expected[copy]);
+            }
+        }
+        VMswitchAddressSpace(0);
+        FillRam();
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    uint64_t regionPages = (argc > 1) ? strtoull(argv[1], nullptr, 10) : (4 * NUM_FRAMES);
+    uint64_t records = (argc > 2) ? strtoull(argv[2], nullptr, 10) : 16;
+    uint64_t ops = (argc > 3) ? strtoull(argv[3], nullptr, 10) : 200000;
+    if ((regionPages == 0) || (regionPages > NUM_PAGES) || (records == 0)) {
+        fprintf(stderr, "regionPages must be between 1 and %llu, and records must be positive\n",
+                (unsigned long long) NUM_PAGES);
+        return 1;
+    }
+
+    printf("dedup,region_pages,records,scan_ms,merged_frames,faults,evictions,swap_pages,swap_bytes,saved_frames,"
+           "saved_swap_pages,saved_swap_bytes,read_ms,mismatches\n");
+    uint64_t mismatches = RunDedup(false, regionPages, records, ops);
+    mismatches += RunDedup(true, regionPages, records, ops);
+
+    printf("case,copies,merged_frames,unshared_frames,saved_frames,mismatches\n");
+    for (int sharingCase = 0; sharingCase < NUM_SHARING_CASES; sharingCase++) {
+        SharingResult result = CheckSharing((SharingCase) sharingCase);
+        printf("%s,%d,%llu,%llu,%llu,%llu\n", SHARING_CASE_NAMES[sharingCase], SHARING_COPIES,
+               (unsigned long long) result.mergedFrames, (unsigned long long) result.unsharedFrames,
+               (unsigned long long) result.savedFrames, (unsigned long long) result.mismatches);
+        mismatches += result.mismatches;
+    }
+    return (mismatches == 0) ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/*
+ * Measures the cost of VMfork against the number of pages that are written after it, and prints a CSV line per policy
+ * and fraction of written pages. An address space of 4x the RAM (or the whole virtual memory, if it is smaller) is
+ * filled first, so most of its pages are in the swap file. Then it is forked, the child writes a word in the given
+ * fraction of its pages, and the child is destroyed, which merges the parent back into the snapshot. The fork and the
+ * destruction are timed apart from the writes, and every page of both address spaces is checked afterwards.
+ *
+ * usage: forkBenchmark [rounds]
+ */
+#include "VirtualMemory.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+typedef struct {
+    const char* name;
+    PageReplacementPolicy policy;
+} PolicyEntry;
+
+typedef struct {
+    double forkSeconds;
+    double writeSeconds;
+    double destroySeconds;
+    uint64_t copyOnWriteFaults;
+    uint64_t snapshotPageReads;
+    uint64_t mismatches;
+} RunResult;
+
+/**
+ * @return the value that the parent keeps in the first word of the given page.
+ */
+word_t ParentValue(uint64_t page) {
+    return (word_t) (page * 3 + 1);
+}
+
+/**
+ * Forks the current address space 'rounds' times, writing every 'writeEvery' page in the child (none if writeEvery is
+ * 0) and destroying it after each fork.
+ */
+RunResult Run(PageReplacementPolicy policy, uint64_t pages, uint64_t writeEvery, int rounds) {
+    VMinitialize(policy);
+    for (uint64_t page = 0; page < pages; page++) {
+        VMwrite(page * PAGE_SIZE, ParentValue(page));
+    }
+    RunResult result = {0, 0, 0, 0, 0, 0};
+    VMresetStats();
+
+    for (int round = 0; round < rounds; round++) {
+        auto start = std::chrono::steady_clock::now();
+        int child = VMfork();
+        auto forked = std::chrono::steady_clock::now();
+        if (child < 0) {
+            result.mismatches++;
+            break;
+        }
+        VMswitchAddressSpace(child);
+        for (uint64_t page = 0; (writeEvery > 0) && (page < pages); page += writeEvery) {
+            VMwrite(page * PAGE_SIZE, (word_t) (~page));
+        }
+        auto written = std::chrono::steady_clock::now();
+        for (uint64_t page = 0; page < pages; page++) {
+            word_t value;
+            bool isWritten = (writeEvery > 0) && ((page % writeEvery) == 0);
+            if (!VMread(page * PAGE_SIZE, &value) || (value != (isWritten ? (word_t) (~page) : ParentValue(page)))) {
+                result.mismatches++;
+            }
+        }
+        VMswitchAddressSpace(0);
+        auto checked = std::chrono::steady_clock::now();
+        VMdestroyAddressSpace(child);
+        auto destroyed = std::chrono::steady_clock::now();
+        result.forkSeconds += std::chrono::duration<double>(forked - start).count();
+        result.writeSeconds += std::chrono::duration<double>(written - forked).count();
+        result.destroySeconds += std::chrono::duration<double>(destroyed - checked).count();
+    }
+
+    VMstats stats;
+    VMgetStats(&stats);
+    result.copyOnWriteFaults = stats.copyOnWriteFaults;
+    result.snapshotPageReads = stats.snapshotPageReads;
+    for (uint64_t page = 0; page < pages; page++) {
+        word_t value;
+        if (!VMread(page * PAGE_SIZE, &value) || (value != ParentValue(page))) {
+            result.mismatches++;
+        }
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    int rounds = (argc > 1) ? atoi(argv[1]) : 20;
+    if (rounds <= 0) {
+        fprintf(stderr, "rounds must be positive\n");
+        return 1;
+    }
+    const PolicyEntry policies[] = {{"cyclic", CYCLIC_DISTANCE_POLICY}, {"lru", LRU_POLICY}};
+    // write every n-th page, where 0 writes none:
+    const uint64_t writeEveries[] = {0, 64, 16, 4, 1};
+    uint64_t pages = (4 * NUM_FRAMES < NUM_PAGES) ? 4 * NUM_FRAMES : NUM_PAGES;
+
+    printf("policy,pages,written_pages,rounds,fork_us,write_us,destroy_us,cow_faults,snapshot_reads,mismatches\n");
+    uint64_t mismatches = 0;
+    for (const PolicyEntry &policy : policies) {
+        for (uint64_t writeEvery : writeEveries) {
+            RunResult result = Run(policy.policy, pages, writeEvery, rounds);
+            uint64_t writtenPages = (writeEvery > 0) ? (pages + writeEvery - 1) / writeEvery : 0;
+            printf("%s,%llu,%llu,%d,%.2f,%.2f,%.2f,%llu,%llu,%llu\n", policy.name, (unsigned long long) pages,
+                   (unsigned long long) writtenPages, rounds, result.forkSeconds * 1e6 / rounds,
+                   result.writeSeconds * 1e6 / rounds, result.destroySeconds * 1e6 / rounds,
+                   (unsigned long long) result.copyOnWriteFaults, (unsigned long long) result.snapshotPageReads,
+                   (unsigned long long) result.mismatches);
+            mismatches += result.mismatches;
+        }
+    }
+    return (mismatches == 0) ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+/*
+ * Times the word kernels behind PMfindNonZero, PMisZero and PMzeroFrame on frames of several sizes, and prints a CSV
+ * line per set of kernels that the CPU supports and frame size, with the nanoseconds per call of each kernel:
+ *  find_ns    - FindNonZeroWord on a frame whose only word that is not 0 is the last one, so the whole frame is scanned
+ *  is_zero_ns - AreWordsZero on a frame of zeroes
+ *  zero_ns    - ZeroWords on a frame
+ * The frames are far larger than PAGE_SIZE, as in geometries with pages of 512 or 1024 words. Every kernel is checked
+ * against the scalar one, on frames with a word that is not 0 at every offset.
+ *
+ * usage: frameKernelBenchmark [callsPerKernel]
+ */
+#include "PhysicalMemory.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+typedef struct {
+    double findNs;
+    double isZeroNs;
+    double zeroNs;
+    uint64_t mismatches;
+} RunResult;
+
+/**
+ * @return the number of offsets at which the kernels in use disagree with the scalar kernels.
+ */
+uint64_t CheckKernels(const char* kernels, uint64_t words) {
+    std::vector<word_t> frame(words, 0);
+    uint64_t mismatches = 0;
+    for (uint64_t offset = 0; offset <= words; offset++) {
+        if (offset < words) {
+            frame[offset] = (word_t) (offset + 1);
+        }
+        SetWordKernels(kernels);
+        uint64_t found = FindNonZeroWord(frame.data(), words);
+        bool isZero = AreWordsZero(frame.data(), words);
+        SetWordKernels("scalar");
+        if ((found != FindNonZeroWord(frame.data(), words)) || (isZero != AreWordsZero(frame.data(), words))) {
+            mismatches++;
+        }
+        if (offset < words) {
+            frame[offset] = 0;
+        }
+    }
+    SetWordKernels(kernels);
+    ZeroWords(frame.data(), words);
+    SetWordKernels("scalar");
+    if (!AreWordsZero(frame.data(), words)) {
+        mismatches++;
+    }
+    return mismatches;
+}
+
+RunResult Run(const char* kernels, uint64_t words, uint64_t calls) {
+    RunResult result = {0, 0, 0, CheckKernels(kernels, words)};
+    SetWordKernels(kernels);
+    std::vector<word_t> frame(words, 0);
+    frame[words - 1] = 1;
+    // the results are summed, so the calls are not optimised away:
+    volatile uint64_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t call = 0; call < calls; call++) {
+        sink = sink + FindNonZeroWord(frame.data(), words);
+    }
+    auto found = std::chrono::steady_clock::now();
+    frame[words - 1] = 0;
+    for (uint64_t call = 0; call < calls; call++) {
+        sink = sink + (AreWordsZero(frame.data(), words) ? 1 : 0);
+    }
+    auto checked = std::chrono::steady_clock::now();
+    for (uint64_t call = 0; call < calls; call++) {
+        ZeroWords(frame.data(), words);
+        sink = sink + (uint64_t) frame[call % words];
+    }
+    auto zeroed = std::chrono::steady_clock::now();
+
+    result.findNs = std::chrono::duration<double, std::nano>(found - start).count() / calls;
+    result.isZeroNs = std::chrono::duration<double, std::nano>(checked - found).count() / calls;
+    result.zeroNs = std::chrono::duration<double, std::nano>(zeroed - checked).count() / calls;
+    return result;
+}
+
+int main(int argc, char** argv) {
+    uint64_t calls = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 200000;
+    if (calls == 0) {
+        fprintf(stderr, "callsPerKernel must be positive\n");
+        return 1;
+    }
+    const char* const allKernels[] = {"scalar", "sse2", "avx2"};
+    const uint64_t frameWords[] = {16, 64, 256, 512, 1024, 4096};
+    const char* selected = GetWordKernels();
+
+    printf("kernels,words,calls,find_ns,is_zero_ns,zero_ns,mismatches\n");
+    uint64_t mismatches = 0;
+    for (const char* kernels : allKernels) {
+        if (!SetWordKernels(kernels)) {
+            continue;
+        }
+        for (uint64_t words : frameWords) {
+            RunResult result = Run(kernels, words, calls);
+            printf("%s,%llu,%llu,%.2f,%.2f,%.2f,%llu\n", kernels, (unsigned long long) words,
+                   (unsigned long long) calls, result.findNs, result.isZeroNs, result.zeroNs,
+                   (unsigned long long) result.mismatches);
+            mismatches += result.mismatches;
+        }
+    }
+    SetWordKernels(selected);
+    return (mismatches == 0) ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+/*
+ * Compares a VirtualMemoryInstance whose geometry is read at runtime (generic) with one whose geometry is a compile
+ * time constant (specialised), on the same accesses, and prints a CSV line per geometry, workload and path with its
+ * throughput. Both paths must fault and evict the same pages, and read the same values, which is checked.
+ * Every path is run REPETITIONS times, alternating which path runs first, and its best time is printed, so the
+ * speedup is not the noise of a single run. The faults of both paths do the same work (see VirtualMemoryInstance), so a
+ * workload that mostly faults, like uniform, is expected to run at a speedup of about 1.
+ * Workloads (in pages of the RAM of the geometry, one write in every 4 accesses):
+ *  seq     - word after word over 4x the RAM
+ *  uniform - uniform over the words of 4x the RAM
+ *  hot     - uniform over the words of 1/2 the RAM, so it hardly faults and measures the walk
+ *
+ * usage: geometryBenchmark [opsPerWorkload]
+ */
+#include "VirtualMemoryInstance.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#define WRITE_EVERY 4
+#define REPETITIONS 5
+
+typedef struct {
+    const char* name;
+    std::vector<uint64_t> addresses;
+} Workload;
+
+typedef struct {
+    double seconds;
+    uint64_t pageFaults;
+    uint64_t evictions;
+    // the sum of the values that were read, to check that both paths read the same values:
+    uint64_t checksum;
+} RunResult;
+
+template<typename Geometry>
+std::vector<Workload> MakeWorkloads(const Geometry &geometry, uint64_t ops) {
+    uint64_t ramWords = geometry.NumFrames() * geometry.PageSize();
+    uint64_t largeWords = (4 * ramWords < geometry.VirtualMemorySize()) ? 4 * ramWords : geometry.VirtualMemorySize();
+    std::mt19937_64 rng(1);
+    std::vector<Workload> workloads;
+
+    Workload seq = {"seq", std::vector<uint64_t>()};
+    Workload uniform = {"uniform", std::vector<uint64_t>()};
+    Workload hot = {"hot", std::vector<uint64_t>()};
+    for (uint64_t op = 0; op < ops; op++) {
+        seq.addresses.push_back(op % largeWords);
+        uniform.addresses.push_back(rng() % largeWords);
+        hot.addresses.push_back(rng() % (ramWords / 2));
+    }
+    workloads.push_back(seq);
+    workloads.push_back(uniform);
+    workloads.push_back(hot);
+    return workloads;
+}
+
+template<typename Geometry>
+RunResult Run(VirtualMemoryInstance<Geometry> &vm, const Workload &workload) {
+    vm.Initialize();
+    RunResult result = {0, 0, 0, 0};
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t op = 0; op < workload.addresses.size(); op++) {
+        if ((op % WRITE_EVERY) == 0) {
+            vm.Write(workload.addresses[op], (word_t) op);
+        } else {
+            word_t value;
+            vm.Read(workload.addresses[op], &value);
+            result.checksum += (uint64_t) value;
+        }
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    vm.GetPagingStats(&result.pageFaults, &result.evictions);
+    return result;
+}
+
+void PrintResult(const char* geometryName, const char* workloadName, const char* path, uint64_t ops,
+                 const RunResult &result, double speedup) {
+    printf("%s,%s,%s,%llu,%.6f,%.0f,%llu,%llu,%.2f\n", geometryName, workloadName, path, (unsigned long long) ops,
+           result.seconds, (double) ops / result.seconds, (unsigned long long) result.pageFaults,
+           (unsigned long long) result.evictions, speedup);
+}
+
+/**
+ * Runs every workload on the generic and the specialised instance of the same geometry.
+ * @return false if the two paths disagreed on some workload.
+ */
+template<typename Static>
+bool Compare(const char* geometryName, uint64_t ops) {
+    VMgeometry config = {Static::OffsetWidth(), Static::PhysicalAddressWidth(), Static::VirtualAddressWidth()};
+    VirtualMemoryInstance<RuntimeGeometry> generic((RuntimeGeometry(config)));
+    VirtualMemoryInstance<Static> specialised;
+    bool agreed = true;
+    for (const Workload &workload : MakeWorkloads(specialised.GetGeometry(), ops)) {
+        RunResult genericResult = {0, 0, 0, 0};
+        RunResult specialisedResult = {0, 0, 0, 0};
+        for (int repetition = 0; repetition < REPETITIONS; repetition++) {
+            RunResult genericRun;
+            RunResult specialisedRun;
+            if ((repetition % 2) == 0) {
+                genericRun = Run(generic, workload);
+                specialisedRun = Run(specialised, workload);
+            } else {
+                specialisedRun = Run(specialised, workload);
+                genericRun = Run(generic, workload);
+            }
+            if ((repetition > 0) && (genericRun.seconds > genericResult.seconds)) {
+                genericRun.seconds = genericResult.seconds;
+            }
+            if ((repetition > 0) && (specialisedRun.seconds > specialisedResult.seconds)) {
+                specialisedRun.seconds = specialisedResult.seconds;
+            }
+            genericResult = genericRun;
+            specialisedResult = specialisedRun;
+        }
+        PrintResult(geometryName, workload.name, "generic", ops, genericResult, 1.0);
+        PrintResult(geometryName, workload.name, "specialised", ops, specialisedResult,
+                    genericResult.seconds / specialisedResult.seconds);
+        if ((genericResult.pageFaults != specialisedResult.pageFaults) ||
+            (genericResult.evictions != specialisedResult.evictions) ||
+            (genericResult.checksum != specialisedResult.checksum)) {
+            fprintf(stderr, "the paths disagree on %s/%s\n", geometryName, workload.name);
+            agreed = false;
+        }
+    }
+    return agreed;
+}
+
+int main(int argc, char** argv) {
+    uint64_t ops = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 1000000;
+    if (ops == 0) {
+        fprintf(stderr, "opsPerWorkload must be positive\n");
+        return 1;
+    }
+    printf("geometry,workload,path,ops,seconds,ops_per_sec,page_faults,evictions,speedup\n");
+    bool agreed = Compare<CompiledGeometry>("compiled", ops);
+    agreed = Compare<LargeGeometry>("large", ops) && agreed;
+    return agreed ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+/*
+ * Runs the same access traces under every page replacement policy, and prints a CSV line per trace and policy with
+ * its page fault rate and throughput.
+ * Traces (in pages of NUM_FRAMES):
+ *  loop   - sequential passes over 1.5x the RAM, the worst case of LRU
+ *  scan   - a hot set of 1/4 of the RAM, interrupted by sequential scans over 2x the RAM
+ *  random - uniform over 4x the RAM
+ *  zipf   - Zipf (s = 1) over 8x the RAM
+ *
+ * usage: policyComparison [opsPerTrace]
+ */
+#include "VirtualMemory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+typedef struct {
+    const char* name;
+    PageReplacementPolicy policy;
+} PolicyEntry;
+
+typedef struct {
+    const char* name;
+    std::vector<uint64_t> pages;
+} Trace;
+
+uint64_t ClampPages(uint64_t pages) {
+    return (pages < NUM_PAGES) ? pages : NUM_PAGES;
+}
+
+Trace MakeLoopTrace(uint64_t ops) {
+    Trace trace = {"loop", std::vector<uint64_t>()};
+    uint64_t loopPages = ClampPages((3 * NUM_FRAMES) / 2);
+    for (uint64_t op = 0; op < ops; op++) {
+        trace.pages.push_back(op % loopPages);
+    }
+    return trace;
+}
+
+Trace MakeScanTrace(uint64_t ops, std::mt19937_64 &rng) {
+    Trace trace = {"scan", std::vector<uint64_t>()};
+    uint64_t hotPages = ClampPages(NUM_FRAMES / 4);
+    uint64_t scanPages = ClampPages(2 * NUM_FRAMES);
+    uint64_t nextScan = 0;
+    while (trace.pages.size() < ops) {
+        for (int hotAccess = 0; (hotAccess < 1000) && (trace.pages.size() < ops); hotAccess++) {
+            trace.pages.push_back(rng() % hotPages);
+        }
+        // the scan runs over the pages after the hot set, continuing where the previous scan stopped:
+        for (uint64_t scanned = 0; (scanned < scanPages) && (trace.pages.size() < ops); scanned++) {
+            trace.pages.push_back(ClampPages(hotPages + (nextScan++ % scanPages)) % NUM_PAGES);
+        }
+    }
+    return trace;
+}
+
+Trace MakeRandomTrace(uint64_t ops, std::mt19937_64 &rng) {
+    Trace trace = {"random", std::vector<uint64_t>()};
+    uint64_t pages = ClampPages(4 * NUM_FRAMES);
+    for (uint64_t op = 0; op < ops; op++) {
+        trace.pages.push_back(rng() % pages);
+    }
+    return trace;
+}
+
+Trace MakeZipfTrace(uint64_t ops, std::mt19937_64 &rng) {
+    Trace trace = {"zipf", std::vector<uint64_t>()};
+    uint64_t pages = ClampPages(8 * NUM_FRAMES);
+    std::vector<double> weights;
+    for (uint64_t rank = 1; rank <= pages; rank++) {
+        weights.push_back(1.0 / (double) rank);
+    }
+    std::discrete_distribution<uint64_t> zipf(weights.begin(), weights.end());
+    // scatters the ranks over the pages, so the popular pages do not share their tables:
+    std::vector<uint64_t> pageOfRank;
+    for (uint64_t rank = 0; rank < pages; rank++) {
+        pageOfRank.push_back(rank);
+    }
+    std::shuffle(pageOfRank.begin(), pageOfRank.end(), rng);
+    for (uint64_t op = 0; op < ops; op++) {
+        trace.pages.push_back(pageOfRank[zipf(rng)]);
+    }
+    return trace;
+}
+
+int main(int argc, char** argv) {
+    uint64_t ops = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 200000;
+    std::mt19937_64 rng(1);
+
+    std::vector<Trace> traces;
+    traces.push_back(MakeLoopTrace(ops));
+    traces.push_back(MakeScanTrace(ops, rng));
+    traces.push_back(MakeRandomTrace(ops, rng));
+    traces.push_back(MakeZipfTrace(ops, rng));
+
+    PolicyEntry policies[] = {{"cyclic", CYCLIC_DISTANCE_POLICY},
+                              {"lru",    LRU_POLICY},
+                              {"clock",  CLOCK_POLICY},
+                              {"arc",    ARC_POLICY}};
+
+    printf("trace,policy,ops,page_faults,fault_rate,evictions,ops_per_sec\n");
+    for (const Trace &trace : traces) {
+        for (const PolicyEntry &policy : policies) {
+            VMinitialize(policy.policy);
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t op = 0; op < trace.pages.size(); op++) {
+                uint64_t virtualAddress = trace.pages[op] * PAGE_SIZE;
+                if ((op % 5) == 0) {
+                    VMwrite(virtualAddress, (word_t) op);
+                } else {
+                    word_t value;
+                    VMread(virtualAddress, &value);
+                }
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            uint64_t pageFaults;
+            uint64_t evictions;
+            VMgetPagingStats(&pageFaults, &evictions);
+            printf("%s,%s,%llu,%llu,%.4f,%llu,%.0f\n", trace.name, policy.name,
+                   (unsigned long long) trace.pages.size(), (unsigned long long) pageFaults,
+                   (double) pageFaults / (double) trace.pages.size(), (unsigned long long) evictions,
+                   (double) trace.pages.size() / seconds);
+        }
+    }
+    return 0;
+}
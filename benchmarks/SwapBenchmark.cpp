@@ -0,0 +1,126 @@
+/*
+ * Compares the in-memory swap store with the file-backed swap device, on a workload that evicts on almost every
+ * access: random words of a region of the virtual memory that is several times larger than the RAM.
+ * The backends are the swap store alone (memory), the swap file alone (file), and the swap store in front of the swap
+ * file, limited to half of the compressed region (tiered). Each of them runs on pages that only have their first word
+ * set (sparse), and on pages whose every word is set (dense), and prints the compression ratio of the swap store and
+ * the time it took to compress and decompress a page.
+ * Every run is in its own child process, since a process cannot switch back from the swap file.
+ *
+ * usage: swapBenchmark [swapFilePath] [ops] [regionPages]
+ */
+#include "VirtualMemory.h"
+#include "PhysicalMemory.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef enum {
+    BACKEND_MEMORY,
+    BACKEND_FILE,
+    BACKEND_TIERED
+} SwapBackend;
+
+const char* const backendNames[] = {"memory", "file", "tiered"};
+
+typedef struct {
+    const char* swapFilePath;
+    uint64_t ops;
+    uint64_t regionPages;
+} SwapBenchmarkConfig;
+
+/**
+ * @return the value of the given word of the given page, which depends on both in a dense region.
+ */
+word_t GetWordValue(uint64_t pageIdx, uint64_t offset, bool dense) {
+    if (!dense) {
+        return (offset == 0) ? (word_t) pageIdx : 0;
+    }
+    return (word_t) (((pageIdx * PAGE_SIZE + offset) * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+/**
+ * Runs the workload on the given backend, and prints its throughput.
+ * @return 0 if every value that was read back is the value that was written there.
+ */
+int RunBackend(const SwapBenchmarkConfig &config, SwapBackend backend, bool dense) {
+    if ((backend != BACKEND_MEMORY) && !PMuseSwapFile(config.swapFilePath)) {
+        fprintf(stderr, "cannot open the swap file %s\n", config.swapFilePath);
+        return 1;
+    }
+    if (backend == BACKEND_TIERED) {
+        // the pages of a sparse region compress to a single small slot, which may be as little as a word:
+        uint64_t pageBytes = dense ? PAGE_SIZE * sizeof(word_t) : sizeof(word_t) * 4;
+        PMsetSwapStoreLimit((config.regionPages / 2) * pageBytes);
+    }
+    VMinitialize();
+
+    // every word of the region holds GetWordValue, and a word of a random page is checked on every read:
+    std::mt19937_64 rng(1);
+    uint64_t errors = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t pageIdx = 0; pageIdx < config.regionPages; pageIdx++) {
+        for (uint64_t offset = 0; offset < (dense ? PAGE_SIZE : 1); offset++) {
+            VMwrite(pageIdx * PAGE_SIZE + offset, GetWordValue(pageIdx, offset, dense));
+        }
+    }
+    for (uint64_t op = 0; op < config.ops; op++) {
+        uint64_t pageIdx = rng() % config.regionPages;
+        uint64_t offset = op % PAGE_SIZE;
+        word_t value;
+        VMread(pageIdx * PAGE_SIZE + offset, &value);
+        if (value != GetWordValue(pageIdx, offset, dense)) {
+            errors++;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    VMstats stats;
+    VMgetStats(&stats);
+    uint64_t restores = stats.swapRestores;
+    uint64_t totalOps = config.regionPages * (dense ? PAGE_SIZE : 1) + config.ops;
+    printf("backend=%s content=%s ops=%llu seconds=%.3f ops_per_sec=%.0f compression_ratio=%.2f "
+           "compress_ns_per_page=%.0f decompress_ns_per_restore=%.0f spilled_pages=%llu errors=%llu\n",
+           backendNames[backend], dense ? "dense" : "sparse", (unsigned long long) totalOps, seconds,
+           (double) totalOps / seconds,
+           (stats.swapCompressedBytes > 0) ? (double) stats.swapUncompressedBytes / stats.swapCompressedBytes : 0.0,
+           (stats.swapSavedPages > 0) ? (double) stats.swapCompressNs / stats.swapSavedPages : 0.0,
+           (restores > 0) ? (double) stats.swapDecompressNs / restores : 0.0,
+           (unsigned long long) stats.swapSpilledPages, (unsigned long long) errors);
+
+    fflush(stdout);
+    return (errors == 0) ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    SwapBenchmarkConfig config;
+    config.swapFilePath = (argc > 1) ? argv[1] : "swapBenchmark.swp";
+    config.ops = (argc > 2) ? strtoull(argv[2], nullptr, 10) : 200000;
+    config.regionPages = (argc > 3) ? strtoull(argv[3], nullptr, 10) : (4 * NUM_FRAMES);
+    if (config.regionPages > NUM_PAGES) {
+        config.regionPages = NUM_PAGES;
+    }
+
+    int result = 0;
+    for (int dense = 0; dense <= 1; dense++) {
+        for (int backend = BACKEND_MEMORY; backend <= BACKEND_TIERED; backend++) {
+            pid_t child = fork();
+            if (child == 0) {
+                _exit(RunBackend(config, (SwapBackend) backend, dense != 0));
+            }
+            int status = 1;
+            if ((child < 0) || (waitpid(child, &status, 0) < 0) || !WIFEXITED(status) ||
+                (WEXITSTATUS(status) != 0)) {
+                result = 1;
+            }
+        }
+    }
+    unlink(config.swapFilePath);
+    return result;
+}
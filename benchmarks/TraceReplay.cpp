@@ -0,0 +1,379 @@
+/*
+ * Replays a trace that was recorded with VMstartRecording against this build of the library, as fast as it can, and
+ * then checks that every word the trace wrote (and that the trace alone determines) holds the value it should.
+ * The trace is decoded before the replay, so the decoding is not timed. Its physical memory records are counted, but
+ * not replayed, since they are what the library under test produces.
+ * The trace must have been recorded by a build with the same geometry.
+ *
+ * usage: traceReplay traceFile [cyclic|lru|clock|arc]
+ *        the policy, if given, replaces the one that the trace was recorded with.
+ */
+#include "VirtualMemory.h"
+#include "TraceRecorder.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
+
+typedef struct {
+    TraceOpcode opcode;
+    uint64_t virtualAddress;
+    // the source address of TRACE_VM_COPY, the policy of TRACE_VM_INITIALIZE, the advice of TRACE_VM_ADVISE, or the
+    // address space of the address space records:
+    uint64_t argument;
+    uint64_t count;
+    word_t value;
+    // the index of the first value of TRACE_VM_WRITE_RANGE in the values of the trace:
+    uint64_t firstValue;
+} ReplayOp;
+
+typedef struct {
+    std::vector<ReplayOp> ops;
+    std::vector<word_t> values;
+    uint64_t physicalRecords;
+} DecodedTrace;
+
+typedef struct {
+    const uint8_t *position;
+    const uint8_t *end;
+} TraceReader;
+
+void Fail(const char *message) {
+    fprintf(stderr, "%s\n", message);
+    exit(1);
+}
+
+uint64_t ReadVarint(TraceReader &reader) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (reader.position == reader.end) {
+            Fail("the trace is truncated");
+        }
+        uint8_t byte = *reader.position++;
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    Fail("the trace has an invalid varint");
+    return 0;
+}
+
+int64_t ReadZigZag(TraceReader &reader) {
+    uint64_t value = ReadVarint(reader);
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+uint64_t ReadDelta(TraceReader &reader, uint64_t *lastAddress) {
+    *lastAddress += (uint64_t) ReadZigZag(reader);
+    return *lastAddress;
+}
+
+std::vector<uint8_t> ReadFile(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        Fail("cannot open the trace");
+    }
+    std::vector<uint8_t> bytes;
+    uint8_t chunk[1 << 16];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        bytes.insert(bytes.end(), chunk, chunk + read);
+    }
+    fclose(file);
+    return bytes;
+}
+
+DecodedTrace Decode(const std::vector<uint8_t> &bytes) {
+    TraceHeader header;
+    if (bytes.size() < sizeof(header)) {
+        Fail("the trace has no header");
+    }
+    memcpy(&header, bytes.data(), sizeof(header));
+    if ((header.magic != TRACE_MAGIC) || (header.version < 1) || (header.version > TRACE_VERSION)) {
+        Fail("not a trace of this version");
+    }
+    if ((header.offsetWidth != OFFSET_WIDTH) || (header.physicalAddressWidth != PHYSICAL_ADDRESS_WIDTH) ||
+        (header.virtualAddressWidth != VIRTUAL_ADDRESS_WIDTH)) {
+        Fail("the trace was recorded with another geometry");
+    }
+
+    DecodedTrace trace;
+    trace.physicalRecords = 0;
+    TraceReader reader = {bytes.data() + sizeof(header), bytes.data() + bytes.size()};
+    uint64_t lastVirtualAddress = 0;
+    uint64_t lastPhysicalAddress = 0;
+    while (reader.position != reader.end) {
+        ReplayOp op = {(TraceOpcode) *reader.position++, 0, 0, 1, 0, 0};
+        switch (op.opcode) {
+            case TRACE_VM_INITIALIZE:
+            case TRACE_VM_SWITCH_ADDRESS_SPACE:
+            case TRACE_VM_CREATE_ADDRESS_SPACE:
+            case TRACE_VM_DESTROY_ADDRESS_SPACE:
+            case TRACE_VM_FORK_ADDRESS_SPACE:
+                op.argument = ReadVarint(reader);
+                break;
+            case TRACE_VM_READ:
+                op.virtualAddress = ReadDelta(reader, &lastVirtualAddress);
+                break;
+            case TRACE_VM_WRITE:
+                op.virtualAddress = ReadDelta(reader, &lastVirtualAddress);
+                op.value = (word_t) ReadZigZag(reader);
+                break;
+            case TRACE_VM_READ_RANGE:
+                op.virtualAddress = ReadDelta(reader, &lastVirtualAddress);
+                op.count = ReadVarint(reader);
+                break;
+            case TRACE_VM_WRITE_RANGE:
+                op.virtualAddress = ReadDelta(reader, &lastVirtualAddress);
+                op.count = ReadVarint(reader);
+                op.firstValue = trace.values.size();
+                for (uint64_t i = 0; i < op.count; i++) {
+                    trace.values.push_back((word_t) ReadZigZag(reader));
+                }
+                break;
+            case TRACE_VM_FILL:
+                op.virtualAddress = ReadDelta(reader, &lastVirtualAddress);
+                op.count = ReadVarint(reader);
+                op.value = (word_t) ReadZigZag(reader);
+                break;
+            case TRACE_VM_COPY:
+                op.virtualAddress = ReadDelta(reader, &lastVirtualAddress);
+                op.argument = op.virtualAddress + (uint64_t) ReadZigZag(reader);
+                op.count = ReadVarint(reader);
+                break;
+            case TRACE_VM_ADVISE:
+                op.virtualAddress = ReadDelta(reader, &lastVirtualAddress);
+                op.count = ReadVarint(reader);
+                op.argument = ReadVarint(reader);
+                break;
+            case TRACE_PM_READ:
+                ReadDelta(reader, &lastPhysicalAddress);
+                trace.physicalRecords++;
+                continue;
+            case TRACE_PM_WRITE:
+                ReadDelta(reader, &lastPhysicalAddress);
+                ReadZigZag(reader);
+                trace.physicalRecords++;
+                continue;
+            case TRACE_PM_EVICT:
+            case TRACE_PM_RESTORE:
+                ReadVarint(reader);
+                ReadVarint(reader);
+                trace.physicalRecords++;
+                continue;
+            default:
+                Fail("the trace has an unknown record");
+        }
+        trace.ops.push_back(op);
+    }
+    return trace;
+}
+
+/**
+ * Replays the operations on the library.
+ * @return the number of operations that the library rejected, which it accepted when the trace was recorded.
+ */
+uint64_t Replay(const DecodedTrace &trace, bool overridePolicy, PageReplacementPolicy policy) {
+    uint64_t failures = 0;
+    std::vector<word_t> buffer;
+    for (const ReplayOp &op : trace.ops) {
+        word_t value;
+        switch (op.opcode) {
+            case TRACE_VM_INITIALIZE:
+                VMinitialize(overridePolicy ? policy : (PageReplacementPolicy) op.argument);
+                continue;
+            case TRACE_VM_READ:
+                failures += !VMread(op.virtualAddress, &value);
+                break;
+            case TRACE_VM_WRITE:
+                failures += !VMwrite(op.virtualAddress, op.value);
+                break;
+            case TRACE_VM_READ_RANGE:
+                buffer.resize(op.count);
+                failures += !VMreadRange(op.virtualAddress, buffer.data(), op.count);
+                break;
+            case TRACE_VM_WRITE_RANGE:
+                failures += !VMwriteRange(op.virtualAddress, trace.values.data() + op.firstValue, op.count);
+                break;
+            case TRACE_VM_FILL:
+                failures += !VMfill(op.virtualAddress, op.value, op.count);
+                break;
+            case TRACE_VM_COPY:
+                failures += !VMcopy(op.virtualAddress, op.argument, op.count);
+                break;
+            case TRACE_VM_ADVISE:
+                failures += !VMadvise(op.virtualAddress, op.count, (PageAdvice) op.argument);
+                break;
+            case TRACE_VM_SWITCH_ADDRESS_SPACE:
+                failures += !VMswitchAddressSpace((int) op.argument);
+                break;
+            case TRACE_VM_CREATE_ADDRESS_SPACE:
+                failures += (VMcreateAddressSpace() != (int) op.argument);
+                break;
+            case TRACE_VM_DESTROY_ADDRESS_SPACE:
+                // the replay is in the address space if the last thread that accessed it was:
+                if (VMgetAddressSpace() == (int) op.argument) {
+                    VMswitchAddressSpace(0);
+                }
+                failures += !VMdestroyAddressSpace((int) op.argument);
+                break;
+            case TRACE_VM_FORK_ADDRESS_SPACE:
+                failures += (VMfork() != (int) op.argument);
+                break;
+            default:
+                break;
+        }
+    }
+    return failures;
+}
+
+/**
+ * @return the key of a word in ExpectedMemory: its virtual address, tagged with its address space.
+ */
+uint64_t WordKey(uint64_t addressSpace, uint64_t virtualAddress) {
+    return (addressSpace << VIRTUAL_ADDRESS_WIDTH) | virtualAddress;
+}
+
+/**
+ * Computes the words that the trace determines at its end: the words it wrote since its last initialization, in their
+ * address space and in the address spaces forked from it after the write, unless they were copied from words that it
+ * did not write, or their address space was destroyed, or their page was dropped by ADVISE_DONTNEED.
+ */
+std::unordered_map<uint64_t, word_t> ExpectedMemory(const DecodedTrace &trace) {
+    std::unordered_map<uint64_t, word_t> expected;
+    uint64_t space = 0;
+    for (const ReplayOp &op : trace.ops) {
+        switch (op.opcode) {
+            case TRACE_VM_INITIALIZE:
+                expected.clear();
+                space = 0;
+                break;
+            case TRACE_VM_WRITE:
+                expected[WordKey(space, op.virtualAddress)] = op.value;
+                break;
+            case TRACE_VM_WRITE_RANGE:
+                for (uint64_t i = 0; i < op.count; i++) {
+                    expected[WordKey(space, op.virtualAddress + i)] = trace.values[op.firstValue + i];
+                }
+                break;
+            case TRACE_VM_FILL:
+                for (uint64_t i = 0; i < op.count; i++) {
+                    expected[WordKey(space, op.virtualAddress + i)] = op.value;
+                }
+                break;
+            case TRACE_VM_COPY: {
+                // reads the whole source before writing, like VMcopy does for overlapping ranges:
+                std::vector<std::pair<bool, word_t> > source;
+                for (uint64_t i = 0; i < op.count; i++) {
+                    auto it = expected.find(WordKey(space, op.argument + i));
+                    source.push_back((it != expected.end()) ? std::make_pair(true, it->second)
+                                                            : std::make_pair(false, (word_t) 0));
+                }
+                for (uint64_t i = 0; i < op.count; i++) {
+                    if (source[i].first) {
+                        expected[WordKey(space, op.virtualAddress + i)] = source[i].second;
+                    } else {
+                        expected.erase(WordKey(space, op.virtualAddress + i));
+                    }
+                }
+                break;
+            }
+            case TRACE_VM_ADVISE: {
+                if (op.argument != ADVISE_DONTNEED) {
+                    break;
+                }
+                // the pages that were dropped are as if the trace never wrote them:
+                uint64_t end = op.virtualAddress + (((op.count + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE);
+                for (auto it = expected.begin(); it != expected.end();) {
+                    uint64_t address = it->first & (VIRTUAL_MEMORY_SIZE - 1);
+                    bool dropped = ((it->first >> VIRTUAL_ADDRESS_WIDTH) == space) && (address >= op.virtualAddress) &&
+                                   (address < end);
+                    it = dropped ? expected.erase(it) : std::next(it);
+                }
+                break;
+            }
+            case TRACE_VM_SWITCH_ADDRESS_SPACE:
+                space = op.argument;
+                break;
+            case TRACE_VM_DESTROY_ADDRESS_SPACE:
+                for (auto it = expected.begin(); it != expected.end();) {
+                    it = ((it->first >> VIRTUAL_ADDRESS_WIDTH) == op.argument) ? expected.erase(it) : std::next(it);
+                }
+                space = (space == op.argument) ? 0 : space;
+                break;
+            case TRACE_VM_FORK_ADDRESS_SPACE: {
+                // the child starts with the words of its parent:
+                std::vector<std::pair<uint64_t, word_t> > words;
+                for (const auto &word : expected) {
+                    if ((word.first >> VIRTUAL_ADDRESS_WIDTH) == space) {
+                        words.push_back(word);
+                    }
+                }
+                for (const auto &word : words) {
+                    expected[WordKey(op.argument, word.first & (VIRTUAL_MEMORY_SIZE - 1))] = word.second;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return expected;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        Fail("usage: traceReplay traceFile [cyclic|lru|clock|arc]");
+    }
+    bool overridePolicy = (argc > 2);
+    PageReplacementPolicy policy = CYCLIC_DISTANCE_POLICY;
+    if (overridePolicy) {
+        const char *names[] = {"cyclic", "lru", "clock", "arc"};
+        const PageReplacementPolicy policies[] = {CYCLIC_DISTANCE_POLICY, LRU_POLICY, CLOCK_POLICY, ARC_POLICY};
+        bool found = false;
+        for (int i = 0; i < 4; i++) {
+            if (strcmp(argv[2], names[i]) == 0) {
+                policy = policies[i];
+                found = true;
+            }
+        }
+        if (!found) {
+            Fail("unknown policy");
+        }
+    }
+
+    DecodedTrace trace = Decode(ReadFile(argv[1]));
+    if (trace.ops.empty() || (trace.ops[0].opcode != TRACE_VM_INITIALIZE)) {
+        Fail("the trace does not start with an initialization");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t failures = Replay(trace, overridePolicy, policy);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t pageFaults;
+    uint64_t evictions;
+    VMgetPagingStats(&pageFaults, &evictions);
+
+    std::unordered_map<uint64_t, word_t> expected = ExpectedMemory(trace);
+    uint64_t mismatches = 0;
+    for (const auto &word : expected) {
+        word_t value;
+        if (!VMswitchAddressSpace((int) (word.first >> VIRTUAL_ADDRESS_WIDTH)) ||
+            !VMread(word.first & (VIRTUAL_MEMORY_SIZE - 1), &value) || (value != word.second)) {
+            mismatches++;
+        }
+    }
+
+    uint64_t ops = trace.ops.size();
+    printf("ops=%llu physical_records=%llu seconds=%.6f ops_per_sec=%.0f page_faults=%llu evictions=%llu "
+           "failed_ops=%llu checked_words=%llu mismatches=%llu\n",
+           (unsigned long long) ops, (unsigned long long) trace.physicalRecords, seconds, (double) ops / seconds,
+           (unsigned long long) pageFaults, (unsigned long long) evictions, (unsigned long long) failures,
+           (unsigned long long) expected.size(), (unsigned long long) mismatches);
+    return ((failures == 0) && (mismatches == 0)) ? 0 : 1;
+}
@@ -0,0 +1,255 @@
+/*
+ * Runs synthetic workloads against the library, and prints a record per workload with its throughput, the latency
+ * percentiles of a single VMread/VMwrite, its page faults and evictions per 1000 operations, and the physical memory
+ * words it read and wrote per operation. The output is CSV (the default) or JSON, to compare builds.
+ * Workloads (in pages of NUM_FRAMES, one write in every 5 operations unless noted):
+ *  seq      - word after word over 4x the RAM
+ *  strided  - every 3rd page (and next word) over 4x the RAM
+ *  uniform  - uniform over the words of 4x the RAM
+ *  zipf     - Zipf (s = 1) over the pages of 8x the RAM
+ *  wsshift  - uniform over a working set of 1/2 the RAM, which moves by a quarter of itself 8 times
+ *  chase    - reads only, following a random cycle of pointers through one word in every page of 2x the RAM
+ *
+ * The physical memory counts are taken with PM_COUNT_ACCESSES, which the build of this benchmark defines.
+ *
+ * usage: workloadBenchmark [opsPerWorkload] [csv|json] [huge]
+ *        huge enables huge pages in every workload.
+ */
+#include "VirtualMemory.h"
+#include "PhysicalMemory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#define WRITE_EVERY 5
+#define STRIDE_PAGES 3
+#define WORKING_SET_SHIFTS 8
+
+typedef struct {
+    uint64_t virtualAddress;
+    bool isWrite;
+} Access;
+
+typedef struct {
+    const char* name;
+    std::vector<Access> accesses;
+    // a pointer chase decides every address by the previous read, so it has no accesses, only a start address:
+    bool isChase;
+    uint64_t chaseStart;
+} Workload;
+
+typedef struct {
+    uint64_t ops;
+    double seconds;
+    uint64_t p50Ns;
+    uint64_t p99Ns;
+    uint64_t p999Ns;
+    uint64_t pageFaults;
+    uint64_t evictions;
+    uint64_t pmReads;
+    uint64_t pmWrites;
+} WorkloadResult;
+
+uint64_t ClampPages(uint64_t pages) {
+    return (pages < NUM_PAGES) ? pages : NUM_PAGES;
+}
+
+void AddAccess(Workload &workload, uint64_t virtualAddress) {
+    Access access = {virtualAddress % VIRTUAL_MEMORY_SIZE, (workload.accesses.size() % WRITE_EVERY) == 0};
+    workload.accesses.push_back(access);
+}
+
+Workload MakeSequentialWorkload(uint64_t ops) {
+    Workload workload = {"seq", std::vector<Access>(), false, 0};
+    uint64_t words = ClampPages(4 * NUM_FRAMES) * PAGE_SIZE;
+    for (uint64_t op = 0; op < ops; op++) {
+        AddAccess(workload, op % words);
+    }
+    return workload;
+}
+
+Workload MakeStridedWorkload(uint64_t ops) {
+    Workload workload = {"strided", std::vector<Access>(), false, 0};
+    uint64_t words = ClampPages(4 * NUM_FRAMES) * PAGE_SIZE;
+    for (uint64_t op = 0; op < ops; op++) {
+        AddAccess(workload, (op * ((STRIDE_PAGES * PAGE_SIZE) + 1)) % words);
+    }
+    return workload;
+}
+
+Workload MakeUniformWorkload(uint64_t ops, std::mt19937_64 &rng) {
+    Workload workload = {"uniform", std::vector<Access>(), false, 0};
+    uint64_t words = ClampPages(4 * NUM_FRAMES) * PAGE_SIZE;
+    for (uint64_t op = 0; op < ops; op++) {
+        AddAccess(workload, rng() % words);
+    }
+    return workload;
+}
+
+Workload MakeZipfWorkload(uint64_t ops, std::mt19937_64 &rng) {
+    Workload workload = {"zipf", std::vector<Access>(), false, 0};
+    uint64_t pages = ClampPages(8 * NUM_FRAMES);
+    std::vector<double> weights;
+    for (uint64_t rank = 1; rank <= pages; rank++) {
+        weights.push_back(1.0 / (double) rank);
+    }
+    std::discrete_distribution<uint64_t> zipf(weights.begin(), weights.end());
+    // scatters the ranks over the pages, so the popular pages do not share their tables:
+    std::vector<uint64_t> pageOfRank;
+    for (uint64_t rank = 0; rank < pages; rank++) {
+        pageOfRank.push_back(rank);
+    }
+    std::shuffle(pageOfRank.begin(), pageOfRank.end(), rng);
+    for (uint64_t op = 0; op < ops; op++) {
+        AddAccess(workload, (pageOfRank[zipf(rng)] * PAGE_SIZE) + (rng() % PAGE_SIZE));
+    }
+    return workload;
+}
+
+Workload MakeWorkingSetShiftWorkload(uint64_t ops, std::mt19937_64 &rng) {
+    Workload workload = {"wsshift", std::vector<Access>(), false, 0};
+    uint64_t setPages = ClampPages((NUM_FRAMES / 2) > 0 ? (NUM_FRAMES / 2) : 1);
+    uint64_t shiftPages = (setPages / 4) > 0 ? (setPages / 4) : 1;
+    uint64_t opsPerPhase = (ops / (WORKING_SET_SHIFTS + 1)) + 1;
+    for (uint64_t op = 0; op < ops; op++) {
+        uint64_t firstPage = (op / opsPerPhase) * shiftPages;
+        uint64_t pageIdx = (firstPage + (rng() % setPages)) % NUM_PAGES;
+        AddAccess(workload, (pageIdx * PAGE_SIZE) + (rng() % PAGE_SIZE));
+    }
+    return workload;
+}
+
+/**
+ * Writes a random cycle of pointers into the virtual memory, one node per page, and returns the workload that follows
+ * it. Must be called after VMinitialize, and the accesses it makes are not part of the workload.
+ */
+Workload MakeChaseWorkload(std::mt19937_64 &rng) {
+    Workload workload = {"chase", std::vector<Access>(), true, 0};
+    uint64_t pages = ClampPages(2 * NUM_FRAMES);
+    std::vector<uint64_t> nodes;
+    for (uint64_t pageIdx = 0; pageIdx < pages; pageIdx++) {
+        // a node per page, at an offset that differs between neighbouring pages:
+        nodes.push_back((pageIdx * PAGE_SIZE) + ((pageIdx * 7) % PAGE_SIZE));
+    }
+    std::shuffle(nodes.begin(), nodes.end(), rng);
+    for (uint64_t node = 0; node < nodes.size(); node++) {
+        VMwrite(nodes[node], (word_t) nodes[(node + 1) % nodes.size()]);
+    }
+    workload.chaseStart = nodes[0];
+    return workload;
+}
+
+uint64_t Percentile(const std::vector<uint64_t> &sortedNs, double fraction) {
+    uint64_t idx = (uint64_t) (fraction * (double) (sortedNs.size() - 1));
+    return sortedNs[idx];
+}
+
+/**
+ * Runs the workload on the current state of the virtual memory, timing every operation.
+ */
+WorkloadResult RunWorkload(const Workload &workload, uint64_t ops) {
+    std::vector<uint64_t> latencyNs;
+    latencyNs.reserve(ops);
+    uint64_t faultsBefore, evictionsBefore, readsBefore, writesBefore;
+    VMgetPagingStats(&faultsBefore, &evictionsBefore);
+    PMgetAccessCounts(&readsBefore, &writesBefore);
+
+    uint64_t chaseAddress = workload.chaseStart;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t op = 0; op < ops; op++) {
+        auto opStart = std::chrono::steady_clock::now();
+        if (workload.isChase) {
+            word_t next;
+            VMread(chaseAddress, &next);
+            chaseAddress = (uint64_t) next;
+        } else if (workload.accesses[op].isWrite) {
+            VMwrite(workload.accesses[op].virtualAddress, (word_t) op);
+        } else {
+            word_t value;
+            VMread(workload.accesses[op].virtualAddress, &value);
+        }
+        auto opEnd = std::chrono::steady_clock::now();
+        latencyNs.push_back((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(opEnd - opStart).count());
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    WorkloadResult result;
+    result.ops = ops;
+    result.seconds = seconds;
+    std::sort(latencyNs.begin(), latencyNs.end());
+    result.p50Ns = Percentile(latencyNs, 0.5);
+    result.p99Ns = Percentile(latencyNs, 0.99);
+    result.p999Ns = Percentile(latencyNs, 0.999);
+    VMgetPagingStats(&result.pageFaults, &result.evictions);
+    result.pageFaults -= faultsBefore;
+    result.evictions -= evictionsBefore;
+    PMgetAccessCounts(&result.pmReads, &result.pmWrites);
+    result.pmReads -= readsBefore;
+    result.pmWrites -= writesBefore;
+    return result;
+}
+
+void PrintResult(const char* name, const WorkloadResult &result, bool json, bool isFirst) {
+    double ops = (double) result.ops;
+    double opsPerSec = ops / result.seconds;
+    double faultsPer1k = (1000.0 * (double) result.pageFaults) / ops;
+    double evictionsPer1k = (1000.0 * (double) result.evictions) / ops;
+    double pmReadsPerOp = (double) result.pmReads / ops;
+    double pmWritesPerOp = (double) result.pmWrites / ops;
+    if (json) {
+        printf("%s  {\"workload\": \"%s\", \"ops\": %llu, \"seconds\": %.6f, \"ops_per_sec\": %.0f, "
+               "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"faults_per_1k_ops\": %.3f, "
+               "\"evictions_per_1k_ops\": %.3f, \"pm_reads_per_op\": %.3f, \"pm_writes_per_op\": %.3f}",
+               isFirst ? "" : ",\n", name, (unsigned long long) result.ops, result.seconds, opsPerSec,
+               (unsigned long long) result.p50Ns, (unsigned long long) result.p99Ns,
+               (unsigned long long) result.p999Ns, faultsPer1k, evictionsPer1k, pmReadsPerOp, pmWritesPerOp);
+    } else {
+        printf("%s,%llu,%.6f,%.0f,%llu,%llu,%llu,%.3f,%.3f,%.3f,%.3f\n", name, (unsigned long long) result.ops,
+               result.seconds, opsPerSec, (unsigned long long) result.p50Ns, (unsigned long long) result.p99Ns,
+               (unsigned long long) result.p999Ns, faultsPer1k, evictionsPer1k, pmReadsPerOp, pmWritesPerOp);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t ops = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 200000;
+    bool json = (argc > 2) && (strcmp(argv[2], "json") == 0);
+    bool huge = (argc > 3) && (strcmp(argv[3], "huge") == 0);
+    if (ops == 0) {
+        fprintf(stderr, "opsPerWorkload must be positive\n");
+        return 1;
+    }
+    std::mt19937_64 rng(1);
+
+    std::vector<Workload> workloads;
+    workloads.push_back(MakeSequentialWorkload(ops));
+    workloads.push_back(MakeStridedWorkload(ops));
+    workloads.push_back(MakeUniformWorkload(ops, rng));
+    workloads.push_back(MakeZipfWorkload(ops, rng));
+    workloads.push_back(MakeWorkingSetShiftWorkload(ops, rng));
+
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("workload,ops,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,faults_per_1k_ops,evictions_per_1k_ops,"
+               "pm_reads_per_op,pm_writes_per_op\n");
+    }
+    for (uint64_t workloadIdx = 0; workloadIdx < workloads.size(); workloadIdx++) {
+        VMinitialize();
+        VMsetHugePages(huge);
+        PrintResult(workloads[workloadIdx].name, RunWorkload(workloads[workloadIdx], ops), json, workloadIdx == 0);
+    }
+    // the pointers of the chase are written into a fresh virtual memory:
+    VMinitialize();
+    VMsetHugePages(huge);
+    Workload chase = MakeChaseWorkload(rng);
+    PrintResult(chase.name, RunWorkload(chase, ops), json, workloads.empty());
+    if (json) {
+        printf("\n]\n");
+    }
+    return 0;
+}